@@ -5,11 +5,18 @@
  */
 
 #include <app/server.hpp>
+#include <common/async_file.hpp>
 #include <common/config.hpp>
 #include <common/error.hpp>
 #include <common/listener.hpp>
 #include <common/log.hpp>
+#include <common/pool.hpp>
+#include <common/uring.hpp>
 #include <common/thread.hpp>
+#include <common/utils.hpp>
+#include <protocol/rtmp/edge.hpp>
+#include <protocol/rtmp/fast_start.hpp>
+#include <protocol/rtmp/relay.hpp>
 #include <protocol/rtmp/source.hpp>
 #include <repo_version.h>
 
@@ -17,12 +24,28 @@
 // #include <gperftools/profiler.h>
 
 #include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <vector>
+
+// a worker which exits sooner than the stable time after its spawn is
+// respawned after a delay, doubled for every such exit up to the max
+#define WORKER_RESPAWN_MIN_MS 100
+#define WORKER_RESPAWN_MAX_MS (30 * 1000)
+#define WORKER_STABLE_MS (10 * 1000)
+// the interval of the master to reap and respawn the workers
+#define WORKER_POLL_MS 100
 
 ILog*           _log     = new FastLog;
 IThreadContext* _context = new ThreadContext;
 StreamServer*   _server  = new StreamServer;
 Config*         _config  = new Config;
 
+// pid of every worker, only filled in the master process, -1 while it
+// waits for its respawn
+std::vector<pid_t> _workers;
+
 void print_git_info()
 {
     rs_info("##################################################");
@@ -32,13 +55,166 @@ void print_git_info()
     rs_info("##################################################");
 }
 
-int32_t RunMaster()
+int32_t RunWorker(int index, int count, pid_t master)
 {
     int32_t ret = ERROR_SUCCESS;
+
+    rtmp::Worker::Initialize(index, count, master);
+
+    // st must be initialized after fork, every worker has its own scheduler
     if ((ret = _server->InitializeST()) != ERROR_SUCCESS) {
         return ret;
     }
 
+    if (_config->GetIOBackend() == "io_uring") {
+        UringLoop* loop = UringLoop::Instance();
+        if ((ret = loop->Initialize(_config->GetUringEntries())) !=
+            ERROR_SUCCESS) {
+            rs_warn("io_uring is unavailable, use st. ret=%d", ret);
+            ret = ERROR_SUCCESS;
+        }
+    }
+
+    // the dvr writes on io threads, they must be created after fork too
+    if ((ret = AsyncFilePool::Instance()->Initialize(
+             _config->GetDvrIOThreads(), _config->GetDvrIOQueueSize(),
+             _config->GetDvrIOQueueBytes(), _config->GetDvrIOWaitMS())) !=
+        ERROR_SUCCESS) {
+        return ret;
+    }
+
+    RTMPStreamListener listener(_server, ListenerType::RTMP);
+
+    if ((ret = listener.Listen("0.0.0.0", 1935)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    RTMPStreamListener http_flv_listener(_server, ListenerType::HTTP_FLV);
+
+    int http_flv_port = _config->GetHttpFlvPort();
+    if (http_flv_port > 0 &&
+        (ret = http_flv_listener.Listen("0.0.0.0", http_flv_port)) !=
+            ERROR_SUCCESS) {
+        return ret;
+    }
+
+    rtmp::RelayServer relay(_server);
+
+    if (count > 1 && (ret = relay.Listen()) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    int interval = _config->GetPoolStatsInterval();
+    for (int64_t i = 1;; i++) {
+        rtmp::Source::CycleAll();
+        if (interval > 0 && i % interval == 0) {
+            Pools::Dump();
+            rtmp::Source::DumpGopCache();
+            rtmp::FastStartStats::Dump();
+            AsyncFilePool::Instance()->Dump();
+        }
+        st_usleep(1000 * 1000);
+    }
+
+    return ret;
+}
+
+pid_t SpawnWorker(int index, int count)
+{
+    pid_t master = getpid();
+    pid_t pid    = fork();
+
+    if (pid == 0) {
+        _workers.clear();
+        exit(RunWorker(index, count, master));
+    }
+
+    if (pid < 0) {
+        rs_error("fork worker[%d] failed", index);
+        return pid;
+    }
+
+    rs_trace("spawn worker[%d], pid=%d", index, pid);
+
+    return pid;
+}
+
+int NextRespawnDelay(int delay_ms)
+{
+    return rs_min(rs_max(delay_ms * 2, WORKER_RESPAWN_MIN_MS),
+                  WORKER_RESPAWN_MAX_MS);
+}
+
+int32_t RunMaster()
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    // before the fork, the workers never resolve a name
+    if ((ret = rtmp::EdgeOrigins::Resolve()) != ERROR_SUCCESS) {
+        rs_error("resolve the edge origins failed. ret=%d", ret);
+        return ret;
+    }
+
+    int count = _config->GetWorkers();
+    if (count <= 1) {
+        return RunWorker(0, 1, getpid());
+    }
+
+    _workers.resize(count, -1);
+    std::vector<int64_t> spawned_at(count, 0);
+    std::vector<int64_t> respawn_at(count, 0);
+    std::vector<int>     backoff_ms(count, 0);
+
+    while (true) {
+        int   status = 0;
+        pid_t pid    = waitpid(-1, &status, WNOHANG);
+
+        // none left to wait for while all of them wait for their respawn
+        if (pid < 0 && errno != EINTR && errno != ECHILD) {
+            ret = ERROR_SYSTEM_WAITPID;
+            rs_error("master waitpid failed. ret=%d", ret);
+            return ret;
+        }
+
+        int64_t now = Utils::GetSteadyMilliSeconds();
+
+        for (int i = 0; pid > 0 && i < count; i++) {
+            if (_workers[i] != pid) {
+                continue;
+            }
+
+            if (now - spawned_at[i] >= WORKER_STABLE_MS) {
+                backoff_ms[i] = WORKER_RESPAWN_MIN_MS;
+            }
+            else {
+                backoff_ms[i] = NextRespawnDelay(backoff_ms[i]);
+            }
+
+            rs_warn("worker[%d] pid=%d exited, status=%d, respawn it in %dms",
+                    i, pid, status, backoff_ms[i]);
+            _workers[i]   = -1;
+            respawn_at[i] = now + backoff_ms[i];
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (_workers[i] > 0 || now < respawn_at[i]) {
+                continue;
+            }
+
+            // a failed fork is retried as a worker which exited at once
+            _workers[i]   = SpawnWorker(i, count);
+            spawned_at[i] = now;
+            if (_workers[i] < 0) {
+                backoff_ms[i] = NextRespawnDelay(backoff_ms[i]);
+                respawn_at[i] = now + backoff_ms[i];
+            }
+        }
+
+        if (pid <= 0) {
+            usleep(WORKER_POLL_MS * 1000);
+        }
+    }
+
     return ret;
 }
 
@@ -48,6 +224,12 @@ void signal_handler(int signo)
         return;
     }
 
+    for (int i = 0; i < (int)_workers.size(); i++) {
+        if (_workers[i] > 0) {
+            kill(_workers[i], SIGTERM);
+        }
+    }
+
     exit(0);
 }
 
@@ -58,18 +240,9 @@ int32_t main(int32_t argc, char* argv[])
 
     signal(SIGPIPE, signal_handler);
     signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
 
     print_git_info();
 
-    RunMaster();
-
-    RTMPStreamListener listener(_server, ListenerType::RTMP);
-
-    listener.Listen("0.0.0.0", 1935);
-
-    while (true) {
-        rtmp::Source::CycleAll();
-        st_usleep(1000 * 1000);
-    }
-    return 0;
+    return RunMaster();
 }
\ No newline at end of file
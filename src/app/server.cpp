@@ -4,10 +4,12 @@
  * @LastEditors: linmin
  */
 #include <app/server.hpp>
+#include <common/config.hpp>
 #include <common/error.hpp>
 #include <common/log.hpp>
 #include <common/st.hpp>
 #include <common/utils.hpp>
+#include <protocol/http/flv.hpp>
 #include <protocol/rtmp/connection.hpp>
 
 #include <algorithm>
@@ -45,14 +47,16 @@ int32_t RTMPStreamListener::Listen(const std::string& ip, int32_t port)
     port_ = port;
 
     rs_freep(listener_);
-    listener_ = new TCPListener(this, ip, port);
+    listener_ = new TCPListener(this, ip, port, _config->GetWorkers() > 1);
 
     if ((ret = listener_->Listen()) != ERROR_SUCCESS) {
         rs_error("tcp listen failed,ep=[%s:%d],ret=%d", ip.c_str(), port, ret);
         return ret;
     }
 
-    rs_info("RTMP streamer listen on [%s:%d]", ip.c_str(), port);
+    rs_info("%s streamer listen on [%s:%d]",
+            type_ == ListenerType::HTTP_FLV ? "HTTP-FLV" : "RTMP", ip.c_str(),
+            port);
 
     return ret;
 }
@@ -60,8 +64,7 @@ int32_t RTMPStreamListener::Listen(const std::string& ip, int32_t port)
 int32_t RTMPStreamListener::OnTCPClient(st_netfd_t stfd)
 {
     int ret = ERROR_SUCCESS;
-    if ((ret = server_->AcceptClient(ListenerType::RTMP, stfd)) !=
-        ERROR_SUCCESS) {
+    if ((ret = server_->AcceptClient(type_, stfd)) != ERROR_SUCCESS) {
         rs_error("accpet client failed,ret=%d", ret);
         return ret;
     }
@@ -116,6 +119,9 @@ int32_t StreamServer::AcceptClient(ListenerType type, st_netfd_t stfd)
     if (type == ListenerType::RTMP) {
         conn = new rtmp::Connection(this, stfd);
     }
+    else if (type == ListenerType::HTTP_FLV) {
+        conn = new http::FlvConnection(this, stfd);
+    }
 
     conns_.push_back(conn);
 
@@ -14,7 +14,8 @@
 #include <string>
 
 enum class ListenerType {
-    RTMP = 0,
+    RTMP     = 0,
+    HTTP_FLV = 1,
 };
 
 class StreamServer;
@@ -35,6 +36,8 @@ class IServerListener {
     int32_t       port_;
 };
 
+// the clients accepted are made connections of the type of the listener by
+// the server, rtmp or http-flv
 class RTMPStreamListener : virtual public IServerListener,
                            virtual public ITCPClientHandler {
   public:
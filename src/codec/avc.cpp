@@ -652,9 +652,7 @@ int Codec::demux_ibmf_format(BufferManager *manager, ICodecSample *sample)
 {
     int ret = ERROR_SUCCESS;
 
-    int picture_length = manager->Size() - manager->Pos();
-
-    for (int i = 0; i < picture_length; i++)
+    while (!manager->Empty())
     {
         if (!manager->Require(length_size_minus_one + 1))
         {
@@ -697,8 +695,6 @@ int Codec::demux_ibmf_format(BufferManager *manager, ICodecSample *sample)
         }
 
         manager->Skip(nalu_unit_length);
-
-        i += length_size_minus_one + 1 + nalu_unit_length;
     }
 
     return ret;
@@ -708,7 +704,7 @@ int Codec::DecodecNalu(BufferManager *manager, ICodecSample *sample)
 {
     int ret = ERROR_SUCCESS;
 
-    if (HasSequenceHeader())
+    if (!HasSequenceHeader())
     {
         rs_warn("avc ignore type=%d for no sequence header", (int8_t)avc::NaluType::NON_IDR);
         return ret;
@@ -0,0 +1,988 @@
+#include <common/async_file.hpp>
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/queue.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// done requests reaped in one round
+#define ASYNC_FILE_REAP_BATCH 64
+// suffixes tried for a unique file
+#define ASYNC_FILE_MAX_SUFFIX 1000
+
+static AsyncFilePool* _async_file = nullptr;
+
+IAsyncFileRef::IAsyncFileRef() {}
+
+IAsyncFileRef::~IAsyncFileRef() {}
+
+RS_IMPLEMENT_POOL(AsyncFileTask, "async_file_task")
+
+AsyncFileTask::AsyncFileTask(AsyncFileOp op, AsyncFileHandle* file)
+    : op(op), file(file), flags(0), unique(false), remove(false),
+      truncate(-1), offset(0), length(0), nb_iovs(0), data(nullptr),
+      ref(nullptr), size(0), err(0)
+{
+}
+
+AsyncFileTask::~AsyncFileTask()
+{
+    rs_freep(ref);
+    if (data) {
+        ::free(data);
+    }
+}
+
+void AsyncFileTask::Run()
+{
+    switch (op) {
+        case AsyncFileOp::OPEN:
+            do_open();
+            break;
+        case AsyncFileOp::WRITE:
+            do_write();
+            break;
+        case AsyncFileOp::ALLOCATE:
+            do_allocate();
+            break;
+        case AsyncFileOp::CLOSE:
+            do_close();
+            break;
+        case AsyncFileOp::REMOVE:
+            do_remove();
+            break;
+    }
+}
+
+static int create_dirs(const std::string& dir)
+{
+    mode_t mode = S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IWGRP | S_IXGRP |
+                  S_IROTH | S_IXOTH;
+
+    for (size_t pos = 1; pos != std::string::npos;) {
+        pos = dir.find('/', pos + 1);
+
+        std::string parent = dir.substr(0, pos);
+        if (::mkdir(parent.c_str(), mode) < 0 && errno != EEXIST) {
+            return errno;
+        }
+    }
+
+    return 0;
+}
+
+static std::string suffix_path(const std::string& path, int n)
+{
+    size_t dot   = path.rfind('.');
+    size_t slash = path.rfind('/');
+    if (dot == std::string::npos ||
+        (slash != std::string::npos && dot < slash)) {
+        dot = path.length();
+    }
+
+    return path.substr(0, dot) + "_" + std::to_string(n) + path.substr(dot);
+}
+
+void AsyncFileTask::do_open()
+{
+    size_t pos = path.rfind('/');
+    if (pos != std::string::npos && pos > 0) {
+        if ((err = create_dirs(path.substr(0, pos))) != 0) {
+            return;
+        }
+    }
+
+    mode_t mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH;
+
+    std::string p = path;
+    for (int i = 1; i <= ASYNC_FILE_MAX_SUFFIX; i++) {
+        int fd = ::open(p.c_str(), flags | (unique ? O_EXCL : 0), mode);
+        if (fd >= 0) {
+            file->fd   = fd;
+            file->path = p;
+            path       = p;
+            return;
+        }
+        if (!unique || errno != EEXIST) {
+            break;
+        }
+        p = suffix_path(path, i);
+    }
+
+    err = errno;
+}
+
+void AsyncFileTask::do_write()
+{
+    if (file->fd < 0) {
+        err = EBADF;
+        return;
+    }
+
+    iovec*  iov     = iovs;
+    int     iovcnt  = nb_iovs;
+    int64_t pos     = offset;
+    int64_t written = 0;
+
+    while (written < size) {
+        ssize_t nwrite = ::pwritev(file->fd, iov, iovcnt, (off_t)pos);
+        if (nwrite < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            err = errno;
+            return;
+        }
+
+        written += nwrite;
+        pos += nwrite;
+
+        // partial write, skip what is done
+        while (iovcnt > 0 && (size_t)nwrite >= iov->iov_len) {
+            nwrite -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + nwrite;
+            iov->iov_len -= nwrite;
+        }
+    }
+}
+
+void AsyncFileTask::do_allocate()
+{
+    if (file->fd < 0) {
+        return;
+    }
+
+    // only a hint, some filesystems don't support it
+    ::fallocate(file->fd, FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)length);
+}
+
+void AsyncFileTask::do_close()
+{
+    if (file->fd < 0) {
+        return;
+    }
+
+    // release the preallocated space past the end
+    if (truncate >= 0 && ::ftruncate(file->fd, (off_t)truncate) < 0) {
+        err = errno;
+    }
+
+    if (::close(file->fd) < 0) {
+        err = errno;
+    }
+    file->fd = -1;
+
+    if (remove && ::unlink(file->path.c_str()) < 0) {
+        err = errno;
+    }
+    else if (!remove && !path.empty() &&
+             ::rename(file->path.c_str(), path.c_str()) < 0) {
+        err = errno;
+    }
+}
+
+void AsyncFileTask::do_remove()
+{
+    if (::unlink(path.c_str()) < 0 && errno != ENOENT) {
+        err = errno;
+    }
+}
+
+// a pool thread with its request and done queues, each one has a single
+// producer and a single consumer.
+class AsyncFileWorker {
+  public:
+    AsyncFileWorker(int queue_size, int efd);
+    ~AsyncFileWorker();
+
+  public:
+    int  Start();
+    void Wakeup();
+
+  private:
+    void run();
+
+  public:
+    RingBuffer<AsyncFileTask*> requests;
+    RingBuffer<AsyncFileTask*> done;
+    // queued and not yet reaped, by the st thread
+    int inflight;
+
+  private:
+    int                     efd_;
+    std::thread             thread_;
+    std::mutex              mutex_;
+    std::condition_variable cond_;
+    std::atomic<bool>       sleeping_;
+    std::atomic<bool>       quit_;
+};
+
+AsyncFileWorker::AsyncFileWorker(int queue_size, int efd)
+    : requests(queue_size), done(queue_size), inflight(0), efd_(efd)
+{
+    sleeping_.store(false);
+    quit_.store(false);
+}
+
+AsyncFileWorker::~AsyncFileWorker()
+{
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            quit_.store(true);
+        }
+        cond_.notify_one();
+        thread_.join();
+    }
+}
+
+int AsyncFileWorker::Start()
+{
+    try {
+        thread_ = std::thread(&AsyncFileWorker::run, this);
+    }
+    catch (const std::system_error&) {
+        return ERROR_SYSTEM_ASYNC_FILE;
+    }
+    return ERROR_SUCCESS;
+}
+
+void AsyncFileWorker::Wakeup()
+{
+    // pairs with the fence of run, either the thread sees the request or
+    // we see it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cond_.notify_one();
+    }
+}
+
+void AsyncFileWorker::run()
+{
+    AsyncFileTask* tasks[ASYNC_FILE_REAP_BATCH];
+
+    while (!quit_.load()) {
+        int n = requests.PopFront(tasks, ASYNC_FILE_REAP_BATCH);
+        if (n == 0) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            sleeping_.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            cond_.wait(lock, [this] {
+                return quit_.load() || !requests.Empty();
+            });
+            sleeping_.store(false);
+            continue;
+        }
+
+        for (int i = 0; i < n; i++) {
+            tasks[i]->Run();
+            // never full, the inflight requests fit in the queue
+            done.TryPush(tasks[i]);
+        }
+
+        uint64_t v = 1;
+        while (::write(efd_, &v, sizeof(v)) < 0 && errno == EINTR) {
+        }
+    }
+}
+
+AsyncFilePool::AsyncFilePool()
+{
+    queue_size_  = 0;
+    queue_bytes_ = 0;
+    wait_us_     = 0;
+    next_        = 0;
+    efd_         = -1;
+    event_stfd_  = nullptr;
+    space_cond_  = st_cond_new();
+    thread_      = nullptr;
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+AsyncFilePool::~AsyncFilePool()
+{
+    rs_freep(thread_);
+    for (size_t i = 0; i < workers_.size(); i++) {
+        rs_freep(workers_[i]);
+    }
+    workers_.clear();
+
+    if (event_stfd_) {
+        st_netfd_close(event_stfd_);
+    }
+    else if (efd_ != -1) {
+        ::close(efd_);
+    }
+
+    st_cond_destroy(space_cond_);
+}
+
+AsyncFilePool* AsyncFilePool::Instance()
+{
+    if (!_async_file) {
+        _async_file = new AsyncFilePool;
+    }
+    return _async_file;
+}
+
+int AsyncFilePool::Initialize(int     nb_threads,
+                              int     queue_size,
+                              int64_t queue_bytes,
+                              int     wait_ms)
+{
+    int ret = ERROR_SUCCESS;
+
+    queue_bytes_ = queue_bytes;
+    wait_us_     = (st_utime_t)wait_ms * 1000;
+
+    if ((efd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        ret = ERROR_SYSTEM_ASYNC_FILE;
+        rs_error("create async file eventfd failed. errno=%d, ret=%d", errno,
+                 ret);
+        return ret;
+    }
+    if ((event_stfd_ = st_netfd_open(efd_)) == nullptr) {
+        ret = ERROR_ST_OPEN_SOCKET;
+        rs_error("st open async file eventfd failed. ret=%d", ret);
+        return ret;
+    }
+
+    for (int i = 0; i < rs_max(nb_threads, 1); i++) {
+        AsyncFileWorker* worker = new AsyncFileWorker(queue_size, efd_);
+        workers_.push_back(worker);
+
+        if ((ret = worker->Start()) != ERROR_SUCCESS) {
+            rs_error("start async file thread failed. ret=%d", ret);
+            return ret;
+        }
+    }
+    // rounded up by the ring
+    queue_size_ = workers_[0]->requests.Capacity();
+
+    rs_trace("async file initialized. threads=%d, queue=%d, bytes=%lld, "
+             "wait=%dms",
+             (int)workers_.size(), queue_size_, (long long)queue_bytes_,
+             wait_ms);
+
+    thread_ = new internal::Thread("async_file", this, 0, false);
+    if ((ret = thread_->Start()) != ERROR_SUCCESS) {
+        rs_error("start async file reap thread failed. ret=%d", ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+int AsyncFilePool::Assign()
+{
+    if (workers_.empty()) {
+        return -1;
+    }
+    next_ = (next_ + 1) % (int)workers_.size();
+    return next_;
+}
+
+bool AsyncFilePool::is_full(AsyncFileWorker* worker, int64_t size)
+{
+    if (worker->inflight >= queue_size_) {
+        return true;
+    }
+    // a write larger than the limit still goes through an empty queue
+    return stats_.pending_bytes > 0 &&
+           stats_.pending_bytes + size > queue_bytes_;
+}
+
+int AsyncFilePool::Reserve(int worker, int64_t size, bool can_drop)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (worker < 0 || worker >= (int)workers_.size()) {
+        ret = ERROR_SYSTEM_ASYNC_FILE;
+        rs_error("async file is not initialized. ret=%d", ret);
+        return ret;
+    }
+
+    AsyncFileWorker* w     = workers_[worker];
+    st_utime_t       start = st_utime();
+
+    while (is_full(w, size)) {
+        if (!can_drop) {
+            st_cond_wait(space_cond_);
+            continue;
+        }
+
+        st_utime_t elapsed = st_utime() - start;
+        if (elapsed >= wait_us_) {
+            Drop(size);
+            return ERROR_SYSTEM_FILE_QUEUE_FULL;
+        }
+        st_cond_timedwait(space_cond_, wait_us_ - elapsed);
+    }
+
+    return ret;
+}
+
+int AsyncFilePool::Submit(int worker, AsyncFileTask* task)
+{
+    int ret = ERROR_SUCCESS;
+
+    if ((ret = Reserve(worker, task->size, false)) != ERROR_SUCCESS) {
+        rs_freep(task);
+        return ret;
+    }
+
+    AsyncFileWorker* w = workers_[worker];
+    w->requests.TryPush(task);
+    w->inflight++;
+    task->file->refs++;
+
+    stats_.queued++;
+    stats_.pending++;
+    stats_.pending_bytes += task->size;
+
+    w->Wakeup();
+
+    return ret;
+}
+
+void AsyncFilePool::Remove(const std::string& path, int worker)
+{
+    if (worker < 0 || worker >= (int)workers_.size()) {
+        worker = Assign();
+    }
+    if (worker < 0) {
+        return;
+    }
+
+    AsyncFileHandle* file = new AsyncFileHandle;
+    file->fd              = -1;
+    file->st_path         = path;
+    file->error           = ERROR_SUCCESS;
+    file->refs            = 1;
+
+    AsyncFileTask* task = new AsyncFileTask(AsyncFileOp::REMOVE, file);
+    task->path          = path;
+    Submit(worker, task);
+
+    if (--file->refs == 0) {
+        rs_freep(file);
+    }
+}
+
+void AsyncFilePool::Drop(int64_t size)
+{
+    stats_.dropped++;
+    stats_.dropped_bytes += size;
+}
+
+void AsyncFilePool::Stats(AsyncFileStats& stats)
+{
+    stats = stats_;
+}
+
+void AsyncFilePool::Dump()
+{
+    if (workers_.empty()) {
+        return;
+    }
+
+    rs_trace("async file, queued=%lld, written=%lld(%lldB), "
+             "dropped=%lld(%lldB), errors=%lld, pending=%d(%lldB)",
+             (long long)stats_.queued, (long long)stats_.written,
+             (long long)stats_.written_bytes, (long long)stats_.dropped,
+             (long long)stats_.dropped_bytes, (long long)stats_.errors,
+             stats_.pending, (long long)stats_.pending_bytes);
+}
+
+void AsyncFilePool::reap(AsyncFileTask* task)
+{
+    AsyncFileHandle* file = task->file;
+
+    stats_.pending--;
+    stats_.pending_bytes -= task->size;
+
+    if (task->err != 0) {
+        stats_.errors++;
+        if (file->error == ERROR_SUCCESS) {
+            file->error = task->op == AsyncFileOp::OPEN
+                              ? ERROR_SYSTEM_FILE_OPENE
+                              : task->op == AsyncFileOp::WRITE
+                                    ? ERROR_SYSTEM_FILE_WRITE
+                                    : ERROR_SYSTEM_FILE_CLOSE;
+        }
+        rs_error("async file %s failed. op=%d, errno=%d, ret=%d",
+                 file->st_path.c_str(), (int)task->op, task->err,
+                 file->error);
+    }
+    else if (task->op == AsyncFileOp::OPEN) {
+        file->st_path = task->path;
+    }
+    else if (task->op == AsyncFileOp::WRITE) {
+        stats_.written++;
+        stats_.written_bytes += task->size;
+    }
+
+    if (--file->refs == 0) {
+        rs_freep(file);
+    }
+    rs_freep(task);
+}
+
+int32_t AsyncFilePool::Cycle()
+{
+    int ret = ERROR_SUCCESS;
+
+    AsyncFileTask* tasks[ASYNC_FILE_REAP_BATCH];
+
+    bool reaped = false;
+    for (size_t i = 0; i < workers_.size(); i++) {
+        AsyncFileWorker* w = workers_[i];
+
+        int n = 0;
+        while ((n = w->done.PopFront(tasks, ASYNC_FILE_REAP_BATCH)) > 0) {
+            for (int j = 0; j < n; j++) {
+                reap(tasks[j]);
+            }
+            w->inflight -= n;
+            reaped = true;
+        }
+    }
+
+    if (reaped) {
+        st_cond_broadcast(space_cond_);
+    }
+
+    // sleep until a pool thread posts its done requests
+    uint64_t v   = 0;
+    ssize_t  nbr = st_read(event_stfd_, &v, sizeof(v), ST_UTIME_NO_TIMEOUT);
+
+    if (nbr < 0 && errno != EINTR && errno != EAGAIN) {
+        ret = ERROR_SYSTEM_ASYNC_FILE;
+        rs_error("read async file eventfd failed. errno=%d, ret=%d", errno,
+                 ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+AsyncFileWriter::AsyncFileWriter()
+{
+    pool_          = AsyncFilePool::Instance();
+    file_          = nullptr;
+    worker_        = -1;
+    fixed_worker_  = -1;
+    pos_           = 0;
+    end_           = 0;
+    ref_           = nullptr;
+    ref_data_      = nullptr;
+    ref_size_      = 0;
+    block_size_    = 0;
+    block_         = nullptr;
+    block_offset_  = 0;
+    block_used_    = 0;
+    allocated_     = 0;
+    allocate_step_ = 0;
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+    Close();
+    rs_freep(ref_);
+    if (block_) {
+        ::free(block_);
+    }
+}
+
+int AsyncFileWriter::Open(const std::string& path, bool append)
+{
+    int flags = O_CREAT | O_WRONLY | O_TRUNC;
+    if (append) {
+        flags = O_CREAT | O_APPEND | O_WRONLY;
+    }
+    return do_open(path, flags, false);
+}
+
+int AsyncFileWriter::OpenUnique(const std::string& path)
+{
+    return do_open(path, O_CREAT | O_WRONLY, true);
+}
+
+int AsyncFileWriter::do_open(const std::string& path, int flags, bool unique)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (file_) {
+        ret = ERROR_SYSTEM_FILE_ALREADY_OPENED;
+        rs_error("file %s already opened. ret=%d", path.c_str(), ret);
+        return ret;
+    }
+
+    worker_ = fixed_worker_;
+    if (worker_ < 0 && (worker_ = pool_->Assign()) < 0) {
+        ret = ERROR_SYSTEM_ASYNC_FILE;
+        rs_error("async file is not initialized. path=%s, ret=%d",
+                 path.c_str(), ret);
+        return ret;
+    }
+
+    file_          = new AsyncFileHandle;
+    file_->fd      = -1;
+    file_->st_path = path;
+    file_->error   = ERROR_SUCCESS;
+    file_->refs    = 1;
+
+    AsyncFileTask* task = new AsyncFileTask(AsyncFileOp::OPEN, file_);
+    task->path          = path;
+    task->flags         = flags;
+    task->unique        = unique;
+
+    path_          = path;
+    pos_           = 0;
+    end_           = 0;
+    block_offset_  = 0;
+    block_used_    = 0;
+    allocated_     = 0;
+    allocate_step_ = 0;
+
+    if ((ret = pool_->Submit(worker_, task)) != ERROR_SUCCESS) {
+        rs_error("queue open file %s failed. ret=%d", path.c_str(), ret);
+        do_close(false, "");
+        return ret;
+    }
+
+    return ret;
+}
+
+void AsyncFileWriter::Close()
+{
+    do_close(false, "");
+}
+
+void AsyncFileWriter::CloseAndRemove()
+{
+    do_close(true, "");
+}
+
+void AsyncFileWriter::CloseAndRename(const std::string& path)
+{
+    do_close(false, path);
+}
+
+void AsyncFileWriter::do_close(bool remove, const std::string& rename)
+{
+    if (!file_) {
+        return;
+    }
+
+    if (!remove) {
+        flush();
+    }
+    else if (block_) {
+        ::free(block_);
+        block_ = nullptr;
+    }
+
+    AsyncFileHandle* file = file_;
+    file_                 = nullptr;
+
+    AsyncFileTask* task = new AsyncFileTask(AsyncFileOp::CLOSE, file);
+    task->remove        = remove;
+    task->path          = rename;
+    if (allocated_ > 0 && !remove) {
+        task->truncate = end_;
+    }
+    pool_->Submit(worker_, task);
+
+    if (--file->refs == 0) {
+        rs_freep(file);
+    }
+}
+
+bool AsyncFileWriter::IsOpen()
+{
+    return file_ != nullptr;
+}
+
+void AsyncFileWriter::Lseek(int64_t offset)
+{
+    pos_ = offset;
+}
+
+int64_t AsyncFileWriter::Tellg()
+{
+    return pos_;
+}
+
+void AsyncFileWriter::SetBlockSize(int size)
+{
+    block_size_ = size;
+}
+
+void AsyncFileWriter::SetWorker(int worker)
+{
+    fixed_worker_ = worker;
+}
+
+void AsyncFileWriter::Preallocate(int64_t size, int64_t step)
+{
+    allocate_step_ = rs_max(step, (int64_t)block_size_);
+    allocate(rs_max(size, allocate_step_));
+}
+
+void AsyncFileWriter::allocate(int64_t end)
+{
+    if (!file_ || end <= allocated_) {
+        return;
+    }
+
+    AsyncFileTask* task = new AsyncFileTask(AsyncFileOp::ALLOCATE, file_);
+    task->offset        = allocated_;
+    task->length        = end - allocated_;
+    allocated_          = end;
+
+    pool_->Submit(worker_, task);
+}
+
+std::string AsyncFileWriter::GetPath()
+{
+    return file_ ? file_->st_path : path_;
+}
+
+int AsyncFileWriter::Reserve(int64_t size, bool can_drop)
+{
+    // only a full block is queued
+    if (block_size_ > 0) {
+        if (block_used_ + size < block_size_) {
+            return ERROR_SUCCESS;
+        }
+        size = block_size_;
+    }
+    return pool_->Reserve(worker_, size, can_drop);
+}
+
+void AsyncFileWriter::Drop(int64_t size)
+{
+    pool_->Drop(size);
+}
+
+void AsyncFileWriter::Hold(IAsyncFileRef* ref, const char* data, int size)
+{
+    rs_freep(ref_);
+    ref_      = ref;
+    ref_data_ = data;
+    ref_size_ = size;
+}
+
+int AsyncFileWriter::Write(void* buf, size_t count, ssize_t* pnwrite)
+{
+    iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len  = count;
+    return Writev(&iov, 1, pnwrite);
+}
+
+int AsyncFileWriter::Writev(iovec* iov, int iovcnt, ssize_t* pnwrite)
+{
+    int ret = ERROR_SUCCESS;
+
+    IAsyncFileRef* ref      = ref_;
+    const char*    ref_data = ref_data_;
+    int            ref_size = ref_size_;
+    ref_                    = nullptr;
+
+    if (!file_) {
+        rs_freep(ref);
+        ret = ERROR_SYSTEM_FILE_WRITE;
+        rs_error("write to closed file %s. ret=%d", path_.c_str(), ret);
+        return ret;
+    }
+
+    if ((ret = file_->error) != ERROR_SUCCESS) {
+        rs_freep(ref);
+        return ret;
+    }
+
+    int64_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+
+    // the patches of what was already queued are written on their own
+    if (block_size_ > 0 && pos_ + total > block_offset_) {
+        rs_freep(ref);
+        return write_block(iov, iovcnt, pnwrite);
+    }
+
+    AsyncFileTask* task = new AsyncFileTask(AsyncFileOp::WRITE, file_);
+    task->offset        = pos_;
+    task->ref           = ref;
+
+    // the iovecs out of the held memory are copied
+    int64_t copy_size = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        const char* base = (const char*)iov[i].iov_base;
+        bool held = ref && iovcnt <= RS_ASYNC_FILE_MAX_IOVS &&
+                    base >= ref_data &&
+                    base + iov[i].iov_len <= ref_data + ref_size;
+        if (!held) {
+            copy_size += iov[i].iov_len;
+        }
+        task->size += iov[i].iov_len;
+    }
+
+    char* p = task->inline_data;
+    if (copy_size > RS_ASYNC_FILE_INLINE_SIZE) {
+        p = task->data = (char*)::malloc(copy_size);
+    }
+
+    if (iovcnt > RS_ASYNC_FILE_MAX_IOVS) {
+        task->iovs[0].iov_len = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            memcpy(p + task->iovs[0].iov_len, iov[i].iov_base, iov[i].iov_len);
+            task->iovs[0].iov_len += iov[i].iov_len;
+        }
+        task->iovs[0].iov_base = p;
+        task->nb_iovs          = 1;
+    }
+    else {
+        for (int i = 0; i < iovcnt; i++) {
+            const char* base = (const char*)iov[i].iov_base;
+            iovec&      dst  = task->iovs[task->nb_iovs++];
+            dst.iov_len      = iov[i].iov_len;
+            if (ref && base >= ref_data &&
+                base + iov[i].iov_len <= ref_data + ref_size) {
+                dst.iov_base = iov[i].iov_base;
+                continue;
+            }
+            memcpy(p, base, iov[i].iov_len);
+            dst.iov_base = p;
+            p += iov[i].iov_len;
+        }
+    }
+
+    ssize_t nwrite = (ssize_t)task->size;
+    if ((ret = pool_->Submit(worker_, task)) != ERROR_SUCCESS) {
+        rs_error("queue write to file %s failed. ret=%d", path_.c_str(), ret);
+        return ret;
+    }
+
+    pos_ += nwrite;
+    end_ = rs_max(end_, pos_);
+    if (allocate_step_ > 0 && end_ >= allocated_) {
+        allocate(end_ + allocate_step_);
+    }
+
+    if (pnwrite) {
+        *pnwrite = nwrite;
+    }
+
+    return ret;
+}
+
+int AsyncFileWriter::write_block(iovec* iov, int iovcnt, ssize_t* pnwrite)
+{
+    int ret = ERROR_SUCCESS;
+
+    // only a contiguous range is kept, queue it before moving elsewhere
+    if (block_ &&
+        (pos_ < block_offset_ || pos_ > block_offset_ + block_used_)) {
+        if ((ret = flush()) != ERROR_SUCCESS) {
+            return ret;
+        }
+    }
+
+    ssize_t nwrite = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        const char* p    = (const char*)iov[i].iov_base;
+        int64_t     left = iov[i].iov_len;
+
+        while (left > 0) {
+            if (!block_) {
+                if (::posix_memalign((void**)&block_, RS_ASYNC_FILE_BLOCK_ALIGN,
+                                     block_size_) != 0) {
+                    block_ = nullptr;
+                    ret    = ERROR_SYSTEM_FILE_WRITE;
+                    rs_error("alloc block of file %s failed. size=%d, ret=%d",
+                             path_.c_str(), block_size_, ret);
+                    return ret;
+                }
+                block_offset_ = pos_;
+                block_used_   = 0;
+            }
+
+            int at = (int)(pos_ - block_offset_);
+            int n  = (int)rs_min(left, (int64_t)(block_size_ - at));
+            memcpy(block_ + at, p, n);
+
+            p += n;
+            left -= n;
+            pos_ += n;
+            nwrite += n;
+            block_used_ = rs_max(block_used_, at + n);
+
+            if (block_used_ < block_size_) {
+                continue;
+            }
+            if ((ret = flush()) != ERROR_SUCCESS) {
+                return ret;
+            }
+        }
+    }
+
+    end_ = rs_max(end_, pos_);
+    if (allocate_step_ > 0 && end_ + block_size_ > allocated_) {
+        allocate(end_ + allocate_step_);
+    }
+
+    if (pnwrite) {
+        *pnwrite = nwrite;
+    }
+
+    return ret;
+}
+
+int AsyncFileWriter::flush()
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!block_) {
+        return ret;
+    }
+
+    AsyncFileTask* task    = new AsyncFileTask(AsyncFileOp::WRITE, file_);
+    task->offset           = block_offset_;
+    task->data             = block_;
+    task->size             = block_used_;
+    task->iovs[0].iov_base = block_;
+    task->iovs[0].iov_len  = block_used_;
+    task->nb_iovs          = 1;
+
+    block_ = nullptr;
+    block_offset_ += block_used_;
+    block_used_ = 0;
+
+    if ((ret = pool_->Submit(worker_, task)) != ERROR_SUCCESS) {
+        rs_error("queue block of file %s failed. ret=%d", path_.c_str(), ret);
+        return ret;
+    }
+
+    return ret;
+}
@@ -0,0 +1,223 @@
+#ifndef RS_ASYNC_FILE_HPP
+#define RS_ASYNC_FILE_HPP
+
+#include <common/core.hpp>
+#include <common/file.hpp>
+#include <common/pool.hpp>
+#include <common/thread.hpp>
+
+#include <st.h>
+
+#include <string>
+#include <vector>
+
+// iovecs of a write kept in the request itself, the others are copied
+#define RS_ASYNC_FILE_MAX_IOVS 4
+// small iovecs, such as the tag headers on the stack, are copied inline
+#define RS_ASYNC_FILE_INLINE_SIZE 64
+// alignment of the coalescing blocks
+#define RS_ASYNC_FILE_BLOCK_ALIGN 4096
+
+// memory referenced by a queued write, released by the st thread once the
+// write is done.
+class IAsyncFileRef {
+  public:
+    IAsyncFileRef();
+    virtual ~IAsyncFileRef();
+};
+
+// file shared by a writer and its requests. fd and path belong to the pool
+// thread, the others to the st thread.
+struct AsyncFileHandle
+{
+    int         fd;
+    std::string path;
+    std::string st_path;
+    int         error;
+    int         refs;
+};
+
+enum class AsyncFileOp {
+    OPEN,
+    WRITE,
+    ALLOCATE,
+    CLOSE,
+    REMOVE,
+};
+
+class AsyncFileTask {
+    RS_DECLARE_POOL();
+
+  public:
+    AsyncFileTask(AsyncFileOp op, AsyncFileHandle* file);
+    ~AsyncFileTask();
+
+  public:
+    // run by the pool thread, which must not log nor touch st
+    void Run();
+
+  private:
+    void do_open();
+    void do_write();
+    void do_allocate();
+    void do_close();
+    void do_remove();
+
+  public:
+    AsyncFileOp      op;
+    AsyncFileHandle* file;
+    // open, the path to rename to on close, or to remove
+    std::string path;
+    int         flags;
+    bool        unique;
+    // close, truncate to the written size when preallocated
+    bool    remove;
+    int64_t truncate;
+    // write and allocate
+    int64_t        offset;
+    int64_t        length;
+    iovec          iovs[RS_ASYNC_FILE_MAX_IOVS];
+    int            nb_iovs;
+    char           inline_data[RS_ASYNC_FILE_INLINE_SIZE];
+    char*          data;
+    IAsyncFileRef* ref;
+    int64_t        size;
+    // errno of the failed request
+    int err;
+};
+
+struct AsyncFileStats
+{
+    int64_t queued;
+    int64_t written;
+    int64_t written_bytes;
+    int64_t dropped;
+    int64_t dropped_bytes;
+    int64_t errors;
+    int     pending;
+    int64_t pending_bytes;
+};
+
+class AsyncFileWorker;
+
+// disk io of the worker process. the st threads queue their requests to a
+// few pool threads and never block on the filesystem. the requests of a file
+// always go to the same pool thread, so they are done in order. the done
+// requests come back through an eventfd and are released by the st thread,
+// since neither the messages nor the pools are shared between threads.
+class AsyncFilePool : public internal::IThreadHandler {
+  public:
+    AsyncFilePool();
+    virtual ~AsyncFilePool();
+
+  public:
+    static AsyncFilePool* Instance();
+
+  public:
+    virtual int Initialize(int     nb_threads,
+                           int     queue_size,
+                           int64_t queue_bytes,
+                           int     wait_ms);
+    // the pool thread of a new file
+    virtual int Assign();
+    // wait for room for size bytes on the pool thread, at most the wait_ms
+    // of Initialize when the write can be dropped.
+    virtual int  Reserve(int worker, int64_t size, bool can_drop);
+    virtual int  Submit(int worker, AsyncFileTask* task);
+    // remove a file which is not open, e.g. an expired segment, after the
+    // requests queued to worker, or on any pool thread.
+    virtual void Remove(const std::string& path, int worker = -1);
+    virtual void Drop(int64_t size);
+    virtual void Stats(AsyncFileStats& stats);
+    virtual void Dump();
+    // IThreadHandler
+    virtual int32_t Cycle() override;
+
+  private:
+    virtual bool is_full(AsyncFileWorker* worker, int64_t size);
+    virtual void reap(AsyncFileTask* task);
+
+  private:
+    std::vector<AsyncFileWorker*> workers_;
+    int                           queue_size_;
+    int64_t                       queue_bytes_;
+    st_utime_t                    wait_us_;
+    int                           next_;
+    int                           efd_;
+    st_netfd_t                    event_stfd_;
+    st_cond_t                     space_cond_;
+    internal::Thread*             thread_;
+    AsyncFileStats                stats_;
+};
+
+// file writer over the pool. the position is tracked here, so Tellg and
+// Lseek don't reach the disk, and the errors of the pool thread are
+// returned by the next call. with a block size the writes are coalesced
+// into aligned blocks, and one request is queued per block.
+class AsyncFileWriter : public FileWriter {
+  public:
+    AsyncFileWriter();
+    virtual ~AsyncFileWriter();
+
+  public:
+    // the parent dirs are created, and with unique an existing file is not
+    // overwritten, a _N suffix is added before the extension instead.
+    virtual int     Open(const std::string& path, bool append = false) override;
+    virtual int     OpenUnique(const std::string& path);
+    virtual void    Close() override;
+    // remove the file once closed, e.g. when nothing was recorded
+    virtual void    CloseAndRemove();
+    // rename the file once closed, to replace path at once
+    virtual void    CloseAndRename(const std::string& path);
+    virtual bool    IsOpen() override;
+    virtual void    Lseek(int64_t offset) override;
+    virtual int64_t Tellg() override;
+    virtual int     Write(void* buf, size_t count, ssize_t* pnwrite) override;
+    virtual int     Writev(iovec* iov, int iovcnt, ssize_t* pnwrite) override;
+
+  public:
+    // before Open, 0 to queue every write on its own
+    virtual void SetBlockSize(int size);
+    // before Open, the pool thread of the file instead of a new one, so its
+    // requests are done after the ones already queued to it, -1 to assign.
+    virtual void SetWorker(int worker);
+    // allocate the first size bytes of the file, then step bytes ahead of
+    // the writes. the file is truncated to what was written on close.
+    virtual void Preallocate(int64_t size, int64_t step);
+    // the path once opened, with its suffix if any
+    virtual std::string GetPath();
+    // see AsyncFilePool::Reserve
+    virtual int  Reserve(int64_t size, bool can_drop);
+    virtual void Drop(int64_t size);
+    // the next write references [data, data + size) instead of copying it,
+    // ref is released when the write is done.
+    virtual void Hold(IAsyncFileRef* ref, const char* data, int size);
+
+  private:
+    virtual int  do_open(const std::string& path, int flags, bool unique);
+    virtual void do_close(bool remove, const std::string& rename);
+    virtual int  write_block(iovec* iov, int iovcnt, ssize_t* pnwrite);
+    virtual int  flush();
+    virtual void allocate(int64_t end);
+
+  private:
+    AsyncFilePool*   pool_;
+    AsyncFileHandle* file_;
+    int              worker_;
+    int              fixed_worker_;
+    std::string      path_;
+    int64_t          pos_;
+    int64_t          end_;
+    IAsyncFileRef*   ref_;
+    const char*      ref_data_;
+    int              ref_size_;
+    // the block being filled, at block_offset_ of the file
+    int              block_size_;
+    char*            block_;
+    int64_t          block_offset_;
+    int              block_used_;
+    int64_t          allocated_;
+    int64_t          allocate_step_;
+};
+
+#endif
@@ -294,6 +294,7 @@ void FastBuffer::SetBuffer(int buffer_size)
     int size = Size();
 
     buf_ = (char *)realloc(buf_, buffer_size);
+    capacity_ = buffer_size;
     start_ = buf_ + start_pos;
     end_ = start_ + size;
 }
@@ -376,6 +377,59 @@ int FastBuffer::Grow(IBufferReader *r, int required_size)
     return ret;
 }
 
+int FastBuffer::ReadInto(IBufferReader *r, char *dst, int size)
+{
+    int ret = ERROR_SUCCESS;
+
+    int nb = rs_min(Size(), size);
+    if (nb > 0)
+    {
+        memcpy(dst, start_, nb);
+        start_ += nb;
+    }
+
+    if (nb == size)
+    {
+        return ret;
+    }
+
+    // the buffer is drained, give the whole space to the read ahead
+    start_ = end_ = buf_;
+
+    while (nb < size)
+    {
+        iovec iovs[2];
+        iovs[0].iov_base = dst + nb;
+        iovs[0].iov_len = size - nb;
+        iovs[1].iov_base = end_;
+        iovs[1].iov_len = buf_ + capacity_ - end_;
+
+        ssize_t nread;
+        if ((ret = r->ReadEv(iovs, iovs[1].iov_len > 0 ? 2 : 1, &nread)) != ERROR_SUCCESS)
+        {
+            return ret;
+        }
+
+        if (merged_read_ && mr_handler_)
+        {
+            mr_handler_->OnRead(nread);
+        }
+
+        rs_assert(int(nread) > 0);
+        if (nread <= size - nb)
+        {
+            nb += nread;
+        }
+        else
+        {
+            end_ += nread - (size - nb);
+            nb = size;
+        }
+    }
+
+    return ret;
+}
+
 void FastBuffer::SetMergeReadHandler(bool enable, IMergeReadHandler *mr_handler)
 {
     merged_read_ = enable;
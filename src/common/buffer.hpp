@@ -81,6 +81,9 @@ public:
     virtual char *ReadSlice(int size);
     virtual void Skip(int size);
     virtual int Grow(IBufferReader *r, int required_size);
+    // fill dst with the buffered bytes, then scatter read the rest straight
+    // into dst, the bytes following dst are read ahead into the buffer.
+    virtual int ReadInto(IBufferReader *r, char *dst, int size);
     virtual void SetMergeReadHandler(bool enable, IMergeReadHandler *mr_handler);
 
 private:
@@ -41,6 +41,31 @@ int Config::GetMRSleepMS(const std::string& vhost)
     return 350;
 }
 
+bool Config::GetMWAdaptive(const std::string& vhost)
+{
+    return true;
+}
+
+int Config::GetMWMinSleepMS(const std::string& vhost)
+{
+    return 10;
+}
+
+int Config::GetMWSleepMS(const std::string& vhost)
+{
+    return 350;  // the max latency added by the merged write
+}
+
+int Config::GetMWBatchBytes(const std::string& vhost)
+{
+    return 64 * 1024;
+}
+
+bool Config::GetLowLatency(const std::string& vhost)
+{
+    return false;
+}
+
 bool Config::GetRealTimeEnabled(const std::string& vhost)
 {
     return false;
@@ -51,11 +76,25 @@ bool Config::GetReduceSequenceHeader(const std::string& vhost)
     return true;
 }
 
+std::vector<std::string> Config::GetVhosts()
+{
+    std::vector<std::string> vhosts;
+    vhosts.push_back("__defaultVhost__");
+    return vhosts;
+}
+
 bool Config::GetVhostIsEdge(const std::string& vhost)
 {
     return false;
 }
 
+std::vector<std::string> Config::GetEdgeOrigins(const std::string& vhost)
+{
+    std::vector<std::string> origins;
+    origins.push_back("127.0.0.1:19350");
+    return origins;
+}
+
 int Config::GetPublishFirstPktTimeout(const std::string& vhost)
 {
     return 20000;
@@ -114,4 +153,190 @@ bool Config::GetParseSPS(const std::string& vhost)
 int Config::GetQueueSize(const std::string& vhost)
 {
     return 5;
-}
\ No newline at end of file
+}
+
+bool Config::GetGopCache(const std::string& vhost)
+{
+    return true;
+}
+
+int Config::GetGopCacheMaxBytes(const std::string& vhost)
+{
+    return 16 * 1024 * 1024;  // bytes, 0 for no limit
+}
+
+int Config::GetGopCacheMaxDuration(const std::string& vhost)
+{
+    return 10;  // seconds, 0 for no limit
+}
+
+std::string Config::GetGopCacheOverflow(const std::string& vhost)
+{
+    return "trim";  // trim or disable
+}
+
+int Config::GetTimeShift(const std::string& vhost)
+{
+    return 0;  // seconds of gops kept for the time shift, 0 to disable
+}
+
+int Config::GetTimeShiftMaxBytes(const std::string& vhost)
+{
+    return 256 * 1024 * 1024;  // bytes, 0 for no limit
+}
+
+std::string Config::GetJoinStrategy(const std::string& vhost)
+{
+    return "gop";  // gop, keyframe or burst
+}
+
+int Config::GetJoinBurstRate(const std::string& vhost)
+{
+    return 4;  // times the bitrate of the stream, 0 for the socket's
+}
+
+int Config::GetWorkers()
+{
+    return 1;
+}
+
+std::string Config::GetRelaySocketPath()
+{
+    // [master] is the pid of the master, two servers on a host do not share
+    // their sockets
+    return "/tmp/rtmp_server.relay.[master].[worker].sock";
+}
+
+int Config::GetRelayRingSize()
+{
+    return 8 * 1024 * 1024;  // bytes, power of 2
+}
+
+bool Config::GetSharedQueueEnabled(const std::string& vhost)
+{
+    return false;
+}
+int Config::GetPoolStatsInterval()
+{
+    return 60;  // seconds, 0 to disable
+}
+
+std::string Config::GetIOBackend()
+{
+    return "st";  // st or io_uring
+}
+
+int Config::GetUringEntries()
+{
+    return 4096;
+}
+
+int Config::GetDvrIOThreads()
+{
+    return 2;
+}
+
+int Config::GetDvrIOQueueSize()
+{
+    return 1024;  // requests per io thread
+}
+
+int Config::GetDvrIOQueueBytes()
+{
+    return 64 * 1024 * 1024;
+}
+
+int Config::GetDvrIOWaitMS()
+{
+    return 100;  // then drop the audio and video until the next keyframe
+}
+
+int Config::GetDvrBlockSize()
+{
+    return 1024 * 1024;  // bytes written at once, 0 to write every tag
+}
+
+bool Config::GetDvrPreallocate(const std::string& vhost)
+{
+    return true;
+}
+
+bool Config::GetDvrIndex(const std::string& vhost)
+{
+    return true;  // keyframe index sidecar of every segment
+}
+
+bool Config::GetVodEnabled(const std::string& vhost)
+{
+    return true;  // play the recordings of GetVodPath
+}
+
+std::string Config::GetVodPath(const std::string& vhost)
+{
+    return "/home/lam2003/flv_record";
+}
+
+int Config::GetVodBufferMS(const std::string& vhost)
+{
+    return 1000;  // sent ahead of the timestamps
+}
+
+int Config::GetHttpFlvPort()
+{
+    return 8080;  // 0 to disable
+}
+
+bool Config::GetHlsEnabled(const std::string& vhost)
+{
+    return true;
+}
+
+std::string Config::GetHlsPath(const std::string& vhost)
+{
+    return "/home/lam2003/hls";
+}
+
+int Config::GetHlsFragment(const std::string& vhost)
+{
+    return 5;  // seconds, cut at the next keyframe
+}
+
+int Config::GetHlsWindow(const std::string& vhost)
+{
+    return 30;  // seconds of segments in the playlist
+}
+
+bool Config::GetCmafEnabled(const std::string& vhost)
+{
+    return false;  // made for the players of each worker, on request
+}
+
+int Config::GetCmafFragment(const std::string& vhost)
+{
+    return 2;  // seconds, cut at the next keyframe
+}
+
+int Config::GetCmafPartMS(const std::string& vhost)
+{
+    return 500;
+}
+
+int Config::GetCmafWindow(const std::string& vhost)
+{
+    return 12;  // seconds of segments kept in memory
+}
+
+int64_t Config::GetCmafMaxBytes(const std::string& vhost)
+{
+    return 32 * 1024 * 1024;  // bytes of segments kept in memory
+}
+
+bool Config::GetZeroCopyEnabled(const std::string& vhost)
+{
+    return false;
+}
+
+int Config::GetZeroCopyThreshold(const std::string& vhost)
+{
+    return 64 * 1024;  // bytes of a send batch
+}
@@ -8,6 +8,8 @@
 
 #include <common/reload.hpp>
 
+#include <vector>
+
 #define RS_CONFIG_NVR_PLAN_SESSION "session"
 #define RS_CONFIG_NVR_PLAN_APPEND "append"
 #define RS_CONFIG_NVR_PLAN_SEGMENT "segment"
@@ -30,9 +32,19 @@ class Config {
     virtual bool        GetATC(const std::string& vhost);
     virtual bool        GetMREnabled(const std::string& vhost);
     virtual int         GetMRSleepMS(const std::string& vhost);
+    virtual bool        GetMWAdaptive(const std::string& vhost);
+    virtual int         GetMWMinSleepMS(const std::string& vhost);
+    virtual int         GetMWSleepMS(const std::string& vhost);
+    virtual int         GetMWBatchBytes(const std::string& vhost);
+    virtual bool        GetLowLatency(const std::string& vhost);
     virtual bool        GetRealTimeEnabled(const std::string& vhost);
     virtual bool        GetReduceSequenceHeader(const std::string& vhost);
+    virtual std::vector<std::string> GetVhosts();
+    // the players of an edge vhost pull the stream from its origins
     virtual bool        GetVhostIsEdge(const std::string& vhost);
+    // host:port of the origins, tried in turn when one fails
+    // host:port of the origins, the names are resolved once at the start
+    virtual std::vector<std::string> GetEdgeOrigins(const std::string& vhost);
     virtual int         GetPublishFirstPktTimeout(const std::string& vhost);
     virtual int         GetPublishNormalPktTimeout(const std::string& vhost);
     virtual bool        GetTCPNoDelay(const std::string& vhost);
@@ -46,6 +58,43 @@ class Config {
     virtual bool        GetATCAuto(const std::string& vhost);
     virtual bool        GetParseSPS(const std::string& vhost);
     virtual int         GetQueueSize(const std::string& vhost);
+    virtual bool        GetGopCache(const std::string& vhost);
+    virtual int         GetGopCacheMaxBytes(const std::string& vhost);
+    virtual int         GetGopCacheMaxDuration(const std::string& vhost);
+    virtual std::string GetGopCacheOverflow(const std::string& vhost);
+    virtual int         GetTimeShift(const std::string& vhost);
+    virtual int         GetTimeShiftMaxBytes(const std::string& vhost);
+    virtual std::string GetJoinStrategy(const std::string& vhost);
+    virtual int         GetJoinBurstRate(const std::string& vhost);
+    virtual bool        GetSharedQueueEnabled(const std::string& vhost);
+    virtual bool        GetZeroCopyEnabled(const std::string& vhost);
+    virtual int         GetZeroCopyThreshold(const std::string& vhost);
+    virtual int         GetWorkers();
+    virtual std::string GetRelaySocketPath();
+    virtual int         GetRelayRingSize();
+    virtual int         GetPoolStatsInterval();
+    virtual std::string GetIOBackend();
+    virtual int         GetUringEntries();
+    virtual int         GetDvrIOThreads();
+    virtual int         GetDvrIOQueueSize();
+    virtual int         GetDvrIOQueueBytes();
+    virtual int         GetDvrIOWaitMS();
+    virtual int         GetDvrBlockSize();
+    virtual bool        GetDvrPreallocate(const std::string& vhost);
+    virtual bool        GetDvrIndex(const std::string& vhost);
+    virtual bool        GetVodEnabled(const std::string& vhost);
+    virtual std::string GetVodPath(const std::string& vhost);
+    virtual int         GetVodBufferMS(const std::string& vhost);
+    virtual int         GetHttpFlvPort();
+    virtual bool        GetHlsEnabled(const std::string& vhost);
+    virtual std::string GetHlsPath(const std::string& vhost);
+    virtual int         GetHlsFragment(const std::string& vhost);
+    virtual int         GetHlsWindow(const std::string& vhost);
+    virtual bool        GetCmafEnabled(const std::string& vhost);
+    virtual int         GetCmafFragment(const std::string& vhost);
+    virtual int         GetCmafPartMS(const std::string& vhost);
+    virtual int         GetCmafWindow(const std::string& vhost);
+    virtual int64_t     GetCmafMaxBytes(const std::string& vhost);
 };
 
 extern Config* _config;
@@ -70,6 +70,9 @@
 #define ERROR_SYSTEM_DNS_RESOLVE 1059
 #define ERROR_SOCKET_SETKEEPALIVE 1060
 #define ERROR_SYSTEM_FILE_REMOVE 1061
+#define ERROR_SYSTEM_IO_URING 1062
+#define ERROR_SYSTEM_FILE_QUEUE_FULL 1063
+#define ERROR_SYSTEM_ASYNC_FILE 1064
 ///////////////////////////////////////////////////////
 // RTMP protocol error.
 ///////////////////////////////////////////////////////
@@ -207,6 +210,8 @@
 #define ERROR_DECODE_AAC_EXTRA_DATA_FAILED 3068
 #define ERROR_ACODEC_NOT_SUPPORT 3069
 #define ERROR_SAMPLE_EXCEED 3070
+#define ERROR_FLV_INDEX_INVALID 3071
+#define ERROR_FLV_INVALID_TAG 3072
 ///////////////////////////////////////////////////////
 // HTTP/StreamCaster protocol error.
 ///////////////////////////////////////////////////////
@@ -252,6 +257,10 @@
 #define ERROR_USER_START 9000
 #define ERROR_USER_DISCONNECT 9001
 #define ERROR_SOURCE_NOT_FOUND 9002
+#define ERROR_RELAY_FRAME_INVALID 9003
+#define ERROR_RELAY_RING_FULL 9004
+#define ERROR_TIME_SHIFT_NO_CLIP 9005
+#define ERROR_CMAF_OVERFLOW 9006
 #define ERROR_USER_END 9999
 
 //muxer
@@ -7,31 +7,282 @@
 #include <common/error.hpp>
 #include <common/file.hpp>
 #include <common/log.hpp>
+#include <common/utils.hpp>
 
 #include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-// FileReader::FileReader() : fd_(-1)
-// {
-// }
+#include <map>
 
-// FileReader::~FileReader()
-// {
-//     Close();
-// }
+static std::map<std::string, MappedFile *> _mapped_files;
 
-// int32_t FileReader::Open(const std::string &p)
-// {
-//     int32_t ret = ERROR_SUCCESS;
+static int64_t mtime_ns(const struct stat &st)
+{
+    return (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+MappedFile::MappedFile(const std::string &path)
+{
+    path_ = path;
+    fd_ = -1;
+    data_ = nullptr;
+    size_ = 0;
+    ino_ = 0;
+    mtime_ns_ = 0;
+    refs_ = 1;
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_)
+    {
+        ::munmap(data_, (size_t)size_);
+    }
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+    }
+}
+
+int MappedFile::Acquire(const std::string &path, MappedFile **pfile)
+{
+    int ret = ERROR_SUCCESS;
+
+    std::map<std::string, MappedFile *>::iterator it = _mapped_files.find(path);
+    if (it != _mapped_files.end())
+    {
+        if (!it->second->Changed())
+        {
+            it->second->AddRef();
+            *pfile = it->second;
+            return ret;
+        }
+
+        // the readers of the old one keep it, the new readers map the file
+        rs_trace("file %s changed, map it again", path.c_str());
+        _mapped_files.erase(it);
+    }
+
+    MappedFile *file = new MappedFile(path);
+    if ((ret = file->open()) != ERROR_SUCCESS)
+    {
+        rs_freep(file);
+        return ret;
+    }
+
+    _mapped_files[path] = file;
+    *pfile = file;
+
+    return ret;
+}
+
+int MappedFile::open()
+{
+    int ret = ERROR_SUCCESS;
+
+    int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        ret = ERROR_SYSTEM_FILE_OPENE;
+        rs_error("open file %s failed. errno=%d, ret=%d", path_.c_str(), errno, ret);
+        return ret;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) < 0 || st.st_size <= 0)
+    {
+        ::close(fd);
+        ret = ERROR_SYSTEM_FILE_READ;
+        rs_error("empty or unknown size of file %s. ret=%d", path_.c_str(), ret);
+        return ret;
+    }
+
+    void *ptr = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED)
+    {
+        ::close(fd);
+        ret = ERROR_SYSTEM_FILE_READ;
+        rs_error("mmap file %s failed. errno=%d, ret=%d", path_.c_str(), errno, ret);
+        return ret;
+    }
+
+    // kept open to tell a truncate by fstat
+    fd_ = fd;
+    data_ = (char *)ptr;
+    size_ = st.st_size;
+    ino_ = st.st_ino;
+    mtime_ns_ = mtime_ns(st);
+
+    return ret;
+}
+
+void MappedFile::AddRef()
+{
+    refs_++;
+}
+
+void MappedFile::Release()
+{
+    if (--refs_ > 0)
+    {
+        return;
+    }
+
+    // a changed file may be mapped again under the path
+    std::map<std::string, MappedFile *>::iterator it = _mapped_files.find(path_);
+    if (it != _mapped_files.end() && it->second == this)
+    {
+        _mapped_files.erase(it);
+    }
+    delete this;
+}
+
+bool MappedFile::Changed()
+{
+    struct stat st;
+    if (::stat(path_.c_str(), &st) < 0)
+    {
+        return true;
+    }
+
+    return st.st_ino != ino_ || st.st_size != size_ || mtime_ns(st) != mtime_ns_;
+}
+
+bool MappedFile::Truncated()
+{
+    struct stat st;
+    if (fd_ < 0 || ::fstat(fd_, &st) < 0)
+    {
+        return true;
+    }
+
+    return st.st_size < size_;
+}
+
+const std::string &MappedFile::Path()
+{
+    return path_;
+}
+
+char *MappedFile::Data()
+{
+    return data_;
+}
 
-//     if (fd_ > 0)
-//     {
-//         return ERROR_SYSTEM_FILE_ALREADY_OPENED;
-//     }
+int64_t MappedFile::Size()
+{
+    return size_;
+}
 
-//     return ret;
-// }
+void MappedFile::WillNeed(int64_t offset, int64_t size)
+{
+    // madvise requires a page aligned address
+    int64_t page = ::sysconf(_SC_PAGESIZE);
+    int64_t begin = offset / page * page;
+    int64_t end = rs_min(offset + size, size_);
+
+    if (begin >= end)
+    {
+        return;
+    }
+    ::madvise(data_ + begin, (size_t)(end - begin), MADV_WILLNEED);
+}
+
+FileReader::FileReader()
+{
+    file_ = nullptr;
+    pos_ = 0;
+}
+
+FileReader::~FileReader()
+{
+    Close();
+}
+
+int32_t FileReader::Open(const std::string &p)
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    if (file_)
+    {
+        ret = ERROR_SYSTEM_FILE_ALREADY_OPENED;
+        rs_error("file %s already opened. ret=%d", p.c_str(), ret);
+        return ret;
+    }
+
+    if ((ret = MappedFile::Acquire(p, &file_)) != ERROR_SUCCESS)
+    {
+        file_ = nullptr;
+        return ret;
+    }
+    pos_ = 0;
+
+    return ret;
+}
+
+void FileReader::Close()
+{
+    if (file_)
+    {
+        file_->Release();
+        file_ = nullptr;
+    }
+}
+
+bool FileReader::IsOpen()
+{
+    return file_ != nullptr;
+}
+
+int64_t FileReader::Tellg()
+{
+    return pos_;
+}
+
+void FileReader::Skip(int64_t size)
+{
+    pos_ = rs_max((int64_t)0, rs_min(pos_ + size, file_->Size()));
+}
+
+int64_t FileReader::Lseek(int64_t offset)
+{
+    pos_ = rs_max((int64_t)0, rs_min(offset, file_->Size()));
+    return pos_;
+}
+
+int64_t FileReader::FileSize()
+{
+    return file_->Size();
+}
+
+int32_t FileReader::Read(void *buf, size_t size, ssize_t *nread)
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    if (pos_ >= file_->Size())
+    {
+        return ERROR_SYSTEM_FILE_EOF;
+    }
+
+    size_t n = (size_t)rs_min((int64_t)size, file_->Size() - pos_);
+    memcpy(buf, file_->Data() + pos_, n);
+    pos_ += n;
+
+    if (nread)
+    {
+        *nread = (ssize_t)n;
+    }
+
+    return ret;
+}
+
+MappedFile *FileReader::Mapping()
+{
+    return file_;
+}
 
 FileWriter::FileWriter()
 {
@@ -137,3 +388,76 @@ int FileWriter::Writev(iovec* iov, int iovcnt, ssize_t* pnwrite)
 
     return ret;
 }
+
+MemoryWriter::MemoryWriter()
+{
+    pos_ = 0;
+}
+
+MemoryWriter::~MemoryWriter() {}
+
+int MemoryWriter::Open(const std::string& path, bool append)
+{
+    if (!append) {
+        data_.clear();
+    }
+    pos_ = data_.size();
+
+    return ERROR_SUCCESS;
+}
+
+void MemoryWriter::Close() {}
+
+bool MemoryWriter::IsOpen()
+{
+    return true;
+}
+
+void MemoryWriter::Lseek(int64_t offset)
+{
+    pos_ = rs_min((size_t)offset, data_.size());
+}
+
+int64_t MemoryWriter::Tellg()
+{
+    return (int64_t)pos_;
+}
+
+int MemoryWriter::Write(void* buf, size_t count, ssize_t* pnwrite)
+{
+    // over what was written after a seek back, appended at the end
+    size_t overwrite = rs_min(count, data_.size() - pos_);
+    data_.replace(pos_, overwrite, (char*)buf, count);
+    pos_ += count;
+
+    if (pnwrite) {
+        *pnwrite = (ssize_t)count;
+    }
+
+    return ERROR_SUCCESS;
+}
+
+int MemoryWriter::Writev(iovec* iov, int iovcnt, ssize_t* pnwrite)
+{
+    int     ret    = ERROR_SUCCESS;
+    ssize_t nwrite = 0;
+
+    for (int i = 0; i < iovcnt; i++) {
+        if ((ret = Write(iov[i].iov_base, iov[i].iov_len, nullptr)) !=
+            ERROR_SUCCESS) {
+            return ret;
+        }
+        nwrite += iov[i].iov_len;
+    }
+
+    if (pnwrite) {
+        *pnwrite = nwrite;
+    }
+
+    return ret;
+}
+
+std::string& MemoryWriter::Data()
+{
+    return data_;
+}
@@ -12,27 +12,67 @@
 
 #include <string>
 
-// class FileReader : public Reader
-// {
-// public:
-//     FileReader();
-//     virtual ~FileReader();
-
-// public:
-//     virtual int32_t Open(const std::string &p) override;
-//     virtual void Close() override;
-
-// public:
-//     virtual bool IsOpen() override;
-//     virtual int64_t Tellg() override;
-//     virtual void Skip(int64_t size) override;
-//     virtual int64_t Lseek(int64_t offset) override;
-//     virtual int64_t FileSize() override;
-//     virtual int32_t Read(void *buf, size_t size, ssize_t *nread) override;
-
-// private:
-//     int32_t fd_;
-// };
+// read only mapping of a file, shared by all the readers of the process so
+// a file read by many clients is mapped and paged in once. a file replaced or
+// rewritten since it was mapped is mapped again by the next Acquire.
+class MappedFile
+{
+public:
+    static int Acquire(const std::string &path, MappedFile **pfile);
+    virtual void AddRef();
+    virtual void Release();
+    // the path is no more the file mapped
+    virtual bool Changed();
+    // the file was cut under the mapping, a read of the pages past its end
+    // raises SIGBUS
+    virtual bool Truncated();
+
+public:
+    virtual const std::string &Path();
+    virtual char *Data();
+    virtual int64_t Size();
+    // read ahead in the background, st would block on the page fault
+    virtual void WillNeed(int64_t offset, int64_t size);
+
+private:
+    MappedFile(const std::string &path);
+    virtual ~MappedFile();
+    int open();
+
+private:
+    std::string path_;
+    int fd_;
+    char *data_;
+    int64_t size_;
+    ino_t ino_;
+    int64_t mtime_ns_;
+    int refs_;
+};
+
+class FileReader : public Reader
+{
+public:
+    FileReader();
+    virtual ~FileReader();
+
+public:
+    virtual int32_t Open(const std::string &p) override;
+    virtual void Close() override;
+
+public:
+    virtual bool IsOpen() override;
+    virtual int64_t Tellg() override;
+    virtual void Skip(int64_t size) override;
+    virtual int64_t Lseek(int64_t offset) override;
+    virtual int64_t FileSize() override;
+    virtual int32_t Read(void *buf, size_t size, ssize_t *nread) override;
+    // the bytes are read from this mapping, for zero copy views of the file
+    virtual MappedFile *Mapping();
+
+private:
+    MappedFile *file_;
+    int64_t pos_;
+};
 
 class FileWriter
 {
@@ -53,4 +93,29 @@ private:
     std::string path_;
     st_netfd_t stfd_;
 };
+
+// writer to a string instead of a file, for a muxer to make a file which is
+// sent rather than saved. it is open from the start.
+class MemoryWriter : public FileWriter
+{
+public:
+    MemoryWriter();
+    virtual ~MemoryWriter();
+
+public:
+    virtual int Open(const std::string &path, bool append = false) override;
+    virtual void Close() override;
+    virtual bool IsOpen() override;
+    virtual void Lseek(int64_t offset) override;
+    virtual int64_t Tellg() override;
+    virtual int Write(void *buf, size_t count, ssize_t *pnwrite) override;
+    virtual int Writev(iovec *iov, int iovcnt, ssize_t *pnwrite) override;
+
+public:
+    virtual std::string &Data();
+
+private:
+    std::string data_;
+    size_t pos_;
+};
 #endif
\ No newline at end of file
@@ -48,6 +48,14 @@ IProtocolReaderWriter::~IProtocolReaderWriter()
 {
 }
 
+IZeroCopyWriter::IZeroCopyWriter()
+{
+}
+
+IZeroCopyWriter::~IZeroCopyWriter()
+{
+}
+
 IMergeReadHandler::IMergeReadHandler()
 {
 }
@@ -13,6 +13,7 @@ public:
 
 public:
     virtual int32_t Read(void *buf, size_t size, ssize_t *nread) = 0;
+    virtual int32_t ReadEv(const iovec *iov, int32_t iov_size, ssize_t *nread) = 0;
 };
 
 class IBufferWriter
@@ -72,6 +73,26 @@ public:
     virtual bool IsNeverTimeout(int64_t timeout_us) = 0;
 };
 
+// writer which lets the kernel send straight from the user pages, the
+// pages must stay untouched until the send is reported as completed.
+class IZeroCopyWriter
+{
+public:
+    IZeroCopyWriter();
+    virtual ~IZeroCopyWriter();
+
+public:
+    virtual bool EnableZeroCopy() = 0;
+    // pseq is the last sequence used by the zero copy sends, -1 when all
+    // the bytes were copied into the kernel.
+    virtual int32_t WriteEvZeroCopy(const iovec *iov, int32_t iov_size, ssize_t *nwrite, int64_t *pseq) = 0;
+    // every sequence before *pdone is completed
+    virtual int32_t ReapZeroCopy(uint32_t *pdone) = 0;
+    // resets the connection, the kernel drops the queued sends and reports
+    // them as completed, the socket is left open to reap them.
+    virtual int32_t AbortZeroCopy() = 0;
+};
+
 class IMergeReadHandler
 {
 public:
@@ -127,6 +127,22 @@ int64_t Kbps::GetSendBytes()
     return bytes;
 }
 
+int Kbps::GetSendKbps()
+{
+    int64_t duration = Utils::GetSteadyMilliSeconds() - os_.start_time;
+    if (duration <= 0)
+    {
+        return 0;
+    }
+
+    return (int)(GetSendBytes() * 8 / duration);
+}
+
+int Kbps::GetSendKbps30s()
+{
+    return os_.sample_30s.kbps;
+}
+
 void Kbps::Resample()
 {
     Sample();
@@ -64,6 +64,9 @@ public:
     virtual void AddDelta(IKbpsDelta *delta);
     virtual void Sample();
     virtual void SetIO(IStatistic *in, IStatistic *out);
+    // the average since the first io, and of the last 30 seconds
+    virtual int GetSendKbps();
+    virtual int GetSendKbps30s();
     //IStatistic
     virtual int64_t GetRecvBytes() override;
     virtual int64_t GetSendBytes() override;
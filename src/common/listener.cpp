@@ -19,11 +19,13 @@ ITCPClientHandler::~ITCPClientHandler()
 
 TCPListener::TCPListener(ITCPClientHandler *client_handler,
                          const std::string &ip,
-                         int32_t port) : client_handler_(client_handler),
-                                     ip_(ip),
-                                     port_(port),
-                                     fd_(-1),
-                                     stfd_(nullptr)
+                         int32_t port,
+                         bool reuse_port) : client_handler_(client_handler),
+                                            ip_(ip),
+                                            port_(port),
+                                            reuse_port_(reuse_port),
+                                            fd_(-1),
+                                            stfd_(nullptr)
 {
     thread_ = new internal::Thread("tcp-listener", this, 0, true);
 }
@@ -67,6 +69,19 @@ int32_t TCPListener::Listen()
 
     rs_verbose("set socket reuse address success,ep=[%s:%d]", ip_.c_str(), port_);
 
+    //every worker process binds the same port, the kernel balances accepts between them
+    if (reuse_port_)
+    {
+        if (::setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &reuse_socket, sizeof(int32_t)) == -1)
+        {
+            ret = ERROR_SOCKET_SETREUSE;
+            rs_error("set socket reuse port failed,ep=[%s:%d],ret=%d", ip_.c_str(), port_, ret);
+            return ret;
+        }
+
+        rs_verbose("set socket reuse port success,ep=[%s:%d]", ip_.c_str(), port_);
+    }
+
     int32_t tcp_keepalive = 1;
     if (::setsockopt(fd_, SOL_SOCKET, SO_KEEPALIVE, &tcp_keepalive, sizeof(int32_t)) == -1)
     {
@@ -0,0 +1,238 @@
+#include <common/log.hpp>
+#include <common/pool.hpp>
+#include <common/utils.hpp>
+
+#include <new>
+
+#include <stdlib.h>
+
+// keep the payload 16 bytes aligned behind the size class index
+#define RS_POOL_BUFFER_PREFIX 16
+#define RS_POOL_LARGE_CLASS -1
+
+// the pools of a thread are never released, the objects may outlive the
+// thread_local destructors at exit.
+static thread_local std::vector<FreeListPool*>* _pools       = nullptr;
+static thread_local BufferPool*                 _buffer_pool = nullptr;
+
+FreeListPool::FreeListPool(const std::string& name,
+                           int                block_size,
+                           int                max_cached)
+{
+    name_       = name;
+    block_size_ = rs_max(block_size, (int)sizeof(Block));
+    max_cached_ = max_cached;
+    free_list_  = nullptr;
+    cached_     = 0;
+    in_use_     = 0;
+    allocs_     = 0;
+    hits_       = 0;
+    frees_      = 0;
+}
+
+FreeListPool::~FreeListPool()
+{
+    while (free_list_) {
+        Block* block = free_list_;
+        free_list_   = block->next;
+        ::free(block);
+    }
+}
+
+void* FreeListPool::Alloc()
+{
+    allocs_++;
+    in_use_++;
+
+    if (free_list_) {
+        Block* block = free_list_;
+        free_list_   = block->next;
+        cached_--;
+        hits_++;
+        return block;
+    }
+
+    void* p = ::malloc(block_size_);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+void FreeListPool::Free(void* p)
+{
+    if (!p) {
+        return;
+    }
+
+    frees_++;
+    in_use_--;
+
+    if (cached_ >= max_cached_) {
+        ::free(p);
+        return;
+    }
+
+    Block* block = (Block*)p;
+    block->next  = free_list_;
+    free_list_   = block;
+    cached_++;
+}
+
+void FreeListPool::Stats(PoolStats& stats)
+{
+    stats.name       = name_;
+    stats.block_size = block_size_;
+    stats.allocs     = allocs_;
+    stats.hits       = hits_;
+    stats.frees      = frees_;
+    stats.in_use     = in_use_;
+    stats.cached     = cached_;
+}
+
+BufferPool::BufferPool()
+{
+    for (int i = 0; i < RS_POOL_MAX_CLASS_BITS - RS_POOL_MIN_CLASS_BITS + 1;
+         i++) {
+        int size = 1 << (RS_POOL_MIN_CLASS_BITS + i);
+        // bound the bytes cached by the big classes
+        int max_cached =
+            rs_min(RS_POOL_MAX_CACHED, RS_POOL_MAX_CACHED_BYTES / size);
+
+        classes_[i] = new FreeListPool("buffer", size + RS_POOL_BUFFER_PREFIX,
+                                       max_cached);
+    }
+
+    large_allocs_ = 0;
+    large_frees_  = 0;
+}
+
+BufferPool::~BufferPool()
+{
+    for (int i = 0; i < RS_POOL_MAX_CLASS_BITS - RS_POOL_MIN_CLASS_BITS + 1;
+         i++) {
+        rs_freep(classes_[i]);
+    }
+}
+
+BufferPool* BufferPool::Instance()
+{
+    if (!_buffer_pool) {
+        _buffer_pool = new BufferPool;
+    }
+    return _buffer_pool;
+}
+
+char* BufferPool::Alloc(int size)
+{
+    int index = RS_POOL_LARGE_CLASS;
+    for (int i = RS_POOL_MIN_CLASS_BITS; i <= RS_POOL_MAX_CLASS_BITS; i++) {
+        if (size <= (1 << i)) {
+            index = i - RS_POOL_MIN_CLASS_BITS;
+            break;
+        }
+    }
+
+    char* p = nullptr;
+    if (index == RS_POOL_LARGE_CLASS) {
+        p = (char*)::malloc(RS_POOL_BUFFER_PREFIX + size);
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        large_allocs_++;
+    }
+    else {
+        p = (char*)classes_[index]->Alloc();
+    }
+
+    *(int*)p = index;
+
+    return p + RS_POOL_BUFFER_PREFIX;
+}
+
+void BufferPool::Free(char* p)
+{
+    if (!p) {
+        return;
+    }
+
+    p -= RS_POOL_BUFFER_PREFIX;
+
+    int index = *(int*)p;
+    if (index == RS_POOL_LARGE_CLASS) {
+        large_frees_++;
+        ::free(p);
+        return;
+    }
+
+    classes_[index]->Free(p);
+}
+
+void BufferPool::Stats(std::vector<PoolStats>& stats)
+{
+    for (int i = 0; i < RS_POOL_MAX_CLASS_BITS - RS_POOL_MIN_CLASS_BITS + 1;
+         i++) {
+        PoolStats s;
+        classes_[i]->Stats(s);
+        s.block_size -= RS_POOL_BUFFER_PREFIX;
+        if (s.allocs > 0) {
+            stats.push_back(s);
+        }
+    }
+
+    if (large_allocs_ > 0) {
+        PoolStats s;
+        s.name       = "buffer";
+        s.block_size = 0;
+        s.allocs     = large_allocs_;
+        s.hits       = 0;
+        s.frees      = large_frees_;
+        s.in_use     = (int)(large_allocs_ - large_frees_);
+        s.cached     = 0;
+        stats.push_back(s);
+    }
+}
+
+FreeListPool* Pools::Register(const std::string& name, int block_size)
+{
+    if (!_pools) {
+        _pools = new std::vector<FreeListPool*>;
+    }
+
+    FreeListPool* pool = new FreeListPool(name, block_size, RS_POOL_MAX_CACHED);
+    _pools->push_back(pool);
+
+    return pool;
+}
+
+void Pools::Stats(std::vector<PoolStats>& stats)
+{
+    if (_pools) {
+        for (size_t i = 0; i < _pools->size(); i++) {
+            PoolStats s;
+            _pools->at(i)->Stats(s);
+            stats.push_back(s);
+        }
+    }
+
+    if (_buffer_pool) {
+        _buffer_pool->Stats(stats);
+    }
+}
+
+void Pools::Dump()
+{
+    std::vector<PoolStats> stats;
+    Stats(stats);
+
+    for (size_t i = 0; i < stats.size(); i++) {
+        PoolStats& s = stats[i];
+        rs_trace("pool %s(%d), allocs=%lld, hits=%lld(%d%%), frees=%lld, "
+                 "in_use=%d, cached=%d",
+                 s.name.c_str(), s.block_size, (long long)s.allocs,
+                 (long long)s.hits,
+                 s.allocs > 0 ? (int)(s.hits * 100 / s.allocs) : 0,
+                 (long long)s.frees, s.in_use, s.cached);
+    }
+}
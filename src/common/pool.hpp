@@ -0,0 +1,125 @@
+#ifndef RS_POOL_HPP
+#define RS_POOL_HPP
+
+#include <common/core.hpp>
+
+#include <string>
+#include <vector>
+
+// smallest and largest size class of the buffer pool, 128B .. 1MB
+#define RS_POOL_MIN_CLASS_BITS 7
+#define RS_POOL_MAX_CLASS_BITS 20
+// max free blocks cached by a pool, the others go back to the heap
+#define RS_POOL_MAX_CACHED 4096
+#define RS_POOL_MAX_CACHED_BYTES (16 * 1024 * 1024)
+
+struct PoolStats
+{
+    std::string name;
+    int         block_size;
+    // blocks handed out, and how many of them came from the free list
+    int64_t     allocs;
+    int64_t     hits;
+    int64_t     frees;
+    int         in_use;
+    int         cached;
+};
+
+// free list of fixed size blocks. every block is malloc'ed on its own, so a
+// block may be released to the pool of another thread than the one which
+// allocated it.
+class FreeListPool {
+  public:
+    FreeListPool(const std::string& name, int block_size, int max_cached);
+    virtual ~FreeListPool();
+
+  public:
+    virtual void* Alloc();
+    virtual void  Free(void* p);
+    virtual void  Stats(PoolStats& stats);
+
+  private:
+    struct Block
+    {
+        Block* next;
+    };
+
+  private:
+    std::string name_;
+    int         block_size_;
+    int         max_cached_;
+    Block*      free_list_;
+    int         cached_;
+    int         in_use_;
+    int64_t     allocs_;
+    int64_t     hits_;
+    int64_t     frees_;
+};
+
+// payload buffers by power of 2 size classes, the class index is kept in a
+// hidden prefix so Free doesn't need the size. buffers larger than the
+// biggest class go to the heap directly.
+class BufferPool {
+  public:
+    BufferPool();
+    virtual ~BufferPool();
+
+  public:
+    // the pool of the calling thread
+    static BufferPool* Instance();
+
+  public:
+    virtual char* Alloc(int size);
+    virtual void  Free(char* p);
+    virtual void  Stats(std::vector<PoolStats>& stats);
+
+  private:
+    FreeListPool* classes_[RS_POOL_MAX_CLASS_BITS - RS_POOL_MIN_CLASS_BITS + 1];
+    int64_t       large_allocs_;
+    int64_t       large_frees_;
+};
+
+// per thread pools of the classes which declare RS_DECLARE_POOL
+class Pools {
+  public:
+    static FreeListPool* Register(const std::string& name, int block_size);
+    static void          Stats(std::vector<PoolStats>& stats);
+    static void          Dump();
+};
+
+// route the operator new/delete of a class to a per thread free list,
+// derived classes of a different size fall back to the heap.
+#define RS_DECLARE_POOL()                                  \
+  public:                                                  \
+    static void* operator new(size_t size);                \
+    static void  operator delete(void* p, size_t size);    \
+                                                           \
+  private:                                                 \
+    static FreeListPool* pool()
+
+#define RS_IMPLEMENT_POOL(cls, name)                       \
+    FreeListPool* cls::pool()                              \
+    {                                                      \
+        static thread_local FreeListPool* p = nullptr;     \
+        if (!p) {                                          \
+            p = Pools::Register(name, sizeof(cls));        \
+        }                                                  \
+        return p;                                          \
+    }                                                      \
+    void* cls::operator new(size_t size)                   \
+    {                                                      \
+        if (size != sizeof(cls)) {                         \
+            return ::operator new(size);                   \
+        }                                                  \
+        return pool()->Alloc();                            \
+    }                                                      \
+    void cls::operator delete(void* p, size_t size)        \
+    {                                                      \
+        if (size != sizeof(cls)) {                         \
+            ::operator delete(p);                          \
+            return;                                        \
+        }                                                  \
+        pool()->Free(p);                                   \
+    }
+
+#endif
@@ -5,8 +5,14 @@
 #include <common/log.hpp>
 #include <common/utils.hpp>
 
+#include <atomic>
+#include <vector>
+
 #define FAST_VEC_DEFAULT_SIZE 1024
+#define RING_BUFFER_DEFAULT_SIZE 1024
 #define MIX_CORRECT_PURE_AV 10
+#define MIX_QUEUE_LANE_SIZE 128
+#define HASH_INDEX_DEFAULT_SIZE 1024
 
 template <typename T>
 class FastVector
@@ -133,6 +139,171 @@ void FastVector<T>::PushBack(T msg)
     msgs_[count_++] = msg;
 }
 
+// power of 2 ring, head and tail run freely and are masked on access.
+// PushBack grows the ring when full, which is only safe when the producer and
+// the consumer are the same thread, it stops after warm-up. TryPush never
+// grows, with TryPush/PopFront the ring is a lock-free spsc queue.
+template <typename T>
+class RingBuffer
+{
+public:
+    RingBuffer(int size = RING_BUFFER_DEFAULT_SIZE);
+    virtual ~RingBuffer();
+
+public:
+    virtual int Size();
+    virtual int Capacity();
+    virtual bool Empty();
+    virtual T At(int index);
+    virtual void Clear();
+    virtual void Free();
+    virtual void PushBack(T msg);
+    virtual bool TryPush(T msg);
+    virtual int PopFront(T *msgs, int count);
+
+private:
+    virtual void grow();
+
+private:
+    T *msgs_;
+    uint32_t capacity_;
+    uint32_t mask_;
+    std::atomic<uint32_t> head_;
+    std::atomic<uint32_t> tail_;
+};
+
+template <typename T>
+RingBuffer<T>::RingBuffer(int size)
+{
+    capacity_ = 1;
+    while ((int)capacity_ < size)
+    {
+        capacity_ <<= 1;
+    }
+
+    msgs_ = new T[capacity_];
+    mask_ = capacity_ - 1;
+    head_.store(0);
+    tail_.store(0);
+}
+
+template <typename T>
+RingBuffer<T>::~RingBuffer()
+{
+    Free();
+    rs_freepa(msgs_);
+}
+
+template <typename T>
+int RingBuffer<T>::Size()
+{
+    return (int)(tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire));
+}
+
+template <typename T>
+int RingBuffer<T>::Capacity()
+{
+    return (int)capacity_;
+}
+
+template <typename T>
+bool RingBuffer<T>::Empty()
+{
+    return Size() == 0;
+}
+
+template <typename T>
+T RingBuffer<T>::At(int index)
+{
+    return msgs_[(head_.load(std::memory_order_relaxed) + index) & mask_];
+}
+
+template <typename T>
+void RingBuffer<T>::Clear()
+{
+    head_.store(tail_.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+template <typename T>
+void RingBuffer<T>::Free()
+{
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    for (uint32_t i = head; i != tail; i++)
+    {
+        T msg = msgs_[i & mask_];
+        rs_freep(msg);
+    }
+    head_.store(tail, std::memory_order_release);
+}
+
+template <typename T>
+void RingBuffer<T>::grow()
+{
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    uint32_t size = capacity_ * 2;
+
+    T *buf = new T[size];
+    for (uint32_t i = head; i != tail; i++)
+    {
+        buf[i - head] = msgs_[i & mask_];
+    }
+
+    rs_info("ring buffer increase %u=>%u", capacity_, size);
+    rs_freepa(msgs_);
+    msgs_ = buf;
+    capacity_ = size;
+    mask_ = size - 1;
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(tail - head, std::memory_order_relaxed);
+}
+
+template <typename T>
+void RingBuffer<T>::PushBack(T msg)
+{
+    if (!TryPush(msg))
+    {
+        grow();
+        TryPush(msg);
+    }
+}
+
+template <typename T>
+bool RingBuffer<T>::TryPush(T msg)
+{
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) >= capacity_)
+    {
+        return false;
+    }
+
+    msgs_[tail & mask_] = msg;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+int RingBuffer<T>::PopFront(T *msgs, int count)
+{
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+
+    int n = rs_min(count, (int)(tail - head));
+    for (int i = 0; i < n; i++)
+    {
+        msgs[i] = msgs_[(head + i) & mask_];
+    }
+
+    head_.store(head + n, std::memory_order_release);
+    return n;
+}
+
+// merges the audio and the video by timestamp, each track already comes in
+// order so it waits in a fifo of its own and the smaller of the two heads
+// goes first, the audio on a tie. a message is held until the other track
+// has one too, unless MIX_CORRECT_PURE_AV of a single track tell the stream
+// has no other. the lanes only grow in the warm-up.
 template <typename T>
 class MixQueue
 {
@@ -146,16 +317,13 @@ public:
     virtual T *Pop();
 
 private:
-    uint32_t nb_videos_;
-    uint32_t nb_audios_;
-    std::multimap<int64_t, T *> msgs_;
+    RingBuffer<T *> audios_;
+    RingBuffer<T *> videos_;
 };
 
 template <typename T>
-MixQueue<T>::MixQueue()
+MixQueue<T>::MixQueue() : audios_(MIX_QUEUE_LANE_SIZE), videos_(MIX_QUEUE_LANE_SIZE)
 {
-    nb_videos_ = 0;
-    nb_audios_ = 0;
 }
 
 template <typename T>
@@ -167,16 +335,8 @@ MixQueue<T>::~MixQueue()
 template <typename T>
 void MixQueue<T>::Clear()
 {
-    typename std::multimap<int64_t, T *>::iterator it;
-    for (it = msgs_.begin(); it != msgs_.end(); it++)
-    {
-        T *msg = it->second;
-        rs_freep(msg);
-    }
-
-    msgs_.clear();
-    nb_videos_ = 0;
-    nb_audios_ = 0;
+    audios_.Free();
+    videos_.Free();
 }
 
 template <typename T>
@@ -184,30 +344,30 @@ void MixQueue<T>::Push(T *msg)
 {
     if (msg->IsVideo())
     {
-        nb_videos_++;
+        videos_.PushBack(msg);
     }
     else
     {
-        nb_audios_++;
+        audios_.PushBack(msg);
     }
-
-    msgs_.insert(std::make_pair(msg->timestamp, msg));
 }
 
 template <typename T>
 T *MixQueue<T>::Pop()
 {
+    int nb_videos = videos_.Size();
+    int nb_audios = audios_.Size();
     bool mix_ok = false;
 
-    if (nb_videos_ >= MIX_CORRECT_PURE_AV && nb_audios_ == 0)
+    if (nb_videos >= MIX_CORRECT_PURE_AV && nb_audios == 0)
     {
         mix_ok = true;
     }
-    if (nb_audios_ >= MIX_CORRECT_PURE_AV && nb_videos_ == 0)
+    if (nb_audios >= MIX_CORRECT_PURE_AV && nb_videos == 0)
     {
         mix_ok = true;
     }
-    if (nb_videos_ > 0 && nb_audios_ > 0)
+    if (nb_videos > 0 && nb_audios > 0)
     {
         mix_ok = true;
     }
@@ -217,20 +377,276 @@ T *MixQueue<T>::Pop()
         return nullptr;
     }
 
-    typename std::multimap<int64_t, T *>::iterator it = msgs_.begin();
-    T *msg = it->second;
-    msgs_.erase(it);
-
-    if (msg->IsVideo())
+    T *msg = nullptr;
+    if (nb_videos == 0 || (nb_audios > 0 && audios_.At(0)->timestamp <= videos_.At(0)->timestamp))
     {
-        nb_videos_--;
+        audios_.PopFront(&msg, 1);
     }
     else
     {
-        nb_audios_--;
+        videos_.PopFront(&msg, 1);
     }
 
     return msg;
 }
 
+// open addressing index of values by a hash computed by the caller, the
+// values of the same hash are told apart by the match given to Find. linear
+// probing in a power of 2 table, the erased slots are left as tombstones
+// until the next rehash.
+template <typename T>
+class HashIndex
+{
+public:
+    HashIndex(int size = HASH_INDEX_DEFAULT_SIZE);
+    virtual ~HashIndex();
+
+public:
+    virtual int Size();
+    virtual void Insert(uint32_t hash, T value);
+    virtual bool Erase(uint32_t hash, T value);
+    // match(T) is true for the value looked for
+    template <typename Match>
+    T Find(uint32_t hash, Match match);
+
+private:
+    virtual void rehash(uint32_t capacity);
+
+private:
+    enum SlotState
+    {
+        EMPTY = 0,
+        USED,
+        ERASED,
+    };
+
+    struct Slot
+    {
+        uint32_t hash;
+        SlotState state;
+        T value;
+    };
+
+    Slot *slots_;
+    uint32_t capacity_;
+    uint32_t mask_;
+    int count_;
+    // used and erased slots, what the probes go through
+    int occupied_;
+};
+
+template <typename T>
+HashIndex<T>::HashIndex(int size)
+{
+    capacity_ = 1;
+    while ((int)capacity_ < size)
+    {
+        capacity_ <<= 1;
+    }
+    mask_ = capacity_ - 1;
+    slots_ = new Slot[capacity_]();
+    count_ = 0;
+    occupied_ = 0;
+}
+
+template <typename T>
+HashIndex<T>::~HashIndex()
+{
+    rs_freepa(slots_);
+}
+
+template <typename T>
+int HashIndex<T>::Size()
+{
+    return count_;
+}
+
+template <typename T>
+void HashIndex<T>::Insert(uint32_t hash, T value)
+{
+    // at most 3/4 of the slots are probed, the tombstones are dropped in
+    // place while the index is less than half full
+    if ((occupied_ + 1) * 4 > (int)capacity_ * 3)
+    {
+        rehash((count_ + 1) * 2 > (int)capacity_ ? capacity_ << 1 : capacity_);
+    }
+
+    uint32_t i = hash & mask_;
+    while (slots_[i].state == USED)
+    {
+        i = (i + 1) & mask_;
+    }
+
+    if (slots_[i].state == EMPTY)
+    {
+        occupied_++;
+    }
+    slots_[i].hash = hash;
+    slots_[i].state = USED;
+    slots_[i].value = value;
+    count_++;
+}
+
+template <typename T>
+bool HashIndex<T>::Erase(uint32_t hash, T value)
+{
+    for (uint32_t i = hash & mask_; slots_[i].state != EMPTY; i = (i + 1) & mask_)
+    {
+        if (slots_[i].state == USED && slots_[i].hash == hash && slots_[i].value == value)
+        {
+            slots_[i].state = ERASED;
+            count_--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+template <typename T>
+template <typename Match>
+T HashIndex<T>::Find(uint32_t hash, Match match)
+{
+    for (uint32_t i = hash & mask_; slots_[i].state != EMPTY; i = (i + 1) & mask_)
+    {
+        if (slots_[i].state == USED && slots_[i].hash == hash && match(slots_[i].value))
+        {
+            return slots_[i].value;
+        }
+    }
+
+    return T();
+}
+
+template <typename T>
+void HashIndex<T>::rehash(uint32_t capacity)
+{
+    Slot *slots = slots_;
+    uint32_t old_capacity = capacity_;
+
+    capacity_ = capacity;
+    mask_ = capacity_ - 1;
+    slots_ = new Slot[capacity_]();
+    count_ = 0;
+    occupied_ = 0;
+
+    for (uint32_t i = 0; i < old_capacity; i++)
+    {
+        if (slots[i].state == USED)
+        {
+            Insert(slots[i].hash, slots[i].value);
+        }
+    }
+
+    rs_freepa(slots);
+}
+
+// hashed timing wheel of tick_ms slots, a value is due at the first Expire at
+// or after its time. a time beyond a turn of the wheel waits in its slot for
+// the next turns, so Schedule and Expire cost the values of a slot only.
+template <typename T>
+class TimerWheel
+{
+public:
+    TimerWheel(int64_t tick_ms, int nb_slots);
+    virtual ~TimerWheel();
+
+public:
+    virtual int Size();
+    virtual void Schedule(T value, int64_t at_ms);
+    // the values due at now_ms are moved to due
+    virtual void Expire(int64_t now_ms, std::vector<T> &due);
+
+private:
+    struct Timer
+    {
+        T value;
+        int64_t at_ms;
+    };
+
+    std::vector<Timer> *slots_;
+    int nb_slots_;
+    int64_t tick_ms_;
+    // the last tick expired, -1 before the first Expire
+    int64_t current_tick_;
+    int count_;
+};
+
+template <typename T>
+TimerWheel<T>::TimerWheel(int64_t tick_ms, int nb_slots)
+{
+    slots_ = new std::vector<Timer>[nb_slots];
+    nb_slots_ = nb_slots;
+    tick_ms_ = tick_ms;
+    current_tick_ = -1;
+    count_ = 0;
+}
+
+template <typename T>
+TimerWheel<T>::~TimerWheel()
+{
+    rs_freepa(slots_);
+}
+
+template <typename T>
+int TimerWheel<T>::Size()
+{
+    return count_;
+}
+
+template <typename T>
+void TimerWheel<T>::Schedule(T value, int64_t at_ms)
+{
+    // rounded up, the slot is expired once at_ms is reached, not a turn later
+    int64_t tick = (at_ms + tick_ms_ - 1) / tick_ms_;
+    // already past, at the next Expire
+    if (current_tick_ != -1 && tick <= current_tick_)
+    {
+        tick = current_tick_ + 1;
+    }
+
+    Timer timer;
+    timer.value = value;
+    timer.at_ms = at_ms;
+    slots_[tick % nb_slots_].push_back(timer);
+    count_++;
+}
+
+template <typename T>
+void TimerWheel<T>::Expire(int64_t now_ms, std::vector<T> &due)
+{
+    int64_t now_tick = now_ms / tick_ms_;
+
+    // a turn at most, every slot is seen once when Expire came late or
+    // for the first time
+    int64_t tick = now_tick - nb_slots_ + 1;
+    if (current_tick_ != -1 && current_tick_ + 1 > tick)
+    {
+        tick = current_tick_ + 1;
+    }
+    if (tick < 0)
+    {
+        tick = 0;
+    }
+    for (; tick <= now_tick; tick++)
+    {
+        std::vector<Timer> &slot = slots_[tick % nb_slots_];
+        for (size_t i = 0; i < slot.size();)
+        {
+            if (slot[i].at_ms > now_ms)
+            {
+                i++;
+                continue;
+            }
+
+            due.push_back(slot[i].value);
+            slot[i] = slot.back();
+            slot.pop_back();
+            count_--;
+        }
+    }
+
+    current_tick_ = rs_max(current_tick_, now_tick);
+}
+
 #endif
\ No newline at end of file
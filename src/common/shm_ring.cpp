@@ -0,0 +1,273 @@
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/shm_ring.hpp>
+#include <common/utils.hpp>
+
+#include <atomic>
+#include <new>
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHM_RING_HEADER_SIZE 256
+#define SHM_RING_RECORD_SIZE 4
+
+// head and tail are on different cache lines, the producer only writes tail
+// and the consumer only writes head.
+struct ShmRingHeader
+{
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) std::atomic<int32_t> waiting;
+    uint32_t capacity;
+};
+
+ShmRing::ShmRing()
+{
+    owner_    = false;
+    base_     = nullptr;
+    size_     = 0;
+    header_   = nullptr;
+    data_     = nullptr;
+    mask_     = 0;
+    read_pos_ = 0;
+}
+
+ShmRing::~ShmRing()
+{
+    if (base_) {
+        ::munmap(base_, size_);
+    }
+
+    if (owner_) {
+        Unlink();
+    }
+}
+
+int ShmRing::Create(const std::string& name, int capacity)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (capacity <= 0 || (capacity & (capacity - 1)) != 0) {
+        ret = ERROR_SYSTEM_ASSERT_FAILED;
+        rs_error("shm ring capacity must be power of 2. capacity=%d, ret=%d",
+                 capacity, ret);
+        return ret;
+    }
+
+    int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) {
+        ret = ERROR_SYSTEM_FILE_OPENE;
+        rs_error("shm_open %s failed. ret=%d", name.c_str(), ret);
+        return ret;
+    }
+
+    name_  = name;
+    owner_ = true;
+
+    int size = SHM_RING_HEADER_SIZE + capacity;
+    if (::ftruncate(fd, size) == -1) {
+        ::close(fd);
+        ret = ERROR_SYSTEM_FILE_WRITE;
+        rs_error("truncate shm %s failed. size=%d, ret=%d", name.c_str(), size,
+                 ret);
+        return ret;
+    }
+
+    ret = map(fd, size);
+    ::close(fd);
+    if (ret != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    new (header_) ShmRingHeader;
+    header_->head.store(0);
+    header_->tail.store(0);
+    header_->waiting.store(0);
+    header_->capacity = capacity;
+    mask_             = capacity - 1;
+
+    return ret;
+}
+
+int ShmRing::Open(const std::string& name)
+{
+    int ret = ERROR_SUCCESS;
+
+    int fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd == -1) {
+        ret = ERROR_SYSTEM_FILE_OPENE;
+        rs_error("shm_open %s failed. ret=%d", name.c_str(), ret);
+        return ret;
+    }
+
+    name_ = name;
+
+    struct stat st;
+    if (::fstat(fd, &st) == -1 || st.st_size <= SHM_RING_HEADER_SIZE) {
+        ::close(fd);
+        ret = ERROR_SYSTEM_FILE_READ;
+        rs_error("invalid shm %s. ret=%d", name.c_str(), ret);
+        return ret;
+    }
+
+    ret = map(fd, (int)st.st_size);
+    ::close(fd);
+    if (ret != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if ((int)header_->capacity != size_ - SHM_RING_HEADER_SIZE) {
+        ret = ERROR_SYSTEM_FILE_READ;
+        rs_error("shm %s capacity mismatch. capacity=%u, size=%d, ret=%d",
+                 name.c_str(), header_->capacity, size_, ret);
+        return ret;
+    }
+
+    mask_     = header_->capacity - 1;
+    read_pos_ = header_->head.load(std::memory_order_acquire);
+
+    return ret;
+}
+
+void ShmRing::Unlink()
+{
+    if (name_.empty()) {
+        return;
+    }
+
+    ::shm_unlink(name_.c_str());
+    name_.clear();
+}
+
+int ShmRing::Capacity()
+{
+    return header_ ? (int)header_->capacity : 0;
+}
+
+int ShmRing::map(int fd, int size)
+{
+    int ret = ERROR_SUCCESS;
+
+    void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        ret = ERROR_SYSTEM_FILE_READ;
+        rs_error("mmap shm %s failed. size=%d, ret=%d", name_.c_str(), size,
+                 ret);
+        return ret;
+    }
+
+    base_   = (char*)p;
+    size_   = size;
+    header_ = (ShmRingHeader*)base_;
+    data_   = base_ + SHM_RING_HEADER_SIZE;
+
+    return ret;
+}
+
+void ShmRing::copy_in(uint64_t pos, const char* buf, int size)
+{
+    uint32_t offset = (uint32_t)(pos & mask_);
+    int      first  = rs_min(size, (int)(header_->capacity - offset));
+
+    memcpy(data_ + offset, buf, first);
+    if (first < size) {
+        memcpy(data_, buf + first, size - first);
+    }
+}
+
+void ShmRing::copy_out(uint64_t pos, char* buf, int size)
+{
+    uint32_t offset = (uint32_t)(pos & mask_);
+    int      first  = rs_min(size, (int)(header_->capacity - offset));
+
+    memcpy(buf, data_ + offset, first);
+    if (first < size) {
+        memcpy(buf + first, data_, size - first);
+    }
+}
+
+bool ShmRing::Push(const iovec* iovs, int nb_iovs)
+{
+    int32_t size = 0;
+    for (int i = 0; i < nb_iovs; i++) {
+        size += (int32_t)iovs[i].iov_len;
+    }
+
+    uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+    uint64_t head = header_->head.load(std::memory_order_acquire);
+
+    if (tail - head + SHM_RING_RECORD_SIZE + size > header_->capacity) {
+        return false;
+    }
+
+    copy_in(tail, (const char*)&size, SHM_RING_RECORD_SIZE);
+
+    uint64_t pos = tail + SHM_RING_RECORD_SIZE;
+    for (int i = 0; i < nb_iovs; i++) {
+        copy_in(pos, (const char*)iovs[i].iov_base, (int)iovs[i].iov_len);
+        pos += iovs[i].iov_len;
+    }
+
+    header_->tail.store(pos, std::memory_order_release);
+
+    return true;
+}
+
+bool ShmRing::Notify()
+{
+    // the tail stored before is seen by a reader which stores waiting after
+    // this loads it, or this sees its waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return header_->waiting.exchange(0) == 1;
+}
+
+int ShmRing::Front()
+{
+    uint64_t head = header_->head.load(std::memory_order_relaxed);
+    uint64_t tail = header_->tail.load(std::memory_order_acquire);
+
+    if (head == tail) {
+        return -1;
+    }
+
+    int32_t size = 0;
+    copy_out(head, (char*)&size, SHM_RING_RECORD_SIZE);
+    read_pos_ = head + SHM_RING_RECORD_SIZE;
+
+    return size;
+}
+
+void ShmRing::Read(void* buf, int size)
+{
+    copy_out(read_pos_, (char*)buf, size);
+    read_pos_ += size;
+}
+
+void ShmRing::Pop()
+{
+    uint64_t head = header_->head.load(std::memory_order_relaxed);
+
+    int32_t size = 0;
+    copy_out(head, (char*)&size, SHM_RING_RECORD_SIZE);
+
+    header_->head.store(head + SHM_RING_RECORD_SIZE + size,
+                        std::memory_order_release);
+}
+
+bool ShmRing::Wait()
+{
+    header_->waiting.store(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // the producer may push between the check and the store
+    if (Front() >= 0) {
+        header_->waiting.store(0);
+        return false;
+    }
+
+    return true;
+}
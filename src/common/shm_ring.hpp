@@ -0,0 +1,50 @@
+#ifndef RS_SHM_RING_HPP
+#define RS_SHM_RING_HPP
+
+#include <common/core.hpp>
+
+#include <sys/uio.h>
+
+#include <string>
+
+struct ShmRingHeader;
+
+// single producer single consumer ring of variable size records living in
+// posix shared memory, the producer and consumer may be different processes.
+class ShmRing {
+  public:
+    ShmRing();
+    virtual ~ShmRing();
+
+  public:
+    // capacity must be power of 2
+    virtual int  Create(const std::string& name, int capacity);
+    virtual int  Open(const std::string& name);
+    virtual void Unlink();
+    virtual int  Capacity();
+    // producer
+    virtual bool Push(const iovec* iovs, int nb_iovs);
+    virtual bool Notify();
+    // consumer
+    virtual int  Front();
+    virtual void Read(void* buf, int size);
+    virtual void Pop();
+    virtual bool Wait();
+
+  private:
+    virtual int  map(int fd, int size);
+    virtual void copy_in(uint64_t pos, const char* buf, int size);
+    virtual void copy_out(uint64_t pos, char* buf, int size);
+
+  private:
+    std::string    name_;
+    bool           owner_;
+    char*          base_;
+    int            size_;
+    ShmRingHeader* header_;
+    char*          data_;
+    uint32_t       mask_;
+    uint64_t       read_pos_;
+};
+
+#endif
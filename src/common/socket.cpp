@@ -3,10 +3,21 @@
 #include <common/socket.hpp>
 #include <common/utils.hpp>
 
+#include <limits.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <vector>
+
 StSocket::StSocket(st_netfd_t stfd)
     : stfd_(stfd), send_timeout_(ST_UTIME_NO_TIMEOUT),
       recv_timeout_(ST_UTIME_NO_TIMEOUT), send_bytes_(0), recv_bytes_(0)
 {
+    zero_copy_   = false;
+    zc_next_seq_ = 0;
+    zc_done_     = 0;
 }
 StSocket::~StSocket() {}
 
@@ -86,6 +97,27 @@ int32_t StSocket::ReadFully(void* buf, size_t size, ssize_t* nread)
     return ERROR_SUCCESS;
 }
 
+int32_t StSocket::ReadEv(const iovec* iov, int32_t iov_size, ssize_t* nread)
+{
+    ssize_t nb_read = st_readv(stfd_, iov, iov_size, recv_timeout_);
+
+    if (nread) {
+        *nread = nb_read;
+    }
+    if (nb_read <= 0) {
+        if (nb_read < 0 && errno == ETIME) {
+            return ERROR_SOCKET_TIMEOUT;
+        }
+        else if (nb_read == 0) {
+            errno = ECONNRESET;
+        }
+        return ERROR_SOCKET_READ;
+    }
+
+    recv_bytes_ += nb_read;
+    return ERROR_SUCCESS;
+}
+
 int32_t StSocket::Write(void* buf, size_t size, ssize_t* nwrite)
 {
     ssize_t nb_write = st_write(stfd_, buf, size, send_timeout_);
@@ -123,6 +155,165 @@ int32_t StSocket::WriteEv(const iovec* iov, int32_t iov_size, ssize_t* nwrite)
     return ERROR_SUCCESS;
 }
 
+bool StSocket::EnableZeroCopy()
+{
+#ifdef SO_ZEROCOPY
+    int fd = st_netfd_fileno(stfd_);
+    int v  = 1;
+    if (::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) == 0) {
+        zero_copy_ = true;
+    }
+#endif
+    return zero_copy_;
+}
+
+int32_t StSocket::WriteEvZeroCopy(const iovec* iov,
+                                  int32_t      iov_size,
+                                  ssize_t*     nwrite,
+                                  int64_t*     pseq)
+{
+    *pseq = -1;
+
+    if (!zero_copy_) {
+        return WriteEv(iov, iov_size, nwrite);
+    }
+
+#ifdef MSG_ZEROCOPY
+    // sendmsg may be partial, send until all is done like st_writev
+    std::vector<iovec> left(iov, iov + iov_size);
+    iovec*             cur      = left.empty() ? nullptr : &left[0];
+    int                nb_left  = iov_size;
+    ssize_t            nb_write = 0;
+
+    while (nb_left > 0) {
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov    = cur;
+        msg.msg_iovlen = rs_min(nb_left, IOV_MAX);
+
+        int     flags = zero_copy_ ? MSG_ZEROCOPY : 0;
+        ssize_t n     = st_sendmsg(stfd_, &msg, flags, send_timeout_);
+        if (n < 0 && errno == ENOBUFS && flags) {
+            // out of optmem for the pinned pages, copy this time
+            flags = 0;
+            n     = st_sendmsg(stfd_, &msg, flags, send_timeout_);
+        }
+
+        if (n <= 0) {
+            if (nwrite) {
+                *nwrite = nb_write;
+            }
+            if (n < 0 && errno == ETIME) {
+                return ERROR_SOCKET_TIMEOUT;
+            }
+            return ERROR_SOCKET_WRITE;
+        }
+
+        // the kernel numbers every zero copy sendmsg of the socket
+        if (flags) {
+            *pseq = zc_next_seq_++;
+        }
+
+        nb_write += n;
+        send_bytes_ += n;
+
+        while (nb_left > 0 && (size_t)n >= cur->iov_len) {
+            n -= cur->iov_len;
+            cur++;
+            nb_left--;
+        }
+        if (nb_left > 0) {
+            cur->iov_base = (char*)cur->iov_base + n;
+            cur->iov_len -= n;
+        }
+    }
+
+    if (nwrite) {
+        *nwrite = nb_write;
+    }
+
+    return ERROR_SUCCESS;
+#else
+    return WriteEv(iov, iov_size, nwrite);
+#endif
+}
+
+int32_t StSocket::ReapZeroCopy(uint32_t* pdone)
+{
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+    int fd = st_netfd_fileno(stfd_);
+
+    // the completions are queued on the socket error queue, never blocks
+    while (zc_done_ != zc_next_seq_) {
+        char   control[CMSG_SPACE(sizeof(sock_extended_err))];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm;
+             cm          = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 &&
+                   cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+
+            sock_extended_err* ee = (sock_extended_err*)CMSG_DATA(cm);
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            // [ee_info, ee_data] are completed, tcp completes in order
+            if ((int32_t)(ee->ee_data + 1 - zc_done_) > 0) {
+                zc_done_ = ee->ee_data + 1;
+            }
+
+            // the kernel had to copy anyway, e.g. loopback or no sg nic
+            if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                if (zero_copy_) {
+                    rs_trace("zero copy sends were copied, disable it");
+                }
+                zero_copy_ = false;
+            }
+        }
+    }
+#endif
+
+    *pdone = zc_done_;
+
+    return ERROR_SUCCESS;
+}
+
+int32_t StSocket::AbortZeroCopy()
+{
+    int fd = st_netfd_fileno(stfd_);
+
+    // no fin after the data on close, the reset is sent instead
+    linger lg;
+    lg.l_onoff  = 1;
+    lg.l_linger = 0;
+    if (::setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg)) == -1) {
+        return ERROR_SOCKET_CLOSED;
+    }
+
+    // disconnect purges the write queue with a reset, the skbs holding the
+    // pages are freed and their completions queued, unlike a close the fd
+    // stays to read them
+    sockaddr sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_family = AF_UNSPEC;
+    if (::connect(fd, &sa, sizeof(sa)) == -1) {
+        return ERROR_SOCKET_CLOSED;
+    }
+
+    return ERROR_SUCCESS;
+}
+
 int send_large_iovs(IProtocolReaderWriter* rw,
                     iovec*                 iovs,
                     int                    size,
@@ -16,7 +16,7 @@ extern int send_large_iovs(IProtocolReaderWriter* rw,
                            int                    size,
                            ssize_t*               pnwrite);
 
-class StSocket : public IProtocolReaderWriter {
+class StSocket : public IProtocolReaderWriter, public IZeroCopyWriter {
   public:
     StSocket(st_netfd_t client_stfd);
     virtual ~StSocket();
@@ -33,12 +33,26 @@ class StSocket : public IProtocolReaderWriter {
     // IProtocolReaderWriter
     virtual int32_t Read(void* buf, size_t size, ssize_t* nread) override;
     virtual int32_t ReadFully(void* buf, size_t size, ssize_t* nread) override;
+    virtual int32_t
+    ReadEv(const iovec* iov, int32_t iov_size, ssize_t* nread) override;
     virtual int32_t Write(void* buf, size_t size, ssize_t* nread) override;
     virtual int32_t
     WriteEv(const iovec* iov, int32_t iov_size, ssize_t* nwrite) override;
 
+    // IZeroCopyWriter
+    virtual bool    EnableZeroCopy() override;
+    virtual int32_t WriteEvZeroCopy(const iovec* iov,
+                                    int32_t      iov_size,
+                                    ssize_t*     nwrite,
+                                    int64_t*     pseq) override;
+    virtual int32_t ReapZeroCopy(uint32_t* pdone) override;
+    virtual int32_t AbortZeroCopy() override;
+
   private:
     st_netfd_t stfd_;
+    bool       zero_copy_;
+    uint32_t   zc_next_seq_;
+    uint32_t   zc_done_;
     int64_t    send_timeout_;
     int64_t    recv_timeout_;
     int64_t    send_bytes_;
@@ -0,0 +1,629 @@
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/uring.hpp>
+#include <common/utils.hpp>
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static UringLoop* _uring = nullptr;
+
+static int io_uring_setup(unsigned entries, io_uring_params* p)
+{
+    return (int)::syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete)
+{
+    return (int)::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, 0,
+                          nullptr, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void* arg, unsigned n)
+{
+    return (int)::syscall(__NR_io_uring_register, fd, opcode, arg, n);
+}
+
+UringLoop::UringLoop()
+{
+    fd_          = -1;
+    efd_         = -1;
+    sq_ptr_      = nullptr;
+    sq_size_     = 0;
+    sqes_        = nullptr;
+    sq_entries_  = 0;
+    cq_ptr_      = nullptr;
+    cq_size_     = 0;
+    cq_entries_  = 0;
+    nb_pending_  = 0;
+    nb_inflight_ = 0;
+    waiting_     = false;
+    enabled_     = false;
+    space_cond_  = st_cond_new();
+    event_stfd_  = nullptr;
+    loop_st_     = nullptr;
+    thread_      = nullptr;
+}
+
+UringLoop::~UringLoop()
+{
+    rs_freep(thread_);
+
+    if (event_stfd_) {
+        st_netfd_close(event_stfd_);
+    }
+    if (sqes_) {
+        ::munmap(sqes_, sq_entries_ * sizeof(io_uring_sqe));
+    }
+    if (cq_ptr_ && cq_ptr_ != sq_ptr_) {
+        ::munmap(cq_ptr_, cq_size_);
+    }
+    if (sq_ptr_) {
+        ::munmap(sq_ptr_, sq_size_);
+    }
+    if (fd_ != -1) {
+        ::close(fd_);
+    }
+
+    st_cond_destroy(space_cond_);
+}
+
+UringLoop* UringLoop::Instance()
+{
+    if (!_uring) {
+        _uring = new UringLoop;
+    }
+    return _uring;
+}
+
+bool UringLoop::Enabled()
+{
+    return _uring && _uring->enabled_;
+}
+
+int UringLoop::Initialize(int entries)
+{
+    int ret = ERROR_SUCCESS;
+
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    if ((fd_ = io_uring_setup(entries, &p)) < 0) {
+        fd_ = -1;
+        ret = ERROR_SYSTEM_IO_URING;
+        rs_error("io_uring_setup failed. entries=%d, errno=%d, ret=%d",
+                 entries, errno, ret);
+        return ret;
+    }
+
+    sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_size_ = cq_size_ = rs_max(sq_size_, cq_size_);
+    }
+
+    void* ptr = ::mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED) {
+        ret = ERROR_SYSTEM_IO_URING;
+        rs_error("mmap io_uring sq failed. ret=%d", ret);
+        return ret;
+    }
+    sq_ptr_ = (char*)ptr;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ptr_ = sq_ptr_;
+    }
+    else {
+        ptr = ::mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        if (ptr == MAP_FAILED) {
+            ret = ERROR_SYSTEM_IO_URING;
+            rs_error("mmap io_uring cq failed. ret=%d", ret);
+            return ret;
+        }
+        cq_ptr_ = (char*)ptr;
+    }
+
+    ptr = ::mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe),
+                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                 IORING_OFF_SQES);
+    if (ptr == MAP_FAILED) {
+        ret = ERROR_SYSTEM_IO_URING;
+        rs_error("mmap io_uring sqes failed. ret=%d", ret);
+        return ret;
+    }
+    sqes_       = (io_uring_sqe*)ptr;
+    sq_entries_ = p.sq_entries;
+
+    sq_head_  = (unsigned*)(sq_ptr_ + p.sq_off.head);
+    sq_tail_  = (unsigned*)(sq_ptr_ + p.sq_off.tail);
+    sq_mask_  = (unsigned*)(sq_ptr_ + p.sq_off.ring_mask);
+    sq_array_ = (unsigned*)(sq_ptr_ + p.sq_off.array);
+
+    cq_head_    = (unsigned*)(cq_ptr_ + p.cq_off.head);
+    cq_tail_    = (unsigned*)(cq_ptr_ + p.cq_off.tail);
+    cq_mask_    = (unsigned*)(cq_ptr_ + p.cq_off.ring_mask);
+    cqes_       = (io_uring_cqe*)(cq_ptr_ + p.cq_off.cqes);
+    cq_entries_ = p.cq_entries;
+
+    // the completions are signaled through an eventfd polled by st
+    if ((efd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+        io_uring_register(fd_, IORING_REGISTER_EVENTFD, &efd_, 1) < 0) {
+        ret = ERROR_SYSTEM_IO_URING;
+        rs_error("register io_uring eventfd failed. errno=%d, ret=%d", errno,
+                 ret);
+        return ret;
+    }
+    if ((event_stfd_ = st_netfd_open(efd_)) == nullptr) {
+        ret = ERROR_ST_OPEN_SOCKET;
+        rs_error("st open io_uring eventfd failed. ret=%d", ret);
+        return ret;
+    }
+
+    rs_trace("io_uring initialized. sq=%u, cq=%u", sq_entries_, cq_entries_);
+
+    thread_ = new internal::Thread("io_uring", this, 0, false);
+    if ((ret = thread_->Start()) != ERROR_SUCCESS) {
+        rs_error("start io_uring thread failed. ret=%d", ret);
+        return ret;
+    }
+
+    enabled_ = true;
+
+    return ret;
+}
+
+io_uring_sqe* UringLoop::get_sqe()
+{
+    unsigned tail = *sq_tail_;
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+
+    if (tail - head >= sq_entries_) {
+        return nullptr;
+    }
+
+    unsigned index   = tail & *sq_mask_;
+    sq_array_[index] = index;
+
+    return &sqes_[index];
+}
+
+int UringLoop::acquire_sqe(io_uring_sqe** psqe)
+{
+    int ret = ERROR_SUCCESS;
+
+    // the cq must never overflow, hold the request until a slot is reaped
+    while (nb_inflight_ >= (int)cq_entries_) {
+        st_cond_wait(space_cond_);
+    }
+
+    for (int i = 0; (*psqe = get_sqe()) == nullptr; i++) {
+        if (i >= URING_SQE_RETRIES) {
+            ret = ERROR_SYSTEM_IO_URING;
+            rs_error("io_uring sq is full. pending=%d, ret=%d", nb_pending_,
+                     ret);
+            return ret;
+        }
+
+        // the sq is full, flush it right now
+        if ((ret = enter(nb_pending_)) != ERROR_SUCCESS) {
+            return ret;
+        }
+        if ((*psqe = get_sqe()) != nullptr) {
+            break;
+        }
+        st_usleep(1000);
+    }
+
+    return ret;
+}
+
+int UringLoop::Submit(UringOp* op, const io_uring_sqe& sqe)
+{
+    int ret = ERROR_SUCCESS;
+
+    io_uring_sqe* p = nullptr;
+    if ((ret = acquire_sqe(&p)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    *p           = sqe;
+    p->user_data = (uint64_t)op;
+
+    __atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+
+    op->done   = false;
+    op->result = 0;
+    nb_pending_++;
+    nb_inflight_++;
+
+    // let the loop submit once the runnable threads have queued theirs
+    if (waiting_ && loop_st_) {
+        st_thread_interrupt(loop_st_);
+    }
+
+    return ret;
+}
+
+void UringLoop::Wait(UringOp* op, st_utime_t timeout)
+{
+    if (!op->done) {
+        st_cond_timedwait(op->cond, timeout);
+    }
+
+    if (op->done) {
+        return;
+    }
+
+    int err = errno == ETIME ? ETIME : EINTR;
+
+    // the kernel may still own the buffers until the request completes
+    if (cancel(op) != ERROR_SUCCESS) {
+        op->result = -err;
+        return;
+    }
+    while (!op->done) {
+        st_cond_wait(op->cond);
+    }
+
+    if (op->result == -ECANCELED) {
+        op->result = -err;
+    }
+}
+
+int UringLoop::cancel(UringOp* op)
+{
+    int ret = ERROR_SUCCESS;
+
+    io_uring_sqe* p = nullptr;
+    if ((ret = acquire_sqe(&p)) != ERROR_SUCCESS) {
+        rs_error("cancel io_uring request failed. ret=%d", ret);
+        return ret;
+    }
+
+    memset(p, 0, sizeof(io_uring_sqe));
+    p->opcode    = IORING_OP_ASYNC_CANCEL;
+    p->fd        = -1;
+    p->addr      = (uint64_t)op;
+    p->user_data = 0;
+
+    __atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+
+    nb_pending_++;
+    nb_inflight_++;
+
+    if (waiting_ && loop_st_) {
+        st_thread_interrupt(loop_st_);
+    }
+
+    return ret;
+}
+
+int UringLoop::enter(unsigned to_submit)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (to_submit == 0) {
+        return ret;
+    }
+
+    int n = io_uring_enter(fd_, to_submit, 0);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EBUSY || errno == EINTR) {
+            // reap some completions and retry
+            reap();
+            return ret;
+        }
+        ret = ERROR_SYSTEM_IO_URING;
+        rs_error("io_uring_enter failed. errno=%d, ret=%d", errno, ret);
+        return ret;
+    }
+
+    nb_pending_ -= n;
+
+    return ret;
+}
+
+void UringLoop::reap()
+{
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+        return;
+    }
+
+    for (; head != tail; head++) {
+        io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+        UringOp*      op  = (UringOp*)cqe->user_data;
+
+        nb_inflight_--;
+
+        if (op) {
+            op->result = cqe->res;
+            op->done   = true;
+            st_cond_signal(op->cond);
+        }
+    }
+
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+    st_cond_broadcast(space_cond_);
+}
+
+void UringLoop::OnThreadStart()
+{
+    loop_st_ = st_thread_self();
+}
+
+int32_t UringLoop::Cycle()
+{
+    int ret = ERROR_SUCCESS;
+
+    // all the requests queued since the last round in one syscall
+    if ((ret = enter(nb_pending_)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    reap();
+
+    if (nb_pending_ > 0) {
+        // the kernel is busy, give it some time to drain
+        st_usleep(1000);
+        return ret;
+    }
+
+    // sleep until a completion is posted or a request is queued
+    uint64_t v  = 0;
+    waiting_    = true;
+    ssize_t nbr = st_read(event_stfd_, &v, sizeof(v), ST_UTIME_NO_TIMEOUT);
+    waiting_    = false;
+
+    if (nbr < 0 && errno != EINTR && errno != EAGAIN) {
+        ret = ERROR_SYSTEM_IO_URING;
+        rs_error("read io_uring eventfd failed. errno=%d, ret=%d", errno, ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+UringSocket::UringSocket(st_netfd_t stfd)
+    : send_timeout_(ST_UTIME_NO_TIMEOUT), recv_timeout_(ST_UTIME_NO_TIMEOUT),
+      send_bytes_(0), recv_bytes_(0)
+{
+    // the fd stays nonblocking for st, a request which completes with
+    // -EAGAIN polls the socket through the ring and is retried.
+    fd_ = st_netfd_fileno(stfd);
+
+    read_op_.cond  = st_cond_new();
+    write_op_.cond = st_cond_new();
+}
+
+UringSocket::~UringSocket()
+{
+    st_cond_destroy(read_op_.cond);
+    st_cond_destroy(write_op_.cond);
+}
+
+bool UringSocket::IsNeverTimeout(int64_t timeout_us)
+{
+    return timeout_us == (int64_t)ST_UTIME_NO_TIMEOUT;
+}
+
+void UringSocket::SetRecvTimeout(int64_t timeout_us)
+{
+    recv_timeout_ = timeout_us;
+}
+
+int64_t UringSocket::GetRecvTimeout()
+{
+    return recv_timeout_;
+}
+
+void UringSocket::SetSendTimeout(int64_t timeout_us)
+{
+    send_timeout_ = timeout_us;
+}
+
+int64_t UringSocket::GetSendTimeout()
+{
+    return send_timeout_;
+}
+
+int64_t UringSocket::GetSendBytes()
+{
+    return send_bytes_;
+}
+
+int64_t UringSocket::GetRecvBytes()
+{
+    return recv_bytes_;
+}
+
+int32_t UringSocket::submit(UringOp*            op,
+                            const io_uring_sqe& sqe,
+                            short               events,
+                            int64_t             timeout_us)
+{
+    int ret = ERROR_SUCCESS;
+
+    UringLoop* loop = UringLoop::Instance();
+
+    while (true) {
+        if ((ret = loop->Submit(op, sqe)) != ERROR_SUCCESS) {
+            op->result = -EIO;
+            return ret;
+        }
+        loop->Wait(op, timeout_us);
+
+        if (op->result != -EAGAIN) {
+            return ret;
+        }
+
+        // not ready yet, wait for the socket in the ring and retry
+        io_uring_sqe poll;
+        memset(&poll, 0, sizeof(poll));
+        poll.opcode      = IORING_OP_POLL_ADD;
+        poll.fd          = fd_;
+        poll.poll_events = (uint16_t)events;
+
+        if ((ret = loop->Submit(op, poll)) != ERROR_SUCCESS) {
+            op->result = -EIO;
+            return ret;
+        }
+        loop->Wait(op, timeout_us);
+
+        if (op->result < 0) {
+            return ret;
+        }
+    }
+
+    return ret;
+}
+
+int32_t UringSocket::do_read(io_uring_sqe& sqe, ssize_t* nread)
+{
+    sqe.fd = fd_;
+    submit(&read_op_, sqe, POLLIN, recv_timeout_);
+
+    int res = read_op_.result;
+    if (nread) {
+        *nread = res;
+    }
+    if (res <= 0) {
+        if (res == -ETIME) {
+            errno = ETIME;
+            return ERROR_SOCKET_TIMEOUT;
+        }
+        errno = res == 0 ? ECONNRESET : -res;
+        return ERROR_SOCKET_READ;
+    }
+
+    recv_bytes_ += res;
+    return ERROR_SUCCESS;
+}
+
+int32_t UringSocket::Read(void* buf, size_t size, ssize_t* nread)
+{
+    // straight into the buffer of the caller, the payload is parsed where
+    // the kernel put it
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_RECV;
+    sqe.addr   = (uint64_t)buf;
+    sqe.len    = (uint32_t)size;
+
+    return do_read(sqe, nread);
+}
+
+int32_t UringSocket::ReadFully(void* buf, size_t size, ssize_t* nread)
+{
+    int ret = ERROR_SUCCESS;
+
+    size_t nb_read = 0;
+    while (nb_read < size) {
+        ssize_t n = 0;
+        if ((ret = Read((char*)buf + nb_read, size - nb_read, &n)) !=
+            ERROR_SUCCESS) {
+            if (nread) {
+                *nread = nb_read;
+            }
+            return ret;
+        }
+        nb_read += n;
+    }
+
+    if (nread) {
+        *nread = nb_read;
+    }
+
+    return ret;
+}
+
+int32_t UringSocket::ReadEv(const iovec* iov, int32_t iov_size, ssize_t* nread)
+{
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READV;
+    sqe.addr   = (uint64_t)iov;
+    sqe.len    = (uint32_t)iov_size;
+
+    return do_read(sqe, nread);
+}
+
+int32_t UringSocket::Write(void* buf, size_t size, ssize_t* nwrite)
+{
+    iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len  = size;
+
+    return WriteEv(&iov, 1, nwrite);
+}
+
+int32_t UringSocket::WriteEv(const iovec* iov, int32_t iov_size, ssize_t* nwrite)
+{
+    if (iov_size <= 0) {
+        if (nwrite) {
+            *nwrite = 0;
+        }
+        return ERROR_SUCCESS;
+    }
+
+    // a socket write may be partial, like st_writev send until all is done.
+    // the iovecs left are copied to the socket by windows of iovs_.
+    int     index    = 0;
+    size_t  offset   = 0;
+    ssize_t nb_write = 0;
+
+    while (index < iov_size) {
+        int nb_iovs = rs_min(iov_size - index, URING_WRITE_IOVS);
+        memcpy(iovs_, iov + index, sizeof(iovec) * nb_iovs);
+        iovs_[0].iov_base = (char*)iovs_[0].iov_base + offset;
+        iovs_[0].iov_len -= offset;
+
+        io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_WRITEV;
+        sqe.fd     = fd_;
+        sqe.addr   = (uint64_t)iovs_;
+        sqe.len    = (uint32_t)nb_iovs;
+
+        submit(&write_op_, sqe, POLLOUT, send_timeout_);
+
+        int res = write_op_.result;
+        if (res <= 0) {
+            if (nwrite) {
+                *nwrite = nb_write;
+            }
+            if (res == -ETIME) {
+                errno = ETIME;
+                return ERROR_SOCKET_TIMEOUT;
+            }
+            errno = res == 0 ? ECONNRESET : -res;
+            return ERROR_SOCKET_WRITE;
+        }
+
+        nb_write += res;
+        send_bytes_ += res;
+
+        size_t done = offset + res;
+        while (index < iov_size && done >= iov[index].iov_len) {
+            done -= iov[index].iov_len;
+            index++;
+        }
+        offset = done;
+    }
+
+    if (nwrite) {
+        *nwrite = nb_write;
+    }
+
+    return ERROR_SUCCESS;
+}
@@ -0,0 +1,135 @@
+#ifndef RS_URING_HPP
+#define RS_URING_HPP
+
+#include <common/core.hpp>
+#include <common/io.hpp>
+#include <common/thread.hpp>
+
+#include <st.h>
+
+#include <vector>
+
+// the iovecs of one write request of a socket
+#define URING_WRITE_IOVS 256
+// the flushes of a full sq before a request fails
+#define URING_SQE_RETRIES 100
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// one in flight request, the submitting st thread sleeps on cond until the
+// loop reaps its completion.
+struct UringOp
+{
+    st_cond_t cond;
+    int32_t   result;
+    bool      done;
+};
+
+// io_uring of the worker process. the sqes queued by all the connections
+// are submitted together by the loop thread once they yield, so a single
+// io_uring_enter serves every read and write of one scheduler round. the
+// completions wake the loop through an eventfd watched by st.
+class UringLoop : public internal::IThreadHandler {
+  public:
+    UringLoop();
+    virtual ~UringLoop();
+
+  public:
+    static UringLoop* Instance();
+    static bool       Enabled();
+
+  public:
+    virtual int Initialize(int entries);
+    // queue a request, call Wait to get its result
+    virtual int  Submit(UringOp* op, const io_uring_sqe& sqe);
+    // cancel the request on timeout or interrupt, the result is -ETIME
+    // or -EINTR and the buffers are no longer used by the kernel.
+    virtual void Wait(UringOp* op, st_utime_t timeout);
+    // IThreadHandler
+    virtual void    OnThreadStart() override;
+    virtual int32_t Cycle() override;
+
+  private:
+    virtual io_uring_sqe* get_sqe();
+    virtual int           acquire_sqe(io_uring_sqe** psqe);
+    virtual int           enter(unsigned to_submit);
+    virtual void          reap();
+    virtual int           cancel(UringOp* op);
+
+  private:
+    int fd_;
+    int efd_;
+    // submission ring
+    char*         sq_ptr_;
+    size_t        sq_size_;
+    unsigned*     sq_head_;
+    unsigned*     sq_tail_;
+    unsigned*     sq_mask_;
+    unsigned*     sq_array_;
+    io_uring_sqe* sqes_;
+    unsigned      sq_entries_;
+    // completion ring
+    char*         cq_ptr_;
+    size_t        cq_size_;
+    unsigned*     cq_head_;
+    unsigned*     cq_tail_;
+    unsigned*     cq_mask_;
+    io_uring_cqe* cqes_;
+    unsigned      cq_entries_;
+
+    int               nb_pending_;
+    int               nb_inflight_;
+    bool              waiting_;
+    bool              enabled_;
+    st_cond_t         space_cond_;
+    st_netfd_t        event_stfd_;
+    st_thread_t       loop_st_;
+    internal::Thread* thread_;
+};
+
+class UringSocket : public IProtocolReaderWriter {
+  public:
+    UringSocket(st_netfd_t client_stfd);
+    virtual ~UringSocket();
+
+  public:
+    virtual bool    IsNeverTimeout(int64_t timeout_us) override;
+    virtual void    SetRecvTimeout(int64_t timeout_us) override;
+    virtual int64_t GetRecvTimeout() override;
+    virtual void    SetSendTimeout(int64_t timeout_us) override;
+    virtual int64_t GetSendTimeout() override;
+    virtual int64_t GetSendBytes() override;
+    virtual int64_t GetRecvBytes() override;
+
+    // IProtocolReaderWriter
+    virtual int32_t Read(void* buf, size_t size, ssize_t* nread) override;
+    virtual int32_t ReadFully(void* buf, size_t size, ssize_t* nread) override;
+    virtual int32_t
+    ReadEv(const iovec* iov, int32_t iov_size, ssize_t* nread) override;
+    virtual int32_t Write(void* buf, size_t size, ssize_t* nread) override;
+    virtual int32_t
+    WriteEv(const iovec* iov, int32_t iov_size, ssize_t* nwrite) override;
+
+  private:
+    // the result of the request is in op, -EAGAIN polls for events and
+    // sends the request again
+    virtual int32_t submit(UringOp*            op,
+                           const io_uring_sqe& sqe,
+                           short               events,
+                           int64_t             timeout_us);
+    virtual int32_t do_read(io_uring_sqe& sqe, ssize_t* nread);
+
+  private:
+    int fd_;
+    // the recv thread and the play thread may use the socket concurrently
+    UringOp read_op_;
+    UringOp write_op_;
+    iovec   iovs_[URING_WRITE_IOVS];
+    int64_t send_timeout_;
+    int64_t recv_timeout_;
+    int64_t send_bytes_;
+    int64_t recv_bytes_;
+};
+
+#endif
@@ -7,6 +7,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 
+#include <stdlib.h>
 #include <string.h>
 
 #include <chrono>
@@ -176,6 +177,16 @@ std::string Utils::StringRemove(const std::string& str,
     return retstr;
 }
 
+int64_t Utils::QueryValue(const std::string& query, const std::string& name)
+{
+    size_t pos = query.find(name + "=");
+    if (pos == std::string::npos ||
+        (pos > 0 && query[pos - 1] != '?' && query[pos - 1] != '&')) {
+        return -1;
+    }
+    return ::strtoll(query.c_str() + pos + name.length() + 1, nullptr, 10);
+}
+
 int64_t Utils::GetSteadyNanoSeconds()
 {
     using namespace std::chrono;
@@ -242,6 +253,17 @@ bool Utils::BytesEquals(void* pa, void* pb, int size)
     return true;
 }
 
+// FNV-1a, stable across processes so every worker agrees on the owner
+uint32_t Utils::Hash(const std::string& str, uint32_t hash)
+{
+    for (int i = 0; i < (int)str.length(); i++) {
+        hash ^= (uint8_t)str.at(i);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
 std::string Utils::BuildStreamPath(const std::string& template_path,
                                    const std::string& vhost,
                                    const std::string& app,
@@ -48,12 +48,18 @@ class Utils {
                                      const std::string& trim_chars);
     static std::string StringRemove(const std::string& str,
                                     const std::string& remove_chars);
+    // the number of name=, in ?a=1&b=2, -1 without it
+    static int64_t     QueryValue(const std::string& query,
+                                  const std::string& name);
     static int64_t     GetSteadyNanoSeconds();
     static int64_t     GetSteadyMicroSeconds();
     static int64_t     GetSteadyMilliSeconds();
     static std::string GetSystemTime(const std::string& format = "%H-%M-%S");
 
     static bool        BytesEquals(void* pa, void* pb, int size);
+    // fnv-1a, the hash of a string continues with the hash of its head
+    static uint32_t    Hash(const std::string& str,
+                            uint32_t           hash = 2166136261u);
     static std::string BuildStreamPath(const std::string& template_path,
                                        const std::string& vhost,
                                        const std::string& app,
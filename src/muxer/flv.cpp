@@ -135,12 +135,12 @@ CodecSample::~CodecSample()
 {
 }
 
-int Muxer::write_previous_tag_size_to_cache(int size, char *cache)
+int Muxer::EncodePreviousTagSize(int size, char *cache)
 {
     int ret = ERROR_SUCCESS;
 
     BufferManager manager;
-    if ((ret = manager.Initialize(cache, size)) != ERROR_SUCCESS)
+    if ((ret = manager.Initialize(cache, FLV_PREVIOUS_TAG_SIZE)) != ERROR_SUCCESS)
     {
         return ret;
     }
@@ -153,7 +153,7 @@ int Muxer::write_tag(char *header, int header_size, char *tag, int tag_size)
     int ret = ERROR_SUCCESS;
 
     char pre_size[FLV_PREVIOUS_TAG_SIZE];
-    if ((ret = write_previous_tag_size_to_cache(header_size + tag_size, pre_size)) != ERROR_SUCCESS)
+    if ((ret = EncodePreviousTagSize(header_size + tag_size, pre_size)) != ERROR_SUCCESS)
     {
         return ret;
     }
@@ -177,14 +177,14 @@ int Muxer::write_tag(char *header, int header_size, char *tag, int tag_size)
     return ret;
 }
 
-int Muxer::write_tag_header_to_cache(char type, int size, int timestamp, char *cache)
+int Muxer::EncodeTagHeader(char type, int size, int64_t timestamp, char *cache)
 {
     int ret = ERROR_SUCCESS;
 
     timestamp &= 0x7fffffff;
 
     BufferManager manager;
-    if (manager.Initialize(cache, 11) != ERROR_SUCCESS)
+    if (manager.Initialize(cache, FLV_TAG_HEADER_SIZE) != ERROR_SUCCESS)
     {
         return ret;
     }
@@ -281,7 +281,7 @@ int Muxer::WriteMetadata(char *data, int size)
     int ret = ERROR_SUCCESS;
 
     char tag_header[FLV_TAG_HEADER_SIZE];
-    if ((ret = write_tag_header_to_cache((char)flv::TagType::SCRIPT, size, 0, tag_header)) != ERROR_SUCCESS)
+    if ((ret = EncodeTagHeader((char)flv::TagType::SCRIPT, size, 0, tag_header)) != ERROR_SUCCESS)
     {
         return ret;
     }
@@ -303,7 +303,7 @@ int Muxer::WriteAudio(int64_t timestamp, char *data, int size)
     int ret = ERROR_SUCCESS;
 
     char tag_header[FLV_TAG_HEADER_SIZE];
-    if ((ret = write_tag_header_to_cache((char)flv::TagType::AUDIO, size, timestamp, tag_header)) != ERROR_SUCCESS)
+    if ((ret = EncodeTagHeader((char)flv::TagType::AUDIO, size, timestamp, tag_header)) != ERROR_SUCCESS)
     {
         return ret;
     }
@@ -325,7 +325,7 @@ int Muxer::WriteVideo(int64_t timestamp, char *data, int size)
     int ret = ERROR_SUCCESS;
 
     char tag_header[FLV_TAG_HEADER_SIZE];
-    if ((ret = write_tag_header_to_cache((char)flv::TagType::VIDEO, size, timestamp, tag_header)) != ERROR_SUCCESS)
+    if ((ret = EncodeTagHeader((char)flv::TagType::VIDEO, size, timestamp, tag_header)) != ERROR_SUCCESS)
     {
         return ret;
     }
@@ -627,4 +627,145 @@ bool Demuxer::IsKeyFrame(char *data, int size)
     return frame_type == (char)flv::VideoFrameType::KEY_FRAME;
 }
 
+KeyframeIndex::KeyframeIndex()
+{
+}
+
+KeyframeIndex::~KeyframeIndex()
+{
+}
+
+std::string KeyframeIndex::Path(const std::string &flv_path)
+{
+    return flv_path + FLV_INDEX_EXT;
+}
+
+void KeyframeIndex::Clear()
+{
+    entries_.clear();
+}
+
+int KeyframeIndex::Size()
+{
+    return (int)entries_.size();
+}
+
+IndexEntry KeyframeIndex::At(int index)
+{
+    return entries_[index];
+}
+
+void KeyframeIndex::Add(int64_t timestamp, int64_t offset)
+{
+    // a timestamp going back would break the search
+    if (!entries_.empty() && timestamp <= entries_.back().timestamp)
+    {
+        return;
+    }
+
+    IndexEntry entry;
+    entry.timestamp = timestamp;
+    entry.offset = offset;
+    entries_.push_back(entry);
+}
+
+int KeyframeIndex::Find(int64_t timestamp)
+{
+    int lo = 0;
+    int hi = (int)entries_.size() - 1;
+    int found = -1;
+
+    while (lo <= hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (entries_[mid].timestamp <= timestamp)
+        {
+            found = mid;
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+
+    return found;
+}
+
+int KeyframeIndex::EncodedSize()
+{
+    return FLV_INDEX_HEADER_SIZE + (int)entries_.size() * FLV_INDEX_ENTRY_SIZE;
+}
+
+int KeyframeIndex::Encode(char *data, int size)
+{
+    int ret = ERROR_SUCCESS;
+
+    BufferManager manager;
+    if ((ret = manager.Initialize(data, size)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if (!manager.Require(EncodedSize()))
+    {
+        ret = ERROR_FLV_INDEX_INVALID;
+        rs_error("flv index requires %d bytes, only %d. ret=%d", EncodedSize(), size, ret);
+        return ret;
+    }
+
+    manager.WriteString("FLVX");
+    manager.Write1Bytes(FLV_INDEX_VERSION);
+    manager.Write3Bytes(0);
+    manager.Write4Bytes((int32_t)entries_.size());
+
+    for (size_t i = 0; i < entries_.size(); i++)
+    {
+        manager.Write8Bytes(entries_[i].timestamp);
+        manager.Write8Bytes(entries_[i].offset);
+    }
+
+    return ret;
+}
+
+int KeyframeIndex::Decode(char *data, int size)
+{
+    int ret = ERROR_SUCCESS;
+
+    entries_.clear();
+
+    BufferManager manager;
+    if ((ret = manager.Initialize(data, size)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if (!manager.Require(FLV_INDEX_HEADER_SIZE) || manager.ReadString(4) != "FLVX")
+    {
+        ret = ERROR_FLV_INDEX_INVALID;
+        rs_error("invalid flv index header. ret=%d", ret);
+        return ret;
+    }
+
+    int8_t version = manager.Read1Bytes();
+    manager.Skip(3);
+    int32_t count = manager.Read4Bytes();
+
+    if (version != FLV_INDEX_VERSION || count < 0 || count > (size - FLV_INDEX_HEADER_SIZE) / FLV_INDEX_ENTRY_SIZE)
+    {
+        ret = ERROR_FLV_INDEX_INVALID;
+        rs_error("invalid flv index. version=%d, count=%d, size=%d. ret=%d", version, count, size, ret);
+        return ret;
+    }
+
+    entries_.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        entries_[i].timestamp = manager.Read8Bytes();
+        entries_[i].offset = manager.Read8Bytes();
+    }
+
+    return ret;
+}
+
 } // namespace flv
\ No newline at end of file
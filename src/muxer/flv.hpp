@@ -8,9 +8,17 @@
 #include <muxer/muxer.hpp>
 #include <codec/codec.hpp>
 
+#include <string>
+#include <vector>
+
 #define FLV_TAG_HEADER_SIZE 11
 #define FLV_PREVIOUS_TAG_SIZE 4
 #define AAC_SAMPLE_RATE_UNSET 15
+// keyframe index sidecar, FLVX, version and count ahead of the entries
+#define FLV_INDEX_EXT ".idx"
+#define FLV_INDEX_VERSION 1
+#define FLV_INDEX_HEADER_SIZE 12
+#define FLV_INDEX_ENTRY_SIZE 16
 
 namespace flv
 {
@@ -133,6 +141,9 @@ public:
 
 public:
     static int SizeTag(int data_size);
+    // the tag header and the previous tag size, in the caller's buffers
+    static int EncodeTagHeader(char type, int size, int64_t timestamp, char *cache);
+    static int EncodePreviousTagSize(int size, char *cache);
     virtual int Initialize(FileWriter *writer) override;
     virtual int WriteMetadata(char *data, int size) override;
     virtual int WriteAudio(int64_t timestamp, char *data, int size) override;
@@ -141,8 +152,6 @@ public:
 
 private:
     int write_flv_header(char flv_header[9]);
-    int write_tag_header_to_cache(char type, int size, int timestamp, char *cache);
-    int write_previous_tag_size_to_cache(int size, char *cache);
     int write_tag(char *header, int header_size, char *tag, int tag_size);
 
 private:
@@ -182,6 +191,37 @@ public:
     IACodec *acodec;
 };
 
+struct IndexEntry
+{
+    int64_t timestamp;
+    int64_t offset;
+};
+
+// timestamp and file offset of the keyframe tags of a recorded flv, saved
+// as a sidecar next to it. the timestamps only grow, so a seek is a binary
+// search instead of a scan of the file.
+class KeyframeIndex
+{
+public:
+    KeyframeIndex();
+    virtual ~KeyframeIndex();
+
+public:
+    static std::string Path(const std::string &flv_path);
+    virtual void Clear();
+    virtual int Size();
+    virtual IndexEntry At(int index);
+    virtual void Add(int64_t timestamp, int64_t offset);
+    // the last keyframe at or before timestamp, -1 when there is none
+    virtual int Find(int64_t timestamp);
+    virtual int EncodedSize();
+    virtual int Encode(char *data, int size);
+    virtual int Decode(char *data, int size);
+
+private:
+    std::vector<IndexEntry> entries_;
+};
+
 } // namespace flv
 
 #endif
\ No newline at end of file
@@ -0,0 +1,613 @@
+#include <muxer/fmp4.hpp>
+#include <common/utils.hpp>
+#include <common/error.hpp>
+#include <codec/aac.hpp>
+#include <codec/avc.hpp>
+
+#include <string.h>
+
+namespace fmp4
+{
+
+static const int aac_sample_rates[] = {
+    96000, 88200, 64000, 48000, 44100, 32000,
+    24000, 22050, 16000, 12000, 11025, 8000, 7350};
+
+static const uint32_t unity_matrix[] = {
+    0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+
+static void put_u8(std::string &out, uint8_t v)
+{
+    out.push_back((char)v);
+}
+
+static void put_u16(std::string &out, uint16_t v)
+{
+    out.push_back((char)(v >> 8));
+    out.push_back((char)v);
+}
+
+static void put_u32(std::string &out, uint32_t v)
+{
+    out.push_back((char)(v >> 24));
+    out.push_back((char)(v >> 16));
+    out.push_back((char)(v >> 8));
+    out.push_back((char)v);
+}
+
+static void put_u64(std::string &out, uint64_t v)
+{
+    put_u32(out, (uint32_t)(v >> 32));
+    put_u32(out, (uint32_t)v);
+}
+
+static void put_zeros(std::string &out, int count)
+{
+    out.append(count, '\0');
+}
+
+static void patch_u32(std::string &out, size_t pos, uint32_t v)
+{
+    out[pos] = (char)(v >> 24);
+    out[pos + 1] = (char)(v >> 16);
+    out[pos + 2] = (char)(v >> 8);
+    out[pos + 3] = (char)v;
+}
+
+// the size is patched by end_box, once the children are written
+static size_t begin_box(std::string &out, const char type[4])
+{
+    size_t pos = out.size();
+    put_u32(out, 0);
+    out.append(type, 4);
+    return pos;
+}
+
+static size_t begin_full_box(std::string &out, const char type[4], uint8_t version, uint32_t flags)
+{
+    size_t pos = begin_box(out, type);
+    put_u32(out, ((uint32_t)version << 24) | (flags & 0xffffff));
+    return pos;
+}
+
+static void end_box(std::string &out, size_t pos)
+{
+    patch_u32(out, pos, (uint32_t)(out.size() - pos));
+}
+
+Muxer::Muxer()
+{
+    demuxer_ = new flv::Demuxer;
+    sample_ = new flv::CodecSample;
+    sequence_ = 0;
+}
+
+Muxer::~Muxer()
+{
+    Reset();
+    rs_freep(sample_);
+    rs_freep(demuxer_);
+}
+
+bool Muxer::HasVideo()
+{
+    return demuxer_->vcodec && demuxer_->vcodec->HasSequenceHeader();
+}
+
+bool Muxer::HasAudio()
+{
+    return demuxer_->acodec && demuxer_->acodec->HasSequenceHeader();
+}
+
+void Muxer::clear(std::vector<Sample *> &samples, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        rs_freep(samples[i]);
+    }
+    samples.erase(samples.begin(), samples.begin() + count);
+}
+
+void Muxer::Reset()
+{
+    clear(videos_, (int)videos_.size());
+    clear(audios_, (int)audios_.size());
+}
+
+int64_t Muxer::QueuedDuration()
+{
+    std::vector<Sample *> &samples = videos_.empty() ? audios_ : videos_;
+    if (samples.size() < 2)
+    {
+        return 0;
+    }
+    return samples.back()->dts - samples.front()->dts;
+}
+
+int Muxer::WriteAudio(int64_t timestamp, char *data, int size)
+{
+    int ret = ERROR_SUCCESS;
+
+    sample_->Clear();
+    if ((ret = demuxer_->DemuxAudio(data, size, sample_)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    // the sequence header only updates the codec
+    if (sample_->aac_pkt_type != flv::AACPacketType::RAW_DATA || sample_->nb_sample_units <= 0)
+    {
+        return ret;
+    }
+
+    Sample *s = new Sample;
+    s->dts = timestamp;
+    s->cts = 0;
+    s->keyframe = true;
+    for (int i = 0; i < sample_->nb_sample_units; i++)
+    {
+        CodecSampleUnit *unit = &sample_->sample_units[i];
+        s->data.append(unit->bytes, unit->size);
+    }
+    audios_.push_back(s);
+
+    return ret;
+}
+
+int Muxer::WriteVideo(int64_t timestamp, char *data, int size)
+{
+    int ret = ERROR_SUCCESS;
+
+    sample_->Clear();
+    if ((ret = demuxer_->DemuxVideo(data, size, sample_)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if (sample_->avc_pkt_type != flv::AVCPacketType::NALU || sample_->nb_sample_units <= 0)
+    {
+        return ret;
+    }
+
+    // the composition time is a signed 24 bits
+    int32_t cts = sample_->composition_time;
+    if (cts & 0x800000)
+    {
+        cts |= ~0xffffff;
+    }
+
+    Sample *s = new Sample;
+    s->dts = timestamp;
+    s->cts = cts;
+    s->keyframe = sample_->frame_type == flv::VideoFrameType::KEY_FRAME;
+
+    // the parameter sets are in the avcC, the nalus always get 4 bytes
+    // lengths whatever the length size or annexb of the publisher
+    for (int i = 0; i < sample_->nb_sample_units; i++)
+    {
+        CodecSampleUnit *unit = &sample_->sample_units[i];
+        if (unit->size <= 0)
+        {
+            continue;
+        }
+        avc::NaluType type = (avc::NaluType)(unit->bytes[0] & 0x1f);
+        if (type == avc::NaluType::ACCESS_UNIT_DELIMITER || type == avc::NaluType::SPS || type == avc::NaluType::PPS)
+        {
+            continue;
+        }
+        put_u32(s->data, (uint32_t)unit->size);
+        s->data.append(unit->bytes, unit->size);
+    }
+    videos_.push_back(s);
+
+    return ret;
+}
+
+void Muxer::encode_video_trak(std::string &out)
+{
+    avc::Codec *codec = dynamic_cast<avc::Codec *>(demuxer_->vcodec);
+
+    size_t trak = begin_box(out, "trak");
+
+    size_t tkhd = begin_full_box(out, "tkhd", 0, 0x03);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    put_u32(out, FMP4_VIDEO_TRACK_ID);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    put_zeros(out, 8);
+    put_u16(out, 0);
+    put_u16(out, 0);
+    put_u16(out, 0);
+    put_u16(out, 0);
+    for (int i = 0; i < 9; i++)
+    {
+        put_u32(out, unity_matrix[i]);
+    }
+    put_u32(out, (uint32_t)codec->width << 16);
+    put_u32(out, (uint32_t)codec->height << 16);
+    end_box(out, tkhd);
+
+    size_t mdia = begin_box(out, "mdia");
+
+    size_t mdhd = begin_full_box(out, "mdhd", 0, 0);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    put_u32(out, FMP4_TIMESCALE);
+    put_u32(out, 0);
+    // und
+    put_u16(out, 0x55c4);
+    put_u16(out, 0);
+    end_box(out, mdhd);
+
+    size_t hdlr = begin_full_box(out, "hdlr", 0, 0);
+    put_u32(out, 0);
+    out.append("vide", 4);
+    put_zeros(out, 12);
+    out.append("VideoHandler", 13);
+    end_box(out, hdlr);
+
+    size_t minf = begin_box(out, "minf");
+
+    size_t vmhd = begin_full_box(out, "vmhd", 0, 0x01);
+    put_zeros(out, 8);
+    end_box(out, vmhd);
+
+    size_t dinf = begin_box(out, "dinf");
+    size_t dref = begin_full_box(out, "dref", 0, 0);
+    put_u32(out, 1);
+    size_t url = begin_full_box(out, "url ", 0, 0x01);
+    end_box(out, url);
+    end_box(out, dref);
+    end_box(out, dinf);
+
+    size_t stbl = begin_box(out, "stbl");
+    size_t stsd = begin_full_box(out, "stsd", 0, 0);
+    put_u32(out, 1);
+
+    size_t avc1 = begin_box(out, "avc1");
+    put_zeros(out, 6);
+    put_u16(out, 1);
+    put_zeros(out, 16);
+    put_u16(out, (uint16_t)codec->width);
+    put_u16(out, (uint16_t)codec->height);
+    put_u32(out, 0x00480000);
+    put_u32(out, 0x00480000);
+    put_u32(out, 0);
+    put_u16(out, 1);
+    put_zeros(out, 32);
+    put_u16(out, 0x0018);
+    put_u16(out, 0xffff);
+
+    // the record of the publisher, with the length size of the samples
+    size_t avcc = begin_box(out, "avcC");
+    size_t record = out.size();
+    out.append(codec->extradata, codec->extradata_size);
+    if (codec->extradata_size > 4)
+    {
+        out[record + 4] = (char)0xff;
+    }
+    end_box(out, avcc);
+
+    end_box(out, avc1);
+    end_box(out, stsd);
+
+    const char *empty_tables[] = {"stts", "stsc", "stco"};
+    for (int i = 0; i < 3; i++)
+    {
+        size_t table = begin_full_box(out, empty_tables[i], 0, 0);
+        put_u32(out, 0);
+        end_box(out, table);
+    }
+    size_t stsz = begin_full_box(out, "stsz", 0, 0);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    end_box(out, stsz);
+
+    end_box(out, stbl);
+    end_box(out, minf);
+    end_box(out, mdia);
+    end_box(out, trak);
+}
+
+void Muxer::encode_audio_trak(std::string &out)
+{
+    aac::Codec *codec = dynamic_cast<aac::Codec *>(demuxer_->acodec);
+
+    int sample_rate = 44100;
+    if (codec->sample_rate < sizeof(aac_sample_rates) / sizeof(int))
+    {
+        sample_rate = aac_sample_rates[codec->sample_rate];
+    }
+
+    size_t trak = begin_box(out, "trak");
+
+    size_t tkhd = begin_full_box(out, "tkhd", 0, 0x03);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    put_u32(out, FMP4_AUDIO_TRACK_ID);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    put_zeros(out, 8);
+    put_u16(out, 0);
+    put_u16(out, 1);
+    put_u16(out, 0x0100);
+    put_u16(out, 0);
+    for (int i = 0; i < 9; i++)
+    {
+        put_u32(out, unity_matrix[i]);
+    }
+    put_u32(out, 0);
+    put_u32(out, 0);
+    end_box(out, tkhd);
+
+    size_t mdia = begin_box(out, "mdia");
+
+    size_t mdhd = begin_full_box(out, "mdhd", 0, 0);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    put_u32(out, FMP4_TIMESCALE);
+    put_u32(out, 0);
+    put_u16(out, 0x55c4);
+    put_u16(out, 0);
+    end_box(out, mdhd);
+
+    size_t hdlr = begin_full_box(out, "hdlr", 0, 0);
+    put_u32(out, 0);
+    out.append("soun", 4);
+    put_zeros(out, 12);
+    out.append("SoundHandler", 13);
+    end_box(out, hdlr);
+
+    size_t minf = begin_box(out, "minf");
+
+    size_t smhd = begin_full_box(out, "smhd", 0, 0);
+    put_u32(out, 0);
+    end_box(out, smhd);
+
+    size_t dinf = begin_box(out, "dinf");
+    size_t dref = begin_full_box(out, "dref", 0, 0);
+    put_u32(out, 1);
+    size_t url = begin_full_box(out, "url ", 0, 0x01);
+    end_box(out, url);
+    end_box(out, dref);
+    end_box(out, dinf);
+
+    size_t stbl = begin_box(out, "stbl");
+    size_t stsd = begin_full_box(out, "stsd", 0, 0);
+    put_u32(out, 1);
+
+    size_t mp4a = begin_box(out, "mp4a");
+    put_zeros(out, 6);
+    put_u16(out, 1);
+    put_zeros(out, 8);
+    put_u16(out, codec->channels);
+    put_u16(out, 16);
+    put_u32(out, 0);
+    put_u32(out, (uint32_t)sample_rate << 16);
+
+    // es, decoder config and its specific info, all lengths in one byte
+    int asc_size = codec->extradata_size;
+    size_t esds = begin_full_box(out, "esds", 0, 0);
+    put_u8(out, 0x03);
+    put_u8(out, (uint8_t)(3 + 2 + 13 + 2 + asc_size + 3));
+    put_u16(out, FMP4_AUDIO_TRACK_ID);
+    put_u8(out, 0);
+    put_u8(out, 0x04);
+    put_u8(out, (uint8_t)(13 + 2 + asc_size));
+    // mpeg-4 audio, an audio stream
+    put_u8(out, 0x40);
+    put_u8(out, 0x15);
+    put_zeros(out, 3);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    put_u8(out, 0x05);
+    put_u8(out, (uint8_t)asc_size);
+    out.append(codec->extradata, asc_size);
+    put_u8(out, 0x06);
+    put_u8(out, 1);
+    put_u8(out, 0x02);
+    end_box(out, esds);
+
+    end_box(out, mp4a);
+    end_box(out, stsd);
+
+    const char *empty_tables[] = {"stts", "stsc", "stco"};
+    for (int i = 0; i < 3; i++)
+    {
+        size_t table = begin_full_box(out, empty_tables[i], 0, 0);
+        put_u32(out, 0);
+        end_box(out, table);
+    }
+    size_t stsz = begin_full_box(out, "stsz", 0, 0);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    end_box(out, stsz);
+
+    end_box(out, stbl);
+    end_box(out, minf);
+    end_box(out, mdia);
+    end_box(out, trak);
+}
+
+int Muxer::EncodeInitSegment(std::string &out)
+{
+    int ret = ERROR_SUCCESS;
+
+    bool has_video = HasVideo();
+    bool has_audio = HasAudio();
+
+    if (!has_video && !has_audio)
+    {
+        ret = ERROR_TS_CONTEXT_NOT_READY;
+        rs_error("no sequence header for the fmp4 init segment. ret=%d", ret);
+        return ret;
+    }
+
+    out.clear();
+
+    size_t ftyp = begin_box(out, "ftyp");
+    out.append("iso6", 4);
+    put_u32(out, 0);
+    out.append("iso6", 4);
+    out.append("cmfc", 4);
+    out.append("mp41", 4);
+    end_box(out, ftyp);
+
+    size_t moov = begin_box(out, "moov");
+
+    size_t mvhd = begin_full_box(out, "mvhd", 0, 0);
+    put_u32(out, 0);
+    put_u32(out, 0);
+    put_u32(out, FMP4_TIMESCALE);
+    put_u32(out, 0);
+    put_u32(out, 0x00010000);
+    put_u16(out, 0x0100);
+    put_zeros(out, 10);
+    for (int i = 0; i < 9; i++)
+    {
+        put_u32(out, unity_matrix[i]);
+    }
+    put_zeros(out, 24);
+    put_u32(out, FMP4_AUDIO_TRACK_ID + 1);
+    end_box(out, mvhd);
+
+    if (has_video)
+    {
+        encode_video_trak(out);
+    }
+    if (has_audio)
+    {
+        encode_audio_trak(out);
+    }
+
+    size_t mvex = begin_box(out, "mvex");
+    for (int track_id = FMP4_VIDEO_TRACK_ID; track_id <= FMP4_AUDIO_TRACK_ID; track_id++)
+    {
+        if ((track_id == FMP4_VIDEO_TRACK_ID && !has_video) || (track_id == FMP4_AUDIO_TRACK_ID && !has_audio))
+        {
+            continue;
+        }
+        size_t trex = begin_full_box(out, "trex", 0, 0);
+        put_u32(out, track_id);
+        put_u32(out, 1);
+        put_u32(out, 0);
+        put_u32(out, 0);
+        put_u32(out, 0);
+        end_box(out, trex);
+    }
+    end_box(out, mvex);
+
+    end_box(out, moov);
+
+    return ret;
+}
+
+void Muxer::encode_traf(std::string &out, int track_id, std::vector<Sample *> &samples, int count, size_t *data_offset)
+{
+    bool video = track_id == FMP4_VIDEO_TRACK_ID;
+
+    size_t traf = begin_box(out, "traf");
+
+    // the data offsets are from the moof
+    size_t tfhd = begin_full_box(out, "tfhd", 0, 0x020000);
+    put_u32(out, track_id);
+    end_box(out, tfhd);
+
+    size_t tfdt = begin_full_box(out, "tfdt", 1, 0);
+    put_u64(out, (uint64_t)samples[0]->dts);
+    end_box(out, tfdt);
+
+    // data offset, duration and size, the flags and signed cts for the video
+    size_t trun = begin_full_box(out, "trun", video ? 1 : 0, video ? 0x000f01 : 0x000301);
+    put_u32(out, count);
+    *data_offset = out.size();
+    put_u32(out, 0);
+    for (int i = 0; i < count; i++)
+    {
+        Sample *s = samples[i];
+        int64_t duration = rs_max(samples[i + 1]->dts - s->dts, (int64_t)0);
+        put_u32(out, (uint32_t)duration);
+        put_u32(out, (uint32_t)s->data.size());
+        if (video)
+        {
+            put_u32(out, s->keyframe ? FMP4_SAMPLE_SYNC : FMP4_SAMPLE_NON_SYNC);
+            put_u32(out, (uint32_t)s->cts);
+        }
+    }
+    end_box(out, trun);
+
+    end_box(out, traf);
+}
+
+int Muxer::EncodeFragment(std::string &out, int64_t &start, int64_t &duration, bool &independent)
+{
+    int ret = ERROR_SUCCESS;
+
+    int nb_videos = rs_max((int)videos_.size() - 1, 0);
+    int nb_audios = rs_max((int)audios_.size() - 1, 0);
+
+    out.clear();
+    if (nb_videos == 0 && nb_audios == 0)
+    {
+        return ret;
+    }
+
+    std::vector<Sample *> &timeline = nb_videos > 0 ? videos_ : audios_;
+    int nb_timeline = nb_videos > 0 ? nb_videos : nb_audios;
+    start = timeline[0]->dts;
+    duration = timeline[nb_timeline]->dts - start;
+    independent = nb_videos == 0 || videos_[0]->keyframe;
+
+    size_t moof = begin_box(out, "moof");
+
+    size_t mfhd = begin_full_box(out, "mfhd", 0, 0);
+    put_u32(out, ++sequence_);
+    end_box(out, mfhd);
+
+    size_t video_offset = 0;
+    size_t audio_offset = 0;
+    if (nb_videos > 0)
+    {
+        encode_traf(out, FMP4_VIDEO_TRACK_ID, videos_, nb_videos, &video_offset);
+    }
+    if (nb_audios > 0)
+    {
+        encode_traf(out, FMP4_AUDIO_TRACK_ID, audios_, nb_audios, &audio_offset);
+    }
+
+    end_box(out, moof);
+
+    // the video samples then the audio ones, right after the mdat header
+    size_t data = out.size() - moof + 8;
+    if (nb_videos > 0)
+    {
+        patch_u32(out, video_offset, (uint32_t)data);
+        for (int i = 0; i < nb_videos; i++)
+        {
+            data += videos_[i]->data.size();
+        }
+    }
+    if (nb_audios > 0)
+    {
+        patch_u32(out, audio_offset, (uint32_t)data);
+    }
+
+    size_t mdat = begin_box(out, "mdat");
+    for (int i = 0; i < nb_videos; i++)
+    {
+        out.append(videos_[i]->data);
+    }
+    for (int i = 0; i < nb_audios; i++)
+    {
+        out.append(audios_[i]->data);
+    }
+    end_box(out, mdat);
+
+    clear(videos_, nb_videos);
+    clear(audios_, nb_audios);
+
+    return ret;
+}
+
+} // namespace fmp4
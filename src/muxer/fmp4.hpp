@@ -0,0 +1,70 @@
+#ifndef RS_FMP4_HPP
+#define RS_FMP4_HPP
+
+#include <common/core.hpp>
+#include <muxer/flv.hpp>
+
+#include <string>
+#include <vector>
+
+#define FMP4_VIDEO_TRACK_ID 1
+#define FMP4_AUDIO_TRACK_ID 2
+// both tracks count in milliseconds, as the flv timestamps
+#define FMP4_TIMESCALE 1000
+// trun sample flags, a sync sample or one depending on others
+#define FMP4_SAMPLE_SYNC 0x02000000
+#define FMP4_SAMPLE_NON_SYNC 0x01010000
+
+namespace fmp4
+{
+
+struct Sample
+{
+    int64_t dts;
+    int32_t cts;
+    bool keyframe;
+    // the nalus with 4 bytes lengths, or the raw aac frame
+    std::string data;
+};
+
+// remuxes the avc and aac flv tags to cmaf fragments. the frames are queued
+// until a fragment is taken, which is a moof and mdat of the queued samples
+// but the last of each track, whose duration is known at the next frame.
+class Muxer
+{
+public:
+    Muxer();
+    virtual ~Muxer();
+
+public:
+    virtual int WriteAudio(int64_t timestamp, char *data, int size);
+    virtual int WriteVideo(int64_t timestamp, char *data, int size);
+    // the sequence header of the codec was seen
+    virtual bool HasVideo();
+    virtual bool HasAudio();
+    // ftyp and moov of the tracks, changed by a new sequence header
+    virtual int EncodeInitSegment(std::string &out);
+    // the decode time and duration of the fragment, of the video when any
+    virtual int EncodeFragment(std::string &out, int64_t &start, int64_t &duration, bool &independent);
+    // span of the samples a fragment would take now
+    virtual int64_t QueuedDuration();
+    // drops the queued samples, before a new publish
+    virtual void Reset();
+
+private:
+    void encode_video_trak(std::string &out);
+    void encode_audio_trak(std::string &out);
+    void encode_traf(std::string &out, int track_id, std::vector<Sample *> &samples, int count, size_t *data_offset);
+    void clear(std::vector<Sample *> &samples, int count);
+
+private:
+    flv::Demuxer *demuxer_;
+    flv::CodecSample *sample_;
+    std::vector<Sample *> videos_;
+    std::vector<Sample *> audios_;
+    uint32_t sequence_;
+};
+
+} // namespace fmp4
+
+#endif
@@ -0,0 +1,439 @@
+#include <muxer/ts.hpp>
+#include <common/utils.hpp>
+#include <common/error.hpp>
+#include <codec/aac.hpp>
+#include <codec/avc.hpp>
+
+#include <string.h>
+
+namespace ts
+{
+
+static const char aud_nalu[] = {(char)0x00, (char)0x00, (char)0x00, (char)0x01, (char)0x09, (char)0xf0};
+static const char start_code[] = {(char)0x00, (char)0x00, (char)0x00, (char)0x01};
+
+// crc32 of the psi sections, mpeg-2 polynomial without reflection
+static uint32_t crc32_mpeg(const char *data, int size)
+{
+    uint32_t crc = 0xffffffff;
+    for (int i = 0; i < size; i++)
+    {
+        crc ^= (uint32_t)(uint8_t)data[i] << 24;
+        for (int j = 0; j < 8; j++)
+        {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+// 33 bits in 5 bytes with the markers, flag is 0x02 for the pts alone,
+// otherwise 0x03 for the pts and 0x01 for the dts
+static char *write_timestamp(char *p, int flag, int64_t ts)
+{
+    *p++ = (char)((flag << 4) | (((ts >> 30) & 0x07) << 1) | 0x01);
+    *p++ = (char)((ts >> 22) & 0xff);
+    *p++ = (char)((((ts >> 15) & 0x7f) << 1) | 0x01);
+    *p++ = (char)((ts >> 7) & 0xff);
+    *p++ = (char)(((ts & 0x7f) << 1) | 0x01);
+    return p;
+}
+
+Muxer::Muxer()
+{
+    writer_ = nullptr;
+    demuxer_ = new flv::Demuxer;
+    sample_ = new flv::CodecSample;
+    header_written_ = false;
+    cc_pat_ = 0;
+    cc_pmt_ = 0;
+    cc_video_ = 0;
+    cc_audio_ = 0;
+}
+
+Muxer::~Muxer()
+{
+    rs_freep(sample_);
+    rs_freep(demuxer_);
+}
+
+int Muxer::Initialize(FileWriter *writer)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!writer->IsOpen())
+    {
+        ret = ERROR_KERNEL_FLV_STREAM_CLOSED;
+        rs_warn("stream is not open for encoder. ret=%d", ret);
+        return ret;
+    }
+
+    writer_ = writer;
+    header_written_ = false;
+
+    return ret;
+}
+
+bool Muxer::HasVideo()
+{
+    return demuxer_->vcodec && demuxer_->vcodec->HasSequenceHeader();
+}
+
+bool Muxer::HasAudio()
+{
+    return demuxer_->acodec && demuxer_->acodec->HasSequenceHeader();
+}
+
+int Muxer::WriteMetadata(char *data, int size)
+{
+    return ERROR_SUCCESS;
+}
+
+uint8_t *Muxer::continuity_counter(int pid)
+{
+    switch (pid)
+    {
+    case TS_PAT_PID:
+        return &cc_pat_;
+    case TS_PMT_PID:
+        return &cc_pmt_;
+    case TS_VIDEO_PID:
+        return &cc_video_;
+    default:
+        return &cc_audio_;
+    }
+}
+
+void Muxer::write_packet(int pid, const char *data, int size, bool start, bool pcr, bool keyframe, int64_t dts)
+{
+    char pkt[TS_PACKET_SIZE];
+    uint8_t *cc = continuity_counter(pid);
+
+    // the adaptation field carries the pcr, or pads the last packet
+    int af_size = pcr ? 8 : 0;
+    if (af_size + size < TS_PACKET_SIZE - 4)
+    {
+        af_size = TS_PACKET_SIZE - 4 - size;
+    }
+
+    pkt[0] = 0x47;
+    pkt[1] = (char)((start ? 0x40 : 0x00) | ((pid >> 8) & 0x1f));
+    pkt[2] = (char)(pid & 0xff);
+    pkt[3] = (char)((af_size > 0 ? 0x30 : 0x10) | (*cc & 0x0f));
+    *cc = (*cc + 1) & 0x0f;
+
+    char *p = pkt + 4;
+    if (af_size > 0)
+    {
+        *p++ = (char)(af_size - 1);
+        if (af_size > 1)
+        {
+            char *flags = p++;
+            *flags = 0x00;
+            if (pcr)
+            {
+                // pcr base, no extension
+                int64_t base = dts;
+                *flags |= 0x10;
+                *p++ = (char)(base >> 25);
+                *p++ = (char)(base >> 17);
+                *p++ = (char)(base >> 9);
+                *p++ = (char)(base >> 1);
+                *p++ = (char)(((base & 0x01) << 7) | 0x7e);
+                *p++ = 0x00;
+            }
+            if (keyframe)
+            {
+                *flags |= 0x40;
+            }
+            memset(p, 0xff, pkt + 4 + af_size - p);
+            p = pkt + 4 + af_size;
+        }
+    }
+
+    memcpy(p, data, size);
+    packets_.append(pkt, TS_PACKET_SIZE);
+}
+
+int Muxer::write_psi(int pid, char *section, int size)
+{
+    int ret = ERROR_SUCCESS;
+
+    char pkt[TS_PACKET_SIZE];
+    uint8_t *cc = continuity_counter(pid);
+
+    uint32_t crc = crc32_mpeg(section, size);
+    section[size++] = (char)(crc >> 24);
+    section[size++] = (char)(crc >> 16);
+    section[size++] = (char)(crc >> 8);
+    section[size++] = (char)crc;
+
+    pkt[0] = 0x47;
+    pkt[1] = (char)(0x40 | ((pid >> 8) & 0x1f));
+    pkt[2] = (char)(pid & 0xff);
+    pkt[3] = (char)(0x10 | (*cc & 0x0f));
+    *cc = (*cc + 1) & 0x0f;
+    // pointer field
+    pkt[4] = 0x00;
+    memcpy(pkt + 5, section, size);
+    memset(pkt + 5 + size, 0xff, TS_PACKET_SIZE - 5 - size);
+
+    packets_.append(pkt, TS_PACKET_SIZE);
+
+    return ret;
+}
+
+int Muxer::WriteMuxerHeader()
+{
+    int ret = ERROR_SUCCESS;
+
+    bool has_video = HasVideo();
+    bool has_audio = HasAudio();
+
+    packets_.clear();
+
+    // pat, the only program and its pmt pid
+    char pat[16];
+    char *p = pat;
+    *p++ = 0x00;
+    *p++ = (char)0xb0;
+    *p++ = 13;
+    *p++ = 0x00;
+    *p++ = 0x01;
+    *p++ = (char)0xc1;
+    *p++ = 0x00;
+    *p++ = 0x00;
+    *p++ = 0x00;
+    *p++ = TS_PROGRAM_NUMBER;
+    *p++ = (char)(0xe0 | ((TS_PMT_PID >> 8) & 0x1f));
+    *p++ = (char)(TS_PMT_PID & 0xff);
+    write_psi(TS_PAT_PID, pat, p - pat);
+
+    // pmt, the pcr goes with the video when there is one
+    int pcr_pid = has_video ? TS_VIDEO_PID : TS_AUDIO_PID;
+    int nb_streams = (has_video ? 1 : 0) + (has_audio ? 1 : 0);
+    char pmt[32];
+    p = pmt;
+    *p++ = 0x02;
+    *p++ = (char)0xb0;
+    *p++ = (char)(13 + nb_streams * 5);
+    *p++ = 0x00;
+    *p++ = TS_PROGRAM_NUMBER;
+    *p++ = (char)0xc1;
+    *p++ = 0x00;
+    *p++ = 0x00;
+    *p++ = (char)(0xe0 | ((pcr_pid >> 8) & 0x1f));
+    *p++ = (char)(pcr_pid & 0xff);
+    *p++ = (char)0xf0;
+    *p++ = 0x00;
+    if (has_video)
+    {
+        *p++ = TS_STREAM_TYPE_H264;
+        *p++ = (char)(0xe0 | ((TS_VIDEO_PID >> 8) & 0x1f));
+        *p++ = (char)(TS_VIDEO_PID & 0xff);
+        *p++ = (char)0xf0;
+        *p++ = 0x00;
+    }
+    if (has_audio)
+    {
+        *p++ = TS_STREAM_TYPE_AAC;
+        *p++ = (char)(0xe0 | ((TS_AUDIO_PID >> 8) & 0x1f));
+        *p++ = (char)(TS_AUDIO_PID & 0xff);
+        *p++ = (char)0xf0;
+        *p++ = 0x00;
+    }
+    write_psi(TS_PMT_PID, pmt, p - pmt);
+
+    if ((ret = writer_->Write((void *)packets_.data(), packets_.size(), nullptr)) != ERROR_SUCCESS)
+    {
+        rs_error("write ts pat and pmt failed. ret=%d", ret);
+        return ret;
+    }
+
+    header_written_ = true;
+
+    return ret;
+}
+
+int Muxer::write_pes(int pid, int stream_id, int64_t pts, int64_t dts, bool pcr, bool keyframe)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!header_written_ && (ret = WriteMuxerHeader()) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    char header[19];
+    char *p = header;
+    int header_data_size = pts != dts ? 10 : 5;
+    int64_t pes_size = 3 + header_data_size + (int64_t)es_.size();
+    // a video pes may be unbounded
+    if (pes_size > 0xffff)
+    {
+        pes_size = 0;
+    }
+
+    *p++ = 0x00;
+    *p++ = 0x00;
+    *p++ = 0x01;
+    *p++ = (char)stream_id;
+    *p++ = (char)(pes_size >> 8);
+    *p++ = (char)pes_size;
+    *p++ = (char)0x80;
+    *p++ = (char)(pts != dts ? 0xc0 : 0x80);
+    *p++ = (char)header_data_size;
+    if (pts != dts)
+    {
+        p = write_timestamp(p, 0x03, pts);
+        p = write_timestamp(p, 0x01, dts);
+    }
+    else
+    {
+        p = write_timestamp(p, 0x02, pts);
+    }
+    es_.insert(0, header, p - header);
+
+    packets_.clear();
+
+    const char *data = es_.data();
+    int left = (int)es_.size();
+    bool start = true;
+    while (left > 0)
+    {
+        int space = TS_PACKET_SIZE - 4 - (start && pcr ? 8 : 0);
+        int size = rs_min(left, space);
+
+        write_packet(pid, data, size, start, start && pcr, start && keyframe, dts);
+
+        data += size;
+        left -= size;
+        start = false;
+    }
+
+    if ((ret = writer_->Write((void *)packets_.data(), packets_.size(), nullptr)) != ERROR_SUCCESS)
+    {
+        rs_error("write ts pes failed. pid=%d, ret=%d", pid, ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+int Muxer::WriteAudio(int64_t timestamp, char *data, int size)
+{
+    int ret = ERROR_SUCCESS;
+
+    sample_->Clear();
+    if ((ret = demuxer_->DemuxAudio(data, size, sample_)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    // the sequence header only updates the codec
+    if (sample_->aac_pkt_type != flv::AACPacketType::RAW_DATA || sample_->nb_sample_units <= 0)
+    {
+        return ret;
+    }
+
+    aac::Codec *codec = dynamic_cast<aac::Codec *>(demuxer_->acodec);
+
+    // main, lc and ssr only, the he profiles are signalled as lc
+    int profile = (int)codec->object_type - 1;
+    if (profile < 0 || profile > 2)
+    {
+        profile = 1;
+    }
+
+    es_.clear();
+    for (int i = 0; i < sample_->nb_sample_units; i++)
+    {
+        CodecSampleUnit *unit = &sample_->sample_units[i];
+        int frame_size = TS_ADTS_HEADER_SIZE + unit->size;
+        if (frame_size > 0x1fff)
+        {
+            ret = ERROR_HLS_AAC_FRAME_LENGTH;
+            rs_error("aac frame of %d bytes too large for adts. ret=%d", unit->size, ret);
+            return ret;
+        }
+
+        char adts[TS_ADTS_HEADER_SIZE];
+        adts[0] = (char)0xff;
+        adts[1] = (char)0xf1;
+        adts[2] = (char)((profile << 6) | ((codec->sample_rate & 0x0f) << 2) | ((codec->channels >> 2) & 0x01));
+        adts[3] = (char)(((codec->channels & 0x03) << 6) | ((frame_size >> 11) & 0x03));
+        adts[4] = (char)((frame_size >> 3) & 0xff);
+        adts[5] = (char)(((frame_size & 0x07) << 5) | 0x1f);
+        adts[6] = (char)0xfc;
+
+        es_.append(adts, TS_ADTS_HEADER_SIZE);
+        es_.append(unit->bytes, unit->size);
+    }
+
+    int64_t pts = timestamp * TS_CLOCK_MS;
+    bool pcr = !HasVideo();
+
+    return write_pes(TS_AUDIO_PID, TS_AUDIO_STREAM_ID, pts, pts, pcr, false);
+}
+
+int Muxer::WriteVideo(int64_t timestamp, char *data, int size)
+{
+    int ret = ERROR_SUCCESS;
+
+    sample_->Clear();
+    if ((ret = demuxer_->DemuxVideo(data, size, sample_)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if (sample_->avc_pkt_type != flv::AVCPacketType::NALU || sample_->nb_sample_units <= 0)
+    {
+        return ret;
+    }
+
+    avc::Codec *codec = dynamic_cast<avc::Codec *>(demuxer_->vcodec);
+    bool keyframe = sample_->frame_type == flv::VideoFrameType::KEY_FRAME;
+
+    // every access unit starts with a delimiter, a keyframe with the sps and
+    // pps, so a segment can be decoded on its own
+    es_.clear();
+    es_.append(aud_nalu, sizeof(aud_nalu));
+    if (keyframe)
+    {
+        if (codec->sps_length > 0)
+        {
+            es_.append(start_code, sizeof(start_code));
+            es_.append(codec->sps, codec->sps_length);
+        }
+        if (codec->pps_length > 0)
+        {
+            es_.append(start_code, sizeof(start_code));
+            es_.append(codec->pps, codec->pps_length);
+        }
+    }
+
+    for (int i = 0; i < sample_->nb_sample_units; i++)
+    {
+        CodecSampleUnit *unit = &sample_->sample_units[i];
+        if (unit->size <= 0 || (avc::NaluType)(unit->bytes[0] & 0x1f) == avc::NaluType::ACCESS_UNIT_DELIMITER)
+        {
+            continue;
+        }
+        es_.append(start_code + 1, sizeof(start_code) - 1);
+        es_.append(unit->bytes, unit->size);
+    }
+
+    // the composition time is a signed 24 bits
+    int32_t cts = sample_->composition_time;
+    if (cts & 0x800000)
+    {
+        cts |= ~0xffffff;
+    }
+
+    int64_t dts = timestamp * TS_CLOCK_MS;
+    int64_t pts = (timestamp + cts) * TS_CLOCK_MS;
+
+    return write_pes(TS_VIDEO_PID, TS_VIDEO_STREAM_ID, pts, dts, true, keyframe);
+}
+
+} // namespace ts
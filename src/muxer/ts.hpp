@@ -0,0 +1,71 @@
+#ifndef RS_TS_HPP
+#define RS_TS_HPP
+
+#include <common/core.hpp>
+#include <common/file.hpp>
+#include <muxer/flv.hpp>
+#include <muxer/muxer.hpp>
+
+#include <string>
+
+#define TS_PACKET_SIZE 188
+#define TS_PAT_PID 0x0000
+#define TS_PMT_PID 0x1001
+#define TS_VIDEO_PID 0x0100
+#define TS_AUDIO_PID 0x0101
+#define TS_PROGRAM_NUMBER 1
+// pmt stream types and pes stream ids
+#define TS_STREAM_TYPE_H264 0x1b
+#define TS_STREAM_TYPE_AAC 0x0f
+#define TS_VIDEO_STREAM_ID 0xe0
+#define TS_AUDIO_STREAM_ID 0xc0
+// pts, dts and pcr ticks per millisecond
+#define TS_CLOCK_MS 90
+#define TS_ADTS_HEADER_SIZE 7
+
+namespace ts
+{
+
+// remuxes the avc and aac flv tags to mpeg-ts. the codecs are kept from one
+// file to the next, so the sequence headers are needed once, while every file
+// starts with its own pat and pmt.
+class Muxer : public IMuxer
+{
+public:
+    Muxer();
+    virtual ~Muxer();
+
+public:
+    // a new file, the pat and pmt are written before its first frame
+    virtual int Initialize(FileWriter *writer) override;
+    virtual int WriteMetadata(char *data, int size) override;
+    virtual int WriteAudio(int64_t timestamp, char *data, int size) override;
+    virtual int WriteVideo(int64_t timestamp, char *data, int size) override;
+    virtual int WriteMuxerHeader() override;
+    // the sequence header of the codec was seen
+    virtual bool HasVideo();
+    virtual bool HasAudio();
+
+private:
+    int write_psi(int pid, char *section, int size);
+    int write_pes(int pid, int stream_id, int64_t pts, int64_t dts, bool pcr, bool keyframe);
+    void write_packet(int pid, const char *data, int size, bool start, bool pcr, bool keyframe, int64_t dts);
+    uint8_t *continuity_counter(int pid);
+
+private:
+    FileWriter *writer_;
+    flv::Demuxer *demuxer_;
+    flv::CodecSample *sample_;
+    bool header_written_;
+    uint8_t cc_pat_;
+    uint8_t cc_pmt_;
+    uint8_t cc_video_;
+    uint8_t cc_audio_;
+    // elementary stream of the frame, then the packets of its pes
+    std::string es_;
+    std::string packets_;
+};
+
+} // namespace ts
+
+#endif
@@ -0,0 +1,294 @@
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/utils.hpp>
+#include <protocol/http/cmaf.hpp>
+#include <protocol/rtmp/cmaf.hpp>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+// how long a request waits for the stream, a part or the playlist asked for
+#define HTTP_CMAF_TIMEOUT_MS 10000
+
+namespace http {
+
+CmafResponder::CmafResponder(IProtocolReaderWriter* socket)
+{
+    socket_ = socket;
+}
+
+CmafResponder::~CmafResponder() {}
+
+bool CmafResponder::IsCmafFile(const std::string& path)
+{
+    return Utils::StringEndsWith(path, ".m3u8") ||
+           Utils::StringEndsWith(path, ".mp4") ||
+           Utils::StringEndsWith(path, ".m4s");
+}
+
+int CmafResponder::Serve(rtmp::Cmaf*        cmaf,
+                         const std::string& file,
+                         const std::string& query)
+{
+    // a worker pulling the stream from its owner gets it a bit later
+    int64_t deadline = Utils::GetSteadyMilliSeconds() + HTTP_CMAF_TIMEOUT_MS;
+    while (cmaf->LastSequence() < 0 && !cmaf->Ended()) {
+        int64_t now = Utils::GetSteadyMilliSeconds();
+        if (now >= deadline) {
+            return response_not_found();
+        }
+        cmaf->Wait(deadline - now);
+    }
+
+    if (Utils::StringEndsWith(file, ".m3u8")) {
+        return serve_playlist(cmaf, query);
+    }
+
+    if (file == "init.mp4") {
+        return serve_init(cmaf);
+    }
+
+    // 3.m4s or 3.1.m4s
+    char*   end      = nullptr;
+    int64_t sequence = ::strtoll(file.c_str(), &end, 10);
+    if (end == file.c_str() || sequence < 0) {
+        return response_not_found();
+    }
+    if (strcmp(end, ".m4s") == 0) {
+        return serve_segment(cmaf, sequence);
+    }
+
+    char* part_end = nullptr;
+    int   index    = (int)::strtol(end + 1, &part_end, 10);
+    if (*end != '.' || part_end == end + 1 || index < 0 ||
+        strcmp(part_end, ".m4s") != 0) {
+        return response_not_found();
+    }
+
+    return serve_part(cmaf, sequence, index);
+}
+
+int CmafResponder::serve_playlist(rtmp::Cmaf* cmaf, const std::string& query)
+{
+    // -1 without them, as a player asking for the current playlist
+    int64_t msn  = Utils::QueryValue(query, "_HLS_msn");
+    int64_t part = Utils::QueryValue(query, "_HLS_part");
+
+    // a blocking reload, answered once the segment or part is in it
+    int64_t deadline = Utils::GetSteadyMilliSeconds() + HTTP_CMAF_TIMEOUT_MS;
+    while (msn >= 0 && !cmaf->Ended()) {
+        rtmp::CmafSegment* segment = cmaf->FetchSegment(msn);
+        if (segment && (segment->completed ||
+                        (part >= 0 && (int64_t)segment->parts.size() > part))) {
+            break;
+        }
+        if (!segment && msn <= cmaf->LastSequence()) {
+            break;
+        }
+
+        int64_t now = Utils::GetSteadyMilliSeconds();
+        if (now >= deadline) {
+            break;
+        }
+        cmaf->Wait(deadline - now);
+    }
+
+    return response("application/vnd.apple.mpegurl", cmaf->Playlist());
+}
+
+int CmafResponder::serve_init(rtmp::Cmaf* cmaf)
+{
+    rtmp::CmafPart* init = cmaf->InitSegment();
+    if (!init) {
+        return response_not_found();
+    }
+
+    // the stream may change it while this is sent
+    return response("video/mp4", &init, 1);
+}
+
+int CmafResponder::serve_part(rtmp::Cmaf* cmaf, int64_t sequence, int index)
+{
+    int64_t deadline = Utils::GetSteadyMilliSeconds() + HTTP_CMAF_TIMEOUT_MS;
+    while (true) {
+        rtmp::CmafSegment* segment = cmaf->FetchSegment(sequence);
+        if (segment && index < (int)segment->parts.size()) {
+            return response("video/iso.segment", &segment->parts[index], 1);
+        }
+
+        // the preload hint of the playlist, or the first of the next segment
+        bool pending = segment ? !segment->completed :
+                                 sequence == cmaf->LastSequence() + 1;
+        int64_t now = Utils::GetSteadyMilliSeconds();
+        if (!pending || cmaf->Ended() || now >= deadline) {
+            return response_not_found();
+        }
+        cmaf->Wait(deadline - now);
+    }
+}
+
+int CmafResponder::serve_segment(rtmp::Cmaf* cmaf, int64_t sequence)
+{
+    int ret = ERROR_SUCCESS;
+
+    int64_t deadline = Utils::GetSteadyMilliSeconds() + HTTP_CMAF_TIMEOUT_MS;
+    while (!cmaf->FetchSegment(sequence)) {
+        int64_t now = Utils::GetSteadyMilliSeconds();
+        if (sequence != cmaf->LastSequence() + 1 || cmaf->Ended() ||
+            now >= deadline) {
+            return response_not_found();
+        }
+        cmaf->Wait(deadline - now);
+    }
+
+    rtmp::CmafSegment* segment = cmaf->FetchSegment(sequence);
+    // the unpublish may complete a segment without any part
+    if (segment->completed && segment->parts.empty()) {
+        return response_not_found();
+    }
+    if (segment->completed) {
+        return response("video/iso.segment", &segment->parts[0],
+                        (int)segment->parts.size());
+    }
+
+    static const char header[] = "HTTP/1.1 200 OK\r\n"
+                                 "Server: rtmp-server\r\n"
+                                 "Content-Type: video/iso.segment\r\n"
+                                 "Transfer-Encoding: chunked\r\n"
+                                 "Cache-Control: no-cache\r\n"
+                                 "Access-Control-Allow-Origin: *\r\n"
+                                 "Connection: keep-alive\r\n\r\n";
+
+    if ((ret = socket_->Write((char*)header, sizeof(header) - 1, nullptr)) !=
+        ERROR_SUCCESS) {
+        return ret;
+    }
+
+    // a part each chunk, the segment is fetched again after every write as
+    // it may leave the window meanwhile
+    size_t sent = 0;
+    deadline    = Utils::GetSteadyMilliSeconds() + HTTP_CMAF_TIMEOUT_MS;
+    while (true) {
+        segment = cmaf->FetchSegment(sequence);
+        if (!segment) {
+            ret = ERROR_HLS_NO_STREAM;
+            rs_warn("cmaf segment %lld left while sent. ret=%d",
+                    (long long)sequence, ret);
+            return ret;
+        }
+
+        if (sent < segment->parts.size()) {
+            // kept while sent, the segment may leave the window meanwhile
+            rtmp::CmafPart* part = segment->parts[sent++];
+            part->AddRef();
+            ret = response_chunk(part->data);
+            part->Release();
+            if (ret != ERROR_SUCCESS) {
+                return ret;
+            }
+            deadline = Utils::GetSteadyMilliSeconds() + HTTP_CMAF_TIMEOUT_MS;
+            continue;
+        }
+
+        int64_t now = Utils::GetSteadyMilliSeconds();
+        if (segment->completed || cmaf->Ended() || now >= deadline) {
+            break;
+        }
+        cmaf->Wait(deadline - now);
+    }
+
+    return response_chunk("");
+}
+
+int CmafResponder::response(const char* type, const std::string& body)
+{
+    iovec iov;
+    iov.iov_base = (char*)body.data();
+    iov.iov_len  = body.size();
+
+    return response(type, &iov, 1, (int)body.size());
+}
+
+int CmafResponder::response(const char*      type,
+                            rtmp::CmafPart** parts,
+                            int              nb_parts)
+{
+    int ret = ERROR_SUCCESS;
+
+    // the parts are referenced rather than copied, and kept while sent as
+    // the stream may free them or add to their segment meanwhile
+    std::vector<rtmp::CmafPart*> held(parts, parts + nb_parts);
+    std::vector<iovec>           iovs(rs_max(nb_parts, 1));
+    int                          size = 0;
+    for (int i = 0; i < nb_parts; i++) {
+        held[i]->AddRef();
+        iovs[i].iov_base = (char*)held[i]->data.data();
+        iovs[i].iov_len  = held[i]->data.size();
+        size += (int)held[i]->data.size();
+    }
+
+    ret = response(type, &iovs[0], nb_parts, size);
+
+    for (size_t i = 0; i < held.size(); i++) {
+        held[i]->Release();
+    }
+
+    return ret;
+}
+
+int CmafResponder::response(const char* type,
+                            iovec*      body,
+                            int         nb_body,
+                            int         size)
+{
+    char header[256];
+    int  nb_header = snprintf(header, sizeof(header),
+                             "HTTP/1.1 200 OK\r\n"
+                             "Server: rtmp-server\r\n"
+                             "Content-Type: %s\r\n"
+                             "Content-Length: %d\r\n"
+                             "Cache-Control: no-cache\r\n"
+                             "Access-Control-Allow-Origin: *\r\n"
+                             "Connection: keep-alive\r\n\r\n",
+                             type, size);
+
+    std::vector<iovec> iovs(nb_body + 1);
+    iovs[0].iov_base = header;
+    iovs[0].iov_len  = nb_header;
+    for (int i = 0; i < nb_body; i++) {
+        iovs[i + 1] = body[i];
+    }
+
+    return socket_->WriteEv(&iovs[0], (int)iovs.size(), nullptr);
+}
+
+int CmafResponder::response_chunk(const std::string& data)
+{
+    char size[16];
+    int  nb_size = snprintf(size, sizeof(size), "%x\r\n", (int)data.size());
+
+    iovec iovs[3];
+    iovs[0].iov_base = size;
+    iovs[0].iov_len  = nb_size;
+    iovs[1].iov_base = (char*)data.data();
+    iovs[1].iov_len  = data.size();
+    iovs[2].iov_base = (char*)"\r\n";
+    iovs[2].iov_len  = 2;
+
+    return socket_->WriteEv(iovs, 3, nullptr);
+}
+
+int CmafResponder::response_not_found()
+{
+    static const char header[] = "HTTP/1.1 404 Not Found\r\n"
+                                 "Server: rtmp-server\r\n"
+                                 "Content-Length: 0\r\n"
+                                 "Access-Control-Allow-Origin: *\r\n"
+                                 "Connection: keep-alive\r\n\r\n";
+
+    return socket_->Write((char*)header, sizeof(header) - 1, nullptr);
+}
+
+}  // namespace http
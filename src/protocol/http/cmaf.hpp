@@ -0,0 +1,48 @@
+#ifndef RS_HTTP_CMAF_HPP
+#define RS_HTTP_CMAF_HPP
+
+#include <common/core.hpp>
+#include <common/socket.hpp>
+
+#include <string>
+
+namespace rtmp {
+class Cmaf;
+class CmafPart;
+}  // namespace rtmp
+
+namespace http {
+
+// answers the requests of the cmaf files of a stream, the ll-hls playlist
+// index.m3u8, the init.mp4, the segments 3.m4s and their parts 3.1.m4s, on a
+// kept alive connection. a segment still being made is sent chunked as its
+// parts come, the playlist and the next part are held until they are ready.
+class CmafResponder {
+  public:
+    CmafResponder(IProtocolReaderWriter* socket);
+    virtual ~CmafResponder();
+
+  public:
+    static bool IsCmafFile(const std::string& path);
+    virtual int Serve(rtmp::Cmaf*        cmaf,
+                      const std::string& file,
+                      const std::string& query);
+
+  private:
+    int serve_playlist(rtmp::Cmaf* cmaf, const std::string& query);
+    int serve_init(rtmp::Cmaf* cmaf);
+    int serve_segment(rtmp::Cmaf* cmaf, int64_t sequence);
+    int serve_part(rtmp::Cmaf* cmaf, int64_t sequence, int index);
+    int response(const char* type, const std::string& body);
+    int response(const char* type, rtmp::CmafPart** parts, int nb_parts);
+    int response(const char* type, iovec* body, int nb_body, int size);
+    int response_chunk(const std::string& data);
+    int response_not_found();
+
+  private:
+    IProtocolReaderWriter* socket_;
+};
+
+}  // namespace http
+
+#endif
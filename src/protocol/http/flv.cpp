@@ -0,0 +1,552 @@
+#include <app/server.hpp>
+#include <common/config.hpp>
+#include <common/error.hpp>
+#include <common/kbps.hpp>
+#include <common/log.hpp>
+#include <common/uring.hpp>
+#include <common/utils.hpp>
+#include <muxer/flv.hpp>
+#include <protocol/http/cmaf.hpp>
+#include <protocol/http/flv.hpp>
+#include <protocol/rtmp/consumer.hpp>
+#include <protocol/rtmp/defines.hpp>
+#include <protocol/rtmp/fast_start.hpp>
+#include <protocol/rtmp/merged_write.hpp>
+#include <protocol/rtmp/message.hpp>
+#include <protocol/rtmp/source.hpp>
+#include <protocol/rtmp/stack.hpp>
+
+#include <string.h>
+#include <sys/socket.h>
+
+// the request line and headers of a GET, without body
+#define HTTP_MAX_HEADER_SIZE 4096
+#define HTTP_RECV_TIMEOUT_US (int64_t)(15 * 1000 * 1000LL)
+// flv header with audio and video, and the first previous tag size
+#define HTTP_FLV_HEADER_SIZE 13
+// iovecs of a batch, a header, the payload and the previous tag size per tag
+#define HTTP_FLV_IOVS_MAX (RTMP_MR_MSGS * 3)
+// /app/stream/clip.flv?start=60&duration=30, from the time shift
+#define HTTP_FLV_CLIP_FILE "clip.flv"
+
+namespace http {
+
+FlvConnection::FlvConnection(StreamServer* server, st_netfd_t stfd)
+    : IConnection(server, stfd)
+{
+    server_ = server;
+    if (UringLoop::Enabled()) {
+        socket_ = new UringSocket(stfd);
+    }
+    else {
+        socket_ = new StSocket(stfd);
+    }
+    request_  = new rtmp::Request;
+    wakeable_ = nullptr;
+    iovs_     = new iovec[HTTP_FLV_IOVS_MAX];
+    headers_  = new char[RTMP_MR_MSGS * RTMP_FLV_TAG_CACHE_SIZE];
+    kbps_     = new Kbps;
+    kbps_->SetIO(socket_, socket_);
+}
+
+FlvConnection::~FlvConnection()
+{
+    rs_freep(kbps_);
+    rs_freepa(headers_);
+    rs_freepa(iovs_);
+    rs_freep(request_);
+    rs_freep(socket_);
+}
+
+void FlvConnection::Dispose()
+{
+    ::IConnection::Dispose();
+    if (wakeable_) {
+        wakeable_->WakeUp();
+    }
+}
+
+void FlvConnection::Resample()
+{
+    kbps_->Resample();
+}
+
+int64_t FlvConnection::GetSendBytesDelta()
+{
+    return kbps_->GetSendBytesDelta();
+}
+
+int64_t FlvConnection::GetRecvBytesDelta()
+{
+    return kbps_->GetRecvBytesDelta();
+}
+
+void FlvConnection::CleanUp()
+{
+    kbps_->CleanUp();
+}
+
+int32_t FlvConnection::do_cycle()
+{
+    int ret = ERROR_SUCCESS;
+
+    socket_->SetRecvTimeout(HTTP_RECV_TIMEOUT_US);
+    socket_->SetSendTimeout(RTMP_SEND_TIMEOUT_US);
+
+    std::string url;
+    std::string host;
+    if ((ret = read_request(url, host)) != ERROR_SUCCESS) {
+        if (!is_client_gracefully_close(ret)) {
+            rs_error("read http request failed. ret=%d", ret);
+            response_error(400, "Bad Request");
+        }
+        return ret;
+    }
+
+    std::string file;
+    std::string query;
+    if ((ret = parse_request(url, host, file, query)) != ERROR_SUCCESS) {
+        rs_warn("no live stream of %s. ret=%d", url.c_str(), ret);
+        response_error(404, "Not Found");
+        return ret;
+    }
+
+    rtmp::Source* source = nullptr;
+    if ((ret = rtmp::Source::FetchOrCreate(request_, server_, &source)) !=
+        ERROR_SUCCESS) {
+        response_error(500, "Internal Server Error");
+        return ret;
+    }
+
+    if (file == HTTP_FLV_CLIP_FILE) {
+        return serving_clip(source, query);
+    }
+
+    if (!file.empty()) {
+        return serving_cmaf(source, file, query);
+    }
+
+    return playing(source);
+}
+
+int FlvConnection::read_request(std::string& url, std::string& host)
+{
+    int ret = ERROR_SUCCESS;
+
+    // from what came after the last request, a pipelined one
+    char   buf[HTTP_MAX_HEADER_SIZE];
+    size_t nb_buf = rs_min(pending_.size(), sizeof(buf) - 1);
+    memcpy(buf, pending_.data(), nb_buf);
+    buf[nb_buf] = '\0';
+    pending_.clear();
+
+    char* end = strstr(buf, "\r\n\r\n");
+    while (!end) {
+        if (nb_buf >= sizeof(buf) - 1) {
+            ret = ERROR_HTTP_PARSE_HEADER;
+            rs_error("http header exceed %d bytes. ret=%d",
+                     HTTP_MAX_HEADER_SIZE, ret);
+            return ret;
+        }
+
+        ssize_t nread = 0;
+        if ((ret = socket_->Read(buf + nb_buf, sizeof(buf) - 1 - nb_buf,
+                                 &nread)) != ERROR_SUCCESS) {
+            return ret;
+        }
+        nb_buf += nread;
+        buf[nb_buf] = '\0';
+
+        end = strstr(buf, "\r\n\r\n");
+    }
+
+    std::string header(buf, end - buf);
+    pending_.assign(end + 4, buf + nb_buf);
+
+    // GET /app/stream.flv HTTP/1.1
+    size_t      pos  = header.find("\r\n");
+    std::string line = header.substr(0, pos);
+    size_t      sp1  = line.find(' ');
+    size_t      sp2  = line.rfind(' ');
+    if (sp1 == std::string::npos || sp2 <= sp1) {
+        ret = ERROR_HTTP_PARSE_URI;
+        rs_error("invalid http request line %s. ret=%d", line.c_str(), ret);
+        return ret;
+    }
+
+    if (line.substr(0, sp1) != "GET") {
+        ret = ERROR_HTTP_DATA_INVALID;
+        rs_error("http method of %s not supported. ret=%d", line.c_str(), ret);
+        return ret;
+    }
+    url = line.substr(sp1 + 1, sp2 - sp1 - 1);
+
+    while (pos != std::string::npos) {
+        size_t      next  = header.find("\r\n", pos + 2);
+        std::string field = header.substr(pos + 2, next == std::string::npos ?
+                                                       std::string::npos :
+                                                       next - pos - 2);
+        pos = next;
+
+        size_t colon = field.find(':');
+        if (colon != 4 || strncasecmp(field.c_str(), "host", 4) != 0) {
+            continue;
+        }
+        host = Utils::StringTrimStart(field.substr(colon + 1), " \t");
+    }
+
+    return ret;
+}
+
+int FlvConnection::parse_request(const std::string& url,
+                                 const std::string& host,
+                                 std::string&       file,
+                                 std::string&       query)
+{
+    int ret = ERROR_SUCCESS;
+
+    std::string path = url;
+    size_t      pos  = std::string::npos;
+    file             = "";
+    query            = "";
+    if ((pos = url.find('?')) != std::string::npos) {
+        path  = url.substr(0, pos);
+        query = url.substr(pos);
+    }
+
+    // /app/stream.flv, or /app/stream/index.m3u8 and the files it lists, or
+    // /app/stream/clip.flv
+    if (CmafResponder::IsCmafFile(path) ||
+        Utils::StringEndsWith(path, "/" HTTP_FLV_CLIP_FILE)) {
+        pos  = path.rfind('/');
+        file = path.substr(pos + 1);
+        path = path.substr(0, pos) + ".flv";
+    }
+    else if (!Utils::StringEndsWith(path, ".flv")) {
+        ret = ERROR_HTTP_LIVE_STREAM_EXT;
+        return ret;
+    }
+
+    // the app may have slashes, the stream is the last part
+    pos = path.rfind('/');
+    if (pos == std::string::npos || pos == 0) {
+        ret = ERROR_HTTP_PARSE_URI;
+        return ret;
+    }
+    std::string app    = path.substr(1, pos - 1);
+    std::string stream = path.substr(pos + 1, path.length() - pos - 5);
+
+    // resolved as the tcUrl of an rtmp play, so both find the same source
+    request_->tc_url =
+        "rtmp://" + (host.empty() ? RTMP_DEFAULT_VHOST : host) + "/" + app;
+    request_->stream = stream + query;
+    request_->ip     = client_ip_;
+    // seconds before the live point, as the start of an rtmp play
+    request_->start  = (double)Utils::QueryValue(query, "start");
+
+    rtmp::DiscoveryTcUrl(request_->tc_url, request_->schema, request_->host,
+                         request_->vhost, request_->app, request_->stream,
+                         request_->port, request_->param);
+    request_->Strip();
+
+    if (request_->vhost.empty() || request_->app.empty() ||
+        request_->stream.empty()) {
+        ret = ERROR_HTTP_PARSE_URI;
+        return ret;
+    }
+
+    return ret;
+}
+
+int FlvConnection::response_error(int status, const char* reason)
+{
+    char buf[256];
+    int  size = snprintf(buf, sizeof(buf),
+                        "HTTP/1.1 %d %s\r\n"
+                        "Server: rtmp-server\r\n"
+                        "Content-Length: 0\r\n"
+                        "Connection: close\r\n\r\n",
+                        status, reason);
+
+    return socket_->Write(buf, size, nullptr);
+}
+
+int FlvConnection::response_stream()
+{
+    static const char header[] = "HTTP/1.1 200 OK\r\n"
+                                 "Server: rtmp-server\r\n"
+                                 "Content-Type: video/x-flv\r\n"
+                                 "Cache-Control: no-cache\r\n"
+                                 "Access-Control-Allow-Origin: *\r\n"
+                                 "Connection: close\r\n\r\n";
+
+    static const char flv_header[HTTP_FLV_HEADER_SIZE] = {
+        'F',        'L',        'V',        (char)0x01, (char)0x05,
+        (char)0x00, (char)0x00, (char)0x00, (char)0x09, (char)0x00,
+        (char)0x00, (char)0x00, (char)0x00};
+
+    iovec iovs[2];
+    iovs[0].iov_base = (char*)header;
+    iovs[0].iov_len  = sizeof(header) - 1;
+    iovs[1].iov_base = (char*)flv_header;
+    iovs[1].iov_len  = sizeof(flv_header);
+
+    return socket_->WriteEv(iovs, 2, nullptr);
+}
+
+int FlvConnection::playing(rtmp::Source* source)
+{
+    int ret = ERROR_SUCCESS;
+
+    int64_t shift_ms =
+        request_->start > 0 ? (int64_t)(request_->start * 1000) : 0;
+
+    rtmp::Consumer* consumer = nullptr;
+    if ((ret = source->CreateConsumer(this, consumer, true, true, true,
+                                      shift_ms)) != ERROR_SUCCESS) {
+        rs_error("create consumer failed. ret=%d", ret);
+        return ret;
+    }
+
+    rs_auto_free(rtmp::Consumer, consumer);
+
+    if ((ret = response_stream()) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    rs_trace("start http flv play %s", request_->GetStreamUrl().c_str());
+
+    wakeable_ = consumer;
+    ret       = do_playing(consumer);
+    wakeable_ = nullptr;
+
+    return ret;
+}
+
+int FlvConnection::serving_cmaf(rtmp::Source* source,
+                                std::string   file,
+                                std::string   query)
+{
+    int ret = ERROR_SUCCESS;
+
+    // before the consumer, a stream pulled to this worker starts the cmaf
+    // with its publish
+    if ((ret = source->RequestCmaf()) != ERROR_SUCCESS) {
+        rs_warn("no cmaf of %s. ret=%d", request_->GetStreamUrl().c_str(),
+                ret);
+        response_error(404, "Not Found");
+        return ret;
+    }
+
+    // the segments are made by the source, the consumer only keeps the
+    // stream pulled to this worker, its messages are dropped
+    rtmp::Consumer* consumer = nullptr;
+    if ((ret = source->CreateConsumer(this, consumer, false, false, false)) !=
+        ERROR_SUCCESS) {
+        rs_error("create consumer failed. ret=%d", ret);
+        return ret;
+    }
+
+    rs_auto_free(rtmp::Consumer, consumer);
+
+    rs_trace("start http cmaf play %s", request_->GetStreamUrl().c_str());
+
+    rtmp::MessageArray msgs(RTMP_MR_MSGS);
+    CmafResponder      responder(socket_);
+    std::string        stream_url = request_->GetStreamUrl();
+
+    while (!disposed_) {
+        if ((ret = source->RequestCmaf()) != ERROR_SUCCESS) {
+            return ret;
+        }
+
+        if ((ret = responder.Serve(source->GetCmaf(), file, query)) !=
+            ERROR_SUCCESS) {
+            if (!is_client_gracefully_close(ret)) {
+                rs_error("serve cmaf %s failed. ret=%d", file.c_str(), ret);
+            }
+            return ret;
+        }
+
+        int count = 0;
+        do {
+            if ((ret = consumer->DumpPackets(&msgs, count)) != ERROR_SUCCESS) {
+                return ret;
+            }
+            consumer->ReleasePackets(&msgs, count);
+        } while (count > 0);
+
+        // the next request of the kept alive connection, of the same stream
+        std::string url;
+        std::string host;
+        if ((ret = read_request(url, host)) != ERROR_SUCCESS) {
+            return ret;
+        }
+
+        if ((ret = parse_request(url, host, file, query)) != ERROR_SUCCESS ||
+            file.empty() || request_->GetStreamUrl() != stream_url) {
+            ret = ERROR_HTTP_PARSE_URI;
+            rs_warn("cmaf request %s out of %s. ret=%d", url.c_str(),
+                    stream_url.c_str(), ret);
+            response_error(404, "Not Found");
+            return ret;
+        }
+    }
+
+    return ret;
+}
+
+int FlvConnection::serving_clip(rtmp::Source* source, const std::string& query)
+{
+    int ret = ERROR_SUCCESS;
+
+    // the duration defaults to what is left until the live point
+    int64_t start    = Utils::QueryValue(query, "start");
+    int64_t duration = Utils::QueryValue(query, "duration");
+    if (start <= 0) {
+        ret = ERROR_HTTP_DATA_INVALID;
+        rs_warn("clip without start of %s. ret=%d",
+                request_->GetStreamUrl().c_str(), ret);
+        response_error(400, "Bad Request");
+        return ret;
+    }
+
+    std::string body;
+    if ((ret = source->ExportClip(start * 1000,
+                                  (duration > 0 ? duration : start) * 1000,
+                                  body)) != ERROR_SUCCESS) {
+        response_error(404, "Not Found");
+        return ret;
+    }
+
+    char header[256];
+    int  size = snprintf(header, sizeof(header),
+                        "HTTP/1.1 200 OK\r\n"
+                        "Server: rtmp-server\r\n"
+                        "Content-Type: video/x-flv\r\n"
+                        "Content-Length: %d\r\n"
+                        "Access-Control-Allow-Origin: *\r\n"
+                        "Connection: close\r\n\r\n",
+                        (int)body.size());
+
+    iovec iovs[2];
+    iovs[0].iov_base = header;
+    iovs[0].iov_len  = size;
+    iovs[1].iov_base = (char*)body.data();
+    iovs[1].iov_len  = body.size();
+
+    return socket_->WriteEv(iovs, 2, nullptr);
+}
+
+int FlvConnection::do_playing(rtmp::Consumer* consumer)
+{
+    int                ret = ERROR_SUCCESS;
+    rtmp::MessageArray msgs(RTMP_MR_MSGS);
+
+    rtmp::MergedWriteTuner tuner;
+    tuner.Initialize(st_netfd_fileno(client_stfd_),
+                     _config->GetMWAdaptive(request_->vhost),
+                     _config->GetMWMinSleepMS(request_->vhost),
+                     _config->GetMWSleepMS(request_->vhost),
+                     _config->GetMWBatchBytes(request_->vhost));
+    consumer->SetLowLatency(_config->GetLowLatency(request_->vhost));
+
+    rtmp::FastStart fast_start;
+    if (_config->GetJoinStrategy(request_->vhost) == "burst") {
+        fast_start.Initialize(st_netfd_fileno(client_stfd_),
+                              _config->GetJoinBurstRate(request_->vhost),
+                              consumer->JoinBacklogBytes(),
+                              consumer->JoinBacklogMS());
+    }
+
+    while (!disposed_) {
+        if (expired_) {
+            ret = ERROR_USER_DISCONNECT;
+            rs_error("connection expired. ret=%d", ret);
+            return ret;
+        }
+
+        bool bursting = fast_start.Bursting();
+        if (!bursting) {
+            consumer->Wait(tuner.MinMsgs(), tuner.SleepMS());
+        }
+
+        int count = 0;
+        if ((ret = consumer->DumpPackets(&msgs, count)) != ERROR_SUCCESS) {
+            rs_error("get message form consumer failed. ret=%d", ret);
+            return ret;
+        }
+
+        if (count <= 0) {
+            fast_start.StopBurst();
+            // the player never sends, and a write would tell a closed one
+            if (peer_closed()) {
+                return ERROR_SOCKET_READ;
+            }
+            st_usleep(tuner.SleepMS() * 1000);
+            continue;
+        }
+
+        int nb_bytes = 0;
+        for (int i = 0; i < count; i++) {
+            nb_bytes += msgs.msgs[i]->size;
+        }
+
+        ret = send_messages(msgs.msgs, count);
+
+        int delay_ms = 0;
+        if (ret == ERROR_SUCCESS) {
+            delay_ms = fast_start.OnSend(msgs.msgs, count, nb_bytes);
+        }
+        consumer->ReleasePackets(&msgs, count);
+        if (!bursting) {
+            tuner.OnSend(count, nb_bytes);
+        }
+
+        if (ret != ERROR_SUCCESS) {
+            if (!is_client_gracefully_close(ret)) {
+                rs_error("send messages to client failed. ret=%d", ret);
+            }
+            return ret;
+        }
+
+        if (delay_ms > 0) {
+            st_usleep(delay_ms * 1000);
+        }
+    }
+
+    return ret;
+}
+
+int FlvConnection::send_messages(rtmp::SharedPtrMessage** msgs, int count)
+{
+    int nb_iovs = 0;
+    for (int i = 0; i < count; i++) {
+        rtmp::SharedPtrMessage* msg  = msgs[i];
+        int8_t                  type = msg->Header()->message_type;
+        if (!msg->IsAV() && type != RTMP_MSG_AMF0_DATA) {
+            continue;
+        }
+
+        iovec* iovs   = iovs_ + nb_iovs;
+        char*  header = headers_ + i * RTMP_FLV_TAG_CACHE_SIZE;
+        if (msg->GetFlvIovs(header, iovs)) {
+            nb_iovs += 3;
+        }
+    }
+
+    if (nb_iovs == 0) {
+        return ERROR_SUCCESS;
+    }
+
+    return socket_->WriteEv(iovs_, nb_iovs, nullptr);
+}
+
+bool FlvConnection::peer_closed()
+{
+    char c;
+    int  fd = st_netfd_fileno(client_stfd_);
+    return ::recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+}  // namespace http
@@ -0,0 +1,83 @@
+#ifndef RS_HTTP_FLV_HPP
+#define RS_HTTP_FLV_HPP
+
+#include <common/connection.hpp>
+#include <common/core.hpp>
+#include <common/socket.hpp>
+
+#include <string>
+
+#include <sys/uio.h>
+
+class Kbps;
+class StreamServer;
+
+namespace rtmp {
+class Source;
+class Consumer;
+class Request;
+class SharedPtrMessage;
+class IWakeable;
+}  // namespace rtmp
+
+namespace http {
+
+// a player of GET /app/stream.flv. it is a consumer of the rtmp source like
+// the rtmp players, and sends the same shared messages as flv tags, whose
+// headers are cached by the messages, so a send is a single writev. the
+// requests of /app/stream/index.m3u8 and its files get the cmaf segments of
+// the source instead, on a kept alive connection. with ?start=30 the stream
+// is played from its time shift, /app/stream/clip.flv is an flv cut of it.
+class FlvConnection : virtual public IConnection {
+  public:
+    FlvConnection(StreamServer* server, st_netfd_t stfd);
+    virtual ~FlvConnection();
+
+  public:
+    // IConnection
+    virtual void Dispose() override;
+    // IKbpsDelta
+    virtual void    Resample() override;
+    virtual int64_t GetSendBytesDelta() override;
+    virtual int64_t GetRecvBytesDelta() override;
+    virtual void    CleanUp() override;
+
+  protected:
+    // IConnection
+    virtual int32_t do_cycle() override;
+
+  private:
+    int  read_request(std::string& url, std::string& host);
+    int  parse_request(const std::string& url,
+                       const std::string& host,
+                       std::string&       file,
+                       std::string&       query);
+    int  response_error(int status, const char* reason);
+    int  response_stream();
+    int  playing(rtmp::Source* source);
+    int  do_playing(rtmp::Consumer* consumer);
+    int  serving_cmaf(rtmp::Source* source,
+                      std::string   file,
+                      std::string   query);
+    int  serving_clip(rtmp::Source* source, const std::string& query);
+    int  send_messages(rtmp::SharedPtrMessage** msgs, int count);
+    bool peer_closed();
+
+  private:
+    StreamServer*          server_;
+    IProtocolReaderWriter* socket_;
+    rtmp::Request*         request_;
+    rtmp::IWakeable*       wakeable_;
+    // iovecs of a batch, and the tag headers the messages could not cache
+    iovec*                 iovs_;
+    char*                  headers_;
+    // of the socket, for the deltas of the connection
+    Kbps*                  kbps_;
+    // what was read after the header of the last request, the start of the
+    // next one of a kept alive connection
+    std::string            pending_;
+};
+
+}  // namespace http
+
+#endif
@@ -0,0 +1,226 @@
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/utils.hpp>
+#include <protocol/amf/amf0.hpp>
+#include <protocol/rtmp/client.hpp>
+#include <protocol/rtmp/defines.hpp>
+
+// the buffer asked to the origin, as a player would
+#define RTMP_CLIENT_BUFFER_MS 1000
+
+namespace rtmp {
+
+Client::Client(IProtocolReaderWriter* rw) : rw_(rw)
+{
+    handshake_bytes_ = new HandshakeBytes;
+    protocol_        = new Protocol(rw);
+}
+
+Client::~Client()
+{
+    rs_freep(protocol_);
+    rs_freep(handshake_bytes_);
+}
+
+void Client::SetSendTimeout(int64_t timeout_us)
+{
+    protocol_->SetSendTimeout(timeout_us);
+}
+
+void Client::SetRecvTimeout(int64_t timeout_us)
+{
+    protocol_->SetRecvTimeout(timeout_us);
+}
+
+int Client::Handshake()
+{
+    int ret = ERROR_SUCCESS;
+
+    SimpleHandshake handshake;
+    if ((ret = handshake.HandshakeWithServer(handshake_bytes_, rw_)) !=
+        ERROR_SUCCESS) {
+        return ret;
+    }
+
+    rs_freep(handshake_bytes_);
+    handshake_bytes_ = new HandshakeBytes;
+
+    return ret;
+}
+
+int Client::ConnectApp(const std::string& app, const std::string& tc_url)
+{
+    int ret = ERROR_SUCCESS;
+
+    ConnectAppPacket* pkt = new ConnectAppPacket;
+    pkt->command_object->Set("app", AMF0Any::String(app));
+    pkt->command_object->Set("flashVer", AMF0Any::String("WIN 15,0,0,239"));
+    pkt->command_object->Set("swfUrl", AMF0Any::String(""));
+    pkt->command_object->Set("tcUrl", AMF0Any::String(tc_url));
+    pkt->command_object->Set("fpad", AMF0Any::Boolean(false));
+    pkt->command_object->Set("capabilities", AMF0Any::Number(239));
+    pkt->command_object->Set("audioCodecs", AMF0Any::Number(3575));
+    pkt->command_object->Set("videoCodecs", AMF0Any::Number(252));
+    pkt->command_object->Set("videoFunction", AMF0Any::Number(1));
+    pkt->command_object->Set("pageUrl", AMF0Any::String(""));
+    pkt->command_object->Set("objectEncoding", AMF0Any::Number(0));
+
+    if ((ret = protocol_->SendAndFreePacket(pkt, 0)) != ERROR_SUCCESS) {
+        rs_error("send connect app packet failed. ret=%d", ret);
+        return ret;
+    }
+
+    SetWindowAckSizePacket* ack     = new SetWindowAckSizePacket;
+    ack->ackowledgement_window_size = 2500000;
+    if ((ret = protocol_->SendAndFreePacket(ack, 0)) != ERROR_SUCCESS) {
+        rs_error("send set_ackowledgement_window_size packet failed. ret=%d",
+                 ret);
+        return ret;
+    }
+
+    CommonMessage*       msg = nullptr;
+    ConnectAppResPacket* res = nullptr;
+    if ((ret = protocol_->ExpectMessage<ConnectAppResPacket>(&msg, &res)) !=
+        ERROR_SUCCESS) {
+        rs_error("expect connect app response failed. ret=%d", ret);
+        return ret;
+    }
+
+    rs_auto_free(CommonMessage, msg);
+    rs_auto_free(ConnectAppResPacket, res);
+
+    AMF0Any* code = res->info->EnsurePropertyString("code");
+    if (code && code->ToString() != "NetConnection.Connect.Success") {
+        ret = ERROR_RTMP_REQ_CONNECT;
+        rs_error("connect app %s rejected, code=%s. ret=%d", tc_url.c_str(),
+                 code->ToString().c_str(), ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+int Client::CreateStream(int& stream_id)
+{
+    int ret = ERROR_SUCCESS;
+
+    CreateStreamPacket* pkt = new CreateStreamPacket;
+    if ((ret = protocol_->SendAndFreePacket(pkt, 0)) != ERROR_SUCCESS) {
+        rs_error("send create stream packet failed. ret=%d", ret);
+        return ret;
+    }
+
+    CommonMessage*         msg = nullptr;
+    CreateStreamResPacket* res = nullptr;
+    if ((ret = protocol_->ExpectMessage<CreateStreamResPacket>(&msg, &res)) !=
+        ERROR_SUCCESS) {
+        rs_error("expect create stream response failed. ret=%d", ret);
+        return ret;
+    }
+
+    rs_auto_free(CommonMessage, msg);
+    rs_auto_free(CreateStreamResPacket, res);
+
+    stream_id = (int)res->stream_id;
+
+    return ret;
+}
+
+int Client::Play(const std::string& stream, int stream_id)
+{
+    int ret = ERROR_SUCCESS;
+
+    PlayPacket* pkt  = new PlayPacket;
+    pkt->stream_name = stream;
+    if ((ret = protocol_->SendAndFreePacket(pkt, stream_id)) !=
+        ERROR_SUCCESS) {
+        rs_error("send play stream %s failed. ret=%d", stream.c_str(), ret);
+        return ret;
+    }
+
+    UserControlPacket* buffer = new UserControlPacket;
+    buffer->event_type        = (int16_t)UserEventType::SET_BUFFER_LEN;
+    buffer->event_data        = stream_id;
+    buffer->extra_data        = RTMP_CLIENT_BUFFER_MS;
+    if ((ret = protocol_->SendAndFreePacket(buffer, 0)) != ERROR_SUCCESS) {
+        rs_error("send set buffer length failed. ret=%d", ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+int Client::Publish(const std::string& stream, int& stream_id)
+{
+    int ret = ERROR_SUCCESS;
+
+    // the transactions follow the connect, their results are told apart by
+    // them
+    FMLEStartPacket* release = new FMLEStartPacket;
+    release->command_name    = RTMP_AMF0_COMMAND_RELEASE_STREAM;
+    release->transaction_id  = 2;
+    release->stream_name     = stream;
+    if ((ret = protocol_->SendAndFreePacket(release, 0)) != ERROR_SUCCESS) {
+        rs_error("send release stream %s failed. ret=%d", stream.c_str(), ret);
+        return ret;
+    }
+
+    FMLEStartPacket* fc_publish = new FMLEStartPacket;
+    fc_publish->command_name    = RTMP_AMF0_COMMAND_FC_PUBLISH;
+    fc_publish->transaction_id  = 3;
+    fc_publish->stream_name     = stream;
+    if ((ret = protocol_->SendAndFreePacket(fc_publish, 0)) != ERROR_SUCCESS) {
+        rs_error("send FCPublish %s failed. ret=%d", stream.c_str(), ret);
+        return ret;
+    }
+
+    CreateStreamPacket* create = new CreateStreamPacket;
+    create->transaction_id     = 4;
+    if ((ret = protocol_->SendAndFreePacket(create, 0)) != ERROR_SUCCESS) {
+        rs_error("send create stream packet failed. ret=%d", ret);
+        return ret;
+    }
+
+    CommonMessage*         msg = nullptr;
+    CreateStreamResPacket* res = nullptr;
+    if ((ret = protocol_->ExpectMessage<CreateStreamResPacket>(&msg, &res)) !=
+        ERROR_SUCCESS) {
+        rs_error("expect create stream response failed. ret=%d", ret);
+        return ret;
+    }
+
+    rs_auto_free(CommonMessage, msg);
+    rs_auto_free(CreateStreamResPacket, res);
+
+    stream_id = (int)res->stream_id;
+
+    PublishPacket* pkt  = new PublishPacket;
+    pkt->transaction_id = 5;
+    pkt->stream_name    = stream;
+    if ((ret = protocol_->SendAndFreePacket(pkt, stream_id)) !=
+        ERROR_SUCCESS) {
+        rs_error("send publish stream %s failed. ret=%d", stream.c_str(), ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+int Client::RecvMessage(CommonMessage** pmsg)
+{
+    return protocol_->RecvMessage(pmsg);
+}
+
+int Client::DecodeMessage(CommonMessage* msg, Packet** ppacket)
+{
+    return protocol_->DecodeMessage(msg, ppacket);
+}
+
+int Client::SendAndFreeMessages(SharedPtrMessage** msgs,
+                                int                nb_msgs,
+                                int                stream_id)
+{
+    return protocol_->SendAndFreeMessages(msgs, nb_msgs, stream_id);
+}
+
+}  // namespace rtmp
@@ -0,0 +1,44 @@
+#ifndef RS_RTMP_CLIENT_HPP
+#define RS_RTMP_CLIENT_HPP
+
+#include <common/core.hpp>
+#include <protocol/rtmp/handshake.hpp>
+#include <protocol/rtmp/message.hpp>
+#include <protocol/rtmp/packet.hpp>
+#include <protocol/rtmp/stack.hpp>
+
+#include <string>
+
+namespace rtmp {
+
+// the client side of an rtmp connection, to pull a stream from an origin or
+// to publish one to it.
+class Client {
+  public:
+    Client(IProtocolReaderWriter* rw);
+    virtual ~Client();
+
+  public:
+    virtual void SetSendTimeout(int64_t timeout_us);
+    virtual void SetRecvTimeout(int64_t timeout_us);
+    virtual int  Handshake();
+    virtual int  ConnectApp(const std::string& app, const std::string& tc_url);
+    virtual int  CreateStream(int& stream_id);
+    virtual int  Play(const std::string& stream, int stream_id);
+    // as an encoder does, releaseStream, FCPublish, createStream and publish
+    virtual int  Publish(const std::string& stream, int& stream_id);
+    virtual int  RecvMessage(CommonMessage** pmsg);
+    virtual int  DecodeMessage(CommonMessage* msg, Packet** ppacket);
+    virtual int  SendAndFreeMessages(SharedPtrMessage** msgs,
+                                     int                nb_msgs,
+                                     int                stream_id);
+
+  private:
+    IProtocolReaderWriter* rw_;
+    HandshakeBytes*        handshake_bytes_;
+    Protocol*              protocol_;
+};
+
+}  // namespace rtmp
+
+#endif
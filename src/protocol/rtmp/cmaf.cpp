@@ -0,0 +1,426 @@
+#include <common/config.hpp>
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/utils.hpp>
+#include <muxer/flv.hpp>
+#include <muxer/fmp4.hpp>
+#include <protocol/rtmp/cmaf.hpp>
+#include <protocol/rtmp/message.hpp>
+#include <protocol/rtmp/source.hpp>
+
+#include <sstream>
+
+namespace rtmp {
+
+CmafPart::CmafPart()
+{
+    start_time  = 0;
+    duration    = 0;
+    independent = false;
+    refs_       = 1;
+}
+
+CmafPart::~CmafPart() {}
+
+void CmafPart::AddRef()
+{
+    refs_++;
+}
+
+void CmafPart::Release()
+{
+    if (--refs_ > 0) {
+        return;
+    }
+
+    delete this;
+}
+
+Cmaf::Cmaf()
+{
+    source_       = nullptr;
+    request_      = nullptr;
+    enabled_      = false;
+    ended_        = false;
+    muxer_        = new fmp4::Muxer;
+    init_         = nullptr;
+    init_changed_ = false;
+    current_      = nullptr;
+    sequence_     = 0;
+    fragment_ms_  = 0;
+    part_ms_      = 0;
+    window_ms_    = 0;
+    max_bytes_    = 0;
+    bytes_        = 0;
+    update_       = st_cond_new();
+}
+
+Cmaf::~Cmaf()
+{
+    Clear();
+    rs_freep(muxer_);
+    st_cond_destroy(update_);
+}
+
+int Cmaf::Initialize(Source* source, Request* request)
+{
+    int ret = ERROR_SUCCESS;
+
+    source_  = source;
+    request_ = request;
+
+    return ret;
+}
+
+int Cmaf::OnPublish(Request* request)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (enabled_ || !_config->GetCmafEnabled(request_->vhost)) {
+        return ret;
+    }
+
+    fragment_ms_ = _config->GetCmafFragment(request_->vhost) * 1000;
+    part_ms_     = _config->GetCmafPartMS(request_->vhost);
+    window_ms_   = _config->GetCmafWindow(request_->vhost) * 1000;
+    max_bytes_   = _config->GetCmafMaxBytes(request_->vhost);
+
+    // the segments of the last publish go, the sequence goes on
+    Clear();
+    muxer_->Reset();
+
+    init_changed_ = true;
+    ended_        = false;
+    enabled_      = true;
+
+    return ret;
+}
+
+void Cmaf::OnUnpublish()
+{
+    if (!enabled_) {
+        return;
+    }
+
+    if (current_) {
+        flush_part();
+        close_segment();
+    }
+
+    enabled_ = false;
+    ended_   = true;
+    st_cond_broadcast(update_);
+}
+
+bool Cmaf::Enabled()
+{
+    return enabled_;
+}
+
+bool Cmaf::Ended()
+{
+    return ended_;
+}
+
+void Cmaf::Clear()
+{
+    while (!segments_.empty()) {
+        CmafSegment* segment = segments_.front();
+        segments_.pop_front();
+        free_segment(segment);
+    }
+    current_ = nullptr;
+    bytes_   = 0;
+
+    if (init_) {
+        init_->Release();
+        init_ = nullptr;
+    }
+}
+
+int64_t Cmaf::Bytes()
+{
+    return bytes_;
+}
+
+CmafPart* Cmaf::InitSegment()
+{
+    return init_;
+}
+
+int64_t Cmaf::LastSequence()
+{
+    if (segments_.empty()) {
+        return -1;
+    }
+    return segments_.back()->sequence;
+}
+
+CmafSegment* Cmaf::FetchSegment(int64_t sequence)
+{
+    if (segments_.empty() || sequence < segments_.front()->sequence) {
+        return nullptr;
+    }
+
+    size_t index = sequence - segments_.front()->sequence;
+    if (index >= segments_.size()) {
+        return nullptr;
+    }
+
+    return segments_[index];
+}
+
+void Cmaf::Wait(int timeout_ms)
+{
+    st_cond_timedwait(update_, timeout_ms * 1000);
+}
+
+void Cmaf::open_segment(int64_t timestamp)
+{
+    if (init_changed_) {
+        CmafPart* init = new CmafPart;
+        if (muxer_->EncodeInitSegment(init->data) == ERROR_SUCCESS) {
+            // the players sending the last one keep it
+            if (init_) {
+                init_->Release();
+            }
+            init_         = init;
+            init_changed_ = false;
+        }
+        else {
+            init->Release();
+        }
+    }
+
+    current_             = new CmafSegment;
+    current_->sequence   = sequence_++;
+    current_->start_time = timestamp;
+    current_->duration   = 0;
+    current_->completed  = false;
+    segments_.push_back(current_);
+
+    shrink();
+}
+
+void Cmaf::close_segment()
+{
+    current_->completed = true;
+    current_            = nullptr;
+    st_cond_broadcast(update_);
+}
+
+void Cmaf::free_segment(CmafSegment* segment)
+{
+    for (size_t i = 0; i < segment->parts.size(); i++) {
+        bytes_ -= segment->parts[i]->data.size();
+        segment->parts[i]->Release();
+    }
+    rs_freep(segment);
+}
+
+void Cmaf::shrink()
+{
+    // the window is of the completed segments, the players may still be
+    // fetching the oldest, they keep the parts they send
+    int64_t duration = 0;
+    for (size_t i = 0; i < segments_.size(); i++) {
+        duration += segments_[i]->duration;
+    }
+    while (segments_.size() > 2 &&
+           (duration > window_ms_ || bytes_ > max_bytes_)) {
+        CmafSegment* segment = segments_.front();
+        segments_.pop_front();
+
+        duration -= segment->duration;
+        free_segment(segment);
+    }
+
+    // the last completed segment goes too, rather than the bound
+    while (bytes_ > max_bytes_ && segments_.size() > 1 &&
+           segments_.front() != current_) {
+        CmafSegment* segment = segments_.front();
+        segments_.pop_front();
+        free_segment(segment);
+    }
+}
+
+int Cmaf::flush_part()
+{
+    int ret = ERROR_SUCCESS;
+
+    CmafPart* part = new CmafPart;
+    if ((ret = muxer_->EncodeFragment(part->data, part->start_time,
+                                      part->duration, part->independent)) !=
+            ERROR_SUCCESS ||
+        part->data.empty()) {
+        part->Release();
+        return ret;
+    }
+
+    current_->parts.push_back(part);
+    current_->duration =
+        part->start_time + part->duration - current_->start_time;
+    bytes_ += part->data.size();
+
+    shrink();
+
+    st_cond_broadcast(update_);
+
+    // a gop alone over the bound, e.g. of a stream without keyframes
+    if (bytes_ > max_bytes_) {
+        ret = ERROR_CMAF_OVERFLOW;
+        rs_warn("cmaf segment of %lld bytes exceeds %lld bytes. ret=%d",
+                (long long)bytes_, (long long)max_bytes_, ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+int Cmaf::on_frame(int64_t timestamp, bool cut)
+{
+    int ret = ERROR_SUCCESS;
+
+    // the frames queued but the last end the segment, the last, a keyframe
+    // for a stream with video, starts the next one
+    if (cut) {
+        if (current_) {
+            if ((ret = flush_part()) != ERROR_SUCCESS) {
+                return ret;
+            }
+            close_segment();
+        }
+        open_segment(timestamp);
+        return ret;
+    }
+
+    if (current_ && muxer_->QueuedDuration() >= part_ms_) {
+        return flush_part();
+    }
+
+    return ret;
+}
+
+int Cmaf::OnAudio(SharedPtrMessage* shared_audio)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!enabled_) {
+        return ret;
+    }
+
+    char*   payload   = shared_audio->payload;
+    int     size      = shared_audio->size;
+    int64_t timestamp = shared_audio->timestamp;
+
+    if (flv::Demuxer::IsAACSequenceHeader(payload, size)) {
+        init_changed_ = true;
+        return muxer_->WriteAudio(timestamp, payload, size);
+    }
+
+    // a stream with video waits for its keyframe
+    bool has_video = muxer_->HasVideo();
+    if (has_video && !current_) {
+        return ret;
+    }
+
+    if ((ret = muxer_->WriteAudio(timestamp, payload, size)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    bool cut = !has_video && (!current_ || timestamp - current_->start_time >=
+                                               fragment_ms_);
+
+    return on_frame(timestamp, cut);
+}
+
+int Cmaf::OnVideo(SharedPtrMessage* shared_video)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!enabled_) {
+        return ret;
+    }
+
+    char*   payload   = shared_video->payload;
+    int     size      = shared_video->size;
+    int64_t timestamp = shared_video->timestamp;
+
+    if (flv::Demuxer::IsAVCSequenceHeader(payload, size)) {
+        init_changed_ = true;
+        return muxer_->WriteVideo(timestamp, payload, size);
+    }
+
+    bool is_keyframe = flv::Demuxer::IsAVC(payload, size) &&
+                       flv::Demuxer::IsKeyFrame(payload, size);
+
+    // a segment starts with a keyframe
+    if (!current_ && !is_keyframe) {
+        return ret;
+    }
+
+    if ((ret = muxer_->WriteVideo(timestamp, payload, size)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    bool cut = is_keyframe && (!current_ || timestamp - current_->start_time >=
+                                                fragment_ms_);
+
+    return on_frame(timestamp, cut);
+}
+
+std::string Cmaf::Playlist()
+{
+    int64_t target = fragment_ms_;
+    for (size_t i = 0; i < segments_.size(); i++) {
+        target = rs_max(target, segments_[i]->duration);
+    }
+
+    std::stringstream ss;
+    ss.setf(std::ios::fixed);
+    ss.precision(3);
+
+    ss << "#EXTM3U\n"
+       << "#EXT-X-VERSION:6\n"
+       << "#EXT-X-TARGETDURATION:" << (target + 999) / 1000 << "\n"
+       << "#EXT-X-PART-INF:PART-TARGET=" << part_ms_ / 1000.0 << "\n"
+       << "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK="
+       << part_ms_ * 3 / 1000.0 << "\n";
+
+    if (!segments_.empty()) {
+        ss << "#EXT-X-MEDIA-SEQUENCE:" << segments_.front()->sequence << "\n";
+    }
+    ss << "#EXT-X-MAP:URI=\"init.mp4\"\n";
+
+    // the parts of the last segments only, the older are played whole
+    for (size_t i = 0; i < segments_.size(); i++) {
+        CmafSegment* segment = segments_[i];
+
+        if (i + 3 >= segments_.size()) {
+            for (size_t j = 0; j < segment->parts.size(); j++) {
+                CmafPart* part = segment->parts[j];
+                ss << "#EXT-X-PART:DURATION=" << part->duration / 1000.0
+                   << ",URI=\"" << segment->sequence << "." << j << ".m4s\""
+                   << (part->independent ? ",INDEPENDENT=YES" : "") << "\n";
+            }
+        }
+
+        if (segment->completed) {
+            ss << "#EXTINF:" << segment->duration / 1000.0 << ",\n"
+               << segment->sequence << ".m4s\n";
+        }
+    }
+
+    if (current_) {
+        ss << "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"" << current_->sequence
+           << "." << current_->parts.size() << ".m4s\"\n";
+    }
+
+    if (ended_) {
+        ss << "#EXT-X-ENDLIST\n";
+    }
+
+    return ss.str();
+}
+
+}  // namespace rtmp
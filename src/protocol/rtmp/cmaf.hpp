@@ -0,0 +1,118 @@
+#ifndef RS_RTMP_CMAF_HPP
+#define RS_RTMP_CMAF_HPP
+
+#include <common/core.hpp>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <st.h>
+
+namespace fmp4 {
+class Muxer;
+}
+
+namespace rtmp {
+
+class Source;
+class Request;
+class SharedPtrMessage;
+
+// a part of a segment, or the init segment, shared by the cmaf and the
+// players still sending it, which may outlive its segment
+class CmafPart {
+  public:
+    CmafPart();
+
+  public:
+    virtual void AddRef();
+    virtual void Release();
+
+  private:
+    virtual ~CmafPart();
+
+  public:
+    int64_t     start_time;
+    int64_t     duration;
+    // starts with a keyframe
+    bool        independent;
+    std::string data;
+
+  private:
+    int refs_;
+};
+
+struct CmafSegment
+{
+    int64_t                sequence;
+    int64_t                start_time;
+    int64_t                duration;
+    // no part will be added, the next segment began
+    bool                   completed;
+    std::vector<CmafPart*> parts;
+};
+
+// remuxes the published stream to cmaf segments cut on the keyframes, each
+// made of parts of a fraction of the gop, kept in memory for the http
+// players of this worker. the players wait on it for the next part. it is
+// started by the source for the first player, and the window is bounded by
+// its duration and bytes.
+class Cmaf {
+  public:
+    Cmaf();
+    virtual ~Cmaf();
+
+  public:
+    virtual int  Initialize(Source* source, Request* request);
+    virtual int  OnPublish(Request* request);
+    virtual void OnUnpublish();
+    virtual int  OnAudio(SharedPtrMessage* shared_audio);
+    virtual int  OnVideo(SharedPtrMessage* shared_video);
+
+  public:
+    // the stream is published, or was and its segments are still kept
+    virtual bool         Enabled();
+    virtual bool         Ended();
+    // the segments are freed, once stopped
+    virtual void         Clear();
+    virtual int64_t      Bytes();
+    // nullptr before the sequence headers, AddRef it to keep it
+    virtual CmafPart*    InitSegment();
+    virtual CmafSegment* FetchSegment(int64_t sequence);
+    // the sequence of the segment being made, -1 before the first
+    virtual int64_t      LastSequence();
+    virtual std::string  Playlist();
+    // until a part is added or the stream ends
+    virtual void         Wait(int timeout_ms);
+
+  private:
+    int  on_frame(int64_t timestamp, bool cut);
+    int  flush_part();
+    void open_segment(int64_t timestamp);
+    void close_segment();
+    void free_segment(CmafSegment* segment);
+    void shrink();
+
+  private:
+    Source*                  source_;
+    Request*                 request_;
+    bool                     enabled_;
+    bool                     ended_;
+    fmp4::Muxer*             muxer_;
+    CmafPart*                init_;
+    bool                     init_changed_;
+    std::deque<CmafSegment*> segments_;
+    CmafSegment*             current_;
+    int64_t                  sequence_;
+    int64_t                  fragment_ms_;
+    int64_t                  part_ms_;
+    int64_t                  window_ms_;
+    int64_t                  max_bytes_;
+    int64_t                  bytes_;
+    st_cond_t                update_;
+};
+
+}  // namespace rtmp
+
+#endif
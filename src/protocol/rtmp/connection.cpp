@@ -8,14 +8,18 @@
 #include <common/config.hpp>
 #include <common/error.hpp>
 #include <common/log.hpp>
+#include <common/uring.hpp>
 #include <common/utils.hpp>
 #include <protocol/rtmp/connection.hpp>
 #include <protocol/rtmp/consumer.hpp>
 #include <protocol/rtmp/defines.hpp>
+#include <protocol/rtmp/fast_start.hpp>
+#include <protocol/rtmp/merged_write.hpp>
 #include <protocol/rtmp/message.hpp>
 #include <protocol/rtmp/recv_thread.hpp>
 #include <protocol/rtmp/server.hpp>
 #include <protocol/rtmp/source.hpp>
+#include <protocol/rtmp/vod.hpp>
 
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -27,7 +31,12 @@ Connection::Connection(StreamServer* server, st_netfd_t stfd)
     : IConnection(server, stfd)
 {
     server_      = server;
-    socket_      = new StSocket(stfd);
+    if (UringLoop::Enabled()) {
+        socket_ = new UringSocket(stfd);
+    }
+    else {
+        socket_ = new StSocket(stfd);
+    }
     rtmp_        = new Server(socket_);
     request_     = new Request;
     response_    = new Response;
@@ -84,8 +93,8 @@ int32_t Connection::StreamServiceCycle()
     ConnType type;
 
     if ((ret = rtmp_->IdentifyClient(response_->stream_id, type,
-                                     request_->stream, request_->duration)) !=
-        ERROR_SUCCESS) {
+                                     request_->stream, request_->duration,
+                                     request_->start)) != ERROR_SUCCESS) {
         rs_error("identify client failed. ret=%d", ret);
         return ret;
     }
@@ -108,6 +117,14 @@ int32_t Connection::StreamServiceCycle()
         return ret;
     }
 
+    if (type == ConnType::PLAY) {
+        std::string path = VodFile::Path(request_);
+        if (!path.empty()) {
+            type_ = type;
+            return PlayingVod(path);
+        }
+    }
+
     Source* source = nullptr;
     if ((ret = Source::FetchOrCreate(request_, server_, &source)) !=
         ERROR_SUCCESS) {
@@ -146,7 +163,7 @@ int32_t Connection::StreamServiceCycle()
 void Connection::release_publish(Source* source, bool is_edge)
 {
     if (is_edge) {
-        // TODO
+        source->OnEdgeProxyUnpublish();
     }
     else {
         source->OnUnpublish();
@@ -158,7 +175,7 @@ int32_t Connection::Publishing(Source* source)
     int ret = ERROR_SUCCESS;
 
     bool vhost_is_edge = _config->GetVhostIsEdge(request_->vhost);
-    if ((ret = acquire_publish(source, false)) == ERROR_SUCCESS) {
+    if ((ret = acquire_publish(source, vhost_is_edge)) == ERROR_SUCCESS) {
         PublishRecvThread recv_thread(
             rtmp_, request_, st_netfd_fileno(client_stfd_), 0, this, source,
             type_ != ConnType::FLASH_PUBLISH, vhost_is_edge);
@@ -182,6 +199,22 @@ int32_t Connection::do_playing(Source*          source,
     int          ret = ERROR_SUCCESS;
     MessageArray msgs(RTMP_MR_MSGS);
 
+    MergedWriteTuner tuner;
+    tuner.Initialize(st_netfd_fileno(client_stfd_),
+                     _config->GetMWAdaptive(request_->vhost),
+                     _config->GetMWMinSleepMS(request_->vhost), mw_sleep_,
+                     _config->GetMWBatchBytes(request_->vhost));
+    consumer->SetLowLatency(_config->GetLowLatency(request_->vhost));
+
+    // the cached gop goes at once, then the merged write paces the stream
+    FastStart fast_start;
+    if (_config->GetJoinStrategy(request_->vhost) == "burst") {
+        fast_start.Initialize(st_netfd_fileno(client_stfd_),
+                              _config->GetJoinBurstRate(request_->vhost),
+                              consumer->JoinBacklogBytes(),
+                              consumer->JoinBacklogMS());
+    }
+
     while (!disposed_) {
         if (expired_) {
             ret = ERROR_USER_DISCONNECT;
@@ -204,7 +237,10 @@ int32_t Connection::do_playing(Source*          source,
             return ret;
         }
 
-        consumer->Wait(RTMP_MR_MIN_MSGS, mw_sleep_);
+        bool bursting = fast_start.Bursting();
+        if (!bursting) {
+            consumer->Wait(tuner.MinMsgs(), tuner.SleepMS());
+        }
 
         int count = 0;
         if ((ret = consumer->DumpPackets(&msgs, count)) != ERROR_SUCCESS) {
@@ -213,18 +249,105 @@ int32_t Connection::do_playing(Source*          source,
         }
 
         if (count <= 0) {
-            rs_info("mw sleep %dms for no msg", mw_sleep_);
-            st_usleep(mw_sleep_ * 1000);
+            fast_start.StopBurst();
+            rs_info("mw sleep %dms for no msg", tuner.SleepMS());
+            st_usleep(tuner.SleepMS() * 1000);
             continue;
         }
 
-        if ((ret = rtmp_->SendAndFreeMessages(
-                 msgs.msgs, count, response_->stream_id)) != ERROR_SUCCESS) {
+        int nb_bytes = 0;
+        for (int i = 0; i < count; i++) {
+            nb_bytes += msgs.msgs[i]->size;
+        }
+
+        ret = rtmp_->SendMessages(msgs.msgs, count, response_->stream_id);
+
+        int delay_ms = 0;
+        if (ret == ERROR_SUCCESS) {
+            delay_ms = fast_start.OnSend(msgs.msgs, count, nb_bytes);
+        }
+        consumer->ReleasePackets(&msgs, count);
+        if (!bursting) {
+            tuner.OnSend(count, nb_bytes);
+        }
+
+        if (ret != ERROR_SUCCESS) {
             if (!is_client_gracefully_close(ret)) {
                 rs_error("send messages to client failed. ret=%d", ret);
             }
             return ret;
         }
+
+        if (delay_ms > 0) {
+            st_usleep(delay_ms * 1000);
+        }
+    }
+
+    return ret;
+}
+
+int32_t Connection::do_playing_vod(VodPlayer*       player,
+                                   QueueRecvThread* recv_thread)
+{
+    int ret = ERROR_SUCCESS;
+
+    while (!disposed_) {
+        if (expired_) {
+            ret = ERROR_USER_DISCONNECT;
+            rs_error("connection expired. ret=%d", ret);
+            return ret;
+        }
+
+        while (!recv_thread->Empty()) {
+            CommonMessage* msg = recv_thread->Pump();
+            rs_auto_free(CommonMessage, msg);
+
+            if (!msg->header.IsAMF0Command() && !msg->header.IsAMF3Command()) {
+                continue;
+            }
+
+            Packet* packet = nullptr;
+            if ((ret = rtmp_->DecodeMessage(msg, &packet)) != ERROR_SUCCESS) {
+                rs_error("decode play control message failed. ret=%d", ret);
+                return ret;
+            }
+            rs_auto_free(Packet, packet);
+
+            if (dynamic_cast<SeekPacket*>(packet)) {
+                SeekPacket* pkt = dynamic_cast<SeekPacket*>(packet);
+                if ((ret = player->Seek((int64_t)pkt->offset)) !=
+                    ERROR_SUCCESS) {
+                    return ret;
+                }
+                if ((ret = rtmp_->OnPlaySeek(response_->stream_id)) !=
+                    ERROR_SUCCESS) {
+                    rs_error("response seek failed. ret=%d", ret);
+                    return ret;
+                }
+            }
+        }
+
+        if ((ret = recv_thread->ErrorCode()) != ERROR_SUCCESS) {
+            if (!is_client_gracefully_close(ret) &&
+                !is_system_control_error(ret)) {
+                rs_error("recv thread failed. ret=%d", ret);
+            }
+            return ret;
+        }
+
+        int sleep_ms = 0;
+        if ((ret = player->Cycle(&sleep_ms)) != ERROR_SUCCESS) {
+            if (ret == ERROR_SYSTEM_FILE_EOF) {
+                // the play ends, the client may play again on the connection
+                rs_trace("vod play finished");
+                return rtmp_->OnPlayComplete(response_->stream_id);
+            }
+            return ret;
+        }
+
+        if (sleep_ms > 0) {
+            st_usleep(sleep_ms * 1000);
+        }
     }
 
     return ret;
@@ -234,20 +357,30 @@ int32_t Connection::Playing(Source* source)
 {
     int ret = ERROR_SUCCESS;
 
+    // a start in the past of a live stream, played from its time shift
+    int64_t shift_ms =
+        request_->start > 0 ? (int64_t)(request_->start * 1000) : 0;
+
     Consumer* consumer = nullptr;
-    if ((ret = source->CreateConsumer(this, consumer)) != ERROR_SUCCESS) {
+    if ((ret = source->CreateConsumer(this, consumer, true, true, true,
+                                      shift_ms)) != ERROR_SUCCESS) {
         rs_error("create consumer failed. ret=%d", ret);
         return ret;
     }
 
     rs_auto_free(Consumer, consumer);
 
+    mw_sleep_ = _config->GetMWSleepMS(request_->vhost);
+
     QueueRecvThread recv_thread(consumer, rtmp_, mw_sleep_);
     if ((ret = recv_thread.Start()) != ERROR_SUCCESS) {
         rs_error("start isolate recv thread failed. ret=%d", ret);
         return ret;
     }
 
+    rtmp_->SetZeroCopy(_config->GetZeroCopyEnabled(request_->vhost),
+                       _config->GetZeroCopyThreshold(request_->vhost));
+
     wakeable_ = consumer;
     ret       = do_playing(source, consumer, &recv_thread);
     wakeable_ = nullptr;
@@ -260,6 +393,51 @@ int32_t Connection::Playing(Source* source)
     return ret;
 }
 
+int32_t Connection::PlayingVod(const std::string& path)
+{
+    int ret = ERROR_SUCCESS;
+
+    VodFile* file = nullptr;
+    if ((ret = VodFile::Fetch(path, &file)) != ERROR_SUCCESS) {
+        rs_error("open vod %s failed. ret=%d", path.c_str(), ret);
+        return ret;
+    }
+
+    // the player releases the file
+    VodPlayer player(rtmp_, response_->stream_id);
+    int       buffer_ms = _config->GetVodBufferMS(request_->vhost);
+    if ((ret = player.Initialize(file, buffer_ms)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if ((ret = rtmp_->StartPlay(response_->stream_id)) != ERROR_SUCCESS) {
+        rs_error("start to play vod failed. ret=%d", ret);
+        return ret;
+    }
+
+    mw_sleep_ = _config->GetMWSleepMS(request_->vhost);
+
+    QueueRecvThread recv_thread(nullptr, rtmp_, mw_sleep_);
+    if ((ret = recv_thread.Start()) != ERROR_SUCCESS) {
+        rs_error("start isolate recv thread failed. ret=%d", ret);
+        return ret;
+    }
+
+    rtmp_->SetZeroCopy(_config->GetZeroCopyEnabled(request_->vhost),
+                       _config->GetZeroCopyThreshold(request_->vhost));
+
+    rs_trace("start play vod %s", path.c_str());
+
+    ret = do_playing_vod(&player, &recv_thread);
+
+    recv_thread.Stop();
+
+    if (!recv_thread.Empty()) {
+        rs_warn("drop received %d messages", recv_thread.Size());
+    }
+    return ret;
+}
+
 int32_t Connection::ServiceCycle()
 {
     int ret = ERROR_SUCCESS;
@@ -323,8 +501,13 @@ int Connection::process_publish_message(Source*        source,
                                         bool           is_edge)
 {
     int ret = ERROR_SUCCESS;
+    // the origin gets the stream, the players of the edge pull it back
     if (is_edge) {
-        // TODO implement edge opt
+        if ((ret = source->OnEdgeProxyPublish(msg)) != ERROR_SUCCESS) {
+            rs_error("edge publish proxy message failed. ret=%d", ret);
+            return ret;
+        }
+        return ret;
     }
 
     if (msg->header.IsAudio()) {
@@ -446,7 +629,12 @@ int Connection::acquire_publish(Source* source, bool is_edge)
         return ret;
     }
 
-    if (is_edge) {}
+    if (is_edge) {
+        if ((ret = source->OnEdgeStartPublish()) != ERROR_SUCCESS) {
+            rs_error("notify edge start publish failed. ret=%d", ret);
+            return ret;
+        }
+    }
     else {
         if ((ret = source->OnPublish()) != ERROR_SUCCESS) {
             rs_error("notify publish failed. ret=%d", ret);
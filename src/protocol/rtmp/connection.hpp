@@ -24,6 +24,7 @@ class Response;
 class Request;
 class CommonMessage;
 class IWakeable;
+class VodPlayer;
 
 class Connection : virtual public IConnection {
     friend class PublishRecvThread;
@@ -46,6 +47,7 @@ class Connection : virtual public IConnection {
     virtual int32_t ServiceCycle();
     virtual int32_t Publishing(Source* source);
     virtual int32_t Playing(Source* source);
+    virtual int32_t PlayingVod(const std::string& path);
     // IConnection
     virtual int32_t do_cycle() override;
 
@@ -62,18 +64,19 @@ class Connection : virtual public IConnection {
     int  do_playing(Source*          source,
                     Consumer*        consumer,
                     QueueRecvThread* recv_thread);
+    int  do_playing_vod(VodPlayer* player, QueueRecvThread* recv_thread);
     void release_publish(Source* source, bool is_edge);
 
   private:
-    StreamServer* server_;
-    StSocket*     socket_;
-    Server*       rtmp_;
-    Request*      request_;
-    Response*     response_;
-    ConnType      type_;
-    bool          tcp_nodelay_;
-    int           mw_sleep_;
-    IWakeable*    wakeable_;
+    StreamServer*          server_;
+    IProtocolReaderWriter* socket_;
+    Server*                rtmp_;
+    Request*               request_;
+    Response*              response_;
+    ConnType               type_;
+    bool                   tcp_nodelay_;
+    int                    mw_sleep_;
+    IWakeable*             wakeable_;
 
     int publish_first_pkt_timeout_;
     int publish_normal_pkt_timeout_;
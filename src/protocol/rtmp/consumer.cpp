@@ -1,5 +1,8 @@
 #include <common/error.hpp>
+#include <muxer/flv.hpp>
 #include <protocol/rtmp/consumer.hpp>
+#include <protocol/rtmp/defines.hpp>
+#include <protocol/rtmp/gop_cache.hpp>
 #include <protocol/rtmp/jitter.hpp>
 #include <protocol/rtmp/message.hpp>
 #include <protocol/rtmp/source.hpp>
@@ -12,34 +15,88 @@ IWakeable::~IWakeable() {}
 
 Consumer::Consumer(Source* s, IConnection* c)
 {
+    jitter_enabled_          = true;
+    mw_waiting_              = false;
+    low_latency_             = false;
+    pause_                   = false;
+    mw_min_msgs_             = 0;
+    mw_duration_             = 0;
+    list_                    = nullptr;
+    list_index_              = -1;
     source_                  = s;
     conn_                    = c;
-    pause_                   = false;
-    jitter_                  = new Jitter;
-    queue_                   = new MessageQueue;
     should_update_source_id_ = false;
     mw_wait_                 = st_cond_new();
-    mw_waiting_              = false;
-    mw_min_msgs_             = 0;
-    mw_duration_             = 0;
+    ring_                    = nullptr;
+    cursor_                  = 0;
+    envelopes_               = nullptr;
+    queue_size_ms_           = 0;
+    shift_                   = nullptr;
+    shift_delay_ms_          = 0;
+    wait_keyframe_           = false;
+    join_bytes_              = 0;
+    join_ms_                 = 0;
 }
 
 Consumer::~Consumer()
 {
     source_->OnConsumerDestroy(this);
-    rs_freep(jitter_);
-    rs_freep(queue_);
+    rs_freepa(envelopes_);
     st_cond_destroy(mw_wait_);
 }
 
 void Consumer::SetQueueSize(double second)
 {
-    queue_->SetQueueSize(second);
+    queue_.SetQueueSize(second);
+    queue_size_ms_ = (int)(second * 1000);
+}
+
+void Consumer::AttachRing(MessageRing* ring)
+{
+    ring_   = ring;
+    cursor_ = ring->End();
+
+    if (!envelopes_) {
+        envelopes_ = new SharedPtrMessage[RTMP_MR_MSGS];
+    }
+}
+
+void Consumer::AttachTimeShift(GopCache* cache, int64_t cursor, int delay_ms)
+{
+    shift_          = cache;
+    cursor_         = cursor;
+    shift_delay_ms_ = delay_ms;
+
+    if (!envelopes_) {
+        envelopes_ = new SharedPtrMessage[RTMP_MR_MSGS];
+    }
+}
+
+void Consumer::OnRingPush(bool atc)
+{
+    check_time_shift();
+
+    if (shift_) {
+        wake_if_matched(atc, shift_->At(shift_->End() - 1));
+        return;
+    }
+
+    wake_if_matched(atc, ring_->At(ring_->End() - 1));
+}
+
+void Consumer::SetJitterEnabled(bool enabled)
+{
+    jitter_enabled_ = enabled;
+}
+
+void Consumer::SetLowLatency(bool enabled)
+{
+    low_latency_ = enabled;
 }
 
 int Consumer::GetTime()
 {
-    return jitter_->GetTime();
+    return jitter_.GetTime();
 }
 
 int Consumer::Enqueue(SharedPtrMessage* shared_msg,
@@ -48,39 +105,110 @@ int Consumer::Enqueue(SharedPtrMessage* shared_msg,
 {
     int ret = ERROR_SUCCESS;
 
+    check_time_shift();
+
+    // the time shifted player gets the audio and video from the buffer, the
+    // sequence headers and metadata as they come
+    if (shift_ && shared_msg->IsAV() &&
+        !flv::Demuxer::IsAVCSequenceHeader(shared_msg->payload,
+                                           shared_msg->size) &&
+        !flv::Demuxer::IsAACSequenceHeader(shared_msg->payload,
+                                           shared_msg->size)) {
+        wake_if_matched(atc, shared_msg);
+        return ret;
+    }
+
+    if (drop_for_keyframe(shared_msg)) {
+        return ret;
+    }
+
     SharedPtrMessage* msg = shared_msg->Copy();
 
-    if (!atc) {
-        if ((ret = jitter_->Correct(msg, ag)) != ERROR_SUCCESS) {
+    if (!atc && jitter_enabled_) {
+        if ((ret = jitter_.Correct(msg, ag)) != ERROR_SUCCESS) {
             rs_freep(msg);
             return ret;
         }
     }
 
-    if ((ret = queue_->Enqueue(msg, nullptr)) != ERROR_SUCCESS) {
+    if ((ret = queue_.Enqueue(msg, nullptr)) != ERROR_SUCCESS) {
         return ret;
     }
 
-    if (mw_waiting_) {
-        int  duration_ms    = queue_->Duration();
-        bool match_min_msgs = queue_->Size() > mw_min_msgs_;
+    wake_if_matched(atc, msg);
 
-        // for atc,maybe the sequeue header timestamp bigger than A/V packet
-        // when encode republish or overflow
-        if (atc && duration_ms < 0) {
-            st_cond_signal(mw_wait_);
-            mw_waiting_ = false;
-            return ret;
-        }
+    return ret;
+}
+
+void Consumer::wake_if_matched(bool atc, SharedPtrMessage* msg)
+{
+    if (!mw_waiting_) {
+        return;
+    }
 
-        if (match_min_msgs && duration_ms > mw_duration_) {
+    if (low_latency_ && msg) {
+        bool flush = msg->IsAudio() ||
+                     (msg->IsVideo() &&
+                      flv::Demuxer::IsKeyFrame(msg->payload, msg->size));
+        if (flush) {
             st_cond_signal(mw_wait_);
-            mw_waiting_ = false;
-            return ret;
+            set_waiting(false);
+            return;
         }
     }
 
-    return ret;
+    int  duration_ms    = pending_duration();
+    bool match_min_msgs = pending_count() > mw_min_msgs_;
+
+    // for atc,maybe the sequeue header timestamp bigger than A/V packet
+    // when encode republish or overflow
+    if (atc && duration_ms < 0) {
+        st_cond_signal(mw_wait_);
+        set_waiting(false);
+        return;
+    }
+
+    if (match_min_msgs && duration_ms > mw_duration_) {
+        st_cond_signal(mw_wait_);
+        set_waiting(false);
+        return;
+    }
+}
+
+int Consumer::pending_count()
+{
+    int count = queue_.Size();
+
+    if (ring_) {
+        count += (int)(ring_->End() - rs_max(cursor_, ring_->Begin()));
+    }
+
+    if (shift_) {
+        count += (int)(shift_->End() - rs_max(cursor_, shift_->Begin()));
+    }
+
+    return count;
+}
+
+int Consumer::pending_duration()
+{
+    int duration_ms = queue_.Duration();
+
+    if (ring_ && cursor_ < ring_->End()) {
+        SharedPtrMessage* first = ring_->At(rs_max(cursor_, ring_->Begin()));
+        SharedPtrMessage* last  = ring_->At(ring_->End() - 1);
+        duration_ms =
+            rs_max(duration_ms, (int)(last->timestamp - first->timestamp));
+    }
+
+    // what is delay_ms behind the last message of the buffer
+    if (shift_ && shift_->Skip(cursor_) < shift_->End()) {
+        SharedPtrMessage* first = shift_->At(shift_->Skip(cursor_));
+        int64_t           due   = shift_->LastTimestamp() - shift_delay_ms_;
+        duration_ms = rs_max(duration_ms, (int)(due - first->timestamp));
+    }
+
+    return duration_ms;
 }
 
 int Consumer::DumpPackets(MessageArray* msg_arr, int& count)
@@ -100,14 +228,176 @@ int Consumer::DumpPackets(MessageArray* msg_arr, int& count)
         return ret;
     }
 
-    if ((ret = queue_->DumpPackets(max, msg_arr->msgs, count)) !=
+    check_time_shift();
+
+    if ((ret = queue_.DumpPackets(max, msg_arr->msgs, count)) !=
         ERROR_SUCCESS) {
         return ret;
     }
 
+    if (ring_ && count < max) {
+        int nb_ring = 0;
+        if ((ret = dump_ring(msg_arr->msgs + count, max - count, nb_ring)) !=
+            ERROR_SUCCESS) {
+            return ret;
+        }
+        count += nb_ring;
+    }
+
+    if (shift_ && count < max) {
+        int nb_shift = 0;
+        if ((ret = dump_shift(msg_arr->msgs + count, max - count, nb_shift)) !=
+            ERROR_SUCCESS) {
+            return ret;
+        }
+        count += nb_shift;
+    }
+
+    return ret;
+}
+
+int Consumer::dump_ring(SharedPtrMessage** pmsgs, int max, int& count)
+{
+    int ret = ERROR_SUCCESS;
+
+    count = 0;
+
+    // overflow, the messages behind the cursor were overwritten or the player
+    // is too slow, skip to the latest keyframe instead of shrinking a queue
+    int64_t keyframe = ring_->LastKeyframe();
+    if (cursor_ < ring_->Begin()) {
+        cursor_ = keyframe >= 0 ? keyframe : ring_->End();
+        rs_warn("consumer overflow, skip to seq=%lld", cursor_);
+    }
+    else if (keyframe > cursor_ && pending_duration() > queue_size_ms_) {
+        cursor_ = keyframe;
+        rs_warn("consumer lag over %dms, skip to seq=%lld", queue_size_ms_,
+                cursor_);
+    }
+
+    int nb_msgs = rs_min(max, RTMP_MR_MSGS);
+    while (count < nb_msgs && cursor_ < ring_->End()) {
+        SharedPtrMessage* shared = ring_->At(cursor_++);
+        if (drop_for_keyframe(shared)) {
+            continue;
+        }
+
+        SharedPtrMessage* msg = &envelopes_[count];
+        msg->Assign(shared);
+
+        if (!source_->IsATC() && jitter_enabled_) {
+            if ((ret = jitter_.Correct(msg, source_->GetJitterAlgorithm())) !=
+                ERROR_SUCCESS) {
+                msg->Reset();
+                return ret;
+            }
+        }
+
+        pmsgs[count++] = msg;
+    }
+
+    return ret;
+}
+
+int Consumer::dump_shift(SharedPtrMessage** pmsgs, int max, int& count)
+{
+    int ret = ERROR_SUCCESS;
+
+    count = 0;
+
+    // the gops behind the cursor left the buffer, or it was cleared by a
+    // republish, go on from its oldest keyframe
+    if (cursor_ < shift_->Begin()) {
+        int64_t keyframe = shift_->Seek(shift_->TimeShift());
+        cursor_          = keyframe >= 0 ? keyframe : shift_->End();
+        rs_warn("time shift overflow, skip to seq=%lld", cursor_);
+    }
+
+    int64_t due     = shift_->LastTimestamp() - shift_delay_ms_;
+    int     nb_msgs = rs_min(max, RTMP_MR_MSGS);
+    while (count < nb_msgs && cursor_ < shift_->End()) {
+        SharedPtrMessage* shared = shift_->At(cursor_);
+        if (!shared) {
+            cursor_++;
+            continue;
+        }
+        if (shared->timestamp > due) {
+            break;
+        }
+        cursor_++;
+
+        SharedPtrMessage* msg = &envelopes_[count];
+        msg->Assign(shared);
+
+        if (!source_->IsATC() && jitter_enabled_) {
+            if ((ret = jitter_.Correct(msg, source_->GetJitterAlgorithm())) !=
+                ERROR_SUCCESS) {
+                msg->Reset();
+                return ret;
+            }
+        }
+
+        pmsgs[count++] = msg;
+    }
+
     return ret;
 }
 
+void Consumer::check_time_shift()
+{
+    if (!shift_ || shift_->TimeShifting()) {
+        return;
+    }
+
+    // the messages behind the cursor are dropped, the player goes on with
+    // the live ones, from the last keyframe of the shared ring if any
+    rs_warn("time shift stopped by the gop cache, play live. seq=%lld",
+            cursor_);
+    shift_  = nullptr;
+    cursor_ = 0;
+
+    MessageRing* ring = source_->GetRing();
+    if (ring) {
+        AttachRing(ring);
+        if (ring->LastKeyframe() >= 0) {
+            cursor_ = ring->LastKeyframe();
+        }
+    }
+}
+
+bool Consumer::drop_for_keyframe(SharedPtrMessage* msg)
+{
+    if (!wait_keyframe_ || !msg->IsVideo() ||
+        flv::Demuxer::IsAVCSequenceHeader(msg->payload, msg->size)) {
+        return false;
+    }
+
+    if (flv::Demuxer::IsKeyFrame(msg->payload, msg->size)) {
+        wait_keyframe_ = false;
+        return false;
+    }
+
+    return true;
+}
+
+void Consumer::ReleasePackets(MessageArray* msg_arr, int count)
+{
+    for (int i = 0; i < count; i++) {
+        SharedPtrMessage* msg = msg_arr->msgs[i];
+
+        // the envelopes are reused by the next dump
+        if (envelopes_ && msg >= envelopes_ &&
+            msg < envelopes_ + RTMP_MR_MSGS) {
+            msg->Reset();
+        }
+        else {
+            rs_freep(msg);
+        }
+
+        msg_arr->msgs[i] = nullptr;
+    }
+}
+
 void Consumer::Wait(int nb_msgs, int duration)
 {
     if (pause_) {
@@ -118,23 +408,43 @@ void Consumer::Wait(int nb_msgs, int duration)
     mw_min_msgs_ = nb_msgs;
     mw_duration_ = duration;
 
-    int  duration_ms    = queue_->Duration();
-    bool match_min_msgs = queue_->Size() > mw_min_msgs_;
+    int  duration_ms    = pending_duration();
+    bool match_min_msgs = pending_count() > mw_min_msgs_;
 
-    if (match_min_msgs && duration_ms > mw_min_msgs_) {
+    if (match_min_msgs && duration_ms > mw_duration_) {
         return;
     }
 
-    mw_waiting_ = true;
+    // the merged write never holds the messages longer than duration
+    set_waiting(true);
+
+    if (duration < 0) {
+        st_cond_wait(mw_wait_);
+    }
+    else {
+        st_cond_timedwait(mw_wait_, duration * 1000);
+    }
 
-    st_cond_wait(mw_wait_);
+    set_waiting(false);
 }
 
 void Consumer::WakeUp()
 {
     if (mw_waiting_) {
         st_cond_signal(mw_wait_);
-        mw_waiting_ = false;
+        set_waiting(false);
+    }
+}
+
+void Consumer::set_waiting(bool waiting)
+{
+    if (mw_waiting_ == waiting) {
+        return;
+    }
+
+    mw_waiting_ = waiting;
+    if (list_) {
+        list_->SetWaiting(this, waiting);
     }
 }
 
@@ -152,4 +462,83 @@ void Consumer::UpdateSourceID()
     should_update_source_id_ = true;
 }
 
+void Consumer::SetJoinBacklog(int64_t bytes, int duration_ms)
+{
+    join_bytes_ = bytes;
+    join_ms_    = duration_ms;
+}
+
+void Consumer::DropToKeyframe()
+{
+    wait_keyframe_ = true;
+}
+
+int64_t Consumer::JoinBacklogBytes()
+{
+    return join_bytes_;
+}
+
+int Consumer::JoinBacklogMS()
+{
+    return join_ms_;
+}
+
+ConsumerList::ConsumerList() {}
+
+ConsumerList::~ConsumerList() {}
+
+int ConsumerList::Size()
+{
+    return (int)consumers_.size();
+}
+
+bool ConsumerList::Empty()
+{
+    return consumers_.empty();
+}
+
+Consumer* ConsumerList::At(int index)
+{
+    return consumers_[index];
+}
+
+bool ConsumerList::Waiting(int index)
+{
+    return waiting_[index];
+}
+
+void ConsumerList::Add(Consumer* consumer)
+{
+    consumer->list_       = this;
+    consumer->list_index_ = (int)consumers_.size();
+    consumers_.push_back(consumer);
+    waiting_.push_back(consumer->mw_waiting_);
+}
+
+bool ConsumerList::Remove(Consumer* consumer)
+{
+    int index = consumer->list_index_;
+    if (consumer->list_ != this || index < 0 ||
+        index >= (int)consumers_.size() || consumers_[index] != consumer) {
+        return false;
+    }
+
+    Consumer* last    = consumers_.back();
+    last->list_index_ = index;
+    consumers_[index] = last;
+    waiting_[index]   = waiting_.back();
+    consumers_.pop_back();
+    waiting_.pop_back();
+
+    consumer->list_       = nullptr;
+    consumer->list_index_ = -1;
+
+    return true;
+}
+
+void ConsumerList::SetWaiting(Consumer* consumer, bool waiting)
+{
+    waiting_[consumer->list_index_] = waiting;
+}
+
 }  // namespace rtmp
\ No newline at end of file
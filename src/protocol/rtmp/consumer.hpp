@@ -8,15 +8,17 @@
 
 #include <common/connection.hpp>
 #include <common/core.hpp>
+#include <protocol/rtmp/jitter.hpp>
+#include <protocol/rtmp/message.hpp>
+
+#include <vector>
 
 namespace rtmp {
 
-enum class JitterAlgorithm;
-class SharedPtrMessage;
-class MessageArray;
-class MessageQueue;
+class MessageRing;
+class GopCache;
 class Source;
-class Jitter;
+class ConsumerList;
 
 class IWakeable {
   public:
@@ -28,33 +30,104 @@ class IWakeable {
 };
 
 class Consumer : public IWakeable {
+    friend class ConsumerList;
+
   public:
     Consumer(Source* s, IConnection* c);
     virtual ~Consumer();
 
   public:
     virtual void SetQueueSize(double queue_size);
+    virtual void SetJitterEnabled(bool enabled);
+    // flush every audio frame and video keyframe without merging
+    virtual void SetLowLatency(bool enabled);
+    virtual void AttachRing(MessageRing* ring);
+    // the live messages are played from the buffer of the cache instead,
+    // from cursor and delay_ms behind its last message
+    virtual void AttachTimeShift(GopCache* cache, int64_t cursor, int delay_ms);
+    // only the consumers waiting for messages are told
+    virtual void OnRingPush(bool atc);
     virtual int  GetTime();
     virtual int
                  Enqueue(SharedPtrMessage* shared_msg, bool atc, JitterAlgorithm ag);
     virtual int  DumpPackets(MessageArray* msg_arr, int& count);
+    virtual void ReleasePackets(MessageArray* msg_arr, int count);
     virtual void Wait(int nb_msgs, int duration);
     virtual int  OnPlayClientPause(bool is_pause);
     virtual void UpdateSourceID();
+    // the player joined with a keyframe alone, the video after it refers to
+    // frames it did not get and is dropped until the next keyframe
+    virtual void    DropToKeyframe();
+    // the cached gop the player joined with, for its fast start
+    virtual void    SetJoinBacklog(int64_t bytes, int duration_ms);
+    virtual int64_t JoinBacklogBytes();
+    virtual int     JoinBacklogMS();
     // IWakeable
     virtual void WakeUp() override;
 
   private:
+    virtual int  dump_ring(SharedPtrMessage** pmsgs, int max, int& count);
+    virtual int  dump_shift(SharedPtrMessage** pmsgs, int max, int& count);
+    // the time shift is detached when the cache stopped keeping it
+    virtual void check_time_shift();
+    virtual bool drop_for_keyframe(SharedPtrMessage* msg);
+    virtual int  pending_count();
+    virtual int  pending_duration();
+    virtual void wake_if_matched(bool atc, SharedPtrMessage* msg);
+    virtual void set_waiting(bool waiting);
+
+  private:
+    // held by value, an enqueue follows the pointer to the consumer only
+    MessageQueue queue_;
+    Jitter       jitter_;
+    bool         jitter_enabled_;
+    bool         mw_waiting_;
+    bool         low_latency_;
+    bool         pause_;
+    int          mw_min_msgs_;
+    int          mw_duration_;
+    // the place in the list of the source
+    ConsumerList* list_;
+    int           list_index_;
     Source*       source_;
     IConnection*  conn_;
-    bool          pause_;
-    Jitter*       jitter_;
-    MessageQueue* queue_;
     bool          should_update_source_id_;
     st_cond_t     mw_wait_;
-    bool          mw_waiting_;
-    int           mw_min_msgs_;
-    int           mw_duration_;
+    // shared ring delivery
+    MessageRing*      ring_;
+    int64_t           cursor_;
+    SharedPtrMessage* envelopes_;
+    int               queue_size_ms_;
+    // time shift delivery, from the same cursor
+    GopCache*         shift_;
+    int               shift_delay_ms_;
+    bool              wait_keyframe_;
+    int64_t           join_bytes_;
+    int               join_ms_;
+};
+
+// the pointers to the consumers of a source in a dense row. a consumer keeps
+// its index in it, so it is removed at once by moving the last one to its
+// place. whether they wait for messages is kept aside in a row of flags, the
+// fan-out of the shared ring only goes to the consumers it wakes up, the
+// other fan-out still enqueues into every consumer.
+class ConsumerList {
+  public:
+    ConsumerList();
+    virtual ~ConsumerList();
+
+  public:
+    virtual int       Size();
+    virtual bool      Empty();
+    virtual Consumer* At(int index);
+    virtual bool      Waiting(int index);
+    virtual void      Add(Consumer* consumer);
+    virtual bool      Remove(Consumer* consumer);
+    virtual void      SetWaiting(Consumer* consumer, bool waiting);
+
+  private:
+    std::vector<Consumer*> consumers_;
+    std::vector<uint8_t>   waiting_;
 };
 
 }  // namespace rtmp
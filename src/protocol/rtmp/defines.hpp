@@ -34,6 +34,21 @@
 #define RTMP_MR_SLEEP_MS 350
 #define RTMP_IOVS_MAX (RTMP_MR_MSGS * 2)
 #define RTMP_C0C3_HEADERS_MAX (RTMP_MR_MSGS * 32)
+// the chunked layouts cached by a shared message, one per chunk size
+// seen by the players
+#define RTMP_CHUNKED_CACHE_MAX 4
+// the size of an flv tag header with its previous tag size
+#define RTMP_FLV_TAG_CACHE_SIZE (11 + 4)
+// rtmp fmt3 header size(with extended timestamp)
+#define RTMP_FMT3_HEADER_SIZE 5
+// messages kept by the ring shared by the consumers of a source
+#define RTMP_SHARED_RING_SIZE 4096
+// chunks of at least this size are read straight into the message payload
+#define RTMP_ZERO_COPY_MIN_SIZE 4096
+// a closing connection waits that long for the completions of its zero copy
+// sends, then resets the connection and waits for those the reset dropped
+#define RTMP_ZERO_COPY_DRAIN_MS 100
+#define RTMP_ZERO_COPY_ABORT_MS 1000
 
 // rtmp message header type
 #define RTMP_FMT_TYPE0 0
@@ -77,18 +92,29 @@
 #define RTMP_AMF0_COMMAND_PUBLISH "publish"
 #define RTMP_AMF0_COMMAND_CREATE_STREAM "createStream"
 #define RTMP_AMF0_COMMAND_ON_STATUS "onStatus"
+#define RTMP_AMF0_COMMAND_ON_PLAY_STATUS "onPlayStatus"
 #define RTMP_AMF0_COMMAND_ERROR "error"
 #define RTMP_AMF0_COMMAND_ON_FC_PUBLISH "onFCPublish"
 #define RTMP_AMF0_COMMAND_ON_FC_UNPUBLISH "onFCUnpublish"
 #define RTMP_AMF0_COMMAND_ON_METADATA "onMetaData"
 #define RTMP_AMF0_COMMAND_SET_DATAFRAME "@setDataFrame"
 #define RTMP_AMF0_COMMAND_PLAY "play"
+#define RTMP_AMF0_COMMAND_SEEK "seek"
 #define RTMP_AMF0_COMMAND_ON_BW_DONE "onBWDone"
 
 // 48kHz/1024=46.875fps
 // 46.875fps*10s=468.75
 #define RTMP_NUM_TO_JUDGE_DVR_ONLY_HAS_AUDIO 500
 
+// dvr space allocated ahead of the writes, in seconds at the last bitrate
+#define RTMP_DVR_PREALLOCATE_SECONDS 10
+#define RTMP_DVR_MAX_PREALLOCATE (256 * 1024 * 1024)
+
+// vod bytes paged in ahead of the play position
+#define RTMP_VOD_READ_AHEAD (1024 * 1024)
+// tags searched for the metadata and sequence headers of a recording
+#define RTMP_VOD_MAX_HEADER_TAGS 16
+
 #define RTMP_MAX_JITTER_MS 250
 #define RTMP_MAX_JITTER_MS_NEG -250
 #define RTMP_DEFAULT_FRAME_TIME_MS 10
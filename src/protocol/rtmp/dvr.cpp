@@ -12,27 +12,43 @@
 #include <protocol/rtmp/message.hpp>
 #include <protocol/rtmp/source.hpp>
 
-#include <sstream>
-
 namespace rtmp {
 
+// keeps the payload of a queued tag until it is on disk
+class DvrMessageRef : public IAsyncFileRef {
+  public:
+    DvrMessageRef(SharedPtrMessage* msg) : msg_(msg) {}
+    virtual ~DvrMessageRef()
+    {
+        rs_freep(msg_);
+    }
+
+  private:
+    SharedPtrMessage* msg_;
+};
+
 FlvSegment::FlvSegment(DvrPlan* plan)
 {
     request_                  = nullptr;
     plan_                     = plan;
     muxer_                    = new flv::Muxer;
+    index_                    = new flv::KeyframeIndex;
     jitter_                   = nullptr;
     jitter_algorithm_         = JitterAlgorithm::OFF;
-    writer_                   = new FileWriter;
+    writer_                   = new AsyncFileWriter;
     duration_offset_          = 0;
     filesize_offset_          = 0;
     path_                     = "";
     has_keyframe_             = false;
+    drop_until_keyframe_      = false;
     start_time_               = -1;
     duration_                 = 0;
     stream_start_time_        = 0;
     stream_duration_          = 0;
     stream_previous_pkt_time_ = -1;
+    byte_rate_                = 0;
+
+    writer_->SetBlockSize(_config->GetDvrBlockSize());
 }
 
 FlvSegment::~FlvSegment()
@@ -40,6 +56,7 @@ FlvSegment::~FlvSegment()
     Close();
     rs_freep(writer_);
     rs_freep(jitter_);
+    rs_freep(index_);
     rs_freep(muxer_);
 }
 
@@ -75,15 +92,6 @@ std::string FlvSegment::generate_path()
     return flv_path;
 }
 
-std::string FlvSegment::handle_duplicate_path(const std::string& path)
-{
-    std::ostringstream oss;
-    std::string        prefix = path.substr(0, path.find_last_of(".flv"));
-
-    oss << prefix << "_" << Utils::GetSteadyNanoSeconds() << ".flv";
-    return oss.str();
-}
-
 int FlvSegment::on_update_duration(SharedPtrMessage* msg)
 {
     int ret = ERROR_SUCCESS;
@@ -129,29 +137,29 @@ int FlvSegment::Open()
         return ret;
     }
 
-    path_ = generate_path();
-
-    while (Utils::IsFileExist(path_)) {
-        handle_duplicate_path(path_);
-    }
-
-    std::string dir = path_.substr(0, path_.rfind("/"));
-    if ((ret = Utils::CreateDirRecursively(dir)) != ERROR_SUCCESS) {
-        rs_error("create dir %s failed. ret=%d", dir.c_str(), ret);
-        return ret;
-    }
+    path_                = generate_path();
+    drop_until_keyframe_ = false;
+    index_->Clear();
 
     if ((ret = create_jitter()) != ERROR_SUCCESS) {
         rs_error("create jitter failed. path=%s, ret=%d", path_.c_str(), ret);
         return ret;
     }
 
-    if ((ret = writer_->Open(path_)) != ERROR_SUCCESS) {
+    // the dirs are created and the existing file kept by the io thread
+    if ((ret = writer_->OpenUnique(path_)) != ERROR_SUCCESS) {
         rs_error("open file stream for file %s failed. ret=%d", path_.c_str(),
                  ret);
         return ret;
     }
 
+    // keep the segment in few extents, as large as the last one
+    if (_config->GetDvrPreallocate(request_->vhost)) {
+        int64_t size = byte_rate_ * _config->GetDrvDuration(request_->vhost);
+        writer_->Preallocate(rs_min(size, (int64_t)RTMP_DVR_MAX_PREALLOCATE),
+                             byte_rate_ * RTMP_DVR_PREALLOCATE_SECONDS);
+    }
+
     if ((ret = muxer_->Initialize(writer_)) != ERROR_SUCCESS) {
         rs_error("initialize enc by writer for file %s failed. ret=%d",
                  path_.c_str(), ret);
@@ -303,7 +311,19 @@ int FlvSegment::WriteAudio(SharedPtrMessage* shared_audio)
     char* payload = audio->payload;
     int   size    = audio->size;
 
+    bool is_sequence_header = flv::Demuxer::IsAACSequenceHeader(payload, size);
+
+    // the frame is lost when the disk can't keep up, not the publisher
+    ret = writer_->Reserve(flv::Muxer::SizeTag(size), !is_sequence_header);
+    if (ret == ERROR_SYSTEM_FILE_QUEUE_FULL) {
+        return on_update_duration(audio);
+    }
+    if (ret != ERROR_SUCCESS) {
+        return ret;
+    }
+
     int64_t timestamp = plan_->filter_timestamp(audio->timestamp);
+    writer_->Hold(new DvrMessageRef(audio->Copy()), payload, size);
     if ((ret = muxer_->WriteAudio(timestamp, payload, size)) != ERROR_SUCCESS) {
         return ret;
     }
@@ -348,17 +368,81 @@ int FlvSegment::WriteVideo(SharedPtrMessage* shared_video)
         return ret;
     }
 
+    int tag_size = flv::Muxer::SizeTag(size);
+    if (drop_until_keyframe_ && !is_keyframe && !is_sequence_header) {
+        writer_->Drop(tag_size);
+        return ret;
+    }
+
+    // the frames which depend on a dropped one are useless, so once the disk
+    // falls behind the video is skipped to the next keyframe.
+    ret = writer_->Reserve(tag_size, !is_sequence_header);
+    if (ret == ERROR_SYSTEM_FILE_QUEUE_FULL) {
+        if (!drop_until_keyframe_) {
+            rs_warn("dvr io queue full, drop video until keyframe. path=%s",
+                    path_.c_str());
+        }
+        drop_until_keyframe_ = true;
+        return ERROR_SUCCESS;
+    }
+    if (ret != ERROR_SUCCESS) {
+        return ret;
+    }
+    if (is_keyframe) {
+        drop_until_keyframe_ = false;
+    }
+
     int64_t timestamp = plan_->filter_timestamp(video->timestamp);
+    int64_t offset    = writer_->Tellg();
+    writer_->Hold(new DvrMessageRef(video->Copy()), payload, size);
     if ((ret = muxer_->WriteVideo(timestamp, payload, size)) != ERROR_SUCCESS) {
         return ret;
     }
 
+    if (is_keyframe) {
+        index_->Add(timestamp, offset);
+    }
+
+    return ret;
+}
+
+int FlvSegment::write_index()
+{
+    int ret = ERROR_SUCCESS;
+
+    if (index_->Size() == 0 || !_config->GetDvrIndex(request_->vhost)) {
+        return ret;
+    }
+
+    int   size = index_->EncodedSize();
+    char* data = new char[size];
+    rs_auto_freea(char, data);
+
+    if ((ret = index_->Encode(data, size)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    // a small file written once, through the io threads as the segment
+    AsyncFileWriter writer;
+    std::string     path = flv::KeyframeIndex::Path(path_);
+
+    if ((ret = writer.Open(path)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if ((ret = writer.Write(data, size, nullptr)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    writer.Close();
+    rs_info("dvr index %s, keyframes=%d", path.c_str(), index_->Size());
+
     return ret;
 }
 
 std::string FlvSegment::GetPath()
 {
-    return path_;
+    return writer_->IsOpen() ? writer_->GetPath() : path_;
 }
 
 int FlvSegment::Close()
@@ -369,20 +453,30 @@ int FlvSegment::Close()
         return ret;
     }
 
+    if (duration_ > 0) {
+        byte_rate_ = writer_->Tellg() * 1000 / duration_;
+    }
+
     if ((ret = UpdateFlvMetadata()) != ERROR_SUCCESS) {
         return ret;
     }
 
-    writer_->Close();
+    // the writer flushes the last block and truncates the preallocated file
+    // to the written size
+    path_ = writer_->GetPath();
 
     if (duration_ == 0) {
-        if (::remove(path_.c_str()) < 0) {
-            ret = ERROR_SYSTEM_FILE_REMOVE;
-            rs_error("remove %s failed. %d", path_.c_str(), ret);
-            return ret;
-        }
+        writer_->CloseAndRemove();
         rs_trace("remove %s. duration=%d", path_.c_str(), duration_);
     }
+    else {
+        writer_->Close();
+        if ((ret = write_index()) != ERROR_SUCCESS) {
+            rs_warn("write dvr index of %s failed. ret=%d", path_.c_str(),
+                    ret);
+            ret = ERROR_SUCCESS;
+        }
+    }
 
     if ((ret = plan_->on_reap_segment()) != ERROR_SUCCESS) {
         rs_error("notify plan to reap segment failed. ret=%d", ret);
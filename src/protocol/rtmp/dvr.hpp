@@ -6,12 +6,13 @@
 #ifndef RS_DVR_HPP
 #define RS_DVR_HPP
 
+#include <common/async_file.hpp>
 #include <common/core.hpp>
-#include <common/file.hpp>
 #include <common/queue.hpp>
 
 namespace flv {
 class Muxer;
+class KeyframeIndex;
 }
 
 namespace rtmp {
@@ -40,27 +41,33 @@ class FlvSegment {
 
   private:
     std::string generate_path();
-    std::string handle_duplicate_path(const std::string& path);
     int         create_jitter();
     int         on_update_duration(SharedPtrMessage* msg);
+    int         write_index();
 
   private:
-    Request*        request_;
-    DvrPlan*        plan_;
-    flv::Muxer*     muxer_;
-    Jitter*         jitter_;
-    JitterAlgorithm jitter_algorithm_;
-    FileWriter*     writer_;
-    int64_t         duration_offset_;
-    int64_t         filesize_offset_;
-    std::string     temp_flv_file_;
-    std::string     path_;
-    bool            has_keyframe_;
-    int64_t         start_time_;
-    int64_t         duration_;
-    int64_t         stream_start_time_;
-    int64_t         stream_duration_;
-    int64_t         stream_previous_pkt_time_;
+    Request*            request_;
+    DvrPlan*            plan_;
+    flv::Muxer*         muxer_;
+    // keyframes of the segment, saved next to it on close
+    flv::KeyframeIndex* index_;
+    Jitter*             jitter_;
+    JitterAlgorithm     jitter_algorithm_;
+    AsyncFileWriter*    writer_;
+    int64_t             duration_offset_;
+    int64_t             filesize_offset_;
+    std::string         temp_flv_file_;
+    std::string         path_;
+    bool                has_keyframe_;
+    // the io queue was full, the video waits for a keyframe
+    bool                drop_until_keyframe_;
+    int64_t             start_time_;
+    int64_t             duration_;
+    int64_t             stream_start_time_;
+    int64_t             stream_duration_;
+    int64_t             stream_previous_pkt_time_;
+    // bytes per second of the last segment
+    int64_t             byte_rate_;
 };
 
 class DvrPlan {
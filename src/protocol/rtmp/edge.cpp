@@ -7,8 +7,804 @@
  * @FilePath: \rtmp_server\protocol\rtmp\edge.cpp
  */
 #include <protocol/rtmp/edge.hpp>
+#include <common/buffer.hpp>
+#include <common/config.hpp>
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/socket.hpp>
+#include <common/st.hpp>
+#include <common/utils.hpp>
+#include <protocol/rtmp/client.hpp>
+#include <protocol/rtmp/defines.hpp>
+#include <protocol/rtmp/message.hpp>
+#include <protocol/rtmp/source.hpp>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+
+#define EDGE_CONNECT_TIMEOUT_US (int64_t)(3 * 1000 * 1000LL)
+// before the next origin is tried
+#define EDGE_INGESTER_SLEEP_US (int64_t)(1 * 1000 * 1000LL)
+#define EDGE_DEFAULT_PORT 1935
+// the delay of the forwarded messages at most, as the origin is read
+#define EDGE_FORWARDER_TIMEOUT_US (int64_t)(150 * 1000LL)
+#define EDGE_FORWARDER_SLEEP_US (int64_t)(1 * 1000 * 1000LL)
+#define EDGE_FORWARDER_REPORT_MS 10000
 
 namespace rtmp
 {
 
-} // namespace rtmp
\ No newline at end of file
+// host:port, the default port without
+static void split_origin(const std::string &origin, std::string &host, int &port)
+{
+    host = origin;
+    port = EDGE_DEFAULT_PORT;
+    size_t pos = origin.rfind(':');
+    if (pos != std::string::npos)
+    {
+        host = origin.substr(0, pos);
+        port = ::atoi(origin.substr(pos + 1).c_str());
+    }
+}
+
+std::map<std::string, uint32_t> EdgeOrigins::addrs_;
+
+int EdgeOrigins::Resolve()
+{
+    int ret = ERROR_SUCCESS;
+
+    std::vector<std::string> vhosts = _config->GetVhosts();
+    for (size_t i = 0; i < vhosts.size(); i++)
+    {
+        if (!_config->GetVhostIsEdge(vhosts[i]))
+        {
+            continue;
+        }
+
+        std::vector<std::string> origins = _config->GetEdgeOrigins(vhosts[i]);
+        for (size_t j = 0; j < origins.size(); j++)
+        {
+            std::string host;
+            int port = 0;
+            split_origin(origins[j], host, port);
+
+            in_addr ip;
+            if (::inet_pton(AF_INET, host.c_str(), &ip) == 1 || addrs_.count(host))
+            {
+                continue;
+            }
+
+            addrinfo hints;
+            memset(&hints, 0, sizeof(addrinfo));
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_STREAM;
+
+            addrinfo *result = nullptr;
+            if (::getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 || !result)
+            {
+                ret = ERROR_SYSTEM_IP_INVALID;
+                rs_error("resolve origin %s of vhost %s failed. ret=%d", host.c_str(), vhosts[i].c_str(), ret);
+                return ret;
+            }
+
+            addrs_[host] = ((sockaddr_in *)result->ai_addr)->sin_addr.s_addr;
+            ::freeaddrinfo(result);
+
+            rs_trace("origin %s of vhost %s resolved", host.c_str(), vhosts[i].c_str());
+        }
+    }
+
+    return ret;
+}
+
+int EdgeOrigins::Lookup(const std::string &host, uint32_t &addr)
+{
+    int ret = ERROR_SUCCESS;
+
+    in_addr ip;
+    if (::inet_pton(AF_INET, host.c_str(), &ip) == 1)
+    {
+        addr = ip.s_addr;
+        return ret;
+    }
+
+    std::map<std::string, uint32_t>::iterator it = addrs_.find(host);
+    if (it == addrs_.end())
+    {
+        ret = ERROR_SYSTEM_IP_INVALID;
+        rs_error("origin %s was not resolved at the start. ret=%d", host.c_str(), ret);
+        return ret;
+    }
+
+    addr = it->second;
+
+    return ret;
+}
+
+// connects to the origin at index of the vhost, the index moves to the next
+// origin when it fails
+static int connect_origin(const std::string &vhost, int &index, st_netfd_t &stfd, std::string &ep_server, int &ep_port)
+{
+    int ret = ERROR_SUCCESS;
+
+    std::vector<std::string> origins = _config->GetEdgeOrigins(vhost);
+    if (origins.empty())
+    {
+        ret = ERROR_SYSTEM_CONFIG_INVALID;
+        rs_error("edge has no origin of vhost %s. ret=%d", vhost.c_str(), ret);
+        return ret;
+    }
+
+    // the origin which failed last is left for the next one
+    index %= (int)origins.size();
+    std::string origin = origins.at(index);
+
+    split_origin(origin, ep_server, ep_port);
+
+    // a name was resolved at the start, a lookup would block the worker
+    uint32_t ip = 0;
+    if ((ret = EdgeOrigins::Lookup(ep_server, ip)) != ERROR_SUCCESS)
+    {
+        index++;
+        return ret;
+    }
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = ip;
+    addr.sin_port = htons(ep_port);
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+    {
+        ret = ERROR_SOCKET_CREATE;
+        rs_error("create edge socket failed. ret=%d", ret);
+        return ret;
+    }
+
+    if ((stfd = st_netfd_open_socket(fd)) == nullptr)
+    {
+        ::close(fd);
+        ret = ERROR_ST_OPEN_SOCKET;
+        rs_error("st open edge socket failed. ret=%d", ret);
+        return ret;
+    }
+
+    if (st_connect(stfd, (const sockaddr *)&addr, sizeof(sockaddr_in), EDGE_CONNECT_TIMEOUT_US) == -1)
+    {
+        STCloseFd(stfd);
+        index++;
+        ret = ERROR_ST_CONNECT;
+        rs_error("connect origin %s:%d failed. ret=%d", ep_server.c_str(), ep_port, ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+// the vhost goes to the origin in the tcUrl, its ip when it is the default
+static std::string build_tc_url(Request *req, const std::string &ep_server, int ep_port)
+{
+    std::string host = req->vhost == RTMP_DEFAULT_VHOST ? ep_server : req->vhost;
+    return "rtmp://" + host + ":" + std::to_string(ep_port) + "/" + req->app;
+}
+
+EdgeForwarder::EdgeForwarder()
+{
+    stream_id_ = 0;
+    source_ = nullptr;
+    edge_ = nullptr;
+    request_ = nullptr;
+    thread_ = new internal::Thread("edge-forwarder", this, EDGE_FORWARDER_SLEEP_US, true);
+    stfd_ = nullptr;
+    rw_ = nullptr;
+    client_ = nullptr;
+    queue_ = new MessageQueue;
+    queue_size_ = 0;
+    kbps_ = new Kbps;
+    origin_index_ = 0;
+    send_error_code_ = ERROR_SUCCESS;
+    last_report_ms_ = 0;
+}
+
+EdgeForwarder::~EdgeForwarder()
+{
+    Stop();
+    rs_freep(thread_);
+    rs_freep(queue_);
+    rs_freep(kbps_);
+}
+
+int EdgeForwarder::Initialize(Source *source, PublishEdge *edge, Request *req)
+{
+    int ret = ERROR_SUCCESS;
+
+    source_ = source;
+    edge_ = edge;
+    request_ = req;
+
+    return ret;
+}
+
+void EdgeForwarder::SetQueueSize(double queue_size)
+{
+    queue_size_ = queue_size;
+    queue_->SetQueueSize(queue_size);
+}
+
+int EdgeForwarder::Start()
+{
+    int ret = ERROR_SUCCESS;
+
+    send_error_code_ = ERROR_SUCCESS;
+
+    // connected before the publisher is answered, which is rejected when no
+    // origin can be reached and tries the next one when it comes again
+    std::string ep_server;
+    int ep_port = 0;
+    if ((ret = ConnectServer(ep_server, ep_port)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if ((ret = ConnectApp(ep_server, ep_port)) != ERROR_SUCCESS)
+    {
+        origin_index_++;
+        CloseUnderLayerSocket();
+        return ret;
+    }
+
+    client_->SetRecvTimeout(EDGE_FORWARDER_TIMEOUT_US);
+
+    return thread_->Start();
+}
+
+void EdgeForwarder::Stop()
+{
+    thread_->Stop();
+    CloseUnderLayerSocket();
+
+    // the messages left are not sent to the next origin
+    rs_freep(queue_);
+    queue_ = new MessageQueue;
+    queue_->SetQueueSize(queue_size_);
+}
+
+void EdgeForwarder::CloseUnderLayerSocket()
+{
+    kbps_->SetIO(nullptr, nullptr);
+    rs_freep(client_);
+    rs_freep(rw_);
+    STCloseFd(stfd_);
+}
+
+int EdgeForwarder::ConnectServer(std::string &ep_server, int &ep_port)
+{
+    int ret = ERROR_SUCCESS;
+
+    CloseUnderLayerSocket();
+
+    if ((ret = connect_origin(request_->vhost, origin_index_, stfd_, ep_server, ep_port)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    // the handshake, connect and publish wait for the origin as long as any
+    // client, the short timeout is of the forward loop only
+    rw_ = new StSocket(stfd_);
+    client_ = new Client(rw_);
+    client_->SetRecvTimeout(RTMP_RECV_TIMEOUT_US);
+    client_->SetSendTimeout(RTMP_SEND_TIMEOUT_US);
+
+    kbps_->SetIO(rw_, rw_);
+
+    rs_trace("edge forward to origin %s:%d", ep_server.c_str(), ep_port);
+
+    return ret;
+}
+
+int EdgeForwarder::ConnectApp(const std::string &ep_server, int ep_port)
+{
+    int ret = ERROR_SUCCESS;
+
+    std::string tc_url = build_tc_url(request_, ep_server, ep_port);
+
+    if ((ret = client_->Handshake()) != ERROR_SUCCESS)
+    {
+        rs_error("handshake with origin %s failed. ret=%d", ep_server.c_str(), ret);
+        return ret;
+    }
+
+    if ((ret = client_->ConnectApp(request_->app, tc_url)) != ERROR_SUCCESS)
+    {
+        rs_error("connect origin app %s failed. ret=%d", tc_url.c_str(), ret);
+        return ret;
+    }
+
+    if ((ret = client_->Publish(request_->stream + request_->param, stream_id_)) != ERROR_SUCCESS)
+    {
+        rs_error("publish %s to origin failed. ret=%d", request_->stream.c_str(), ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+int32_t EdgeForwarder::Cycle()
+{
+    int ret = ERROR_SUCCESS;
+
+    MessageArray msgs(RTMP_MR_MSGS);
+
+    while (thread_->CanLoop())
+    {
+        if (send_error_code_ != ERROR_SUCCESS)
+        {
+            st_usleep(EDGE_FORWARDER_SLEEP_US);
+            continue;
+        }
+
+        // the origin only answers the publish, its messages are read and
+        // dropped in the gaps of the stream, the short timeout of which
+        // bounds the delay of the queued messages
+        CommonMessage *msg = nullptr;
+        if ((ret = client_->RecvMessage(&msg)) != ERROR_SUCCESS && ret != ERROR_SOCKET_TIMEOUT)
+        {
+            // interrupted as the publisher left
+            if (!thread_->CanLoop())
+            {
+                break;
+            }
+            rs_error("edge forwarder recv from origin failed. ret=%d", ret);
+            send_error_code_ = ret;
+            origin_index_++;
+            continue;
+        }
+        rs_freep(msg);
+        ret = ERROR_SUCCESS;
+
+        int count = 0;
+        if ((ret = queue_->DumpPackets(msgs.max, msgs.msgs, count)) != ERROR_SUCCESS)
+        {
+            rs_error("edge forwarder dump messages failed. ret=%d", ret);
+            return ret;
+        }
+
+        int64_t now = Utils::GetSteadyMilliSeconds();
+        if (now - last_report_ms_ >= EDGE_FORWARDER_REPORT_MS)
+        {
+            last_report_ms_ = now;
+            kbps_->Sample();
+            rs_trace("edge forward %s, msgs=%d, queue=%d, kbps=%d/%d", request_->GetStreamUrl().c_str(), count, queue_->Size(), kbps_->GetSendKbps(), kbps_->GetSendKbps30s());
+        }
+
+        if (count <= 0)
+        {
+            continue;
+        }
+
+        if ((ret = client_->SendAndFreeMessages(msgs.msgs, count, stream_id_)) != ERROR_SUCCESS)
+        {
+            if (!thread_->CanLoop())
+            {
+                break;
+            }
+            rs_error("edge forwarder send messages failed. ret=%d", ret);
+            send_error_code_ = ret;
+            origin_index_++;
+            continue;
+        }
+    }
+
+    return ret;
+}
+
+int EdgeForwarder::Proxy(CommonMessage *msg)
+{
+    int ret = ERROR_SUCCESS;
+
+    if ((ret = send_error_code_) != ERROR_SUCCESS)
+    {
+        rs_error("edge forwarder failed, kick the publisher. ret=%d", ret);
+        return ret;
+    }
+
+    if (msg->size <= 0 || (!msg->header.IsAudio() && !msg->header.IsVideo() && !msg->header.IsAMF0Data() && !msg->header.IsAMF3Data()))
+    {
+        return ret;
+    }
+
+    SharedPtrMessage *shared_msg = new SharedPtrMessage;
+    if ((ret = shared_msg->Create(msg)) != ERROR_SUCCESS)
+    {
+        rs_freep(shared_msg);
+        rs_error("edge forwarder create message failed. ret=%d", ret);
+        return ret;
+    }
+
+    bool is_overflow = false;
+    if ((ret = queue_->Enqueue(shared_msg, &is_overflow)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if (is_overflow)
+    {
+        rs_warn("edge forwarder queue overflow, the origin is slower than the publisher");
+    }
+
+    return ret;
+}
+
+EdgeIngester::EdgeIngester()
+{
+    stream_id_ = 0;
+    source_ = nullptr;
+    edge_ = nullptr;
+    request_ = nullptr;
+    thread_ = new internal::Thread("edge-ingester", this, EDGE_INGESTER_SLEEP_US, true);
+    stfd_ = nullptr;
+    rw_ = nullptr;
+    client_ = nullptr;
+    origin_index_ = 0;
+    publishing_ = false;
+}
+
+EdgeIngester::~EdgeIngester()
+{
+    Stop();
+    rs_freep(thread_);
+}
+
+int EdgeIngester::Initialize(Source *source, PlayEdge *edge, Request *req)
+{
+    int ret = ERROR_SUCCESS;
+
+    source_ = source;
+    edge_ = edge;
+    request_ = req;
+
+    return ret;
+}
+
+int EdgeIngester::Start()
+{
+    return thread_->Start();
+}
+
+void EdgeIngester::Stop()
+{
+    thread_->Stop();
+    CloseUnderLayerSocket();
+}
+
+void EdgeIngester::CloseUnderLayerSocket()
+{
+    rs_freep(client_);
+    rs_freep(rw_);
+    STCloseFd(stfd_);
+}
+
+int EdgeIngester::ConnectServer(std::string &ep_server, int &ep_port)
+{
+    int ret = ERROR_SUCCESS;
+
+    CloseUnderLayerSocket();
+
+    if ((ret = connect_origin(request_->vhost, origin_index_, stfd_, ep_server, ep_port)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    rw_ = new StSocket(stfd_);
+    client_ = new Client(rw_);
+    client_->SetRecvTimeout(RTMP_RECV_TIMEOUT_US);
+    client_->SetSendTimeout(RTMP_SEND_TIMEOUT_US);
+
+    rs_trace("edge connected to origin %s:%d", ep_server.c_str(), ep_port);
+
+    return ret;
+}
+
+int EdgeIngester::ConnectApp(const std::string &ep_server, int ep_port)
+{
+    int ret = ERROR_SUCCESS;
+
+    std::string tc_url = build_tc_url(request_, ep_server, ep_port);
+
+    if ((ret = client_->Handshake()) != ERROR_SUCCESS)
+    {
+        rs_error("handshake with origin %s failed. ret=%d", ep_server.c_str(), ret);
+        return ret;
+    }
+
+    if ((ret = client_->ConnectApp(request_->app, tc_url)) != ERROR_SUCCESS)
+    {
+        rs_error("connect origin app %s failed. ret=%d", tc_url.c_str(), ret);
+        return ret;
+    }
+
+    if ((ret = client_->CreateStream(stream_id_)) != ERROR_SUCCESS)
+    {
+        rs_error("create stream on origin failed. ret=%d", ret);
+        return ret;
+    }
+
+    if ((ret = client_->Play(request_->stream + request_->param, stream_id_)) != ERROR_SUCCESS)
+    {
+        rs_error("play %s on origin failed. ret=%d", request_->stream.c_str(), ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+int32_t EdgeIngester::Cycle()
+{
+    int ret = ERROR_SUCCESS;
+
+    std::string ep_server;
+    int ep_port = 0;
+    if ((ret = ConnectServer(ep_server, ep_port)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if ((ret = ConnectApp(ep_server, ep_port)) != ERROR_SUCCESS)
+    {
+        origin_index_++;
+        CloseUnderLayerSocket();
+        return ret;
+    }
+
+    edge_->OnIngestPlay();
+
+    ret = Ingest();
+
+    if (publishing_)
+    {
+        publishing_ = false;
+        source_->OnUnpublish();
+    }
+    CloseUnderLayerSocket();
+
+    // the origin dropped the stream, played again while there are players
+    if (is_client_gracefully_close(ret))
+    {
+        rs_warn("origin %s:%d closed the stream. ret=%d", ep_server.c_str(), ep_port, ret);
+        ret = ERROR_SUCCESS;
+    }
+
+    return ret;
+}
+
+void EdgeIngester::OnThreadStop()
+{
+    if (publishing_)
+    {
+        publishing_ = false;
+        source_->OnUnpublish();
+    }
+}
+
+int EdgeIngester::Ingest()
+{
+    int ret = ERROR_SUCCESS;
+
+    while (thread_->CanLoop())
+    {
+        CommonMessage *msg = nullptr;
+        if ((ret = client_->RecvMessage(&msg)) != ERROR_SUCCESS)
+        {
+            return ret;
+        }
+        rs_auto_free(CommonMessage, msg);
+
+        if ((ret = ProcessPublishMessage(msg)) != ERROR_SUCCESS)
+        {
+            return ret;
+        }
+    }
+
+    return ret;
+}
+
+int EdgeIngester::ProcessPublishMessage(CommonMessage *msg)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!msg->header.IsAudio() && !msg->header.IsVideo() && !msg->header.IsAMF0Data())
+    {
+        return ret;
+    }
+
+    // published at the first media, as the players wait for it
+    if (!publishing_)
+    {
+        if (!source_->CanPublish(false))
+        {
+            ret = ERROR_SYSTEM_STREAM_BUSY;
+            rs_warn("edge stream is already publishing. ret=%d", ret);
+            return ret;
+        }
+
+        if ((ret = source_->OnPublish()) != ERROR_SUCCESS)
+        {
+            rs_error("edge notify publish failed. ret=%d", ret);
+            return ret;
+        }
+        publishing_ = true;
+    }
+
+    if (msg->header.IsAudio())
+    {
+        if ((ret = source_->OnAudio(msg)) != ERROR_SUCCESS)
+        {
+            rs_error("edge process audio message failed. ret=%d", ret);
+            return ret;
+        }
+    }
+    else if (msg->header.IsVideo())
+    {
+        if ((ret = source_->OnVideo(msg)) != ERROR_SUCCESS)
+        {
+            rs_error("edge process video message failed. ret=%d", ret);
+            return ret;
+        }
+    }
+    else
+    {
+        BufferManager manager;
+        if ((ret = manager.Initialize(msg->payload, msg->size)) != ERROR_SUCCESS)
+        {
+            return ret;
+        }
+
+        OnMetadataPacket pkt;
+        if ((ret = pkt.Decode(&manager)) != ERROR_SUCCESS)
+        {
+            // not all the amf0 data is metadata
+            return ERROR_SUCCESS;
+        }
+
+        if ((ret = source_->OnMetadata(msg, &pkt)) != ERROR_SUCCESS)
+        {
+            rs_error("edge process metadata failed. ret=%d", ret);
+            return ret;
+        }
+    }
+
+    return ret;
+}
+
+PlayEdge::PlayEdge()
+{
+    state_ = EdgeState::INIT;
+    ingester_ = new EdgeIngester;
+}
+
+PlayEdge::~PlayEdge()
+{
+    rs_freep(ingester_);
+}
+
+int PlayEdge::Initialize(Source *source, Request *req)
+{
+    return ingester_->Initialize(source, this, req);
+}
+
+int PlayEdge::OnClientPlay()
+{
+    int ret = ERROR_SUCCESS;
+
+    if (state_ != EdgeState::INIT)
+    {
+        return ret;
+    }
+
+    if ((ret = ingester_->Start()) != ERROR_SUCCESS)
+    {
+        rs_error("start edge ingester failed. ret=%d", ret);
+        return ret;
+    }
+
+    state_ = EdgeState::PLAY;
+    rs_trace("edge start to pull from origin");
+
+    return ret;
+}
+
+void PlayEdge::OnAllClientStop()
+{
+    if (state_ == EdgeState::INIT)
+    {
+        return;
+    }
+
+    ingester_->Stop();
+    state_ = EdgeState::INIT;
+    rs_trace("edge stop pulling from origin, no player left");
+}
+
+void PlayEdge::OnIngestPlay()
+{
+    if (state_ == EdgeState::PLAY)
+    {
+        state_ = EdgeState::INGEST_CONNECTED;
+    }
+}
+
+PublishEdge::PublishEdge()
+{
+    state_ = EdgeState::INIT;
+    forwarder_ = new EdgeForwarder;
+}
+
+PublishEdge::~PublishEdge()
+{
+    rs_freep(forwarder_);
+}
+
+int PublishEdge::Initialize(Source *source, Request *req)
+{
+    int ret = ERROR_SUCCESS;
+
+    if ((ret = forwarder_->Initialize(source, this, req)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    forwarder_->SetQueueSize(_config->GetQueueSize(req->vhost));
+
+    return ret;
+}
+
+bool PublishEdge::CanPublish()
+{
+    return state_ != EdgeState::PUBLISH;
+}
+
+int PublishEdge::OnClientPublish()
+{
+    int ret = ERROR_SUCCESS;
+
+    if (state_ != EdgeState::INIT)
+    {
+        ret = ERROR_RTMP_EDGE_PUBLISH_STATE;
+        rs_error("edge publish in state %d. ret=%d", state_, ret);
+        return ret;
+    }
+
+    if ((ret = forwarder_->Start()) != ERROR_SUCCESS)
+    {
+        rs_error("start edge forwarder failed. ret=%d", ret);
+        return ret;
+    }
+
+    state_ = EdgeState::PUBLISH;
+    rs_trace("edge start to forward to origin");
+
+    return ret;
+}
+
+int PublishEdge::OnProxyPublish(CommonMessage *msg)
+{
+    return forwarder_->Proxy(msg);
+}
+
+void PublishEdge::OnProxyUnpublish()
+{
+    if (state_ != EdgeState::PUBLISH)
+    {
+        return;
+    }
+
+    forwarder_->Stop();
+    state_ = EdgeState::INIT;
+    rs_trace("edge stop forwarding to origin");
+}
+
+} // namespace rtmp
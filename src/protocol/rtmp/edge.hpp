@@ -11,13 +11,35 @@
 #include <common/io.hpp>
 #include <common/kbps.hpp>
 
+#include <map>
+#include <string>
+
 namespace rtmp
 {
 
 class PublishEdge;
+class PlayEdge;
 class Source;
 class CommonMessage;
 class Request;
+class Client;
+class MessageQueue;
+
+// the addresses of the origins of the edge vhosts. the names are resolved
+// once by the master before the workers are forked, a worker never blocks
+// on a lookup.
+class EdgeOrigins
+{
+public:
+    // fails when a name of an origin cannot be resolved
+    static int Resolve();
+    // the ipv4 address of an ip or of a name resolved at the start
+    static int Lookup(const std::string &host, uint32_t &addr);
+
+private:
+    // in network order, by the name
+    static std::map<std::string, uint32_t> addrs_;
+};
 
 enum EdgeState
 {
@@ -27,6 +49,9 @@ enum EdgeState
     PUBLISH = 200,
 };
 
+// forwards the stream published on the edge to an origin, over a single rtmp
+// connection. the messages wait in a queue of a few seconds, dropped when the
+// origin is slower, and are sent in batches.
 class EdgeForwarder : public internal::IThreadHandler
 {
 public:
@@ -34,18 +59,18 @@ public:
     virtual ~EdgeForwarder();
 
 public:
-    virtual int Initialize();
+    virtual int Initialize(Source *source, PublishEdge *edge, Request *req);
     virtual void SetQueueSize(double queue_size);
     virtual int Start();
     virtual void Stop();
     virtual int Proxy(CommonMessage *msg);
     //internal::IThreadHandler
-    virtual int Cycle() override;
+    virtual int32_t Cycle() override;
 
 private:
     virtual void CloseUnderLayerSocket();
-    virtual int ConnectServer(const std::string &ep_server, const std::string &ep_port);
-    virtual int ConnectApp(const std::string &ep_server, const std::string &ep_port);
+    virtual int ConnectServer(std::string &ep_server, int &ep_port);
+    virtual int ConnectApp(const std::string &ep_server, int ep_port);
 
 private:
     int stream_id_;
@@ -55,10 +80,73 @@ private:
     internal::Thread *thread_;
     st_netfd_t stfd_;
     IProtocolReaderWriter *rw_;
+    Client *client_;
+    MessageQueue *queue_;
+    double queue_size_;
     Kbps *kbps_;
     int origin_index_;
+    // the publisher is kicked once the origin fails
+    int send_error_code_;
+    int64_t last_report_ms_;
+};
+
+// pulls the stream of the edge players from an origin, over a single rtmp
+// connection whatever their number, to the next origin when it fails.
+class EdgeIngester : public internal::IThreadHandler
+{
+public:
+    EdgeIngester();
+    virtual ~EdgeIngester();
+
+public:
+    virtual int Initialize(Source *source, PlayEdge *edge, Request *req);
+    virtual int Start();
+    virtual void Stop();
+    //internal::IThreadHandler
+    virtual int32_t Cycle() override;
+    virtual void OnThreadStop() override;
+
+private:
+    virtual void CloseUnderLayerSocket();
+    virtual int ConnectServer(std::string &ep_server, int &ep_port);
+    virtual int ConnectApp(const std::string &ep_server, int ep_port);
+    virtual int Ingest();
+    virtual int ProcessPublishMessage(CommonMessage *msg);
+
+private:
+    int stream_id_;
+    Source *source_;
+    PlayEdge *edge_;
+    Request *request_;
+    internal::Thread *thread_;
+    st_netfd_t stfd_;
+    IProtocolReaderWriter *rw_;
+    Client *client_;
+    int origin_index_;
+    bool publishing_;
+};
+
+// the first player on the edge starts the ingest, the last one to leave
+// stops it.
+class PlayEdge
+{
+public:
+    PlayEdge();
+    virtual ~PlayEdge();
+
+public:
+    virtual int Initialize(Source *source, Request *req);
+    virtual int OnClientPlay();
+    virtual void OnAllClientStop();
+    virtual void OnIngestPlay();
+
+private:
+    EdgeState state_;
+    EdgeIngester *ingester_;
 };
 
+// the publisher of the edge goes through the forwarder to the origin, the
+// local source is left to the players.
 class PublishEdge
 {
 public:
@@ -66,10 +154,15 @@ public:
     virtual ~PublishEdge();
 
 public:
-    int Initialize(Source *source, Request *req);
+    virtual int Initialize(Source *source, Request *req);
+    virtual bool CanPublish();
+    virtual int OnClientPublish();
+    virtual int OnProxyPublish(CommonMessage *msg);
+    virtual void OnProxyUnpublish();
 
 private:
     EdgeState state_;
+    EdgeForwarder *forwarder_;
 };
 
 } // namespace rtmp
@@ -0,0 +1,161 @@
+#include <common/log.hpp>
+#include <common/utils.hpp>
+#include <muxer/flv.hpp>
+#include <protocol/rtmp/fast_start.hpp>
+#include <protocol/rtmp/message.hpp>
+
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+// the wait for the socket to drain when half of its buffer is unsent
+#define FAST_START_DRAIN_WAIT_MS 5
+// upper bounds of the time to first frame histogram, the last is the rest
+#define FAST_START_BUCKETS 6
+
+namespace rtmp {
+
+static const int ttff_bounds[FAST_START_BUCKETS - 1] = {100, 250, 500, 1000,
+                                                        2000};
+
+static int     ttff_count                       = 0;
+static int64_t ttff_sum                         = 0;
+static int     ttff_max                         = 0;
+static int     ttff_buckets[FAST_START_BUCKETS] = {0};
+
+FastStart::FastStart()
+{
+    fd_               = -1;
+    rate_             = 0;
+    sndbuf_           = 0;
+    backlog_bytes_    = 0;
+    backlog_ms_       = 0;
+    join_ms_          = Utils::GetSteadyMilliSeconds();
+    sent_bytes_       = 0;
+    bursting_         = false;
+    first_frame_sent_ = false;
+}
+
+FastStart::~FastStart() {}
+
+void FastStart::Initialize(int     fd,
+                           int     rate,
+                           int64_t backlog_bytes,
+                           int     backlog_ms)
+{
+    fd_            = fd;
+    rate_          = rate;
+    backlog_bytes_ = backlog_bytes;
+    backlog_ms_    = backlog_ms;
+    bursting_      = backlog_bytes > 0;
+
+    socklen_t len = sizeof(sndbuf_);
+    if (fd_ < 0 ||
+        ::getsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &sndbuf_, &len) != 0) {
+        sndbuf_ = 0;
+    }
+}
+
+bool FastStart::Bursting()
+{
+    return bursting_;
+}
+
+void FastStart::StopBurst()
+{
+    if (!bursting_) {
+        return;
+    }
+
+    bursting_ = false;
+    rs_info("fast start burst %lld/%lld bytes in %dms",
+            (long long)sent_bytes_, (long long)backlog_bytes_,
+            (int)(Utils::GetSteadyMilliSeconds() - join_ms_));
+}
+
+int FastStart::unsent_bytes()
+{
+    int v = 0;
+    if (fd_ < 0 || ::ioctl(fd_, SIOCOUTQ, &v) != 0) {
+        return 0;
+    }
+    return v;
+}
+
+int FastStart::OnSend(SharedPtrMessage** msgs, int count, int nb_bytes)
+{
+    int64_t now = Utils::GetSteadyMilliSeconds();
+
+    for (int i = 0; i < count && !first_frame_sent_; i++) {
+        SharedPtrMessage* msg = msgs[i];
+        if (msg->IsVideo() &&
+            !flv::Demuxer::IsAVCSequenceHeader(msg->payload, msg->size)) {
+            first_frame_sent_ = true;
+            FastStartStats::OnFirstFrame((int)(now - join_ms_));
+        }
+    }
+
+    if (!bursting_) {
+        return 0;
+    }
+
+    sent_bytes_ += nb_bytes;
+    if (sent_bytes_ >= backlog_bytes_) {
+        StopBurst();
+        return 0;
+    }
+
+    // sent ahead of rate times the bitrate of the backlog waits for it
+    int delay_ms = 0;
+    if (rate_ > 0 && backlog_ms_ > 0) {
+        double  bytes_per_ms = (double)backlog_bytes_ * rate_ / backlog_ms_;
+        int64_t allowed      = (int64_t)(bytes_per_ms * (now - join_ms_));
+        if (sent_bytes_ > allowed) {
+            delay_ms = (int)((sent_bytes_ - allowed) / bytes_per_ms);
+        }
+    }
+
+    // what the socket holds is not sent sooner for more of it
+    if (sndbuf_ > 0 && unsent_bytes() > sndbuf_ / 2) {
+        delay_ms = rs_max(delay_ms, FAST_START_DRAIN_WAIT_MS);
+    }
+
+    return delay_ms;
+}
+
+void FastStartStats::OnFirstFrame(int ttff_ms)
+{
+    int bucket = 0;
+    while (bucket < FAST_START_BUCKETS - 1 && ttff_ms >= ttff_bounds[bucket]) {
+        bucket++;
+    }
+
+    ttff_buckets[bucket]++;
+    ttff_count++;
+    ttff_sum += ttff_ms;
+    ttff_max = rs_max(ttff_max, ttff_ms);
+
+    rs_info("first frame sent in %dms", ttff_ms);
+}
+
+void FastStartStats::Dump()
+{
+    if (ttff_count == 0) {
+        return;
+    }
+
+    rs_trace("ttff of %d players. avg=%dms, max=%dms, <100ms=%d, <250ms=%d, "
+             "<500ms=%d, <1s=%d, <2s=%d, more=%d",
+             ttff_count, (int)(ttff_sum / ttff_count), ttff_max,
+             ttff_buckets[0], ttff_buckets[1], ttff_buckets[2],
+             ttff_buckets[3], ttff_buckets[4], ttff_buckets[5]);
+
+    ttff_count = 0;
+    ttff_sum   = 0;
+    ttff_max   = 0;
+    for (int i = 0; i < FAST_START_BUCKETS; i++) {
+        ttff_buckets[i] = 0;
+    }
+}
+
+}  // namespace rtmp
@@ -0,0 +1,55 @@
+#ifndef RS_RTMP_FAST_START_HPP
+#define RS_RTMP_FAST_START_HPP
+
+#include <common/core.hpp>
+
+namespace rtmp {
+
+class SharedPtrMessage;
+
+// the start of a player, from its join to the first video frame it was
+// sent. the backlog it joined with, the cached gop, is sent at rate times
+// the bitrate of the stream instead of waiting for the merged write, and
+// not faster than the socket drains, then the merged write takes over.
+class FastStart {
+  public:
+    FastStart();
+    virtual ~FastStart();
+
+  public:
+    // rate 0 to send the backlog as fast as the socket takes it
+    virtual void Initialize(int     fd,
+                            int     rate,
+                            int64_t backlog_bytes,
+                            int     backlog_ms);
+    virtual bool Bursting();
+    // the backlog is out or was dropped by the queue
+    virtual void StopBurst();
+    // the ms to wait before the next batch, in the burst
+    virtual int  OnSend(SharedPtrMessage** msgs, int count, int nb_bytes);
+
+  private:
+    virtual int unsent_bytes();
+
+  private:
+    int     fd_;
+    int     rate_;
+    int     sndbuf_;
+    int64_t backlog_bytes_;
+    int     backlog_ms_;
+    int64_t join_ms_;
+    int64_t sent_bytes_;
+    bool    bursting_;
+    bool    first_frame_sent_;
+};
+
+// the time to first frame of the players of the worker, since the last dump
+class FastStartStats {
+  public:
+    static void OnFirstFrame(int ttff_ms);
+    static void Dump();
+};
+
+}  // namespace rtmp
+
+#endif
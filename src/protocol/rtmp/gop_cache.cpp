@@ -4,12 +4,15 @@
  * @LastEditTime: 2020-03-25 12:32:09
  */
 #include <common/log.hpp>
+#include <common/utils.hpp>
 #include <muxer/flv.hpp>
 #include <protocol/rtmp/consumer.hpp>
 #include <protocol/rtmp/gop_cache.hpp>
 #include <protocol/rtmp/jitter.hpp>
 #include <protocol/rtmp/message.hpp>
 
+#include <algorithm>
+
 #define PURE_AUDIO_GUESS_THRESHOLD 115
 
 namespace rtmp {
@@ -17,13 +20,19 @@ namespace rtmp {
 GopCache::GopCache()
 {
     cached_video_count_           = 0;
-
-
-    //TODO just for a test
     enable_gop_cache_             = true;
-
-
     audio_after_last_video_count_ = 0;
+    base_                         = 0;
+    bytes_                        = 0;
+    gop_bytes_                    = 0;
+    max_bytes_                    = 0;
+    max_duration_ms_              = 0;
+    disable_on_overflow_          = false;
+    overflowed_                   = false;
+    pure_audio_                   = false;
+    trimmed_count_                = 0;
+    shift_ms_                     = 0;
+    shift_max_bytes_              = 0;
 }
 
 GopCache::~GopCache()
@@ -34,6 +43,8 @@ GopCache::~GopCache()
 void GopCache::Set(bool enabled)
 {
     enable_gop_cache_ = enabled;
+    overflowed_       = false;
+    pure_audio_       = false;
 
     if (!enable_gop_cache_) {
         rs_info("gop cache disabled, clear %d packets", (int)queue_.size());
@@ -42,6 +53,21 @@ void GopCache::Set(bool enabled)
     }
 }
 
+void GopCache::SetLimits(int64_t max_bytes,
+                         int64_t max_duration_ms,
+                         bool    disable_on_overflow)
+{
+    max_bytes_           = max_bytes;
+    max_duration_ms_     = max_duration_ms;
+    disable_on_overflow_ = disable_on_overflow;
+}
+
+void GopCache::SetTimeShift(int64_t shift_ms, int64_t max_bytes)
+{
+    shift_ms_        = shift_ms;
+    shift_max_bytes_ = max_bytes;
+}
+
 void GopCache::Dispose()
 {
     Clear();
@@ -51,7 +77,7 @@ int GopCache::Cache(SharedPtrMessage* shared_msg)
 {
     int ret = ERROR_SUCCESS;
 
-    if (!enable_gop_cache_) {
+    if (!enable_gop_cache_ || overflowed_) {
         return ret;
     }
 
@@ -63,9 +89,23 @@ int GopCache::Cache(SharedPtrMessage* shared_msg)
         }
 
         if (flv::Demuxer::IsKeyFrame(msg->payload, msg->size)) {
-            rs_info("clear gop cache when got keyframe. vcount=%d, count=%d",
-                    cached_video_count_, (int)queue_.size());
-            Clear();
+            // the gops before are kept for the time shift, but what came
+            // before the first keyframe
+            if (shift_ms_ <= 0 || keyframes_.empty()) {
+                rs_info("clear gop cache when got keyframe. vcount=%d, "
+                        "count=%d, trimmed=%d",
+                        cached_video_count_, (int)queue_.size(),
+                        trimmed_count_);
+                Clear();
+            }
+            gop_bytes_     = 0;
+            trimmed_count_ = 0;
+
+            GopKeyframe keyframe;
+            keyframe.timestamp = msg->timestamp;
+            keyframe.sequence  = End();
+            keyframes_.push_back(keyframe);
+
             cached_video_count_ = 1;
         }
         else {
@@ -73,6 +113,7 @@ int GopCache::Cache(SharedPtrMessage* shared_msg)
         }
 
         audio_after_last_video_count_ = 0;
+        pure_audio_                   = false;
     }
     else if (msg->IsAudio()) {
         audio_after_last_video_count_++;
@@ -81,43 +122,184 @@ int GopCache::Cache(SharedPtrMessage* shared_msg)
     if (audio_after_last_video_count_ > PURE_AUDIO_GUESS_THRESHOLD) {
         rs_warn("clear gop cache for guess pure audio overflow");
         Clear();
+        pure_audio_ = true;
         return ret;
     }
 
     queue_.push_back(msg->Copy());
+    bytes_ += msg->size;
+    gop_bytes_ += msg->size;
+
+    if (over_limits(max_bytes_, max_duration_ms_)) {
+        on_overflow();
+    }
+
+    if (shift_ms_ > 0) {
+        shrink();
+    }
 
     return ret;
 }
 
-int GopCache::Dump(Consumer* consumer, bool atc, JitterAlgorithm ag)
+int GopCache::gop_start()
+{
+    if (keyframes_.empty()) {
+        return -1;
+    }
+
+    return (int)(keyframes_.back().sequence - base_);
+}
+
+bool GopCache::over_limits(int64_t max_bytes, int64_t max_duration_ms)
+{
+    if (max_bytes > 0 && gop_bytes_ > max_bytes) {
+        return true;
+    }
+
+    // the keyframe is kept when trimmed, the duration is of what follows it
+    size_t start = tail_start();
+    if (max_duration_ms <= 0 || queue_.size() <= start) {
+        return false;
+    }
+
+    return queue_.back()->timestamp - queue_[start]->timestamp >
+           max_duration_ms;
+}
+
+void GopCache::on_overflow()
+{
+    if (disable_on_overflow_) {
+        rs_warn("gop cache disabled for overflow. count=%d, bytes=%lld, "
+                "duration=%lld",
+                (int)queue_.size(), (long long)gop_bytes_,
+                (long long)Duration());
+        Clear();
+        overflowed_ = true;
+        return;
+    }
+
+    if (trimmed_count_ == 0) {
+        rs_warn("gop cache overflow, keep the keyframe and the tail. "
+                "count=%d, bytes=%lld, duration=%lld",
+                (int)queue_.size(), (long long)gop_bytes_,
+                (long long)Duration());
+    }
+
+    // down to 3/4 of the limits, not erased again for every message
+    int64_t max_bytes       = max_bytes_ * 3 / 4;
+    int64_t max_duration_ms = max_duration_ms_ * 3 / 4;
+    int64_t last            = queue_.back()->timestamp;
+
+    size_t start = tail_start();
+    size_t end   = start;
+    while (end + 1 < queue_.size()) {
+        bool over_bytes    = max_bytes > 0 && gop_bytes_ > max_bytes;
+        bool over_duration = max_duration_ms > 0 &&
+                             last - queue_[end]->timestamp > max_duration_ms;
+        if (!over_bytes && !over_duration) {
+            break;
+        }
+
+        bytes_ -= queue_[end]->size;
+        gop_bytes_ -= queue_[end]->size;
+        rs_freep(queue_[end]);
+        end++;
+    }
+
+    // the time shifted players have cursors in the gop, the trimmed messages
+    // are left as holes for their sequences not to move
+    if (!keeps_holes()) {
+        queue_.erase(queue_.begin() + start, queue_.begin() + end);
+    }
+    trimmed_count_ += (int)(end - start);
+}
+
+bool GopCache::keeps_holes()
+{
+    return shift_ms_ > 0 && gop_start() >= 0;
+}
+
+size_t GopCache::tail_start()
+{
+    size_t start = gop_start() + 1;
+    if (keeps_holes()) {
+        start += trimmed_count_;
+    }
+
+    return start;
+}
+
+void GopCache::shrink()
+{
+    // the oldest gop goes once the next ones cover the time shift, or for
+    // the bytes, the last gop is only bound by the limits of a gop
+    while (keyframes_.size() > 1) {
+        int64_t covered = queue_.back()->timestamp - keyframes_[1].timestamp;
+        if (covered < shift_ms_ &&
+            (shift_max_bytes_ <= 0 || bytes_ <= shift_max_bytes_)) {
+            break;
+        }
+
+        while (base_ < keyframes_[1].sequence) {
+            if (queue_.front()) {
+                bytes_ -= queue_.front()->size;
+            }
+            rs_freep(queue_.front());
+            queue_.pop_front();
+            base_++;
+        }
+        keyframes_.pop_front();
+    }
+}
+
+int GopCache::Dump(Consumer*       consumer,
+                   bool            atc,
+                   JitterAlgorithm ag,
+                   bool            keyframe_only)
 {
     int ret = ERROR_SUCCESS;
 
-    std::vector<SharedPtrMessage*>::iterator it;
-    for (it = queue_.begin(); it != queue_.end(); it++) {
-        if ((ret = consumer->Enqueue(*it, atc, ag)) != ERROR_SUCCESS) {
+    // the last gop only, the older are for the time shift
+    int    start = rs_max(gop_start(), 0);
+    size_t end   = queue_.size();
+    if (keyframe_only) {
+        end = gop_start() >= 0 ? start + 1 : 0;
+    }
+
+    for (size_t i = start; i < end; i++) {
+        if (!queue_[i]) {
+            continue;
+        }
+        if ((ret = consumer->Enqueue(queue_[i], atc, ag)) != ERROR_SUCCESS) {
             rs_error("dispatch cached gop failed. ret=%d", ret);
             return ret;
         }
     }
 
     rs_trace("dispatch cached gop success. count=%d, duration=%d",
-             (int)queue_.size(), consumer->GetTime());
+             (int)end - start, consumer->GetTime());
 
     return ret;
 }
 
 void GopCache::Clear()
 {
-    std::vector<SharedPtrMessage*>::iterator it;
+    std::deque<SharedPtrMessage*>::iterator it;
 
     for (it = queue_.begin(); it != queue_.end(); it++) {
         rs_freep(*it);
     }
 
+    // the sequences go on, the cursors of the time shifted players are
+    // behind Begin then
+    base_ += queue_.size();
     queue_.clear();
+    keyframes_.clear();
     cached_video_count_           = 0;
     audio_after_last_video_count_ = 0;
+    bytes_                        = 0;
+    gop_bytes_                    = 0;
+    trimmed_count_                = 0;
 }
 
 bool GopCache::PureAudio()
@@ -131,11 +313,120 @@ int64_t GopCache::StartTime()
         return 0;
     }
 
-    return queue_[0]->timestamp;
+    return queue_[rs_max(gop_start(), 0)]->timestamp;
 }
 
 bool GopCache::Empty()
 {
     return queue_.empty();
 }
+
+int64_t GopCache::Bytes()
+{
+    return bytes_;
+}
+
+int GopCache::Count()
+{
+    return (int)queue_.size();
+}
+
+int64_t GopCache::Duration()
+{
+    if (Empty()) {
+        return 0;
+    }
+
+    return queue_.back()->timestamp - queue_.front()->timestamp;
+}
+
+int64_t GopCache::GopBytes()
+{
+    if (gop_start() < 0) {
+        return bytes_;
+    }
+
+    return gop_bytes_;
+}
+
+int64_t GopCache::GopDuration()
+{
+    if (Empty()) {
+        return 0;
+    }
+
+    return queue_.back()->timestamp - StartTime();
+}
+
+bool GopCache::Overflowed()
+{
+    return overflowed_;
+}
+
+int64_t GopCache::TimeShift()
+{
+    return shift_ms_;
+}
+
+int64_t GopCache::Begin()
+{
+    return base_;
+}
+
+int64_t GopCache::End()
+{
+    return base_ + (int64_t)queue_.size();
+}
+
+SharedPtrMessage* GopCache::At(int64_t sequence)
+{
+    if (sequence < Begin() || sequence >= End()) {
+        return nullptr;
+    }
+
+    return queue_[sequence - base_];
+}
+
+int64_t GopCache::LastTimestamp()
+{
+    if (Empty()) {
+        return 0;
+    }
+
+    return queue_.back()->timestamp;
+}
+
+int64_t GopCache::Seek(int64_t shift_ms)
+{
+    if (shift_ms_ <= 0 || keyframes_.empty()) {
+        return -1;
+    }
+
+    int64_t timestamp = LastTimestamp() - shift_ms;
+
+    // the keyframes are in the order of their timestamps
+    std::deque<GopKeyframe>::iterator it = std::upper_bound(
+        keyframes_.begin(), keyframes_.end(), timestamp,
+        [](int64_t t, const GopKeyframe& k) { return t < k.timestamp; });
+    if (it != keyframes_.begin()) {
+        --it;
+    }
+
+    return it->sequence;
+}
+
+int64_t GopCache::Skip(int64_t sequence)
+{
+    sequence = rs_max(sequence, Begin());
+    while (sequence < End() && !queue_[sequence - base_]) {
+        sequence++;
+    }
+
+    return sequence;
+}
+
+bool GopCache::TimeShifting()
+{
+    return shift_ms_ > 0 && enable_gop_cache_ && !overflowed_ && !pure_audio_;
+}
 }  // namespace rtmp
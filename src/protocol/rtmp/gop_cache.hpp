@@ -8,7 +8,7 @@
 
 #include <common/core.hpp>
 
-#include <vector>
+#include <deque>
 
 namespace rtmp {
 
@@ -16,6 +16,20 @@ enum class JitterAlgorithm;
 class SharedPtrMessage;
 class Consumer;
 
+struct GopKeyframe
+{
+    int64_t timestamp;
+    int64_t sequence;
+};
+
+// the messages since the last keyframe, dumped to a new player to start
+// with a picture. a gop over the bytes or the duration limit is trimmed to
+// its keyframe and the latest messages, or the cache is disabled for the
+// stream until it is published again.
+//
+// with a time shift the gops of the last seconds are kept as well, indexed
+// by their keyframes. a message has a sequence which only grows, so the
+// time shifted players read them from a cursor as from the shared ring.
 class GopCache {
   public:
     GopCache();
@@ -23,19 +37,83 @@ class GopCache {
 
   public:
     virtual void Dispose();
+    // enables the cache again after an overflow disabled it
     virtual void Set(bool enabled);
+    // 0 for no limit, disable_on_overflow or else trim
+    virtual void SetLimits(int64_t max_bytes,
+                           int64_t max_duration_ms,
+                           bool    disable_on_overflow);
+    // 0 to keep the last gop only
+    virtual void SetTimeShift(int64_t shift_ms, int64_t max_bytes);
     virtual int  Cache(SharedPtrMessage* shared_msg);
     virtual void Clear();
-    virtual int  Dump(Consumer* consumer, bool atc, JitterAlgorithm jitter_ag);
+    // the last gop, or only its keyframe
+    virtual int  Dump(Consumer*       consumer,
+                      bool            atc,
+                      JitterAlgorithm jitter_ag,
+                      bool            keyframe_only = false);
     virtual bool Empty();
     virtual int64_t StartTime();
     virtual bool    PureAudio();
+    // the payload bytes held by the cached messages
+    virtual int64_t Bytes();
+    virtual int     Count();
+    virtual int64_t Duration();
+    // of the last gop, what a player joins with
+    virtual int64_t GopBytes();
+    virtual int64_t GopDuration();
+    virtual bool    Overflowed();
+
+  public:
+    // the time shift, the sequences of [Begin, End)
+    virtual int64_t           TimeShift();
+    virtual int64_t           Begin();
+    virtual int64_t           End();
+    // nullptr out of [Begin, End) and for a message trimmed from its gop
+    virtual SharedPtrMessage* At(int64_t sequence);
+    // the first sequence from sequence on which has a message, End if none
+    virtual int64_t           Skip(int64_t sequence);
+    virtual int64_t           LastTimestamp();
+    // the last keyframe shift_ms or more before the last message, the
+    // oldest when none is, -1 without time shift or keyframe
+    virtual int64_t           Seek(int64_t shift_ms);
+    // false once the cache stopped keeping the stream, for an overflow, being
+    // disabled or a pure audio stream, the time shifted players go live
+    virtual bool              TimeShifting();
+
+  private:
+    // the index of the keyframe of the last gop, -1 before the first
+    int    gop_start();
+    // the trimmed messages of the last gop are erased, or kept as holes
+    // while time shifted players may have cursors in it
+    bool   keeps_holes();
+    // the index of the first message after the keyframe and the trimmed
+    size_t tail_start();
+    bool   over_limits(int64_t max_bytes, int64_t max_duration_ms);
+    void   on_overflow();
+    void   shrink();
 
   private:
-    int                            cached_video_count_;
-    bool                           enable_gop_cache_;
-    int                            audio_after_last_video_count_;
-    std::vector<SharedPtrMessage*> queue_;
+    int                           cached_video_count_;
+    bool                          enable_gop_cache_;
+    int                           audio_after_last_video_count_;
+    std::deque<SharedPtrMessage*> queue_;
+    // the sequence of the first message
+    int64_t                       base_;
+    // the keyframes of the gops in the queue, the last is kept when its gop
+    // is trimmed
+    std::deque<GopKeyframe>       keyframes_;
+    int64_t                       bytes_;
+    int64_t                       gop_bytes_;
+    int64_t                       max_bytes_;
+    int64_t                       max_duration_ms_;
+    bool                          disable_on_overflow_;
+    bool                          overflowed_;
+    // cleared for guessing a pure audio stream, until a video comes
+    bool                          pure_audio_;
+    int                           trimmed_count_;
+    int64_t                       shift_ms_;
+    int64_t                       shift_max_bytes_;
 };
 }  // namespace rtmp
 
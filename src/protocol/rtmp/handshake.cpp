@@ -225,4 +225,49 @@ int32_t SimpleHandshake::HandshakeWithClient(HandshakeBytes *handshake_bytes, IP
     return ret;
 }
 
+int32_t SimpleHandshake::HandshakeWithServer(HandshakeBytes *handshake_bytes, IProtocolReaderWriter *rw)
+{
+    int32_t ret = ERROR_SUCCESS;
+
+    ssize_t nwrite;
+
+    if ((ret = handshake_bytes->CreateC0C1()) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if ((ret = rw->Write(handshake_bytes->c0c1, 1537, &nwrite)) != ERROR_SUCCESS)
+    {
+        rs_error("simple handshake send c0c1 failed. ret=%d", ret);
+        return ret;
+    }
+
+    if ((ret = handshake_bytes->ReadS0S1S2(rw)) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if (handshake_bytes->s0s1s2[0] != 0x03)
+    {
+        ret = ERROR_RTMP_PLAIN_REQUIRED;
+        rs_error("check s0 failed, only support rtmp plain text. ret=%d", ret);
+        return ret;
+    }
+
+    if ((ret = handshake_bytes->CreateC2()) != ERROR_SUCCESS)
+    {
+        return ret;
+    }
+
+    if ((ret = rw->Write(handshake_bytes->c2, 1536, &nwrite)) != ERROR_SUCCESS)
+    {
+        rs_error("simple handshake send c2 failed. ret=%d", ret);
+        return ret;
+    }
+
+    rs_trace("simple handshake with server success");
+
+    return ret;
+}
+
 } // namespace rtmp
\ No newline at end of file
@@ -43,6 +43,7 @@ public:
 
 public:
     virtual int32_t HandshakeWithClient(HandshakeBytes *handshake_bytes, IProtocolReaderWriter *rw);
+    virtual int32_t HandshakeWithServer(HandshakeBytes *handshake_bytes, IProtocolReaderWriter *rw);
 };
 } // namespace rtmp
 
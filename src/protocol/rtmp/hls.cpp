@@ -0,0 +1,377 @@
+#include <common/config.hpp>
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/utils.hpp>
+#include <muxer/flv.hpp>
+#include <muxer/ts.hpp>
+#include <protocol/rtmp/defines.hpp>
+#include <protocol/rtmp/hls.hpp>
+#include <protocol/rtmp/message.hpp>
+#include <protocol/rtmp/source.hpp>
+
+#include <sstream>
+
+namespace rtmp {
+
+Hls::Hls()
+{
+    source_              = nullptr;
+    request_             = nullptr;
+    enabled_             = false;
+    muxer_               = new ts::Muxer;
+    writer_              = new AsyncFileWriter;
+    worker_              = -1;
+    current_             = nullptr;
+    sequence_            = 0;
+    fragment_ms_         = 0;
+    window_ms_           = 0;
+    drop_until_keyframe_ = false;
+
+    writer_->SetBlockSize(_config->GetDvrBlockSize());
+}
+
+Hls::~Hls()
+{
+    OnUnpublish();
+
+    for (size_t i = 0; i < segments_.size(); i++) {
+        rs_freep(segments_[i]);
+    }
+    for (size_t i = 0; i < expired_.size(); i++) {
+        rs_freep(expired_[i]);
+    }
+    rs_freep(writer_);
+    rs_freep(muxer_);
+}
+
+int Hls::Initialize(Source* source, Request* request)
+{
+    int ret = ERROR_SUCCESS;
+
+    source_  = source;
+    request_ = request;
+
+    return ret;
+}
+
+int Hls::OnPublish(Request* request)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (enabled_ || !_config->GetHlsEnabled(request_->vhost)) {
+        return ret;
+    }
+
+    fragment_ms_ = _config->GetHlsFragment(request_->vhost) * 1000;
+    window_ms_   = _config->GetHlsWindow(request_->vhost) * 1000;
+
+    if (worker_ < 0) {
+        worker_ = AsyncFilePool::Instance()->Assign();
+        writer_->SetWorker(worker_);
+    }
+
+    // the playlist of the last publish is not continued
+    while (!segments_.empty()) {
+        expired_.push_back(segments_.front());
+        segments_.pop_front();
+    }
+
+    drop_until_keyframe_ = false;
+    enabled_             = true;
+
+    return ret;
+}
+
+void Hls::OnUnpublish()
+{
+    if (!enabled_) {
+        return;
+    }
+
+    if (close_segment() == ERROR_SUCCESS) {
+        write_playlist(true);
+    }
+    enabled_ = false;
+}
+
+int Hls::open_segment(int64_t timestamp)
+{
+    int ret = ERROR_SUCCESS;
+
+    std::string dir = Utils::BuildStreamPath(
+        _config->GetHlsPath(request_->vhost) + "/[app]", request_->vhost,
+        request_->app, request_->stream);
+
+    std::stringstream ss;
+    ss << request_->stream << "-" << sequence_ << ".ts";
+
+    current_             = new HlsSegment;
+    current_->sequence   = sequence_++;
+    current_->uri        = ss.str();
+    current_->path       = dir + "/" + current_->uri;
+    current_->start_time = timestamp;
+    current_->duration   = 0;
+
+    if ((ret = writer_->Open(current_->path)) != ERROR_SUCCESS) {
+        rs_error("open hls segment %s failed. ret=%d", current_->path.c_str(),
+                 ret);
+        rs_freep(current_);
+        return ret;
+    }
+
+    if ((ret = muxer_->Initialize(writer_)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    return ret;
+}
+
+int Hls::close_segment()
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!current_) {
+        return ret;
+    }
+
+    HlsSegment* segment = current_;
+    current_            = nullptr;
+
+    // nothing to play, e.g. the publisher left at once
+    if (segment->duration <= 0) {
+        writer_->CloseAndRemove();
+        rs_freep(segment);
+        return ret;
+    }
+
+    writer_->Close();
+    segments_.push_back(segment);
+
+    // the window is kept, with the last segment at least
+    int64_t duration = 0;
+    for (size_t i = 0; i < segments_.size(); i++) {
+        duration += segments_[i]->duration;
+    }
+    while (segments_.size() > 1 && duration > window_ms_) {
+        duration -= segments_.front()->duration;
+        expired_.push_back(segments_.front());
+        segments_.pop_front();
+    }
+
+    return ret;
+}
+
+void Hls::remove_expired()
+{
+    // expired at the previous reap
+    while (!expired_.empty()) {
+        HlsSegment* segment = expired_.front();
+        expired_.pop_front();
+
+        AsyncFilePool::Instance()->Remove(segment->path, worker_);
+        rs_freep(segment);
+    }
+}
+
+int Hls::reap_segment(int64_t timestamp)
+{
+    int ret = ERROR_SUCCESS;
+
+    remove_expired();
+
+    // lasts until the next one starts, not to its last frame, or every
+    // extinf is a frame short
+    if (current_) {
+        current_->duration =
+            rs_max(current_->duration, timestamp - current_->start_time);
+    }
+
+    if ((ret = close_segment()) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if ((ret = write_playlist(false)) != ERROR_SUCCESS) {
+        rs_warn("write hls playlist failed. ret=%d", ret);
+        ret = ERROR_SUCCESS;
+    }
+
+    if ((ret = open_segment(timestamp)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    return ret;
+}
+
+int Hls::write_playlist(bool end)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (segments_.empty()) {
+        return ret;
+    }
+
+    int64_t target = 0;
+    for (size_t i = 0; i < segments_.size(); i++) {
+        target = rs_max(target, segments_[i]->duration);
+    }
+
+    std::stringstream ss;
+    ss << "#EXTM3U\n"
+       << "#EXT-X-VERSION:3\n"
+       << "#EXT-X-MEDIA-SEQUENCE:" << segments_.front()->sequence << "\n"
+       << "#EXT-X-TARGETDURATION:" << (target + 999) / 1000 << "\n";
+
+    ss.setf(std::ios::fixed);
+    ss.precision(3);
+    for (size_t i = 0; i < segments_.size(); i++) {
+        HlsSegment* segment = segments_[i];
+        ss << "#EXTINF:" << segment->duration / 1000.0 << ",\n"
+           << segment->uri << "\n";
+    }
+
+    if (end) {
+        ss << "#EXT-X-ENDLIST\n";
+    }
+
+    std::string path = Utils::BuildStreamPath(
+        _config->GetHlsPath(request_->vhost) + "/[app]/[stream].m3u8",
+        request_->vhost, request_->app, request_->stream);
+    std::string playlist = ss.str();
+
+    // the players never see a playlist half written, nor a segment which
+    // is not closed yet as the rename is queued after its close
+    AsyncFileWriter writer;
+    writer.SetWorker(worker_);
+    if ((ret = writer.Open(path + ".tmp")) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if ((ret = writer.Write((void*)playlist.data(), playlist.size(),
+                            nullptr)) != ERROR_SUCCESS) {
+        writer.CloseAndRemove();
+        return ret;
+    }
+
+    writer.CloseAndRename(path);
+
+    return ret;
+}
+
+int Hls::OnAudio(SharedPtrMessage* shared_audio)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!enabled_) {
+        return ret;
+    }
+
+    char*   payload   = shared_audio->payload;
+    int     size      = shared_audio->size;
+    int64_t timestamp = shared_audio->timestamp;
+
+    if (flv::Demuxer::IsAACSequenceHeader(payload, size)) {
+        return muxer_->WriteAudio(timestamp, payload, size);
+    }
+
+    // a stream with video is cut on its keyframes, an audio only one on time
+    if (!muxer_->HasVideo()) {
+        if (!current_) {
+            ret = open_segment(timestamp);
+        }
+        else if (timestamp - current_->start_time >= fragment_ms_) {
+            ret = reap_segment(timestamp);
+        }
+        if (ret != ERROR_SUCCESS) {
+            return ret;
+        }
+    }
+
+    if (!current_) {
+        return ret;
+    }
+
+    ret = writer_->Reserve(size + size / 4 + TS_PACKET_SIZE, true);
+    if (ret == ERROR_SYSTEM_FILE_QUEUE_FULL) {
+        return ERROR_SUCCESS;
+    }
+    if (ret != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if ((ret = muxer_->WriteAudio(timestamp, payload, size)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    current_->duration =
+        rs_max(current_->duration, timestamp - current_->start_time);
+
+    return ret;
+}
+
+int Hls::OnVideo(SharedPtrMessage* shared_video)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!enabled_) {
+        return ret;
+    }
+
+    char*   payload   = shared_video->payload;
+    int     size      = shared_video->size;
+    int64_t timestamp = shared_video->timestamp;
+
+    if (flv::Demuxer::IsAVCSequenceHeader(payload, size)) {
+        return muxer_->WriteVideo(timestamp, payload, size);
+    }
+
+    bool is_keyframe = flv::Demuxer::IsAVC(payload, size) &&
+                       flv::Demuxer::IsKeyFrame(payload, size);
+
+    if (is_keyframe) {
+        if (!current_) {
+            ret = open_segment(timestamp);
+        }
+        else if (timestamp - current_->start_time >= fragment_ms_) {
+            ret = reap_segment(timestamp);
+        }
+        if (ret != ERROR_SUCCESS) {
+            return ret;
+        }
+    }
+
+    // a segment starts with a keyframe
+    if (!current_) {
+        return ret;
+    }
+
+    int ts_size = size + size / 4 + TS_PACKET_SIZE;
+    if (drop_until_keyframe_ && !is_keyframe) {
+        writer_->Drop(ts_size);
+        return ret;
+    }
+
+    ret = writer_->Reserve(ts_size, true);
+    if (ret == ERROR_SYSTEM_FILE_QUEUE_FULL) {
+        if (!drop_until_keyframe_) {
+            rs_warn("hls io queue full, drop video until keyframe. path=%s",
+                    current_->path.c_str());
+        }
+        drop_until_keyframe_ = true;
+        return ERROR_SUCCESS;
+    }
+    if (ret != ERROR_SUCCESS) {
+        return ret;
+    }
+    drop_until_keyframe_ = false;
+
+    if ((ret = muxer_->WriteVideo(timestamp, payload, size)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    current_->duration =
+        rs_max(current_->duration, timestamp - current_->start_time);
+
+    return ret;
+}
+
+}  // namespace rtmp
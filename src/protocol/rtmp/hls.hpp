@@ -0,0 +1,75 @@
+#ifndef RS_RTMP_HLS_HPP
+#define RS_RTMP_HLS_HPP
+
+#include <common/async_file.hpp>
+#include <common/core.hpp>
+
+#include <deque>
+#include <string>
+
+namespace ts {
+class Muxer;
+}
+
+namespace rtmp {
+
+class Source;
+class Request;
+class SharedPtrMessage;
+
+struct HlsSegment
+{
+    int64_t     sequence;
+    // the file, and its uri in the playlist
+    std::string path;
+    std::string uri;
+    int64_t     start_time;
+    int64_t     duration;
+};
+
+// remuxes the published stream to mpeg-ts segments cut on the keyframes, and
+// the live playlist of the last ones. the files are written by one io
+// thread, the playlist replaced at once by a rename once the segments it
+// lists are closed.
+class Hls {
+  public:
+    Hls();
+    virtual ~Hls();
+
+  public:
+    virtual int  Initialize(Source* source, Request* request);
+    virtual int  OnPublish(Request* request);
+    virtual void OnUnpublish();
+    virtual int  OnAudio(SharedPtrMessage* shared_audio);
+    virtual int  OnVideo(SharedPtrMessage* shared_video);
+
+  private:
+    int  open_segment(int64_t timestamp);
+    int  close_segment();
+    int  reap_segment(int64_t timestamp);
+    int  write_playlist(bool end);
+    void remove_expired();
+
+  private:
+    Source*                 source_;
+    Request*                request_;
+    bool                    enabled_;
+    ts::Muxer*              muxer_;
+    AsyncFileWriter*        writer_;
+    // the io thread of the segments, the playlist and the removals
+    int                     worker_;
+    HlsSegment*             current_;
+    std::deque<HlsSegment*> segments_;
+    // out of the playlist, removed at the next reap as players may still
+    // download them
+    std::deque<HlsSegment*> expired_;
+    int64_t                 sequence_;
+    int64_t                 fragment_ms_;
+    int64_t                 window_ms_;
+    // the io queue was full, the video waits for a keyframe
+    bool                    drop_until_keyframe_;
+};
+
+}  // namespace rtmp
+
+#endif
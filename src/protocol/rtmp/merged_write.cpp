@@ -0,0 +1,117 @@
+#include <common/log.hpp>
+#include <common/utils.hpp>
+#include <protocol/rtmp/defines.hpp>
+#include <protocol/rtmp/merged_write.hpp>
+
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+
+// weight of the last sample in the moving averages
+#define MW_EWMA_ALPHA 0.2
+
+namespace rtmp {
+
+MergedWriteTuner::MergedWriteTuner()
+{
+    fd_           = -1;
+    adaptive_     = false;
+    min_sleep_ms_ = 0;
+    max_sleep_ms_ = RTMP_MR_SLEEP_MS;
+    batch_bytes_  = 0;
+    bytes_rate_   = 0;
+    msgs_rate_    = 0;
+    drain_rate_   = 0;
+    last_send_ms_ = 0;
+    last_unsent_  = 0;
+    sleep_ms_     = RTMP_MR_SLEEP_MS;
+    min_msgs_     = RTMP_MR_MIN_MSGS;
+}
+
+MergedWriteTuner::~MergedWriteTuner() {}
+
+void MergedWriteTuner::Initialize(int  fd,
+                                  bool adaptive,
+                                  int  min_sleep_ms,
+                                  int  max_sleep_ms,
+                                  int  batch_bytes)
+{
+    fd_           = fd;
+    adaptive_     = adaptive;
+    min_sleep_ms_ = min_sleep_ms;
+    max_sleep_ms_ = rs_max(min_sleep_ms, max_sleep_ms);
+    batch_bytes_  = batch_bytes;
+    sleep_ms_     = max_sleep_ms_;
+    min_msgs_     = RTMP_MR_MIN_MSGS;
+}
+
+int MergedWriteTuner::unsent_bytes()
+{
+    int v = 0;
+    if (fd_ < 0 || ::ioctl(fd_, SIOCOUTQ, &v) != 0) {
+        return 0;
+    }
+    return v;
+}
+
+void MergedWriteTuner::OnSend(int nb_msgs, int nb_bytes)
+{
+    if (!adaptive_) {
+        return;
+    }
+
+    int64_t now    = Utils::GetSteadyMilliSeconds();
+    int     unsent = unsent_bytes();
+
+    if (last_send_ms_ == 0) {
+        last_send_ms_ = now;
+        last_unsent_  = unsent;
+        return;
+    }
+
+    int64_t elapsed = now - last_send_ms_;
+    if (elapsed <= 0) {
+        return;
+    }
+
+    // what the stream produces and what the client takes out of the socket
+    double drained = (double)(last_unsent_ + nb_bytes - unsent);
+    bytes_rate_ += MW_EWMA_ALPHA * ((double)nb_bytes / elapsed - bytes_rate_);
+    msgs_rate_ += MW_EWMA_ALPHA * ((double)nb_msgs / elapsed - msgs_rate_);
+    drain_rate_ +=
+        MW_EWMA_ALPHA * (rs_max(drained, 0.0) / elapsed - drain_rate_);
+
+    last_send_ms_ = now;
+    last_unsent_  = unsent;
+
+    // the delay which gathers a batch of batch_bytes
+    double sleep_ms = max_sleep_ms_;
+    if (bytes_rate_ > 0) {
+        sleep_ms = batch_bytes_ / bytes_rate_;
+    }
+
+    // the kernel still holds data for a while, don't wake up before
+    if (unsent > 0 && drain_rate_ > 0) {
+        sleep_ms = rs_max(sleep_ms, unsent / drain_rate_);
+    }
+
+    sleep_ms  = rs_min(sleep_ms, (double)max_sleep_ms_);
+    sleep_ms_ = rs_max((int)sleep_ms, min_sleep_ms_);
+    min_msgs_ = rs_min(rs_max((int)(msgs_rate_ * sleep_ms_), 1), RTMP_MR_MSGS);
+
+    rs_verbose("mw tuned, sleep=%dms, min_msgs=%d, rate=%dKBps, drain=%dKBps, "
+               "unsent=%d",
+               sleep_ms_, min_msgs_, (int)bytes_rate_, (int)drain_rate_,
+               unsent);
+}
+
+int MergedWriteTuner::SleepMS()
+{
+    return sleep_ms_;
+}
+
+int MergedWriteTuner::MinMsgs()
+{
+    return min_msgs_;
+}
+
+}  // namespace rtmp
@@ -0,0 +1,48 @@
+#ifndef RS_RTMP_MERGED_WRITE_HPP
+#define RS_RTMP_MERGED_WRITE_HPP
+
+#include <common/core.hpp>
+
+namespace rtmp {
+
+// tune the merged write of a player from what is measured on its socket.
+// a batch should carry enough bytes to amortize the syscall, and there is
+// no point in sending before the kernel has drained what it already holds.
+class MergedWriteTuner {
+  public:
+    MergedWriteTuner();
+    virtual ~MergedWriteTuner();
+
+  public:
+    // fd is used to read the unsent bytes of the socket, -1 to ignore
+    virtual void Initialize(int  fd,
+                            bool adaptive,
+                            int  min_sleep_ms,
+                            int  max_sleep_ms,
+                            int  batch_bytes);
+    virtual void OnSend(int nb_msgs, int nb_bytes);
+    virtual int  SleepMS();
+    virtual int  MinMsgs();
+
+  private:
+    virtual int unsent_bytes();
+
+  private:
+    int  fd_;
+    bool adaptive_;
+    int  min_sleep_ms_;
+    int  max_sleep_ms_;
+    int  batch_bytes_;
+    // moving averages, per ms of wall time
+    double  bytes_rate_;
+    double  msgs_rate_;
+    double  drain_rate_;
+    int64_t last_send_ms_;
+    int     last_unsent_;
+    int     sleep_ms_;
+    int     min_msgs_;
+};
+
+}  // namespace rtmp
+
+#endif
@@ -4,6 +4,7 @@
  * @LastEditTime: 2020-03-19 14:04:04
  */
 #include <common/error.hpp>
+#include <common/file.hpp>
 #include <common/log.hpp>
 #include <common/utils.hpp>
 #include <muxer/flv.hpp>
@@ -193,6 +194,9 @@ void MessageHeader::InitializeAudio(int32_t size, uint32_t time, int32_t stream)
     perfer_cid      = RTMP_CID_AUDIO;
 }
 
+RS_IMPLEMENT_POOL(CommonMessage, "common_msg")
+RS_IMPLEMENT_POOL(SharedPtrMessage, "shared_msg")
+
 CommonMessage::CommonMessage()
 {
     size    = 0;
@@ -201,13 +205,13 @@ CommonMessage::CommonMessage()
 
 CommonMessage::~CommonMessage()
 {
-    rs_freepa(payload);
+    BufferPool::Instance()->Free(payload);
 }
 
 void CommonMessage::CreatePayload(int32_t size)
 {
-    rs_freepa(payload);
-    payload = new char[size];
+    BufferPool::Instance()->Free(payload);
+    payload = BufferPool::Instance()->Alloc(size);
 }
 
 ChunkStream::ChunkStream(int cid)
@@ -221,15 +225,22 @@ ChunkStream::ChunkStream(int cid)
 
 ChunkStream::~ChunkStream() {}
 
+RS_IMPLEMENT_POOL(SharedPtrMessage::SharedPtrPayload, "shared_payload")
+
 /**
  * @name: SharedPtrPayload
  * @msg: SharedPtrPayload构造函数
  */
 SharedPtrMessage::SharedPtrPayload::SharedPtrPayload()
 {
-    size         = 0;
-    payload      = nullptr;
-    shared_count = 0;
+    size              = 0;
+    payload           = nullptr;
+    pooled            = false;
+    mapping           = nullptr;
+    shared_count      = 0;
+    chunked_caches        = nullptr;
+    nb_chunked_caches     = 0;
+    has_previous_tag_size = false;
 }
 
 /**
@@ -238,7 +249,23 @@ SharedPtrMessage::SharedPtrPayload::SharedPtrPayload()
  */
 SharedPtrMessage::SharedPtrPayload::~SharedPtrPayload()
 {
-    rs_freepa(payload);
+    for (int i = 0; i < nb_chunked_caches; i++) {
+        rs_freepa(chunked_caches[i].headers);
+        rs_freepa(chunked_caches[i].iovs);
+    }
+    rs_freepa(chunked_caches);
+
+    if (mapping) {
+        mapping->Release();
+        payload = nullptr;
+    }
+    else if (pooled) {
+        BufferPool::Instance()->Free(payload);
+        payload = nullptr;
+    }
+    else {
+        rs_freepa(payload);
+    }
 }
 
 SharedPtrMessage::SharedPtrMessage()
@@ -247,6 +274,11 @@ SharedPtrMessage::SharedPtrMessage()
 }
 
 SharedPtrMessage::~SharedPtrMessage()
+{
+    Reset();
+}
+
+void SharedPtrMessage::Reset()
 {
     if (ptr_) {
         if (ptr_->shared_count <= 0) {
@@ -256,6 +288,23 @@ SharedPtrMessage::~SharedPtrMessage()
             ptr_->shared_count--;
         }
     }
+
+    ptr_    = nullptr;
+    payload = nullptr;
+    size    = 0;
+}
+
+void SharedPtrMessage::Assign(SharedPtrMessage* src)
+{
+    Reset();
+
+    ptr_ = src->ptr_;
+    ptr_->shared_count++;
+
+    timestamp = src->timestamp;
+    stream_id = src->stream_id;
+    payload   = ptr_->payload;
+    size      = ptr_->size;
 }
 
 int SharedPtrMessage::Create(MessageHeader* pheader, char* payload, int size)
@@ -295,12 +344,32 @@ int SharedPtrMessage::Create(CommonMessage* msg)
         return ret;
     }
 
+    // the payload was allocated by CommonMessage::CreatePayload
+    ptr_->pooled = true;
+
     msg->payload = nullptr;
     msg->size    = 0;
 
     return ret;
 }
 
+int SharedPtrMessage::CreateView(MessageHeader* pheader,
+                                 MappedFile*    file,
+                                 char*          payload,
+                                 int            size)
+{
+    int ret = ERROR_SUCCESS;
+
+    if ((ret = Create(pheader, payload, size)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    file->AddRef();
+    ptr_->mapping = file;
+
+    return ret;
+}
+
 int SharedPtrMessage::Count()
 {
     return ptr_->shared_count;
@@ -351,6 +420,107 @@ int SharedPtrMessage::ChunkHeader(char* buf, bool c0)
     }
 }
 
+/**
+ * @name: GetChunkedIovs
+ * @msg: 获取按chunk_size切分好的iovec,同一个payload的所有拷贝共享,
+ *       第一个iovec留给调用者填自己的c0头,扩展时间戳或缓存已满时返回false,
+ *       由调用者自己编码chunk头
+ */
+bool SharedPtrMessage::GetChunkedIovs(int     chunk_size,
+                                      iovec** piovs,
+                                      int*    pnb_iovs)
+{
+    if (!ptr_ || !payload || size <= 0 || chunk_size <= 0) {
+        return false;
+    }
+
+    // the c3 headers only depend on the timestamp when it is extended
+    if ((uint32_t)timestamp >= RTMP_EXTENDED_TIMESTAMP) {
+        return false;
+    }
+
+    for (int i = 0; i < ptr_->nb_chunked_caches; i++) {
+        ChunkedCache* cache = &ptr_->chunked_caches[i];
+        if (cache->chunk_size == chunk_size) {
+            *piovs    = cache->iovs;
+            *pnb_iovs = cache->nb_iovs;
+            return true;
+        }
+    }
+
+    if (ptr_->nb_chunked_caches >= RTMP_CHUNKED_CACHE_MAX) {
+        return false;
+    }
+
+    if (!ptr_->chunked_caches) {
+        ptr_->chunked_caches = new ChunkedCache[RTMP_CHUNKED_CACHE_MAX];
+    }
+
+    int nb_chunks = (size + chunk_size - 1) / chunk_size;
+
+    ChunkedCache* cache = &ptr_->chunked_caches[ptr_->nb_chunked_caches++];
+    cache->chunk_size   = chunk_size;
+    cache->headers      = new char[nb_chunks * RTMP_FMT3_HEADER_SIZE];
+    cache->iovs         = new iovec[nb_chunks * 2];
+    cache->nb_iovs      = 0;
+
+    char* h    = cache->headers;
+    char* p    = payload;
+    char* pend = payload + size;
+
+    while (p < pend) {
+        iovec* iovs = cache->iovs + cache->nb_iovs;
+        if (p == payload) {
+            iovs[0].iov_base = nullptr;
+            iovs[0].iov_len  = 0;
+        }
+        else {
+            int nbh          = ChunkHeader(h, false);
+            iovs[0].iov_base = h;
+            iovs[0].iov_len  = nbh;
+            h += nbh;
+        }
+
+        int payload_size = rs_min(chunk_size, (int)(pend - p));
+        iovs[1].iov_base = p;
+        iovs[1].iov_len  = payload_size;
+
+        p += payload_size;
+        cache->nb_iovs += 2;
+    }
+
+    *piovs    = cache->iovs;
+    *pnb_iovs = cache->nb_iovs;
+
+    return true;
+}
+
+bool SharedPtrMessage::GetFlvIovs(char* header, iovec* iovs)
+{
+    if (!ptr_ || !payload) {
+        return false;
+    }
+
+    if (!ptr_->has_previous_tag_size) {
+        flv::Muxer::EncodePreviousTagSize(FLV_TAG_HEADER_SIZE + size,
+                                          ptr_->previous_tag_size);
+        ptr_->has_previous_tag_size = true;
+    }
+
+    // the rtmp message types of audio, video and data are the tag types
+    flv::Muxer::EncodeTagHeader(ptr_->header.message_type, size, timestamp,
+                                header);
+
+    iovs[0].iov_base = header;
+    iovs[0].iov_len  = FLV_TAG_HEADER_SIZE;
+    iovs[1].iov_base = payload;
+    iovs[1].iov_len  = size;
+    iovs[2].iov_base = ptr_->previous_tag_size;
+    iovs[2].iov_len  = FLV_PREVIOUS_TAG_SIZE;
+
+    return true;
+}
+
 SharedPtrMessage* SharedPtrMessage::Copy()
 {
     SharedPtrMessage* copy = new SharedPtrMessage;
@@ -365,6 +535,84 @@ SharedPtrMessage* SharedPtrMessage::Copy()
     return copy;
 }
 
+const SharedMessageHeader* SharedPtrMessage::Header()
+{
+    return &ptr_->header;
+}
+
+MessageRing::MessageRing(int size)
+{
+    uint32_t capacity = 1;
+    while ((int)capacity < size) {
+        capacity <<= 1;
+    }
+
+    msgs_     = new SharedPtrMessage*[capacity];
+    mask_     = capacity - 1;
+    begin_    = 0;
+    end_      = 0;
+    keyframe_ = -1;
+}
+
+MessageRing::~MessageRing()
+{
+    Clear();
+    rs_freepa(msgs_);
+}
+
+int64_t MessageRing::Begin()
+{
+    return begin_;
+}
+
+int64_t MessageRing::End()
+{
+    return end_;
+}
+
+int64_t MessageRing::LastKeyframe()
+{
+    return keyframe_ >= begin_ ? keyframe_ : -1;
+}
+
+SharedPtrMessage* MessageRing::At(int64_t seq)
+{
+    if (seq < begin_ || seq >= end_) {
+        return nullptr;
+    }
+
+    return msgs_[seq & mask_];
+}
+
+void MessageRing::Push(SharedPtrMessage* msg)
+{
+    if (end_ - begin_ > (int64_t)mask_) {
+        SharedPtrMessage* oldest = msgs_[begin_ & mask_];
+        rs_freep(oldest);
+        begin_++;
+    }
+
+    if (msg->IsVideo() && flv::Demuxer::IsKeyFrame(msg->payload, msg->size) &&
+        !flv::Demuxer::IsAVCSequenceHeader(msg->payload, msg->size)) {
+        keyframe_ = end_;
+    }
+
+    msgs_[end_ & mask_] = msg->Copy();
+    end_++;
+}
+
+void MessageRing::Clear()
+{
+    for (int64_t seq = begin_; seq < end_; seq++) {
+        SharedPtrMessage* msg = msgs_[seq & mask_];
+        rs_freep(msg);
+    }
+
+    // the sequence keeps going, the cursors of the consumers stay valid
+    begin_    = end_;
+    keyframe_ = -1;
+}
+
 MessageArray::MessageArray(int max_msgs)
 {
     msgs = new SharedPtrMessage*[max_msgs];
@@ -500,23 +748,11 @@ int MessageQueue::DumpPackets(int                max_count,
         return ret;
     }
 
-    count = rs_min(nb_msgs, max_count);
+    count = msgs_.PopFront(pmsgs, rs_min(nb_msgs, max_count));
 
-    SharedPtrMessage** omsgs = msgs_.Data();
-    for (int i = 0; i < count; i++) {
-        pmsgs[i] = omsgs[i];
-    }
-
-    SharedPtrMessage* last = omsgs[count - 1];
+    SharedPtrMessage* last = pmsgs[count - 1];
     av_start_time_         = last->timestamp;
 
-    if (count >= nb_msgs) {
-        msgs_.Clear();
-    }
-    else {
-        msgs_.Erase(msgs_.Begin(), msgs_.Begin() + count);
-    }
-
     return ret;
 }
 
@@ -8,7 +8,13 @@
 #define RS_RTMP_MESSAGE_HPP
 
 #include <common/core.hpp>
+#include <common/pool.hpp>
 #include <common/queue.hpp>
+#include <protocol/rtmp/defines.hpp>
+
+#include <sys/uio.h>
+
+class MappedFile;
 
 namespace rtmp {
 
@@ -55,6 +61,8 @@ class MessageHeader {
 };
 
 class CommonMessage {
+    RS_DECLARE_POOL();
+
   public:
     CommonMessage();
     virtual ~CommonMessage();
@@ -90,6 +98,8 @@ struct SharedMessageHeader
 };
 
 class SharedPtrMessage {
+    RS_DECLARE_POOL();
+
   public:
     SharedPtrMessage();
     virtual ~SharedPtrMessage();
@@ -97,16 +107,43 @@ class SharedPtrMessage {
   public:
     virtual int  Create(CommonMessage* msg);
     virtual int  Create(MessageHeader* pheader, char* payload, int size);
+    // payload points into the mapping, which is kept until the last copy
+    // is released
+    virtual int  CreateView(MessageHeader* pheader,
+                            MappedFile*    file,
+                            char*          payload,
+                            int            size);
     virtual int  Count();
     virtual bool Check(int stream_id);
     virtual bool IsAV();
     virtual bool IsAudio();
     virtual bool IsVideo();
     virtual int  ChunkHeader(char* buf, bool c0);
-    virtual SharedPtrMessage* Copy();
+    // the chunks of the payload and their c3 headers, shared by the players
+    // with the same chunk size. the first iovec is left for the c0 header of
+    // each player, false for an extended timestamp which is in every c3.
+    virtual bool GetChunkedIovs(int chunk_size, iovec** piovs, int* pnb_iovs);
+    // the message as an flv tag in 3 iovecs, the tag header encoded in
+    // header, the payload and the previous tag size kept by the payload.
+    virtual bool GetFlvIovs(char* header, iovec* iovs);
+    virtual SharedPtrMessage*          Copy();
+    virtual const SharedMessageHeader* Header();
+    // reuse this object as a reference of src, no heap allocation
+    virtual void Assign(SharedPtrMessage* src);
+    virtual void Reset();
 
   private:
+    struct ChunkedCache
+    {
+        int    chunk_size;
+        char*  headers;
+        iovec* iovs;
+        int    nb_iovs;
+    };
+
     class SharedPtrPayload {
+        RS_DECLARE_POOL();
+
       public:
         SharedPtrPayload();
         virtual ~SharedPtrPayload();
@@ -114,8 +151,17 @@ class SharedPtrMessage {
       public:
         int                 size;
         char*               payload;
+        // payload comes from the BufferPool rather than new[]
+        bool                pooled;
+        // or is a view of this mapping
+        MappedFile*         mapping;
         int                 shared_count;
         SharedMessageHeader header;
+        // immutable once built, shared by all the copies
+        ChunkedCache*       chunked_caches;
+        int                 nb_chunked_caches;
+        char                previous_tag_size[4];
+        bool                has_previous_tag_size;
     };
 
   public:
@@ -128,6 +174,30 @@ class SharedPtrMessage {
     SharedPtrPayload* ptr_;
 };
 
+// one ring per source shared by all its consumers, every consumer keeps
+// its own read cursor. the messages are addressed by a sequence number which
+// never goes back, the oldest ones are overwritten when the ring is full.
+class MessageRing {
+  public:
+    MessageRing(int size);
+    virtual ~MessageRing();
+
+  public:
+    virtual int64_t           Begin();
+    virtual int64_t           End();
+    virtual int64_t           LastKeyframe();
+    virtual SharedPtrMessage* At(int64_t seq);
+    virtual void              Push(SharedPtrMessage* msg);
+    virtual void              Clear();
+
+  private:
+    SharedPtrMessage** msgs_;
+    uint32_t           mask_;
+    int64_t            begin_;
+    int64_t            end_;
+    int64_t            keyframe_;
+};
+
 class MessageArray {
   public:
     MessageArray(int max_msgs);
@@ -164,7 +234,7 @@ class MessageQueue {
     int64_t                       av_start_time_;
     int64_t                       av_end_time_;
     int                           queue_size_ms_;
-    FastVector<SharedPtrMessage*> msgs_;
+    RingBuffer<SharedPtrMessage*> msgs_;
 };
 
 }  // namespace rtmp
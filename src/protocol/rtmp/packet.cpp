@@ -1119,8 +1119,38 @@ int PublishPacket::GetSize()
 }
 int PublishPacket::EncodePacket(BufferManager* manager)
 {
-    // TODO implement encode
     int ret = ERROR_SUCCESS;
+
+    if ((ret = AMF0WriteString(manager, command_name)) != ERROR_SUCCESS) {
+        rs_error("encode publish packet: amf0 write command failed. ret=%d",
+                 ret);
+        return ret;
+    }
+
+    if ((ret = AMF0WriteNumber(manager, transaction_id)) != ERROR_SUCCESS) {
+        rs_error(
+            "encode publish packet: amf0 write transaction_id failed. ret=%d",
+            ret);
+        return ret;
+    }
+
+    if ((ret = command_object->Write(manager)) != ERROR_SUCCESS) {
+        rs_error("encode publish packet: amf0 write object failed. ret=%d",
+                 ret);
+        return ret;
+    }
+
+    if ((ret = AMF0WriteString(manager, stream_name)) != ERROR_SUCCESS) {
+        rs_error("encode publish packet: amf0 write stream_name failed. ret=%d",
+                 ret);
+        return ret;
+    }
+
+    if ((ret = AMF0WriteString(manager, type)) != ERROR_SUCCESS) {
+        rs_error("encode publish packet: amf0 write type failed. ret=%d", ret);
+        return ret;
+    }
+
     return ret;
 }
 
@@ -1437,6 +1467,111 @@ int PlayPacket::GetSize()
 int PlayPacket::EncodePacket(BufferManager* manager)
 {
     int ret = ERROR_SUCCESS;
+
+    if ((ret = AMF0WriteString(manager, command_name)) != ERROR_SUCCESS) {
+        rs_error("encode play packet: amf0 write command failed. ret=%d", ret);
+        return ret;
+    }
+
+    if ((ret = AMF0WriteNumber(manager, transaction_id)) != ERROR_SUCCESS) {
+        rs_error("encode play packet: amf0 write transaction_id failed. ret=%d",
+                 ret);
+        return ret;
+    }
+
+    if ((ret = command_obj->Write(manager)) != ERROR_SUCCESS) {
+        rs_error("encode play packet: amf0 write object failed. ret=%d", ret);
+        return ret;
+    }
+
+    if ((ret = AMF0WriteString(manager, stream_name)) != ERROR_SUCCESS) {
+        rs_error("encode play packet: amf0 write stream_name failed. ret=%d",
+                 ret);
+        return ret;
+    }
+
+    if ((start != -2 || duration != -1 || !reset) &&
+        (ret = AMF0WriteNumber(manager, start)) != ERROR_SUCCESS) {
+        rs_error("encode play packet: amf0 write start failed. ret=%d", ret);
+        return ret;
+    }
+
+    if ((duration != -1 || !reset) &&
+        (ret = AMF0WriteNumber(manager, duration)) != ERROR_SUCCESS) {
+        rs_error("encode play packet: amf0 write duration failed. ret=%d", ret);
+        return ret;
+    }
+
+    if (!reset && (ret = AMF0WriteBoolean(manager, reset)) != ERROR_SUCCESS) {
+        rs_error("encode play packet: amf0 write reset failed. ret=%d", ret);
+        return ret;
+    }
+
+    rs_trace("encode play packet success");
+
+    return ret;
+}
+
+SeekPacket::SeekPacket()
+{
+    command_name   = RTMP_AMF0_COMMAND_SEEK;
+    transaction_id = 0;
+    command_obj    = AMF0Any::Null();
+    offset         = 0;
+}
+
+SeekPacket::~SeekPacket()
+{
+    rs_freep(command_obj);
+}
+
+int SeekPacket::GetPreferCID()
+{
+    return RTMP_CID_OVER_CONNECTION;
+}
+
+int SeekPacket::GetMessageType()
+{
+    return RTMP_MSG_AMF0_COMMAND;
+}
+
+int SeekPacket::Decode(BufferManager* manager)
+{
+    int ret = ERROR_SUCCESS;
+
+    if ((ret = AMF0ReadString(manager, command_name)) != ERROR_SUCCESS) {
+        rs_error("decode seek packet: amf0 read command failed. ret=%d", ret);
+        return ret;
+    }
+
+    if (command_name != RTMP_AMF0_COMMAND_SEEK) {
+        ret = ERROR_PROTOCOL_AMF0_DECODE;
+        rs_error("decode seek packet: amf0 read command failed. require=%s, "
+                 "actual=%s, ret=%d",
+                 RTMP_AMF0_COMMAND_SEEK, command_name.c_str(), ret);
+        return ret;
+    }
+
+    if ((ret = AMF0ReadNumber(manager, transaction_id)) != ERROR_SUCCESS) {
+        rs_error("decode seek packet: amf0 read transaction_id failed. ret=%d",
+                 ret);
+        return ret;
+    }
+
+    AMF0Any* p = nullptr;
+    if ((ret = AMF0ReadAny(manager, &p)) != ERROR_SUCCESS) {
+        rs_freep(p);
+        rs_error("decode seek packet: amf0 read object failed. ret=%d", ret);
+        return ret;
+    }
+    rs_freep(command_obj);
+    command_obj = p;
+
+    if ((ret = AMF0ReadNumber(manager, offset)) != ERROR_SUCCESS) {
+        rs_error("decode seek packet: amf0 read offset failed. ret=%d", ret);
+        return ret;
+    }
+
     return ret;
 }
 
@@ -328,6 +328,25 @@ class PlayPacket : public Packet {
     bool        reset;
 };
 
+// seek of a vod client, the offset is in ms
+class SeekPacket : public Packet {
+  public:
+    SeekPacket();
+    virtual ~SeekPacket();
+
+  public:
+    // Packet
+    virtual int GetPreferCID() override;
+    virtual int GetMessageType() override;
+    virtual int Decode(BufferManager* manager) override;
+
+  public:
+    std::string command_name;
+    double      transaction_id;
+    AMF0Any*    command_obj;
+    double      offset;
+};
+
 class UserControlPacket : public Packet {
   public:
     UserControlPacket();
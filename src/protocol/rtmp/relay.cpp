@@ -0,0 +1,999 @@
+#include <common/buffer.hpp>
+#include <common/config.hpp>
+#include <common/error.hpp>
+#include <common/log.hpp>
+#include <common/shm_ring.hpp>
+#include <common/socket.hpp>
+#include <common/st.hpp>
+#include <common/utils.hpp>
+#include <protocol/rtmp/consumer.hpp>
+#include <protocol/rtmp/defines.hpp>
+#include <protocol/rtmp/message.hpp>
+#include <protocol/rtmp/packet.hpp>
+#include <protocol/rtmp/relay.hpp>
+#include <protocol/rtmp/source.hpp>
+#include <protocol/rtmp/stack.hpp>
+
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// [1B type][4B length]
+#define RELAY_FRAME_HEADER_SIZE 5
+#define RELAY_HELLO_MAX_SIZE 4096
+// both sides are workers of the host, the hello comes at once
+#define RELAY_HELLO_TIMEOUT_US (int64_t)(3 * 1000 * 1000LL)
+#define RELAY_LISTEN_BACKLOG 128
+#define RELAY_CONNECT_TIMEOUT_US (int64_t)(3 * 1000 * 1000LL)
+// the writer backs off when the reader doesn't drain the ring
+#define RELAY_RING_FULL_SLEEP_US (int64_t)(1 * 1000LL)
+#define RELAY_RING_FULL_TIMEOUT_MS 5000
+// the payload of an rtmp message has 3 bytes for its length
+#define RELAY_MESSAGE_MAX_SIZE (0xffffff + (int)sizeof(RelayMessageHeader))
+
+namespace rtmp {
+
+// both sides run the same binary, the header is copied as it is
+struct RelayMessageHeader
+{
+    int64_t             timestamp;
+    int32_t             stream_id;
+    SharedMessageHeader header;
+};
+
+int Worker::index_  = 0;
+int Worker::count_  = 1;
+int Worker::master_ = 0;
+
+void Worker::Initialize(int index, int count, int master)
+{
+    index_  = index;
+    count_  = rs_max(count, 1);
+    master_ = master;
+}
+
+int Worker::Index()
+{
+    return index_;
+}
+
+int Worker::Count()
+{
+    return count_;
+}
+
+int Worker::OwnerOf(const std::string& stream_url)
+{
+    return (int)(Utils::Hash(stream_url) % (uint32_t)count_);
+}
+
+bool Worker::IsOwner(const std::string& stream_url)
+{
+    return count_ <= 1 || OwnerOf(stream_url) == index_;
+}
+
+std::string Worker::SocketPath(int index)
+{
+    std::string path = _config->GetRelaySocketPath();
+    path = Utils::StringReplace(path, "[master]", std::to_string(master_));
+    return Utils::StringReplace(path, "[worker]", std::to_string(index));
+}
+
+RelayChannel::RelayChannel(st_netfd_t stfd)
+{
+    stfd_ = stfd;
+    skt_  = new StSocket(stfd);
+    ring_ = nullptr;
+}
+
+RelayChannel::~RelayChannel()
+{
+    rs_freep(ring_);
+    rs_freep(skt_);
+    STCloseFd(stfd_);
+}
+
+int RelayChannel::Connect(int worker, RelayChannel** pchannel)
+{
+    int ret = ERROR_SUCCESS;
+
+    std::string path = Worker::SocketPath(worker);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        ret = ERROR_SOCKET_CREATE;
+        rs_error("create relay socket failed. path=%s, ret=%d", path.c_str(),
+                 ret);
+        return ret;
+    }
+
+    st_netfd_t stfd = nullptr;
+    if ((stfd = st_netfd_open_socket(fd)) == nullptr) {
+        ::close(fd);
+        ret = ERROR_ST_OPEN_SOCKET;
+        rs_error("st open relay socket failed. path=%s, ret=%d", path.c_str(),
+                 ret);
+        return ret;
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (st_connect(stfd, (const sockaddr*)&addr, sizeof(sockaddr_un),
+                   RELAY_CONNECT_TIMEOUT_US) == -1) {
+        STCloseFd(stfd);
+        ret = ERROR_ST_CONNECT;
+        rs_error("connect relay worker failed. path=%s, ret=%d", path.c_str(),
+                 ret);
+        return ret;
+    }
+
+    *pchannel = new RelayChannel(stfd);
+
+    return ret;
+}
+
+int RelayChannel::SendHello(RelayFrameType type, Request* r)
+{
+    int ret = ERROR_SUCCESS;
+
+    std::string fields[] = {r->vhost, r->app, r->stream, r->param, r->tc_url};
+    int         nb_fields = sizeof(fields) / sizeof(std::string);
+
+    int size = 0;
+    for (int i = 0; i < nb_fields; i++) {
+        size += 2 + (int)fields[i].length();
+    }
+
+    if (size > RELAY_HELLO_MAX_SIZE) {
+        ret = ERROR_RELAY_FRAME_INVALID;
+        rs_error("relay hello too large. size=%d, ret=%d", size, ret);
+        return ret;
+    }
+
+    char* buf = new char[RELAY_FRAME_HEADER_SIZE + size];
+    rs_auto_freea(char, buf);
+
+    BufferManager manager;
+    if ((ret = manager.Initialize(buf, RELAY_FRAME_HEADER_SIZE + size)) !=
+        ERROR_SUCCESS) {
+        return ret;
+    }
+
+    manager.Write1Bytes((int8_t)type);
+    manager.Write4Bytes(size);
+    for (int i = 0; i < nb_fields; i++) {
+        manager.Write2Bytes((int16_t)fields[i].length());
+        manager.WriteString(fields[i]);
+    }
+
+    if ((ret = skt_->Write(buf, RELAY_FRAME_HEADER_SIZE + size, nullptr)) !=
+        ERROR_SUCCESS) {
+        rs_error("send relay hello failed. ret=%d", ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+int RelayChannel::ReadHello(RelayFrameType& type, Request* r)
+{
+    int ret = ERROR_SUCCESS;
+
+    int32_t size = 0;
+
+    skt_->SetRecvTimeout(RELAY_HELLO_TIMEOUT_US);
+    if ((ret = read_frame_header(type, size)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if ((type != RelayFrameType::HELLO_PUBLISH &&
+         type != RelayFrameType::HELLO_SUBSCRIBE) ||
+        size > RELAY_HELLO_MAX_SIZE) {
+        ret = ERROR_RELAY_FRAME_INVALID;
+        rs_error("invalid relay hello. type=%d, size=%d, ret=%d", (int)type,
+                 size, ret);
+        return ret;
+    }
+
+    char* buf = new char[size];
+    rs_auto_freea(char, buf);
+
+    if ((ret = skt_->ReadFully(buf, size, nullptr)) != ERROR_SUCCESS) {
+        rs_error("read relay hello failed. ret=%d", ret);
+        return ret;
+    }
+    skt_->SetRecvTimeout(ST_UTIME_NO_TIMEOUT);
+
+    BufferManager manager;
+    if ((ret = manager.Initialize(buf, size)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    std::string* fields[] = {&r->vhost, &r->app, &r->stream, &r->param,
+                             &r->tc_url};
+    int          nb_fields = sizeof(fields) / sizeof(std::string*);
+
+    for (int i = 0; i < nb_fields; i++) {
+        if (!manager.Require(2)) {
+            ret = ERROR_RELAY_FRAME_INVALID;
+            rs_error("relay hello field length missing. ret=%d", ret);
+            return ret;
+        }
+
+        int len = (uint16_t)manager.Read2Bytes();
+        if (!manager.Require(len)) {
+            ret = ERROR_RELAY_FRAME_INVALID;
+            rs_error("relay hello field truncated. len=%d, ret=%d", len, ret);
+            return ret;
+        }
+
+        *fields[i] = manager.ReadString(len);
+    }
+
+    return ret;
+}
+
+int RelayChannel::CreateRing(int capacity)
+{
+    int ret = ERROR_SUCCESS;
+
+    static int seq = 0;
+
+    std::string name = "/rtmp_server.relay." + std::to_string(::getpid()) +
+                       "." + std::to_string(seq++);
+
+    rs_freep(ring_);
+    ring_ = new ShmRing;
+
+    if ((ret = ring_->Create(name, capacity)) != ERROR_SUCCESS) {
+        rs_error("create relay ring failed. name=%s, ret=%d", name.c_str(),
+                 ret);
+        return ret;
+    }
+
+    if ((ret = write_frame(RelayFrameType::RING, name.data(),
+                           (int)name.length())) != ERROR_SUCCESS) {
+        rs_error("send relay ring failed. name=%s, ret=%d", name.c_str(), ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+int RelayChannel::SendMessages(SharedPtrMessage** msgs, int count)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!ring_) {
+        ret = ERROR_RELAY_FRAME_INVALID;
+        rs_error("relay ring not created. ret=%d", ret);
+        return ret;
+    }
+
+    for (int i = 0; i < count; i++) {
+        SharedPtrMessage* msg = msgs[i];
+
+        RelayMessageHeader mh;
+        mh.timestamp = msg->timestamp;
+        mh.stream_id = msg->stream_id;
+        mh.header    = *msg->Header();
+
+        iovec iovs[2];
+        iovs[0].iov_base = (char*)&mh;
+        iovs[0].iov_len  = sizeof(RelayMessageHeader);
+        iovs[1].iov_base = msg->payload;
+        iovs[1].iov_len  = msg->size;
+
+        int size = (int)sizeof(RelayMessageHeader) + msg->size;
+        if (size >= ring_->Capacity() / 2) {
+            if ((ret = send_large(iovs, 2, size)) != ERROR_SUCCESS) {
+                return ret;
+            }
+            continue;
+        }
+
+        if ((ret = push(iovs, 2)) != ERROR_SUCCESS) {
+            return ret;
+        }
+    }
+
+    if ((ret = notify()) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    return ret;
+}
+
+int RelayChannel::push(const iovec* iovs, int nb_iovs)
+{
+    int ret = ERROR_SUCCESS;
+
+    int64_t starttime = Utils::GetSteadyMilliSeconds();
+    while (!ring_->Push(iovs, nb_iovs)) {
+        if ((ret = notify()) != ERROR_SUCCESS) {
+            return ret;
+        }
+
+        if (Utils::GetSteadyMilliSeconds() - starttime >
+            RELAY_RING_FULL_TIMEOUT_MS) {
+            ret = ERROR_RELAY_RING_FULL;
+            rs_error("relay ring is full for %dms. ret=%d",
+                     RELAY_RING_FULL_TIMEOUT_MS, ret);
+            return ret;
+        }
+
+        st_usleep(RELAY_RING_FULL_SLEEP_US);
+    }
+
+    return ret;
+}
+
+int RelayChannel::send_large(const iovec* iovs, int nb_iovs, int size)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (size > RELAY_MESSAGE_MAX_SIZE) {
+        ret = ERROR_RELAY_FRAME_INVALID;
+        rs_error("relay message too large. size=%d, ret=%d", size, ret);
+        return ret;
+    }
+
+    // the marker is seen by the reader before the socket is read for the
+    // message, the doorbell wakes it if it already waits on the socket
+    if ((ret = push(nullptr, 0)) != ERROR_SUCCESS ||
+        (ret = notify()) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    char header[RELAY_FRAME_HEADER_SIZE];
+
+    BufferManager manager;
+    if ((ret = manager.Initialize(header, RELAY_FRAME_HEADER_SIZE)) !=
+        ERROR_SUCCESS) {
+        return ret;
+    }
+
+    manager.Write1Bytes((int8_t)RelayFrameType::MESSAGE);
+    manager.Write4Bytes(size);
+
+    iovec frame[3];
+    frame[0].iov_base = header;
+    frame[0].iov_len  = RELAY_FRAME_HEADER_SIZE;
+    for (int i = 0; i < nb_iovs && i < 2; i++) {
+        frame[i + 1] = iovs[i];
+    }
+
+    if ((ret = skt_->WriteEv(frame, rs_min(nb_iovs, 2) + 1, nullptr)) !=
+        ERROR_SUCCESS) {
+        if (!is_client_gracefully_close(ret)) {
+            rs_error("send large relay message failed. size=%d, ret=%d", size,
+                     ret);
+        }
+        return ret;
+    }
+
+    rs_info("relay message larger than ring over socket. size=%d, ring=%d",
+            size, ring_->Capacity());
+
+    return ret;
+}
+
+int RelayChannel::ReadMessage(CommonMessage** pmsg)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!ring_ && (ret = open_ring()) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    int size = -1;
+    while ((size = ring_->Front()) < 0) {
+        if (!ring_->Wait()) {
+            continue;
+        }
+
+        RelayFrameType type;
+        int32_t        length = 0;
+        if ((ret = read_frame_header(type, length)) != ERROR_SUCCESS) {
+            return ret;
+        }
+
+        if (type != RelayFrameType::DOORBELL || length != 0) {
+            ret = ERROR_RELAY_FRAME_INVALID;
+            rs_error("invalid relay doorbell. type=%d, length=%d, ret=%d",
+                     (int)type, length, ret);
+            return ret;
+        }
+    }
+
+    // the next message is on the socket
+    if (size == 0) {
+        ring_->Pop();
+        return read_large(pmsg);
+    }
+
+    if (size < (int)sizeof(RelayMessageHeader)) {
+        ret = ERROR_RELAY_FRAME_INVALID;
+        rs_error("invalid relay message. size=%d, ret=%d", size, ret);
+        return ret;
+    }
+
+    RelayMessageHeader mh;
+    ring_->Read(&mh, sizeof(RelayMessageHeader));
+
+    CommonMessage* msg = new CommonMessage;
+
+    msg->header.message_type   = mh.header.message_type;
+    msg->header.perfer_cid     = mh.header.perfer_cid;
+    msg->header.timestamp      = mh.timestamp;
+    msg->header.stream_id      = mh.stream_id;
+    msg->header.payload_length = size - (int)sizeof(RelayMessageHeader);
+
+    // the only copy, from the shared memory into the payload shared by the
+    // consumers of this process
+    msg->size = msg->header.payload_length;
+    if (msg->size > 0) {
+        msg->CreatePayload(msg->size);
+        ring_->Read(msg->payload, msg->size);
+    }
+
+    ring_->Pop();
+
+    *pmsg = msg;
+
+    return ret;
+}
+
+int RelayChannel::read_large(CommonMessage** pmsg)
+{
+    int ret = ERROR_SUCCESS;
+
+    RelayFrameType type;
+    int32_t        length = 0;
+
+    // the doorbells rung before the message are of no use any more
+    do {
+        if ((ret = read_frame_header(type, length)) != ERROR_SUCCESS) {
+            return ret;
+        }
+    } while (type == RelayFrameType::DOORBELL && length == 0);
+
+    if (type != RelayFrameType::MESSAGE ||
+        length < (int)sizeof(RelayMessageHeader) ||
+        length > RELAY_MESSAGE_MAX_SIZE) {
+        ret = ERROR_RELAY_FRAME_INVALID;
+        rs_error("invalid large relay message. type=%d, length=%d, ret=%d",
+                 (int)type, length, ret);
+        return ret;
+    }
+
+    RelayMessageHeader mh;
+    if ((ret = skt_->ReadFully(&mh, sizeof(RelayMessageHeader), nullptr)) !=
+        ERROR_SUCCESS) {
+        return ret;
+    }
+
+    CommonMessage* msg = new CommonMessage;
+
+    msg->header.message_type   = mh.header.message_type;
+    msg->header.perfer_cid     = mh.header.perfer_cid;
+    msg->header.timestamp      = mh.timestamp;
+    msg->header.stream_id      = mh.stream_id;
+    msg->header.payload_length = length - (int)sizeof(RelayMessageHeader);
+
+    msg->size = msg->header.payload_length;
+    if (msg->size > 0) {
+        msg->CreatePayload(msg->size);
+        if ((ret = skt_->ReadFully(msg->payload, msg->size, nullptr)) !=
+            ERROR_SUCCESS) {
+            rs_freep(msg);
+            return ret;
+        }
+    }
+
+    *pmsg = msg;
+
+    return ret;
+}
+
+int RelayChannel::open_ring()
+{
+    int ret = ERROR_SUCCESS;
+
+    RelayFrameType type;
+    int32_t        length = 0;
+    if ((ret = read_frame_header(type, length)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if (type != RelayFrameType::RING || length <= 0 ||
+        length > RELAY_HELLO_MAX_SIZE) {
+        ret = ERROR_RELAY_FRAME_INVALID;
+        rs_error("invalid relay ring. type=%d, length=%d, ret=%d", (int)type,
+                 length, ret);
+        return ret;
+    }
+
+    std::string name(length, 0);
+    if ((ret = skt_->ReadFully(&name[0], length, nullptr)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    ring_ = new ShmRing;
+    if ((ret = ring_->Open(name)) != ERROR_SUCCESS) {
+        rs_error("open relay ring failed. name=%s, ret=%d", name.c_str(), ret);
+        return ret;
+    }
+
+    // both sides have mapped it, nobody else needs the name
+    ring_->Unlink();
+
+    return ret;
+}
+
+int RelayChannel::notify()
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!ring_->Notify()) {
+        return ret;
+    }
+
+    if ((ret = write_frame(RelayFrameType::DOORBELL, nullptr, 0)) !=
+        ERROR_SUCCESS) {
+        if (!is_client_gracefully_close(ret)) {
+            rs_error("send relay doorbell failed. ret=%d", ret);
+        }
+        return ret;
+    }
+
+    return ret;
+}
+
+int RelayChannel::write_frame(RelayFrameType type, const char* buf, int size)
+{
+    int ret = ERROR_SUCCESS;
+
+    char header[RELAY_FRAME_HEADER_SIZE];
+
+    BufferManager manager;
+    if ((ret = manager.Initialize(header, RELAY_FRAME_HEADER_SIZE)) !=
+        ERROR_SUCCESS) {
+        return ret;
+    }
+
+    manager.Write1Bytes((int8_t)type);
+    manager.Write4Bytes(size);
+
+    iovec iovs[2];
+    iovs[0].iov_base = header;
+    iovs[0].iov_len  = RELAY_FRAME_HEADER_SIZE;
+    iovs[1].iov_base = (char*)buf;
+    iovs[1].iov_len  = size;
+
+    if ((ret = skt_->WriteEv(iovs, size > 0 ? 2 : 1, nullptr)) !=
+        ERROR_SUCCESS) {
+        return ret;
+    }
+
+    return ret;
+}
+
+int RelayChannel::read_frame_header(RelayFrameType& type, int32_t& length)
+{
+    int ret = ERROR_SUCCESS;
+
+    char header[RELAY_FRAME_HEADER_SIZE];
+    if ((ret = skt_->ReadFully(header, RELAY_FRAME_HEADER_SIZE, nullptr)) !=
+        ERROR_SUCCESS) {
+        return ret;
+    }
+
+    BufferManager manager;
+    if ((ret = manager.Initialize(header, RELAY_FRAME_HEADER_SIZE)) !=
+        ERROR_SUCCESS) {
+        return ret;
+    }
+
+    type   = (RelayFrameType)manager.Read1Bytes();
+    length = manager.Read4Bytes();
+
+    if (length < 0) {
+        ret = ERROR_RELAY_FRAME_INVALID;
+        rs_error("invalid relay frame length. length=%d, ret=%d", length, ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+RelaySender::RelaySender(Source* s, RelayChannel* channel)
+{
+    source_   = s;
+    channel_  = channel;
+    consumer_ = nullptr;
+    msgs_     = new MessageArray(RTMP_MR_MSGS);
+    thread_   = new internal::Thread("relay-sender", this, 0, true);
+    finished_ = false;
+}
+
+RelaySender::~RelaySender()
+{
+    Stop();
+    rs_freep(thread_);
+    rs_freep(consumer_);
+    rs_freep(msgs_);
+    rs_freep(channel_);
+}
+
+int RelaySender::Start()
+{
+    int ret = ERROR_SUCCESS;
+
+    if ((ret = source_->CreateConsumer(nullptr, consumer_)) != ERROR_SUCCESS) {
+        rs_error("create relay consumer failed. ret=%d", ret);
+        return ret;
+    }
+
+    // the receiving worker corrects the timestamps for its own players
+    consumer_->SetJitterEnabled(false);
+
+    if ((ret = channel_->CreateRing(_config->GetRelayRingSize())) !=
+        ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if ((ret = thread_->Start()) != ERROR_SUCCESS) {
+        rs_error("start relay sender failed. ret=%d", ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+void RelaySender::Stop()
+{
+    thread_->Stop();
+}
+
+bool RelaySender::Finished()
+{
+    return finished_;
+}
+
+int32_t RelaySender::Cycle()
+{
+    int ret = ERROR_SUCCESS;
+
+    int count = 0;
+    if ((ret = consumer_->DumpPackets(msgs_, count)) != ERROR_SUCCESS) {
+        rs_error("relay sender dump packets failed. ret=%d", ret);
+        return ret;
+    }
+
+    // wake up for every message, the relay adds no merged-write delay
+    if (count == 0) {
+        consumer_->Wait(0, -1);
+        return ret;
+    }
+
+    ret = channel_->SendMessages(msgs_->msgs, count);
+    consumer_->ReleasePackets(msgs_, count);
+
+    if (ret != ERROR_SUCCESS) {
+        thread_->StopLoop();
+        return ret;
+    }
+
+    return ret;
+}
+
+void RelaySender::OnThreadStop()
+{
+    finished_ = true;
+}
+
+RelayReceiver::RelayReceiver(Source* s, RelayChannel* channel)
+{
+    source_     = s;
+    channel_    = channel;
+    thread_     = new internal::Thread("relay-receiver", this, 0, true);
+    publishing_ = false;
+    finished_   = false;
+}
+
+RelayReceiver::~RelayReceiver()
+{
+    Stop();
+    rs_freep(thread_);
+    rs_freep(channel_);
+}
+
+int RelayReceiver::Start()
+{
+    return thread_->Start();
+}
+
+void RelayReceiver::Stop()
+{
+    thread_->Stop();
+}
+
+bool RelayReceiver::Finished()
+{
+    return finished_;
+}
+
+int32_t RelayReceiver::Cycle()
+{
+    int ret = ERROR_SUCCESS;
+
+    CommonMessage* msg = nullptr;
+    if ((ret = channel_->ReadMessage(&msg)) != ERROR_SUCCESS) {
+        thread_->StopLoop();
+        return ret;
+    }
+    rs_auto_free(CommonMessage, msg);
+
+    if ((ret = process_message(msg)) != ERROR_SUCCESS) {
+        thread_->StopLoop();
+        return ret;
+    }
+
+    return ret;
+}
+
+void RelayReceiver::OnThreadStop()
+{
+    if (publishing_) {
+        publishing_ = false;
+        source_->OnUnpublish();
+    }
+
+    finished_ = true;
+}
+
+int RelayReceiver::process_message(CommonMessage* msg)
+{
+    int ret = ERROR_SUCCESS;
+
+    // publish lazily, a local publisher keeps the stream until data arrives
+    if (!publishing_) {
+        if (!source_->CanPublish(false)) {
+            ret = ERROR_SYSTEM_STREAM_BUSY;
+            rs_warn("relay stream is already publishing. ret=%d", ret);
+            return ret;
+        }
+
+        if ((ret = source_->OnRelayPublish()) != ERROR_SUCCESS) {
+            rs_error("relay notify publish failed. ret=%d", ret);
+            return ret;
+        }
+        publishing_ = true;
+    }
+
+    if (msg->header.IsAudio()) {
+        if ((ret = source_->OnAudio(msg)) != ERROR_SUCCESS) {
+            rs_error("relay process audio message failed. ret=%d", ret);
+            return ret;
+        }
+    }
+    else if (msg->header.IsVideo()) {
+        if ((ret = source_->OnVideo(msg)) != ERROR_SUCCESS) {
+            rs_error("relay process video message failed. ret=%d", ret);
+            return ret;
+        }
+    }
+    else if (msg->header.IsAMF0Data()) {
+        BufferManager manager;
+        if ((ret = manager.Initialize(msg->payload, msg->size)) !=
+            ERROR_SUCCESS) {
+            return ret;
+        }
+
+        OnMetadataPacket pkt;
+        if ((ret = pkt.Decode(&manager)) != ERROR_SUCCESS) {
+            rs_error("relay decode metadata failed. ret=%d", ret);
+            return ret;
+        }
+
+        if ((ret = source_->OnMetadata(msg, &pkt)) != ERROR_SUCCESS) {
+            rs_error("relay process metadata failed. ret=%d", ret);
+            return ret;
+        }
+    }
+
+    return ret;
+}
+
+RelayHello::RelayHello(ISourceHandler* handler, RelayChannel* channel)
+{
+    handler_  = handler;
+    channel_  = channel;
+    thread_   = new internal::Thread("relay-hello", this, 0, true);
+    finished_ = false;
+}
+
+RelayHello::~RelayHello()
+{
+    thread_->Stop();
+    rs_freep(thread_);
+    rs_freep(channel_);
+}
+
+int RelayHello::Start()
+{
+    int ret = ERROR_SUCCESS;
+
+    if ((ret = thread_->Start()) != ERROR_SUCCESS) {
+        rs_error("start relay hello failed. ret=%d", ret);
+        return ret;
+    }
+
+    return ret;
+}
+
+bool RelayHello::Finished()
+{
+    return finished_;
+}
+
+int32_t RelayHello::Cycle()
+{
+    int ret = ERROR_SUCCESS;
+
+    // once, whatever happens
+    thread_->StopLoop();
+
+    RelayFrameType type;
+    Request        r;
+    if ((ret = channel_->ReadHello(type, &r)) != ERROR_SUCCESS) {
+        rs_warn("ignore relay channel without hello. ret=%d", ret);
+        return ret;
+    }
+
+    Source* source = nullptr;
+    if ((ret = Source::FetchOrCreate(&r, handler_, &source)) !=
+        ERROR_SUCCESS) {
+        rs_error("relay fetch source failed. url=%s, ret=%d",
+                 r.GetStreamUrl().c_str(), ret);
+        return ret;
+    }
+
+    // the source takes the channel whatever happens
+    RelayChannel* channel = channel_;
+    channel_              = nullptr;
+    if (type == RelayFrameType::HELLO_PUBLISH) {
+        ret = source->AttachRelayReceiver(channel);
+    }
+    else {
+        ret = source->AttachRelaySender(channel);
+    }
+
+    if (ret != ERROR_SUCCESS) {
+        rs_warn("relay attach failed. url=%s, type=%d, ret=%d",
+                r.GetStreamUrl().c_str(), (int)type, ret);
+        return ret;
+    }
+
+    rs_trace("relay channel accepted. url=%s, type=%d",
+             r.GetStreamUrl().c_str(), (int)type);
+
+    return ret;
+}
+
+void RelayHello::OnThreadStop()
+{
+    finished_ = true;
+}
+
+RelayServer::RelayServer(ISourceHandler* handler)
+{
+    handler_ = handler;
+    stfd_    = nullptr;
+    thread_  = new internal::Thread("relay-server", this, 0, true);
+}
+
+RelayServer::~RelayServer()
+{
+    thread_->Stop();
+    rs_freep(thread_);
+    for (size_t i = 0; i < hellos_.size(); i++) {
+        rs_freep(hellos_[i]);
+    }
+    STCloseFd(stfd_);
+    if (!path_.empty()) {
+        ::unlink(path_.c_str());
+    }
+}
+
+int RelayServer::Listen()
+{
+    int ret = ERROR_SUCCESS;
+
+    path_ = Worker::SocketPath(Worker::Index());
+    ::unlink(path_.c_str());
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        ret = ERROR_SOCKET_CREATE;
+        rs_error("create relay socket failed. path=%s, ret=%d", path_.c_str(),
+                 ret);
+        return ret;
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (::bind(fd, (const sockaddr*)&addr, sizeof(sockaddr_un)) == -1) {
+        ::close(fd);
+        ret = ERROR_SOCKET_BIND;
+        rs_error("bind relay socket failed. path=%s, ret=%d", path_.c_str(),
+                 ret);
+        return ret;
+    }
+
+    if (::listen(fd, RELAY_LISTEN_BACKLOG) == -1) {
+        ::close(fd);
+        ret = ERROR_SOCKET_LISTEN;
+        rs_error("listen relay socket failed. path=%s, ret=%d", path_.c_str(),
+                 ret);
+        return ret;
+    }
+
+    if ((stfd_ = st_netfd_open_socket(fd)) == nullptr) {
+        ::close(fd);
+        ret = ERROR_ST_OPEN_SOCKET;
+        rs_error("st open relay socket failed. path=%s, ret=%d", path_.c_str(),
+                 ret);
+        return ret;
+    }
+
+    if ((ret = thread_->Start()) != ERROR_SUCCESS) {
+        rs_error("start relay server failed. ret=%d", ret);
+        return ret;
+    }
+
+    rs_info("relay worker[%d] listen on %s", Worker::Index(), path_.c_str());
+
+    return ret;
+}
+
+int32_t RelayServer::Cycle()
+{
+    int ret = ERROR_SUCCESS;
+
+    st_netfd_t stfd = st_accept(stfd_, nullptr, nullptr, ST_UTIME_NO_TIMEOUT);
+    if (stfd == nullptr) {
+        return ret;
+    }
+
+    std::vector<RelayHello*>::iterator it = hellos_.begin();
+    while (it != hellos_.end()) {
+        if (!(*it)->Finished()) {
+            ++it;
+            continue;
+        }
+        rs_freep(*it);
+        it = hellos_.erase(it);
+    }
+
+    // a bad peer never stops the server
+    RelayHello* hello = new RelayHello(handler_, new RelayChannel(stfd));
+    if ((ret = hello->Start()) != ERROR_SUCCESS) {
+        rs_warn("ignore relay channel accept failed. ret=%d", ret);
+        rs_freep(hello);
+        return ERROR_SUCCESS;
+    }
+    hellos_.push_back(hello);
+
+    return ERROR_SUCCESS;
+}
+
+}  // namespace rtmp
@@ -0,0 +1,180 @@
+#ifndef RS_RTMP_RELAY_HPP
+#define RS_RTMP_RELAY_HPP
+
+#include <common/core.hpp>
+#include <common/thread.hpp>
+
+#include <st.h>
+
+#include <string>
+#include <vector>
+
+class StSocket;
+class ShmRing;
+
+namespace rtmp {
+
+class Source;
+class Request;
+class Consumer;
+class CommonMessage;
+class SharedPtrMessage;
+class MessageArray;
+class ISourceHandler;
+
+// relay frame: [1B type][4B length][payload]
+// the messages go through a shared memory ring, the socket only carries the
+// hello, the ring name and the doorbell which wakes up a waiting reader. a
+// message too large for the ring goes over the socket, a record without
+// payload in the ring marks its place among the others.
+enum class RelayFrameType {
+    HELLO_PUBLISH   = 1,
+    HELLO_SUBSCRIBE = 2,
+    RING            = 3,
+    DOORBELL        = 4,
+    MESSAGE         = 5,
+};
+
+// every worker process owns the streams whose url hash lands on its index,
+// the owner is the rendezvous point for publishers and players that were
+// accepted by other workers.
+class Worker {
+  public:
+    // the master pid keeps the sockets of the servers on a host apart
+    static void        Initialize(int index, int count, int master);
+    static int         Index();
+    static int         Count();
+    static int         OwnerOf(const std::string& stream_url);
+    static bool        IsOwner(const std::string& stream_url);
+    static std::string SocketPath(int index);
+
+  private:
+    static int index_;
+    static int count_;
+    static int master_;
+};
+
+// unix domain channel between two workers.
+class RelayChannel {
+  public:
+    RelayChannel(st_netfd_t stfd);
+    virtual ~RelayChannel();
+
+  public:
+    static int Connect(int worker, RelayChannel** pchannel);
+
+  public:
+    virtual int SendHello(RelayFrameType type, Request* r);
+    virtual int ReadHello(RelayFrameType& type, Request* r);
+    virtual int CreateRing(int capacity);
+    virtual int SendMessages(SharedPtrMessage** msgs, int count);
+    virtual int ReadMessage(CommonMessage** pmsg);
+
+  private:
+    virtual int read_frame_header(RelayFrameType& type, int32_t& length);
+    virtual int write_frame(RelayFrameType type, const char* buf, int size);
+    virtual int open_ring();
+    virtual int notify();
+    // waits for the reader while the ring is full
+    virtual int push(const iovec* iovs, int nb_iovs);
+    virtual int send_large(const iovec* iovs, int nb_iovs, int size);
+    virtual int read_large(CommonMessage** pmsg);
+
+  private:
+    st_netfd_t stfd_;
+    StSocket*  skt_;
+    ShmRing*   ring_;
+};
+
+// pump the messages of a local source into the channel.
+class RelaySender : public internal::IThreadHandler {
+  public:
+    RelaySender(Source* s, RelayChannel* channel);
+    virtual ~RelaySender();
+
+  public:
+    virtual int  Start();
+    virtual void Stop();
+    virtual bool Finished();
+    // IThreadHandler
+    virtual int32_t Cycle() override;
+    virtual void    OnThreadStop() override;
+
+  private:
+    Source*           source_;
+    RelayChannel*     channel_;
+    Consumer*         consumer_;
+    MessageArray*     msgs_;
+    internal::Thread* thread_;
+    bool              finished_;
+};
+
+// feed the messages read from the channel into a local source.
+class RelayReceiver : public internal::IThreadHandler {
+  public:
+    RelayReceiver(Source* s, RelayChannel* channel);
+    virtual ~RelayReceiver();
+
+  public:
+    virtual int  Start();
+    virtual void Stop();
+    virtual bool Finished();
+    // IThreadHandler
+    virtual int32_t Cycle() override;
+    virtual void    OnThreadStop() override;
+
+  private:
+    virtual int process_message(CommonMessage* msg);
+
+  private:
+    Source*           source_;
+    RelayChannel*     channel_;
+    internal::Thread* thread_;
+    bool              publishing_;
+    bool              finished_;
+};
+
+// accept the channels from other workers.
+// the hello of an accepted channel and its attach to the source, on its own
+// thread, a peer which sends nothing does not hold the accept of the others.
+class RelayHello : public internal::IThreadHandler {
+  public:
+    RelayHello(ISourceHandler* handler, RelayChannel* channel);
+    virtual ~RelayHello();
+
+  public:
+    virtual int  Start();
+    virtual bool Finished();
+    // IThreadHandler
+    virtual int32_t Cycle() override;
+    virtual void    OnThreadStop() override;
+
+  private:
+    ISourceHandler*   handler_;
+    RelayChannel*     channel_;
+    internal::Thread* thread_;
+    bool              finished_;
+};
+
+class RelayServer : public internal::IThreadHandler {
+  public:
+    RelayServer(ISourceHandler* handler);
+    virtual ~RelayServer();
+
+  public:
+    virtual int Listen();
+    // IThreadHandler
+    virtual int32_t Cycle() override;
+
+  private:
+    ISourceHandler*   handler_;
+    std::string       path_;
+    st_netfd_t        stfd_;
+    internal::Thread* thread_;
+    // of the channels accepted, freed once they are done
+    std::vector<RelayHello*> hellos_;
+};
+
+}  // namespace rtmp
+
+#endif
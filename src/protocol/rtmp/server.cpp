@@ -201,16 +201,19 @@ int Server::identify_fmle_publish_client(FMLEStartPacket* pkt,
 int Server::identify_play_client(PlayPacket*  pkt,
                                  ConnType&    type,
                                  std::string& stream_name,
-                                 double&      duration)
+                                 double&      duration,
+                                 double&      start)
 {
     int ret = ERROR_SUCCESS;
 
     type        = ConnType::PLAY;
     stream_name = pkt->stream_name;
     duration    = pkt->duration;
+    start       = pkt->start;
 
-    rs_info("identity client type=play, stream_name=%s, duration=%.2f",
-            stream_name.c_str(), duration);
+    rs_info("identity client type=play, stream_name=%s, duration=%.2f, "
+            "start=%.2f",
+            stream_name.c_str(), duration, start);
 
     return ret;
 }
@@ -249,7 +252,8 @@ int Server::identify_create_stream_client(CreateStreamPacket* pkt,
                                           int                 stream_id,
                                           ConnType&           type,
                                           std::string&        stream_name,
-                                          double&             duration)
+                                          double&             duration,
+                                          double&             start)
 {
     int ret = ERROR_SUCCESS;
 
@@ -286,7 +290,7 @@ int Server::identify_create_stream_client(CreateStreamPacket* pkt,
 
         if (dynamic_cast<PlayPacket*>(packet)) {
             return identify_play_client(dynamic_cast<PlayPacket*>(packet), type,
-                                        stream_name, duration);
+                                        stream_name, duration, start);
         }
         else if (dynamic_cast<FMLEStartPacket*>(packet)) {
             return identify_haivisioin_publish_client(
@@ -307,7 +311,8 @@ int Server::identify_create_stream_client(CreateStreamPacket* pkt,
 int Server::IdentifyClient(int          stream_id,
                            ConnType&    type,
                            std::string& stream_name,
-                           double&      duration)
+                           double&      duration,
+                           double&      start)
 {
     int ret = ERROR_SUCCESS;
     type    = ConnType::UNKNOW;
@@ -342,7 +347,7 @@ int Server::IdentifyClient(int          stream_id,
         else if (dynamic_cast<CreateStreamPacket*>(packet)) {
             return identify_create_stream_client(
                 dynamic_cast<CreateStreamPacket*>(packet), stream_id, type,
-                stream_name, duration);
+                stream_name, duration, start);
         }
         else {
             rs_assert(0);
@@ -663,11 +668,102 @@ int Server::StartPlay(int stream_id)
     return ret;
 }
 
+int Server::OnPlaySeek(int stream_id)
+{
+    int ret = ERROR_SUCCESS;
+    {
+        OnStatusCallPacket* pkt = new OnStatusCallPacket;
+        pkt->data->Set("level", AMF0Any::String("status"));
+        pkt->data->Set("code", AMF0Any::String("NetStream.Seek.Notify"));
+        pkt->data->Set("description", AMF0Any::String("Seeking"));
+        pkt->data->Set("details", AMF0Any::String("stream"));
+        pkt->data->Set("clientid", AMF0Any::String("ASAICiss"));
+        if ((ret = protocol_->SendAndFreePacket(pkt, stream_id)) !=
+            ERROR_SUCCESS) {
+            rs_error(
+                "send onStatus(NetStream.Seek.Notify) message failed. ret=%d",
+                ret);
+            return ret;
+        }
+    }
+    {
+        OnStatusCallPacket* pkt = new OnStatusCallPacket;
+        pkt->data->Set("level", AMF0Any::String("status"));
+        pkt->data->Set("code", AMF0Any::String("NetStream.Play.Start"));
+        pkt->data->Set("description", AMF0Any::String("Stream is now playing"));
+        pkt->data->Set("details", AMF0Any::String("stream"));
+        pkt->data->Set("clientid", AMF0Any::String("ASAICiss"));
+        if ((ret = protocol_->SendAndFreePacket(pkt, stream_id)) !=
+            ERROR_SUCCESS) {
+            rs_error(
+                "send onStatus(NetStream.Play.Start) message failed. ret=%d",
+                ret);
+            return ret;
+        }
+    }
+
+    rs_trace("seek play success");
+
+    return ret;
+}
+
+int Server::OnPlayComplete(int stream_id)
+{
+    int ret = ERROR_SUCCESS;
+    {
+        OnStatusCallPacket* pkt = new OnStatusCallPacket;
+        pkt->data->Set("level", AMF0Any::String("status"));
+        pkt->data->Set("code", AMF0Any::String("NetStream.Play.Stop"));
+        pkt->data->Set("description", AMF0Any::String("Stream is stopped"));
+        pkt->data->Set("details", AMF0Any::String("stream"));
+        pkt->data->Set("clientid", AMF0Any::String("ASAICiss"));
+        if ((ret = protocol_->SendAndFreePacket(pkt, stream_id)) !=
+            ERROR_SUCCESS) {
+            rs_error(
+                "send onStatus(NetStream.Play.Stop) message failed. ret=%d",
+                ret);
+            return ret;
+        }
+    }
+    {
+        OnStatusDataPacket* pkt = new OnStatusDataPacket;
+        pkt->command_name       = RTMP_AMF0_COMMAND_ON_PLAY_STATUS;
+        pkt->data->Set("level", AMF0Any::String("status"));
+        pkt->data->Set("code", AMF0Any::String("NetStream.Play.Complete"));
+        if ((ret = protocol_->SendAndFreePacket(pkt, stream_id)) !=
+            ERROR_SUCCESS) {
+            rs_error("send onPlayStatus(NetStream.Play.Complete) message "
+                     "failed. ret=%d",
+                     ret);
+            return ret;
+        }
+    }
+    {
+        UserControlPacket* pkt = new UserControlPacket;
+        pkt->event_type        = (int16_t)UserEventType::STREAM_EOF;
+        pkt->event_data        = stream_id;
+        if ((ret = protocol_->SendAndFreePacket(pkt, stream_id)) !=
+            ERROR_SUCCESS) {
+            rs_error("send StreamEOF failed. ret=%d", ret);
+            return ret;
+        }
+    }
+
+    rs_trace("play complete success");
+
+    return ret;
+}
+
 void Server::SetAutoResponse(bool v)
 {
     protocol_->SetAutoResponse(v);
 }
 
+void Server::SetZeroCopy(bool v, int threshold)
+{
+    protocol_->SetZeroCopy(v, threshold);
+}
+
 int Server::SendAndFreeMessages(SharedPtrMessage** msgs,
                                 int                nb_msgs,
                                 int                stream_id)
@@ -675,4 +771,9 @@ int Server::SendAndFreeMessages(SharedPtrMessage** msgs,
     return protocol_->SendAndFreeMessages(msgs, nb_msgs, stream_id);
 }
 
+int Server::SendMessages(SharedPtrMessage** msgs, int nb_msgs, int stream_id)
+{
+    return protocol_->SendMessages(msgs, nb_msgs, stream_id);
+}
+
 }  // namespace rtmp
\ No newline at end of file
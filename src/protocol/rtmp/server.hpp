@@ -33,7 +33,8 @@ class Server {
     virtual int  IdentifyClient(int          stream_id,
                                 ConnType&    type,
                                 std::string& stream_name,
-                                double&      duration);
+                                double&      duration,
+                                double&      start);
     virtual int  StartFmlePublish(int stream_id);
     virtual int  StartHivisionPublish(int stream_id);
     virtual int  RecvMessage(CommonMessage** pmsg);
@@ -42,9 +43,15 @@ class Server {
     virtual int  DecodeMessage(CommonMessage* msg, Packet** ppacket);
     virtual int  FMLEUnPublish(int stream_id, double unpublish_tid);
     virtual int  StartPlay(int stream_id);
+    virtual int  OnPlaySeek(int stream_id);
+    // the end of a recorded stream, the client stops its play
+    virtual int  OnPlayComplete(int stream_id);
     virtual void SetAutoResponse(bool v);
+    virtual void SetZeroCopy(bool v, int threshold);
     virtual int
     SendAndFreeMessages(SharedPtrMessage** msgs, int nb_msgs, int stream_id);
+    virtual int
+    SendMessages(SharedPtrMessage** msgs, int nb_msgs, int stream_id);
 
   private:
     int identify_fmle_publish_client(FMLEStartPacket* pkt,
@@ -54,11 +61,13 @@ class Server {
                                       int                 stream_id,
                                       ConnType&           type,
                                       std::string&        stream_name,
-                                      double&             duration);
+                                      double&             duration,
+                                      double&             start);
     int identify_play_client(PlayPacket*  pkt,
                              ConnType&    type,
                              std::string& stream_name,
-                             double&      duration);
+                             double&      duration,
+                             double&      start);
     int identify_haivisioin_publish_client(FMLEStartPacket* pkt,
                                            ConnType&        type,
                                            std::string&     stream_name);
@@ -4,17 +4,26 @@
 #include <protocol/rtmp/connection.hpp>
 #include <protocol/rtmp/consumer.hpp>
 #include <protocol/rtmp/defines.hpp>
+#include <protocol/rtmp/cmaf.hpp>
 #include <protocol/rtmp/dvr.hpp>
+#include <protocol/rtmp/edge.hpp>
+#include <protocol/rtmp/hls.hpp>
 #include <protocol/rtmp/gop_cache.hpp>
 #include <protocol/rtmp/jitter.hpp>
 #include <protocol/rtmp/message.hpp>
 #include <protocol/rtmp/packet.hpp>
+#include <protocol/rtmp/relay.hpp>
 #include <protocol/rtmp/source.hpp>
 
 #include <algorithm>
 #include <sstream>
 
 #define SOURCE_CLEAN_UP_MS 5000
+// the cmaf of a stream without requests is stopped after
+#define SOURCE_CMAF_IDLE_MS 30000
+// the expiry is checked each cycle of a second
+#define SOURCE_EXPIRE_TICK_MS 1000
+#define SOURCE_EXPIRE_SLOTS 64
 
 namespace rtmp {
 
@@ -22,7 +31,10 @@ ISourceHandler::ISourceHandler() {}
 
 ISourceHandler::~ISourceHandler() {}
 
-std::map<std::string, Source*> Source::pool_;
+HashIndex<Source*>   Source::pool_;
+std::vector<Source*> Source::sources_;
+TimerWheel<Source*>  Source::expire_wheel_(SOURCE_EXPIRE_TICK_MS,
+                                          SOURCE_EXPIRE_SLOTS);
 
 Source::Source()
 {
@@ -38,17 +50,41 @@ Source::Source()
     cache_sh_audio_            = nullptr;
     ag_                        = JitterAlgorithm::FULL;
     mix_queue_                 = new MixQueue<SharedPtrMessage>;
+    ring_                      = nullptr;
     dvr_                       = new Dvr;
+    hls_                       = new Hls;
+    cmaf_                      = new Cmaf;
+    cmaf_requested_at_         = -1;
     gop_cache_                 = new GopCache;
+    pool_index_                = -1;
+    expire_scheduled_          = false;
     die_at_                    = -1;
     source_id_                 = -1;
     prev_source_id_            = -1;
+    relayed_                   = false;
+    relay_receiver_            = nullptr;
+    relay_forwarder_           = nullptr;
+    play_edge_                 = new PlayEdge;
+    publish_edge_              = new PublishEdge;
 }
 
 Source::~Source()
 {
+    rs_freep(publish_edge_);
+    rs_freep(play_edge_);
+    rs_freep(relay_receiver_);
+    rs_freep(relay_forwarder_);
+    for (int i = 0; i < (int)relay_senders_.size(); i++) {
+        RelaySender* sender = relay_senders_.at(i);
+        rs_freep(sender);
+    }
+    relay_senders_.clear();
+
     rs_freep(gop_cache_);
+    rs_freep(cmaf_);
+    rs_freep(hls_);
     rs_freep(dvr_);
+    rs_freep(ring_);
     rs_freep(mix_queue_);
     rs_freep(cache_sh_audio_);
     rs_freep(cache_sh_video_);
@@ -78,8 +114,10 @@ int Source::FetchOrCreate(Request* r, ISourceHandler* h, Source** pps)
         return ret;
     }
 
-    pool_[stream_url] = source;
-    *pps              = source;
+    pool_.Insert(source->request_->StreamHash(), source);
+    source->pool_index_ = (int)sources_.size();
+    sources_.push_back(source);
+    *pps = source;
 
     rs_info("create new source for url=%s,vhost=%s", stream_url.c_str(),
             vhost.c_str());
@@ -89,16 +127,14 @@ int Source::FetchOrCreate(Request* r, ISourceHandler* h, Source** pps)
 
 Source* Source::fetch(Request* r)
 {
-    Source* source = nullptr;
+    Source* source = pool_.Find(r->StreamHash(), [r](Source* s) {
+        return s->request_->IsSameStream(r);
+    });
 
-    std::string stream_url = r->GetStreamUrl();
-
-    if (pool_.find(stream_url) == pool_.end()) {
+    if (!source) {
         return nullptr;
     }
 
-    source = pool_[stream_url];
-
     source->request_->Update(r);
 
     return source;
@@ -114,37 +150,95 @@ int Source::Initialize(Request* r, ISourceHandler* h)
 
     atc_ = _config->GetATC(r->vhost);
 
+    gop_cache_->SetLimits(
+        _config->GetGopCacheMaxBytes(r->vhost),
+        (int64_t)_config->GetGopCacheMaxDuration(r->vhost) * 1000,
+        _config->GetGopCacheOverflow(r->vhost) == "disable");
+    gop_cache_->SetTimeShift((int64_t)_config->GetTimeShift(r->vhost) * 1000,
+                             _config->GetTimeShiftMaxBytes(r->vhost));
+
+    if (_config->GetSharedQueueEnabled(r->vhost)) {
+        ring_ = new MessageRing(RTMP_SHARED_RING_SIZE);
+    }
+
     if ((ret = dvr_->Initialize(this, request_)) != ERROR_SUCCESS) {
         return ret;
     }
 
+    if ((ret = hls_->Initialize(this, request_)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if ((ret = cmaf_->Initialize(this, request_)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if ((ret = play_edge_->Initialize(this, request_)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if ((ret = publish_edge_->Initialize(this, request_)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
     return ret;
 }
 
 bool Source::CanPublish(bool is_edge)
 {
+    if (is_edge) {
+        return publish_edge_->CanPublish();
+    }
+
     return can_publish_;
 }
 
 void Source::OnConsumerDestroy(Consumer* consumer)
 {
-    std::vector<Consumer*>::iterator it =
-        std::find(consumers_.begin(), consumers_.end(), consumer);
-
-    if (it == consumers_.end()) {
+    if (!consumers_.Remove(consumer)) {
         rs_warn("consumer has been removed. ignore it");
         return;
     }
 
-    consumers_.erase(it);
     rs_info("consumer removed");
-    if (consumers_.empty()) {
+    if (consumers_.Empty()) {
         die_at_ = Utils::GetSteadyMilliSeconds();
+        schedule_expire();
         rs_trace("there are not consumer subscribing %s now",
                  request_->GetStreamUrl().c_str());
+
+        if (_config->GetVhostIsEdge(request_->vhost)) {
+            play_edge_->OnAllClientStop();
+        }
     }
 }
 
+int Source::dispatch(SharedPtrMessage* msg)
+{
+    int ret = ERROR_SUCCESS;
+
+    // one copy in the shared ring instead of one per consumer, the others
+    // find the message at their next dump
+    if (ring_) {
+        ring_->Push(msg);
+        for (int i = 0; i < consumers_.Size(); i++) {
+            if (consumers_.Waiting(i)) {
+                consumers_.At(i)->OnRingPush(atc_);
+            }
+        }
+        return ret;
+    }
+
+    for (int i = 0; i < consumers_.Size(); i++) {
+        Consumer* consumer = consumers_.At(i);
+        if ((ret = consumer->Enqueue(msg, atc_, ag_)) != ERROR_SUCCESS) {
+            return ret;
+        }
+    }
+
+    return ret;
+}
+
 int Source::on_video_impl(SharedPtrMessage* msg)
 {
     int ret = ERROR_SUCCESS;
@@ -183,14 +277,26 @@ int Source::on_video_impl(SharedPtrMessage* msg)
         ret = ERROR_SUCCESS;
     }
 
-    if (!drop_for_reduce) {
-        for (int i = 0; i < (int)consumers_.size(); i++) {
-            Consumer* consumer = consumers_.at(i);
-            if ((ret = consumer->Enqueue(msg, atc_, ag_)) != ERROR_SUCCESS) {
-                rs_error("dispatch video failed. ret=%d", ret);
-                return ret;
-            }
-        }
+    if ((ret = hls_->OnVideo(msg)) != ERROR_SUCCESS) {
+        rs_warn(
+            "hls process video message failed, ignore and disable hls. ret=%d",
+            ret);
+        hls_->OnUnpublish();
+        ret = ERROR_SUCCESS;
+    }
+
+    if ((ret = cmaf_->OnVideo(msg)) != ERROR_SUCCESS) {
+        rs_warn(
+            "cmaf process video message failed, ignore and disable cmaf. ret=%d",
+            ret);
+        cmaf_->OnUnpublish();
+        cmaf_->Clear();
+        ret = ERROR_SUCCESS;
+    }
+
+    if (!drop_for_reduce && (ret = dispatch(msg)) != ERROR_SUCCESS) {
+        rs_error("dispatch video failed. ret=%d", ret);
+        return ret;
     }
 
     if (is_sequence_header) {
@@ -248,14 +354,26 @@ int Source::on_audio_impl(SharedPtrMessage* msg)
         ret = ERROR_SUCCESS;
     }
 
-    if (!drop_for_reduce) {
-        for (int i = 0; i < (int)consumers_.size(); i++) {
-            Consumer* consumer = consumers_.at(i);
-            if ((ret = consumer->Enqueue(msg, atc_, ag_)) != ERROR_SUCCESS) {
-                rs_error("dispatch audio failed. ret=%d", ret);
-                return ret;
-            }
-        }
+    if ((ret = hls_->OnAudio(msg)) != ERROR_SUCCESS) {
+        rs_warn(
+            "hls process audio message failed, ignore and disable hls. ret=%d",
+            ret);
+        hls_->OnUnpublish();
+        ret = ERROR_SUCCESS;
+    }
+
+    if ((ret = cmaf_->OnAudio(msg)) != ERROR_SUCCESS) {
+        rs_warn(
+            "cmaf process audio message failed, ignore and disable cmaf. ret=%d",
+            ret);
+        cmaf_->OnUnpublish();
+        cmaf_->Clear();
+        ret = ERROR_SUCCESS;
+    }
+
+    if (!drop_for_reduce && (ret = dispatch(msg)) != ERROR_SUCCESS) {
+        rs_error("dispatch audio failed. ret=%d", ret);
+        return ret;
     }
 
     if (is_sequence_header || !cache_sh_audio_) {
@@ -296,17 +414,24 @@ int Source::OnAudio(CommonMessage* msg)
 
     last_packet_time_ = msg->header.timestamp;
 
-    SharedPtrMessage shared_msg;
-    if ((shared_msg.Create(msg)) != ERROR_SUCCESS) {
-        rs_error("initialize the audio failed. ret=%d", ret);
-        return ret;
-    }
-
     if (!mix_correct_) {
+        SharedPtrMessage shared_msg;
+        if ((ret = shared_msg.Create(msg)) != ERROR_SUCCESS) {
+            rs_error("initialize the audio failed. ret=%d", ret);
+            return ret;
+        }
         return on_audio_impl(&shared_msg);
     }
 
-    mix_queue_->Push(shared_msg.Copy());
+    // the queue keeps this one, no copy is made
+    SharedPtrMessage* shared_msg = new SharedPtrMessage;
+    if ((ret = shared_msg->Create(msg)) != ERROR_SUCCESS) {
+        rs_freep(shared_msg);
+        rs_error("initialize the audio failed. ret=%d", ret);
+        return ret;
+    }
+
+    mix_queue_->Push(shared_msg);
 
     SharedPtrMessage* m = mix_queue_->Pop();
     if (!m) {
@@ -340,17 +465,24 @@ int Source::OnVideo(CommonMessage* msg)
 
     last_packet_time_ = msg->header.timestamp;
 
-    SharedPtrMessage shared_msg;
-    if ((shared_msg.Create(msg)) != ERROR_SUCCESS) {
-        rs_error("initialize the video failed. ret=%d", ret);
-        return ret;
-    }
-
     if (!mix_correct_) {
+        SharedPtrMessage shared_msg;
+        if ((ret = shared_msg.Create(msg)) != ERROR_SUCCESS) {
+            rs_error("initialize the video failed. ret=%d", ret);
+            return ret;
+        }
         return on_video_impl(&shared_msg);
     }
 
-    mix_queue_->Push(shared_msg.Copy());
+    // the queue keeps this one, no copy is made
+    SharedPtrMessage* shared_msg = new SharedPtrMessage;
+    if ((ret = shared_msg->Create(msg)) != ERROR_SUCCESS) {
+        rs_freep(shared_msg);
+        rs_error("initialize the video failed. ret=%d", ret);
+        return ret;
+    }
+
+    mix_queue_->Push(shared_msg);
 
     SharedPtrMessage* m = mix_queue_->Pop();
     if (!m) {
@@ -479,55 +611,319 @@ int Source::OnPublish()
     OnSourceIDChange(_context->GetID());
 
     mix_queue_->Clear();
+    // a cache disabled by the overflow of the last publish is enabled again
+    gop_cache_->Set(_config->GetGopCache(request_->vhost));
     gop_cache_->Clear();
+    if (ring_) {
+        ring_->Clear();
+    }
 
-    if ((ret = dvr_->OnPublish(request_)) != ERROR_SUCCESS) {
+    std::string url = request_->GetStreamUrl();
+
+    // every worker with players of the stream serves its cmaf from memory,
+    // when they asked for it lately
+    bool cmaf_requested =
+        cmaf_requested_at_ >= 0 &&
+        Utils::GetSteadyMilliSeconds() - cmaf_requested_at_ <=
+            SOURCE_CMAF_IDLE_MS;
+    if (cmaf_requested &&
+        (ret = cmaf_->OnPublish(request_)) != ERROR_SUCCESS) {
+        rs_error("start cmaf failed. ret=%d", ret);
+        return ret;
+    }
+
+    // only the owner worker records the stream
+    if (Worker::IsOwner(url) &&
+        (ret = dvr_->OnPublish(request_)) != ERROR_SUCCESS) {
         rs_error("start dvr failed. ret=%d", ret);
         return ret;
     }
+
+    if (Worker::IsOwner(url) &&
+        (ret = hls_->OnPublish(request_)) != ERROR_SUCCESS) {
+        rs_error("start hls failed. ret=%d", ret);
+        return ret;
+    }
+
+    if (relayed_ || Worker::IsOwner(url)) {
+        return ret;
+    }
+
+    // the local publisher wins over the stream pulled from the owner
+    rs_freep(relay_receiver_);
+
+    if ((ret = start_relay_forward()) != ERROR_SUCCESS) {
+        rs_warn("relay forward failed, retry in cycle. ret=%d", ret);
+        ret = ERROR_SUCCESS;
+    }
+
+    return ret;
+}
+
+int Source::OnRelayPublish()
+{
+    int ret = ERROR_SUCCESS;
+
+    relayed_ = true;
+
+    if ((ret = OnPublish()) != ERROR_SUCCESS) {
+        relayed_ = false;
+        return ret;
+    }
+
     return ret;
 }
 
 void Source::OnUnpublish()
 {
     dvr_->OnUnpubish();
+    hls_->OnUnpublish();
+    cmaf_->OnUnpublish();
+
+    rs_freep(relay_forwarder_);
+
+    // the workers pulling this stream see the end of it
+    for (int i = 0; i < (int)relay_senders_.size(); i++) {
+        RelaySender* sender = relay_senders_.at(i);
+        rs_freep(sender);
+    }
+    relay_senders_.clear();
 
-    if (consumers_.empty()) {
+    relayed_ = false;
+
+    if (consumers_.Empty()) {
         die_at_ = Utils::GetSteadyMilliSeconds();
+        schedule_expire();
     }
 
     can_publish_ = true;
 }
 
+int Source::OnEdgeStartPublish()
+{
+    return publish_edge_->OnClientPublish();
+}
+
+int Source::OnEdgeProxyPublish(CommonMessage* msg)
+{
+    return publish_edge_->OnProxyPublish(msg);
+}
+
+void Source::OnEdgeProxyUnpublish()
+{
+    publish_edge_->OnProxyUnpublish();
+}
+
 int Source::SourceId()
 {
     return 0;
 }
 
-int Source::CreateConsumer(Connection* conn,
-                           Consumer*&  consumer,
-                           bool        ds,  // dispatch sequence header
-                           bool        dm,  // dispatch meta data
-                           bool        dg)         // dispatch gop cache
+int Source::AttachRelayReceiver(RelayChannel* channel)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (relay_receiver_ && relay_receiver_->Finished()) {
+        rs_freep(relay_receiver_);
+    }
+
+    if (relay_receiver_ || !can_publish_) {
+        ret = ERROR_SYSTEM_STREAM_BUSY;
+        rs_warn("stream %s is already publishing. ret=%d",
+                request_->GetStreamUrl().c_str(), ret);
+        rs_freep(channel);
+        return ret;
+    }
+
+    relay_receiver_ = new RelayReceiver(this, channel);
+    if ((ret = relay_receiver_->Start()) != ERROR_SUCCESS) {
+        rs_freep(relay_receiver_);
+        return ret;
+    }
+
+    return ret;
+}
+
+int Source::AttachRelaySender(RelayChannel* channel)
+{
+    int ret = ERROR_SUCCESS;
+
+    RelaySender* sender = new RelaySender(this, channel);
+    if ((ret = sender->Start()) != ERROR_SUCCESS) {
+        rs_freep(sender);
+        return ret;
+    }
+
+    relay_senders_.push_back(sender);
+
+    return ret;
+}
+
+int Source::start_relay_pull()
+{
+    int ret = ERROR_SUCCESS;
+
+    int owner = Worker::OwnerOf(request_->GetStreamUrl());
+
+    RelayChannel* channel = nullptr;
+    if ((ret = RelayChannel::Connect(owner, &channel)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if ((ret = channel->SendHello(RelayFrameType::HELLO_SUBSCRIBE,
+                                  request_)) != ERROR_SUCCESS) {
+        rs_freep(channel);
+        return ret;
+    }
+
+    relay_receiver_ = new RelayReceiver(this, channel);
+    if ((ret = relay_receiver_->Start()) != ERROR_SUCCESS) {
+        rs_freep(relay_receiver_);
+        return ret;
+    }
+
+    rs_trace("pull %s from worker[%d]", request_->GetStreamUrl().c_str(),
+             owner);
+
+    return ret;
+}
+
+int Source::start_relay_forward()
+{
+    int ret = ERROR_SUCCESS;
+
+    int owner = Worker::OwnerOf(request_->GetStreamUrl());
+
+    RelayChannel* channel = nullptr;
+    if ((ret = RelayChannel::Connect(owner, &channel)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if ((ret = channel->SendHello(RelayFrameType::HELLO_PUBLISH, request_)) !=
+        ERROR_SUCCESS) {
+        rs_freep(channel);
+        return ret;
+    }
+
+    relay_forwarder_ = new RelaySender(this, channel);
+    if ((ret = relay_forwarder_->Start()) != ERROR_SUCCESS) {
+        rs_freep(relay_forwarder_);
+        return ret;
+    }
+
+    rs_trace("forward %s to worker[%d]", request_->GetStreamUrl().c_str(),
+             owner);
+
+    return ret;
+}
+
+void Source::cycle_relay()
+{
+    int ret = ERROR_SUCCESS;
+
+    if (relay_receiver_ && relay_receiver_->Finished()) {
+        rs_freep(relay_receiver_);
+    }
+
+    if (relay_forwarder_ && relay_forwarder_->Finished()) {
+        rs_warn("relay forward of %s closed",
+                request_->GetStreamUrl().c_str());
+        rs_freep(relay_forwarder_);
+    }
+
+    std::vector<RelaySender*>::iterator it;
+    for (it = relay_senders_.begin(); it != relay_senders_.end();) {
+        RelaySender* sender = *it;
+        if (sender->Finished()) {
+            it = relay_senders_.erase(it);
+            rs_freep(sender);
+        }
+        else {
+            it++;
+        }
+    }
+
+    if (Worker::IsOwner(request_->GetStreamUrl())) {
+        return;
+    }
+
+    if (!can_publish_ && !relayed_ && !relay_forwarder_) {
+        if ((ret = start_relay_forward()) != ERROR_SUCCESS) {
+            rs_warn("relay forward failed, retry in cycle. ret=%d", ret);
+        }
+        return;
+    }
+
+    if (can_publish_ && !relay_receiver_ && !consumers_.Empty()) {
+        if ((ret = start_relay_pull()) != ERROR_SUCCESS) {
+            rs_warn("relay pull failed, retry in cycle. ret=%d", ret);
+        }
+        return;
+    }
+
+    // nobody plays the pulled stream anymore
+    if (relay_receiver_ && consumers_.Empty() && die_at_ != -1 &&
+        Utils::GetSteadyMilliSeconds() > die_at_ + SOURCE_CLEAN_UP_MS) {
+        rs_trace("stop pulling %s", request_->GetStreamUrl().c_str());
+        rs_freep(relay_receiver_);
+    }
+}
+
+int Source::CreateConsumer(IConnection* conn,
+                           Consumer*&   consumer,
+                           bool         ds,  // dispatch sequence header
+                           bool         dm,  // dispatch meta data
+                           bool         dg,  // dispatch gop cache
+                           int64_t      shift_ms)
 {
     int ret = ERROR_SUCCESS;
 
     consumer = new Consumer(this, conn);
-    consumers_.push_back(consumer);
+    consumers_.Add(consumer);
+
+    // a player of the past starts from an older keyframe of the time shift
+    int64_t shift_seq = shift_ms > 0 ? gop_cache_->Seek(shift_ms) : -1;
+
+    // the cached sh and gop go through the consumer queue, the live
+    // messages from the current end of the ring
+    if (ring_ && shift_seq < 0) {
+        consumer->AttachRing(ring_);
+    }
+
+    // the player landed on a worker which doesn't own the stream
+    if (can_publish_ && !relay_receiver_ &&
+        !Worker::IsOwner(request_->GetStreamUrl())) {
+        if ((ret = start_relay_pull()) != ERROR_SUCCESS) {
+            rs_warn("relay pull failed, retry in cycle. ret=%d", ret);
+            ret = ERROR_SUCCESS;
+        }
+    }
+
+    // only the owner pulls from the origin, the other workers from the owner
+    if (_config->GetVhostIsEdge(request_->vhost) &&
+        Worker::IsOwner(request_->GetStreamUrl())) {
+        if ((ret = play_edge_->OnClientPlay()) != ERROR_SUCCESS) {
+            rs_error("edge start to play failed. ret=%d", ret);
+            return ret;
+        }
+    }
 
     // queue_size 单位second
     double queue_size = _config->GetQueueSize(request_->vhost);
     consumer->SetQueueSize(queue_size);
 
     if (atc_ && !gop_cache_->Empty()) {
+        int64_t start_time = shift_seq >= 0 ?
+                                 gop_cache_->At(shift_seq)->timestamp :
+                                 gop_cache_->StartTime();
         if (cache_metadata_) {
-            cache_metadata_->timestamp = gop_cache_->StartTime();
+            cache_metadata_->timestamp = start_time;
         }
         if (cache_sh_audio_) {
-            cache_sh_audio_->timestamp = gop_cache_->StartTime();
+            cache_sh_audio_->timestamp = start_time;
         }
         if (cache_sh_video_) {
-            cache_sh_video_->timestamp = gop_cache_->StartTime();
+            cache_sh_video_->timestamp = start_time;
         }
     }
 
@@ -555,9 +951,31 @@ int Source::CreateConsumer(Connection* conn,
         return ret;
     }
 
-    if (dg && (ret = gop_cache_->Dump(consumer, atc_, ag_)) != ERROR_SUCCESS) {
-        rs_error("dispatch cached gop failed. ret=%d", ret);
-        return ret;
+    if (shift_seq >= 0) {
+        int delay_ms = (int)(gop_cache_->LastTimestamp() -
+                             gop_cache_->At(shift_seq)->timestamp);
+        consumer->AttachTimeShift(gop_cache_, shift_seq, delay_ms);
+        rs_trace("create time shift consumer. shift=%lldms, delay=%dms",
+                 (long long)shift_ms, delay_ms);
+    }
+    else if (dg) {
+        // a player may start from the keyframe alone, the relays of the
+        // other workers take the gop for their cache
+        bool keyframe_only =
+            conn && _config->GetJoinStrategy(request_->vhost) == "keyframe";
+        if ((ret = gop_cache_->Dump(consumer, atc_, ag_, keyframe_only)) !=
+            ERROR_SUCCESS) {
+            rs_error("dispatch cached gop failed. ret=%d", ret);
+            return ret;
+        }
+
+        if (keyframe_only) {
+            consumer->DropToKeyframe();
+        }
+        else {
+            consumer->SetJoinBacklog(gop_cache_->GopBytes(),
+                                     (int)gop_cache_->GopDuration());
+        }
     }
 
     rs_trace("create consumer. queue_size=%.2f, jitter=%d", queue_size, ag_);
@@ -565,6 +983,74 @@ int Source::CreateConsumer(Connection* conn,
     return ret;
 }
 
+int Source::ExportClip(int64_t start_ms, int64_t duration_ms, std::string& data)
+{
+    int ret = ERROR_SUCCESS;
+
+    int64_t sequence = gop_cache_->Seek(start_ms);
+    if (sequence < 0) {
+        ret = ERROR_TIME_SHIFT_NO_CLIP;
+        rs_warn("no time shift of %s to clip. ret=%d",
+                request_->GetStreamUrl().c_str(), ret);
+        return ret;
+    }
+
+    MemoryWriter writer;
+    flv::Muxer   muxer;
+    if ((ret = muxer.Initialize(&writer)) != ERROR_SUCCESS ||
+        (ret = muxer.WriteMuxerHeader()) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if (cache_metadata_ &&
+        (ret = muxer.WriteMetadata(cache_metadata_->payload,
+                                   cache_metadata_->size)) != ERROR_SUCCESS) {
+        return ret;
+    }
+    if (cache_sh_audio_ &&
+        (ret = muxer.WriteAudio(0, cache_sh_audio_->payload,
+                                cache_sh_audio_->size)) != ERROR_SUCCESS) {
+        return ret;
+    }
+    if (cache_sh_video_ &&
+        (ret = muxer.WriteVideo(0, cache_sh_video_->payload,
+                                cache_sh_video_->size)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    // from the keyframe, the clip starts at 0
+    int64_t base = gop_cache_->At(sequence)->timestamp;
+    for (; sequence < gop_cache_->End(); sequence++) {
+        SharedPtrMessage* msg = gop_cache_->At(sequence);
+        if (!msg) {
+            continue;
+        }
+
+        int64_t timestamp = msg->timestamp - base;
+        if (timestamp > duration_ms) {
+            break;
+        }
+
+        if (msg->IsAudio()) {
+            ret = muxer.WriteAudio(timestamp, msg->payload, msg->size);
+        }
+        else if (msg->IsVideo()) {
+            ret = muxer.WriteVideo(timestamp, msg->payload, msg->size);
+        }
+        if (ret != ERROR_SUCCESS) {
+            return ret;
+        }
+    }
+
+    data.swap(writer.Data());
+
+    rs_trace("export clip of %s. start=%lldms, duration=%lldms, size=%d",
+             request_->GetStreamUrl().c_str(), (long long)start_ms,
+             (long long)duration_ms, (int)data.size());
+
+    return ret;
+}
+
 bool Source::Expired()
 {
     if (die_at_ == -1) {
@@ -575,7 +1061,7 @@ bool Source::Expired()
         return false;
     }
 
-    if (!consumers_.empty()) {
+    if (!consumers_.Empty()) {
         return false;
     }
 
@@ -612,54 +1098,176 @@ void Source::OnSourceIDChange(int id)
 
     source_id_ = id;
 
-    std::vector<Consumer*>::iterator it;
-    for (it = consumers_.begin(); it != consumers_.end(); it++) {
-        (*it)->UpdateSourceID();
+    for (int i = 0; i < consumers_.Size(); i++) {
+        consumers_.At(i)->UpdateSourceID();
+    }
+}
+
+Cmaf* Source::GetCmaf()
+{
+    return cmaf_;
+}
+
+int Source::RequestCmaf()
+{
+    int ret = ERROR_SUCCESS;
+
+    if (!_config->GetCmafEnabled(request_->vhost)) {
+        ret = ERROR_HLS_NO_STREAM;
+        return ret;
     }
+
+    cmaf_requested_at_ = Utils::GetSteadyMilliSeconds();
+
+    // started by the publish, when there is none yet
+    if (can_publish_ || cmaf_->Enabled()) {
+        return ret;
+    }
+
+    return start_cmaf();
+}
+
+int Source::start_cmaf()
+{
+    int ret = ERROR_SUCCESS;
+
+    if ((ret = cmaf_->OnPublish(request_)) != ERROR_SUCCESS) {
+        rs_error("start cmaf failed. ret=%d", ret);
+        return ret;
+    }
+
+    // in the middle of the stream, the sequence headers were sent already
+    if (cache_sh_video_ && (ret = cmaf_->OnVideo(cache_sh_video_)) !=
+                               ERROR_SUCCESS) {
+        return ret;
+    }
+    if (cache_sh_audio_ && (ret = cmaf_->OnAudio(cache_sh_audio_)) !=
+                               ERROR_SUCCESS) {
+        return ret;
+    }
+
+    rs_trace("start cmaf of %s", request_->GetStreamUrl().c_str());
+
+    return ret;
+}
+
+MessageRing* Source::GetRing()
+{
+    return ring_;
+}
+
+bool Source::IsATC()
+{
+    return atc_;
+}
+
+JitterAlgorithm Source::GetJitterAlgorithm()
+{
+    return ag_;
 }
 
 int Source::Cycle()
 {
     int ret = ERROR_SUCCESS;
-    // TODO:do something
+
+    cycle_relay();
+
+    // the segments kept after the publish are freed as well
+    int64_t now     = Utils::GetSteadyMilliSeconds();
+    bool    running = cmaf_->Enabled() || cmaf_->Bytes() > 0;
+    if (running && now - cmaf_requested_at_ > SOURCE_CMAF_IDLE_MS) {
+        rs_trace("stop cmaf of %s without players",
+                 request_->GetStreamUrl().c_str());
+        cmaf_->OnUnpublish();
+        cmaf_->Clear();
+        cmaf_requested_at_ = -1;
+    }
+
     return ret;
 }
 
+void Source::schedule_expire()
+{
+    if (expire_scheduled_) {
+        return;
+    }
+
+    expire_scheduled_ = true;
+    expire_wheel_.Schedule(this, die_at_ + SOURCE_CLEAN_UP_MS);
+}
+
 int Source::do_cycle_all()
 {
     int ret = ERROR_SUCCESS;
 
-    std::map<std::string, Source*>::iterator it;
-    for (it = pool_.begin(); it != pool_.end();) {
-        Source* source = it->second;
-
-        if ((ret = source->Cycle() != ERROR_SUCCESS)) {
+    for (size_t i = 0; i < sources_.size(); i++) {
+        if ((ret = sources_[i]->Cycle()) != ERROR_SUCCESS) {
             return ret;
         }
+    }
 
-        if (source->Expired()) {
-            int cid = source->GetSouceID();
-            if (cid == -1 || source->GetPrevSourceID() > 0) {
-                cid = source->GetPrevSourceID();
-            }
-            if (cid > 0) {
-                _context->SetID(cid);
+    // only the sources which lost their last player or publisher are checked
+    std::vector<Source*> due;
+    expire_wheel_.Expire(Utils::GetSteadyMilliSeconds(), due);
+
+    for (size_t i = 0; i < due.size(); i++) {
+        Source* source            = due[i];
+        source->expire_scheduled_ = false;
+
+        if (!source->Expired()) {
+            // left again later than it was scheduled, or used again and
+            // scheduled when it is left
+            if (source->die_at_ != -1 && source->can_publish_ &&
+                source->consumers_.Empty()) {
+                source->schedule_expire();
             }
+            continue;
+        }
 
-            std::string url = it->first;
-            it              = pool_.erase(it);
-            rs_trace("clean die source[%s]. now total=%d", url.c_str(),
-                     (int)pool_.size());
-            rs_freep(source);
+        int cid = source->GetSouceID();
+        if (cid == -1 || source->GetPrevSourceID() > 0) {
+            cid = source->GetPrevSourceID();
         }
-        else {
-            it++;
+        if (cid > 0) {
+            _context->SetID(cid);
         }
+
+        pool_.Erase(source->request_->StreamHash(), source);
+
+        Source* last                  = sources_.back();
+        last->pool_index_             = source->pool_index_;
+        sources_[source->pool_index_] = last;
+        sources_.pop_back();
+
+        rs_trace("clean die source[%s]. now total=%d",
+                 source->request_->GetStreamUrl().c_str(), pool_.Size());
+        rs_freep(source);
     }
 
     return ret;
 }
 
+void Source::DumpGopCache()
+{
+    int64_t bytes = 0;
+    for (size_t i = 0; i < sources_.size(); i++) {
+        Source*   source = sources_[i];
+        GopCache* cache  = source->gop_cache_;
+        bytes += cache->Bytes();
+
+        if (!cache->Empty() || cache->Overflowed()) {
+            rs_info("gop cache of %s. count=%d, bytes=%lld, duration=%lld, "
+                    "overflowed=%d",
+                    source->request_->GetStreamUrl().c_str(),
+                    cache->Count(), (long long)cache->Bytes(),
+                    (long long)cache->Duration(), cache->Overflowed());
+        }
+    }
+
+    rs_trace("gop cache of %d sources. bytes=%lld", (int)sources_.size(),
+             (long long)bytes);
+}
+
 int Source::CycleAll()
 {
     int ret = ERROR_SUCCESS;
@@ -12,6 +12,7 @@
 #include <common/connection.hpp>
 #include <common/core.hpp>
 #include <common/queue.hpp>
+#include <protocol/rtmp/consumer.hpp>
 
 #include <vector>
 
@@ -21,15 +22,22 @@ enum class JitterAlgorithm;
 
 class GopCache;
 class Dvr;
+class Hls;
+class Cmaf;
 class Request;
 class Reponse;
 class CommonMessage;
 class OnMetadataPacket;
 class Consumer;
 class Source;
-class Connection;
 class Jitter;
 class SharedPtrMessage;
+class MessageRing;
+class RelayChannel;
+class RelaySender;
+class RelayReceiver;
+class PlayEdge;
+class PublishEdge;
 
 class ISourceHandler {
   public:
@@ -49,6 +57,8 @@ class Source {
   public:
     static int   FetchOrCreate(Request* r, ISourceHandler* h, Source** pps);
     static int   CycleAll();
+    // the memory held by the gop cache of every source of the worker
+    static void  DumpGopCache();
     virtual int  Initialize(Request* r, ISourceHandler* h);
     virtual bool CanPublish(bool is_edge);
     virtual void OnConsumerDestroy(Consumer* consumer);
@@ -57,29 +67,66 @@ class Source {
     virtual int  OnMetadata(CommonMessage* msg, OnMetadataPacket* pkt);
     virtual int  OnDvrRequestSH();
     virtual int  OnPublish();
+    virtual int  OnRelayPublish();
     virtual void OnUnpublish();
+    // the publisher of an edge vhost, forwarded to the origin
+    virtual int  OnEdgeStartPublish();
+    virtual int  OnEdgeProxyPublish(CommonMessage* msg);
+    virtual void OnEdgeProxyUnpublish();
+    virtual int  AttachRelayReceiver(RelayChannel* channel);
+    virtual int  AttachRelaySender(RelayChannel* channel);
     virtual int  SourceId();
     virtual int  Cycle();
     virtual bool Expired();
     virtual int  GetPrevSourceID();
     virtual int  GetSouceID();
     virtual void OnSourceIDChange(int id);
-    virtual int  CreateConsumer(Connection* conn,
-                                Consumer*&  consumer,
-                                bool        ds = true,
-                                bool        dm = true,
-                                bool        dg = true);
+    virtual int  CreateConsumer(IConnection* conn,
+                                Consumer*&   consumer,
+                                bool         ds = true,
+                                bool         dm = true,
+                                bool         dg = true,
+                                int64_t      shift_ms = 0);
+    // the flv of the duration_ms from the keyframe start_ms before the live
+    // point, from the time shift
+    virtual int  ExportClip(int64_t      start_ms,
+                            int64_t      duration_ms,
+                            std::string& data);
+
+  public:
+    // the fmp4 segments of the stream, served to the http players
+    virtual Cmaf*           GetCmaf();
+    // a cmaf request of a player of this worker, the segments are made from
+    // the next keyframe on until no player asked for them for a while
+    virtual int             RequestCmaf();
+    // the shared ring of the live players, nullptr without
+    virtual MessageRing*    GetRing();
+    // how the consumers correct the messages of the shared ring
+    virtual bool            IsATC();
+    virtual JitterAlgorithm GetJitterAlgorithm();
 
   protected:
     static Source* fetch(Request* r);
 
   private:
     int        on_audio_impl(SharedPtrMessage* msg);
+    int        dispatch(SharedPtrMessage* msg);
     int        on_video_impl(SharedPtrMessage* msg);
     static int do_cycle_all();
+    int        start_cmaf();
+    int        start_relay_pull();
+    int        start_relay_forward();
+    void       cycle_relay();
+    void       schedule_expire();
 
   private:
-    static std::map<std::string, Source*> pool_;
+    // by the hash of the stream url, the sources in a row for the cycle and
+    // those without players nor publisher by when they expire
+    static HashIndex<Source*>             pool_;
+    static std::vector<Source*>           sources_;
+    static TimerWheel<Source*>            expire_wheel_;
+    int                                   pool_index_;
+    bool                                  expire_scheduled_;
     Request*                              request_;
     bool                                  atc_;
     ISourceHandler*                       handler_;
@@ -90,14 +137,24 @@ class Source {
     SharedPtrMessage*                     cache_metadata_;
     SharedPtrMessage*                     cache_sh_video_;
     SharedPtrMessage*                     cache_sh_audio_;
-    std::vector<Consumer*>                consumers_;
+    ConsumerList                          consumers_;
     JitterAlgorithm                       ag_;
     MixQueue<SharedPtrMessage>*           mix_queue_;
+    MessageRing*                          ring_;
     Dvr*                                  dvr_;
+    Hls*                                  hls_;
+    Cmaf*                                 cmaf_;
+    int64_t                               cmaf_requested_at_;
     GopCache*                             gop_cache_;
     int64_t                               die_at_;
     int                                   source_id_;
     int                                   prev_source_id_;
+    bool                                  relayed_;
+    RelayReceiver*                        relay_receiver_;
+    RelaySender*                          relay_forwarder_;
+    std::vector<RelaySender*>             relay_senders_;
+    PlayEdge*                             play_edge_;
+    PublishEdge*                          publish_edge_;
 };
 }  // namespace rtmp
 #endif
@@ -99,7 +99,10 @@ Request::Request()
 {
     object_encoding = 3;
     duration        = -1;
+    start           = -2;
     args            = nullptr;
+    stream_hash_    = 0;
+    hashed_         = false;
 }
 
 Request::~Request() {}
@@ -116,6 +119,8 @@ void Request::Strip()
 
     app    = Utils::StringTrimStart(app, "/");
     stream = Utils::StringTrimStart(stream, "/");
+
+    hashed_ = false;
 }
 
 Request* Request::Copy()
@@ -135,6 +140,7 @@ Request* Request::Copy()
     cp->tc_url          = tc_url;
     cp->vhost           = vhost;
     cp->duration        = duration;
+    cp->start           = start;
 
     if (args) {
         cp->args = args->Copy()->ToObject();
@@ -148,6 +154,38 @@ std::string Request::GetStreamUrl()
     return generate_stream_url(vhost, app, stream);
 }
 
+uint32_t Request::StreamHash()
+{
+    if (hashed_) {
+        return stream_hash_;
+    }
+
+    // the same as Utils::Hash(GetStreamUrl())
+    uint32_t hash = Utils::Hash(vhost != RTMP_DEFAULT_VHOST ? vhost : "");
+    hash          = Utils::Hash("/", hash);
+    hash          = Utils::Hash(app, hash);
+    hash          = Utils::Hash("/", hash);
+    stream_hash_  = Utils::Hash(stream, hash);
+    hashed_       = true;
+
+    return stream_hash_;
+}
+
+bool Request::IsSameStream(Request* req)
+{
+    if (StreamHash() != req->StreamHash()) {
+        return false;
+    }
+
+    bool is_default     = vhost == RTMP_DEFAULT_VHOST || vhost.empty();
+    bool req_is_default = req->vhost == RTMP_DEFAULT_VHOST || req->vhost.empty();
+    if (is_default != req_is_default || (!is_default && vhost != req->vhost)) {
+        return false;
+    }
+
+    return app == req->app && stream == req->stream;
+}
+
 void Request::Update(Request* req)
 {
     page_url = req->page_url;
@@ -188,6 +226,8 @@ Protocol::Protocol(IProtocolReaderWriter* rw)
         cs_cache_[cid]        = cs;
     }
     auto_response_when_recv_ = false;
+    zc_writer_               = nullptr;
+    zc_threshold_            = 0;
 }
 
 Protocol::~Protocol()
@@ -218,6 +258,10 @@ Protocol::~Protocol()
     }
     rs_freepa(cs_cache_);
     rs_freepa(out_iovs_);
+
+    // the socket is still open, the kernel may read the pages of the sends
+    // until their completions come
+    drain_zero_copy();
 }
 
 void Protocol::SetSendTimeout(int64_t timeout_us)
@@ -460,16 +504,31 @@ int Protocol::ReadMessagePayload(ChunkStream* cs, CommonMessage** pmsg)
         cs->msg->CreatePayload(cs->header.payload_length);
     }
 
-    if ((ret = in_buffer_->Grow(rw_, payload_size)) != ERROR_SUCCESS) {
-        if (!is_client_gracefully_close(ret)) {
-            rs_error("read payload failed. required_size=%d, ret=%d",
-                     payload_size, ret);
+    if (payload_size >= RTMP_ZERO_COPY_MIN_SIZE &&
+        in_buffer_->Size() < payload_size) {
+        // large chunk, avoid copying it through the in buffer
+        if ((ret = in_buffer_->ReadInto(
+                 rw_, cs->msg->payload + cs->msg->size, payload_size)) !=
+            ERROR_SUCCESS) {
+            if (!is_client_gracefully_close(ret)) {
+                rs_error("read payload failed. required_size=%d, ret=%d",
+                         payload_size, ret);
+            }
+            return ret;
         }
-        return ret;
     }
+    else {
+        if ((ret = in_buffer_->Grow(rw_, payload_size)) != ERROR_SUCCESS) {
+            if (!is_client_gracefully_close(ret)) {
+                rs_error("read payload failed. required_size=%d, ret=%d",
+                         payload_size, ret);
+            }
+            return ret;
+        }
 
-    memcpy(cs->msg->payload + cs->msg->size,
-           in_buffer_->ReadSlice(payload_size), payload_size);
+        memcpy(cs->msg->payload + cs->msg->size,
+               in_buffer_->ReadSlice(payload_size), payload_size);
+    }
     cs->msg->size += payload_size;
 
     if (cs->header.payload_length == cs->msg->size) {
@@ -669,6 +728,10 @@ int Protocol::DoDecodeMessage(MessageHeader& header,
             *ppacket = packet = new PlayPacket;
             return packet->Decode(manager);
         }
+        else if (command == RTMP_AMF0_COMMAND_SEEK) {
+            *ppacket = packet = new SeekPacket;
+            return packet->Decode(manager);
+        }
         else {
             rs_trace("drop the amf0 command message, command_name=%s",
                      command.c_str());
@@ -711,6 +774,22 @@ int Protocol::OnSendPacket(MessageHeader* header, Packet* packet)
             out_chunk_size_         = pkt->chunk_size;
             break;
         }
+        // the requests of a client, to decode their _result by transaction
+        case RTMP_MSG_AMF0_COMMAND: {
+            if (ConnectAppPacket* pkt =
+                    dynamic_cast<ConnectAppPacket*>(packet)) {
+                requests_[pkt->transaction_id] = pkt->command_name;
+            }
+            else if (CreateStreamPacket* pkt =
+                         dynamic_cast<CreateStreamPacket*>(packet)) {
+                requests_[pkt->transaction_id] = pkt->command_name;
+            }
+            else if (FMLEStartPacket* pkt =
+                         dynamic_cast<FMLEStartPacket*>(packet)) {
+                requests_[pkt->transaction_id] = pkt->command_name;
+            }
+            break;
+        }
         default: break;
     }
     return ret;
@@ -849,6 +928,18 @@ int Protocol::SendAndFreePacket(Packet* packet, int stream_id)
 int Protocol::SendAndFreeMessages(SharedPtrMessage** msgs,
                                   int                nb_msgs,
                                   int                stream_id)
+{
+    int ret = SendMessages(msgs, nb_msgs, stream_id);
+    for (int i = 0; i < nb_msgs; i++) {
+        rs_freep(msgs[i]);
+    }
+
+    return ret;
+}
+
+int Protocol::SendMessages(SharedPtrMessage** msgs,
+                           int                nb_msgs,
+                           int                stream_id)
 {
     for (int i = 0; i < nb_msgs; i++) {
         if (!msgs[i]) {
@@ -860,12 +951,7 @@ int Protocol::SendAndFreeMessages(SharedPtrMessage** msgs,
         }
     }
 
-    int ret = do_send_messages(msgs, nb_msgs);
-    for (int i = 0; i < nb_msgs; i++) {
-        rs_freep(msgs[i]);
-    }
-
-    return ret;
+    return do_send_messages(msgs, nb_msgs);
 }
 
 int Protocol::OnRecvMessage(CommonMessage* msg)
@@ -930,6 +1016,24 @@ void Protocol::SetAutoResponse(bool v)
     auto_response_when_recv_ = v;
 }
 
+void Protocol::SetZeroCopy(bool v, int threshold)
+{
+    zc_writer_    = nullptr;
+    zc_threshold_ = threshold;
+
+    if (!v) {
+        return;
+    }
+
+    IZeroCopyWriter* writer = dynamic_cast<IZeroCopyWriter*>(rw_);
+    if (!writer || !writer->EnableZeroCopy()) {
+        rs_warn("zero copy send is not supported by the socket");
+        return;
+    }
+
+    zc_writer_ = writer;
+}
+
 int Protocol::do_send_messages(SharedPtrMessage** msgs, int nb_msgs)
 {
     int ret = ERROR_SUCCESS;
@@ -938,6 +1042,13 @@ int Protocol::do_send_messages(SharedPtrMessage** msgs, int nb_msgs)
     iovec* iovs             = out_iovs_ + iov_index;
     int    c0c3_cache_index = 0;
     char*  c0c3_cache       = out_c0c3_caches_ + c0c3_cache_index;
+    // only the chunked layouts owned by the payloads are immutable
+    bool   zero_copy        = zc_writer_ != nullptr;
+    int    nb_bytes         = 0;
+
+    if (!zc_pending_.empty()) {
+        reap_zero_copy();
+    }
 
     for (int i = 0; i < nb_msgs; i++) {
         SharedPtrMessage* msg = msgs[i];
@@ -950,6 +1061,51 @@ int Protocol::do_send_messages(SharedPtrMessage** msgs, int nb_msgs)
             continue;
         }
 
+        // the players with the same chunk size share the chunked layout,
+        // only the c0 header with the timestamp of the player is its own
+        iovec* chunked_iovs    = nullptr;
+        int    nb_chunked_iovs = 0;
+        if (msg->GetChunkedIovs(out_chunk_size_, &chunked_iovs,
+                                &nb_chunked_iovs)) {
+            int c0c3_left = RTMP_C0C3_HEADERS_MAX - c0c3_cache_index;
+            if (c0c3_left < RTMP_FMT0_HEADER_SIZE) {
+                if ((ret = send_large_iovs(rw_, out_iovs_, iov_index,
+                                           nullptr)) != ERROR_SUCCESS) {
+                    return ret;
+                }
+
+                zero_copy        = false;
+                iov_index        = 0;
+                c0c3_cache_index = 0;
+                c0c3_cache       = out_c0c3_caches_ + c0c3_cache_index;
+            }
+
+            if (iov_index + nb_chunked_iovs > nb_out_iovs_) {
+                while (iov_index + nb_chunked_iovs > nb_out_iovs_) {
+                    nb_out_iovs_ += RTMP_IOVS_MAX;
+                }
+                int relloc_size = sizeof(iovec) * nb_out_iovs_;
+                out_iovs_       = (iovec*)realloc(out_iovs_, relloc_size);
+            }
+
+            iovs = out_iovs_ + iov_index;
+            memcpy(iovs, chunked_iovs, sizeof(iovec) * nb_chunked_iovs);
+
+            int nbh          = msg->ChunkHeader(c0c3_cache, true);
+            iovs[0].iov_base = c0c3_cache;
+            iovs[0].iov_len  = nbh;
+
+            c0c3_cache_index += nbh;
+            c0c3_cache = out_c0c3_caches_ + c0c3_cache_index;
+
+            iov_index += nb_chunked_iovs;
+            iovs = out_iovs_ + iov_index;
+            nb_bytes += msg->size;
+            continue;
+        }
+
+        zero_copy = false;
+
         char* p    = msg->payload;
         char* pend = msg->payload + msg->size;
 
@@ -996,7 +1152,121 @@ int Protocol::do_send_messages(SharedPtrMessage** msgs, int nb_msgs)
     if (iov_index <= 0) {
         return ret;
     }
+
+    if (zero_copy && nb_bytes >= zc_threshold_) {
+        return send_zero_copy(msgs, nb_msgs, iov_index, c0c3_cache_index);
+    }
+
     return send_large_iovs(rw_, out_iovs_, iov_index, nullptr);
 }
 
+int Protocol::send_zero_copy(SharedPtrMessage** msgs,
+                             int                nb_msgs,
+                             int                nb_iovs,
+                             int                nb_headers)
+{
+    int ret = ERROR_SUCCESS;
+
+    // the c0 headers move out of the buffer the next send writes to
+    char* headers = new char[rs_max(nb_headers, 1)];
+    memcpy(headers, out_c0c3_caches_, nb_headers);
+    for (int i = 0; i < nb_iovs; i++) {
+        char* base = (char*)out_iovs_[i].iov_base;
+        if (base >= out_c0c3_caches_ &&
+            base < out_c0c3_caches_ + RTMP_C0C3_HEADERS_MAX) {
+            out_iovs_[i].iov_base = headers + (base - out_c0c3_caches_);
+        }
+    }
+
+    int64_t seq = -1;
+    ret = zc_writer_->WriteEvZeroCopy(out_iovs_, nb_iovs, nullptr, &seq);
+
+    // hold a reference of the payloads until the kernel is done with them,
+    // even when the send failed half way.
+    if (seq >= 0) {
+        ZeroCopySend* send = new ZeroCopySend;
+        send->seq          = (uint32_t)seq;
+        send->headers      = headers;
+        for (int i = 0; i < nb_msgs; i++) {
+            if (msgs[i]) {
+                send->msgs.push_back(msgs[i]->Copy());
+            }
+        }
+        zc_pending_.push_back(send);
+    }
+    else {
+        rs_freepa(headers);
+    }
+
+    if (ret != ERROR_SUCCESS) {
+        if (!is_client_gracefully_close(ret)) {
+            rs_error("send with zero copy failed. ret=%d", ret);
+        }
+        return ret;
+    }
+
+    reap_zero_copy();
+
+    return ret;
+}
+
+void Protocol::reap_zero_copy()
+{
+    uint32_t done = 0;
+    zc_writer_->ReapZeroCopy(&done);
+
+    while (!zc_pending_.empty() &&
+           (int32_t)(zc_pending_.front()->seq - done) < 0) {
+        free_zero_copy(zc_pending_.front());
+        zc_pending_.pop_front();
+    }
+}
+
+void Protocol::drain_zero_copy()
+{
+    if (!zc_writer_) {
+        return;
+    }
+
+    int64_t starttime = Utils::GetSteadyMilliSeconds();
+    int64_t timeout   = RTMP_ZERO_COPY_DRAIN_MS;
+    bool    aborted   = false;
+    while (true) {
+        reap_zero_copy();
+        if (zc_pending_.empty()) {
+            return;
+        }
+
+        if (Utils::GetSteadyMilliSeconds() - starttime >= timeout) {
+            if (aborted) {
+                break;
+            }
+
+            // a peer which stopped reading never completes them, the reset
+            // makes the kernel drop its references to the pages
+            int ret = zc_writer_->AbortZeroCopy();
+            if (ret != ERROR_SUCCESS) {
+                rs_warn("reset for zero copy sends failed. ret=%d", ret);
+            }
+            aborted = true;
+            timeout += RTMP_ZERO_COPY_ABORT_MS;
+        }
+        st_usleep(1000);
+    }
+
+    // the kernel never reported them, leaked rather than reused under it
+    rs_error("zero copy sends not completed, leak %d sends",
+             (int)zc_pending_.size());
+    zc_pending_.clear();
+}
+
+void Protocol::free_zero_copy(ZeroCopySend* send)
+{
+    for (size_t i = 0; i < send->msgs.size(); i++) {
+        rs_freep(send->msgs[i]);
+    }
+    rs_freepa(send->headers);
+    rs_freep(send);
+}
+
 }  // namespace rtmp
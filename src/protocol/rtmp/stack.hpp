@@ -11,6 +11,7 @@
 #include <protocol/rtmp/message.hpp>
 #include <protocol/rtmp/packet.hpp>
 
+#include <deque>
 #include <map>
 #include <vector>
 
@@ -57,6 +58,10 @@ class Request {
     virtual void        Strip();
     virtual Request*    Copy();
     virtual std::string GetStreamUrl();
+    // the hash of the stream url, without making it. it is kept until the
+    // next Strip, which ends the changes of vhost, app and stream
+    virtual uint32_t    StreamHash();
+    virtual bool        IsSameStream(Request* req);
     virtual void        Update(Request* req);
 
   public:
@@ -75,7 +80,14 @@ class Request {
     std::string param;
     std::string stream;
     double      duration;
+    // of the play, in seconds. a live stream with time shift is played from
+    // that long before the live point
+    double      start;
     AMF0Object* args;
+
+  private:
+    uint32_t stream_hash_;
+    bool     hashed_;
 };
 
 class Response {
@@ -108,9 +120,12 @@ class Protocol {
     virtual int  SendAndFreePacket(Packet* packet, int stream_id);
     virtual int
                  SendAndFreeMessages(SharedPtrMessage** msgs, int nb_msgs, int stream_id);
+    virtual int  SendMessages(SharedPtrMessage** msgs, int nb_msgs, int stream_id);
     virtual void SetRecvBuffer(int buffer_size);
     virtual void SetMargeRead(bool v, IMergeReadHandler* handler);
     virtual void SetAutoResponse(bool v);
+    // send the batches of at least threshold bytes with MSG_ZEROCOPY
+    virtual void SetZeroCopy(bool v, int threshold);
 
     template <typename T> int ExpectMessage(CommonMessage** pmsg, T** ppacket)
     {
@@ -162,6 +177,24 @@ class Protocol {
     virtual int OnSendPacket(MessageHeader* header, Packet* packet);
     virtual int ManualResponseFlush();
     virtual int do_send_messages(SharedPtrMessage** msgs, int nb_msgs);
+    virtual int  send_zero_copy(SharedPtrMessage** msgs,
+                                int                nb_msgs,
+                                int                nb_iovs,
+                                int                nb_headers);
+    virtual void reap_zero_copy();
+    virtual void drain_zero_copy();
+
+  private:
+    // a zero copy send, its payloads and the c0 headers of its players
+    // which the kernel reads from until the send is completed
+    struct ZeroCopySend
+    {
+        uint32_t                       seq;
+        char*                          headers;
+        std::vector<SharedPtrMessage*> msgs;
+    };
+
+    static void free_zero_copy(ZeroCopySend* send);
 
   private:
     IProtocolReaderWriter*        rw_;
@@ -178,6 +211,10 @@ class Protocol {
     iovec*                        out_iovs_;
     int                           nb_out_iovs_;
     char                          out_c0c3_caches_[RTMP_C0C3_HEADERS_MAX];
+    IZeroCopyWriter*              zc_writer_;
+    int                           zc_threshold_;
+    // the sends whose pages the kernel may still read, by their sequence
+    std::deque<ZeroCopySend*>     zc_pending_;
 };
 
 }  // namespace rtmp
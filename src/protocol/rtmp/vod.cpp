@@ -0,0 +1,509 @@
+#include <common/buffer.hpp>
+#include <common/config.hpp>
+#include <common/error.hpp>
+#include <common/file.hpp>
+#include <common/log.hpp>
+#include <common/utils.hpp>
+#include <muxer/flv.hpp>
+#include <protocol/rtmp/defines.hpp>
+#include <protocol/rtmp/message.hpp>
+#include <protocol/rtmp/server.hpp>
+#include <protocol/rtmp/stack.hpp>
+#include <protocol/rtmp/vod.hpp>
+
+#include <map>
+
+namespace rtmp {
+
+static std::map<std::string, VodFile*> _vod_files;
+
+VodFile::VodFile(const std::string& path)
+{
+    path_     = path;
+    file_     = nullptr;
+    index_    = new flv::KeyframeIndex;
+    begin_    = 0;
+    metadata_ = -1;
+    sh_video_ = -1;
+    sh_audio_ = -1;
+    refs_     = 1;
+}
+
+VodFile::~VodFile()
+{
+    if (file_) {
+        file_->Release();
+    }
+    rs_freep(index_);
+}
+
+std::string VodFile::Path(Request* request)
+{
+    const std::string& stream = request->stream;
+
+    if (!_config->GetVodEnabled(request->vhost)) {
+        return "";
+    }
+
+    if (stream.length() <= 4 ||
+        stream.compare(stream.length() - 4, 4, ".flv") != 0) {
+        return "";
+    }
+
+    // never out of the vod dir
+    if (stream.find("..") != std::string::npos ||
+        request->app.find("..") != std::string::npos) {
+        return "";
+    }
+
+    return _config->GetVodPath(request->vhost) + "/" + request->app + "/" +
+           stream;
+}
+
+int VodFile::Fetch(const std::string& path, VodFile** pfile)
+{
+    int ret = ERROR_SUCCESS;
+
+    std::map<std::string, VodFile*>::iterator it = _vod_files.find(path);
+    if (it != _vod_files.end()) {
+        if (!it->second->file_->Changed()) {
+            it->second->refs_++;
+            *pfile = it->second;
+            return ret;
+        }
+
+        // recorded again, its viewers keep the old one
+        _vod_files.erase(it);
+    }
+
+    VodFile* file = new VodFile(path);
+    if ((ret = file->initialize()) != ERROR_SUCCESS) {
+        rs_freep(file);
+        return ret;
+    }
+
+    _vod_files[path] = file;
+    *pfile           = file;
+
+    return ret;
+}
+
+void VodFile::Release()
+{
+    if (--refs_ > 0) {
+        return;
+    }
+
+    std::map<std::string, VodFile*>::iterator it = _vod_files.find(path_);
+    if (it != _vod_files.end() && it->second == this) {
+        _vod_files.erase(it);
+    }
+    delete this;
+}
+
+bool VodFile::Truncated()
+{
+    return file_->Truncated();
+}
+
+int VodFile::initialize()
+{
+    int ret = ERROR_SUCCESS;
+
+    if ((ret = MappedFile::Acquire(path_, &file_)) != ERROR_SUCCESS) {
+        file_ = nullptr;
+        return ret;
+    }
+
+    char* data = file_->Data();
+    if (file_->Size() < 9 + FLV_PREVIOUS_TAG_SIZE || data[0] != 'F' ||
+        data[1] != 'L' || data[2] != 'V') {
+        ret = ERROR_KERNEL_FLV_HEADER;
+        rs_error("invalid flv header of %s. ret=%d", path_.c_str(), ret);
+        return ret;
+    }
+
+    BufferManager manager;
+    if ((ret = manager.Initialize(data + 5, 4)) != ERROR_SUCCESS) {
+        return ret;
+    }
+    begin_ = (uint32_t)manager.Read4Bytes() + FLV_PREVIOUS_TAG_SIZE;
+
+    if ((ret = scan_headers()) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if (load_index() != ERROR_SUCCESS &&
+        (ret = build_index()) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    rs_trace("vod %s opened, size=%lld, keyframes=%d", path_.c_str(),
+             (long long)file_->Size(), index_->Size());
+
+    return ret;
+}
+
+int VodFile::scan_headers()
+{
+    int ret = ERROR_SUCCESS;
+
+    // the dvr writes the metadata and sequence headers first
+    int64_t offset = begin_;
+    for (int i = 0; i < RTMP_VOD_MAX_HEADER_TAGS; i++) {
+        VodTag tag;
+        if (ReadTag(offset, &tag) != ERROR_SUCCESS) {
+            break;
+        }
+
+        if (tag.type == (int8_t)flv::TagType::SCRIPT) {
+            if (metadata_ < 0) {
+                metadata_ = tag.offset;
+            }
+        }
+        else if (tag.type == (int8_t)flv::TagType::VIDEO &&
+                 flv::Demuxer::IsAVCSequenceHeader(tag.data, tag.size)) {
+            sh_video_ = tag.offset;
+        }
+        else if (tag.type == (int8_t)flv::TagType::AUDIO &&
+                 flv::Demuxer::IsAACSequenceHeader(tag.data, tag.size)) {
+            sh_audio_ = tag.offset;
+        }
+        else {
+            break;
+        }
+
+        offset = tag.next;
+    }
+
+    return ret;
+}
+
+int VodFile::load_index()
+{
+    int ret = ERROR_SUCCESS;
+
+    FileReader reader;
+    if ((ret = reader.Open(flv::KeyframeIndex::Path(path_))) !=
+        ERROR_SUCCESS) {
+        return ret;
+    }
+
+    if ((ret = index_->Decode(reader.Mapping()->Data(),
+                              (int)reader.FileSize())) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    // an index of another file, or of a segment still being recorded
+    if (index_->Size() > 0 &&
+        index_->At(index_->Size() - 1).offset >= file_->Size()) {
+        ret = ERROR_FLV_INDEX_INVALID;
+        rs_warn("index of %s out of the file. ret=%d", path_.c_str(), ret);
+        index_->Clear();
+        return ret;
+    }
+
+    return ret;
+}
+
+int VodFile::build_index()
+{
+    int ret = ERROR_SUCCESS;
+
+    rs_warn("no index of %s, scan the keyframes", path_.c_str());
+
+    VodTag tag;
+    for (int64_t offset = begin_;
+         ReadTag(offset, &tag) == ERROR_SUCCESS; offset = tag.next) {
+        if (tag.type == (int8_t)flv::TagType::VIDEO &&
+            flv::Demuxer::IsKeyFrame(tag.data, tag.size) &&
+            !flv::Demuxer::IsAVCSequenceHeader(tag.data, tag.size)) {
+            index_->Add(tag.timestamp, tag.offset);
+        }
+    }
+
+    return ret;
+}
+
+int64_t VodFile::Begin()
+{
+    return begin_;
+}
+
+int64_t VodFile::Seek(int64_t timestamp)
+{
+    int index = index_->Find(timestamp);
+    if (index < 0) {
+        return begin_;
+    }
+    return index_->At(index).offset;
+}
+
+int VodFile::ReadTag(int64_t offset, VodTag* tag)
+{
+    int ret = ERROR_SUCCESS;
+
+    if (offset + FLV_TAG_HEADER_SIZE > file_->Size()) {
+        return ERROR_SYSTEM_FILE_EOF;
+    }
+
+    BufferManager manager;
+    if ((ret = manager.Initialize(file_->Data() + offset,
+                                  FLV_TAG_HEADER_SIZE)) != ERROR_SUCCESS) {
+        return ret;
+    }
+
+    tag->type      = manager.Read1Bytes() & 0x1f;
+    tag->size      = manager.Read3Bytes();
+    tag->timestamp = (uint32_t)manager.Read3Bytes();
+    tag->timestamp |= (int64_t)(uint8_t)manager.Read1Bytes() << 24;
+    tag->offset = offset;
+    tag->data   = file_->Data() + offset + FLV_TAG_HEADER_SIZE;
+    tag->next   = offset + FLV_TAG_HEADER_SIZE + tag->size +
+                  FLV_PREVIOUS_TAG_SIZE;
+
+    // a truncated tag, e.g. of a segment still being recorded
+    if (tag->size < 0 || tag->next > file_->Size()) {
+        return ERROR_SYSTEM_FILE_EOF;
+    }
+
+    return ret;
+}
+
+int VodFile::CreateMessage(VodTag* tag, SharedPtrMessage** pmsg)
+{
+    int ret = ERROR_SUCCESS;
+
+    MessageHeader header;
+    switch ((flv::TagType)tag->type) {
+        case flv::TagType::AUDIO:
+            header.InitializeAudio(tag->size, (uint32_t)tag->timestamp, 0);
+            break;
+        case flv::TagType::VIDEO:
+            header.InitializeVideo(tag->size, (uint32_t)tag->timestamp, 0);
+            break;
+        case flv::TagType::SCRIPT:
+            header.InitializeAMF0Script(tag->size, 0);
+            header.timestamp = tag->timestamp;
+            break;
+        default:
+            // the log macros shadow a variable named tag
+            int     type   = tag->type;
+            int64_t offset = tag->offset;
+            ret            = ERROR_FLV_INVALID_TAG;
+            rs_error("invalid tag type %d of %s at %lld. ret=%d", type,
+                     path_.c_str(), (long long)offset, ret);
+            return ret;
+    }
+
+    SharedPtrMessage* msg = new SharedPtrMessage;
+    if ((ret = msg->CreateView(&header, file_, tag->data, tag->size)) !=
+        ERROR_SUCCESS) {
+        rs_freep(msg);
+        return ret;
+    }
+
+    *pmsg = msg;
+
+    return ret;
+}
+
+void VodFile::WillNeed(int64_t offset, int64_t size)
+{
+    file_->WillNeed(offset, size);
+}
+
+int64_t VodFile::Metadata()
+{
+    return metadata_;
+}
+
+int64_t VodFile::VideoSequenceHeader()
+{
+    return sh_video_;
+}
+
+int64_t VodFile::AudioSequenceHeader()
+{
+    return sh_audio_;
+}
+
+VodPlayer::VodPlayer(Server* rtmp, int stream_id)
+{
+    rtmp_            = rtmp;
+    stream_id_       = stream_id;
+    file_            = nullptr;
+    buffer_ms_       = 0;
+    pos_             = 0;
+    headers_sent_    = false;
+    start_timestamp_ = -1;
+    start_ms_        = 0;
+    read_ahead_      = 0;
+}
+
+VodPlayer::~VodPlayer()
+{
+    if (file_) {
+        file_->Release();
+    }
+}
+
+int VodPlayer::Initialize(VodFile* file, int buffer_ms)
+{
+    int ret = ERROR_SUCCESS;
+
+    file_      = file;
+    buffer_ms_ = buffer_ms;
+    pos_       = file->Begin();
+
+    return ret;
+}
+
+int VodPlayer::Seek(int64_t timestamp)
+{
+    int ret = ERROR_SUCCESS;
+
+    pos_             = file_->Seek(timestamp);
+    headers_sent_    = false;
+    start_timestamp_ = -1;
+    read_ahead_      = 0;
+
+    rs_trace("vod seek to %lldms, offset=%lld", (long long)timestamp,
+             (long long)pos_);
+
+    return ret;
+}
+
+int VodPlayer::send(SharedPtrMessage** msgs, int count)
+{
+    int ret = ERROR_SUCCESS;
+
+    if ((ret = rtmp_->SendAndFreeMessages(msgs, count, stream_id_)) !=
+        ERROR_SUCCESS) {
+        if (!is_client_gracefully_close(ret)) {
+            rs_error("send vod messages failed. ret=%d", ret);
+        }
+        return ret;
+    }
+
+    return ret;
+}
+
+int VodPlayer::send_headers(int64_t timestamp)
+{
+    int ret = ERROR_SUCCESS;
+
+    SharedPtrMessage* msgs[3];
+    int               count = 0;
+
+    int64_t offsets[3] = {file_->Metadata(), file_->VideoSequenceHeader(),
+                          file_->AudioSequenceHeader()};
+
+    for (int i = 0; i < 3; i++) {
+        VodTag tag;
+        if (offsets[i] < 0 ||
+            file_->ReadTag(offsets[i], &tag) != ERROR_SUCCESS) {
+            continue;
+        }
+
+        // the decoder is reset at the timestamp of the seek
+        tag.timestamp = timestamp;
+        if ((ret = file_->CreateMessage(&tag, &msgs[count])) !=
+            ERROR_SUCCESS) {
+            break;
+        }
+        count++;
+    }
+
+    if (count > 0 && ret == ERROR_SUCCESS) {
+        return send(msgs, count);
+    }
+
+    for (int i = 0; i < count; i++) {
+        rs_freep(msgs[i]);
+    }
+
+    return ret;
+}
+
+int VodPlayer::Cycle(int* psleep_ms)
+{
+    int ret = ERROR_SUCCESS;
+
+    SharedPtrMessage* msgs[RTMP_MR_MSGS];
+    int               count = 0;
+    int64_t           now   = Utils::GetSteadyMilliSeconds();
+
+    *psleep_ms = 0;
+
+    // the pages past the end of a cut file can't be read
+    if (file_->Truncated()) {
+        ret = ERROR_SYSTEM_FILE_READ;
+        rs_error("vod file truncated while played. ret=%d", ret);
+        return ret;
+    }
+
+    while (count < RTMP_MR_MSGS) {
+        VodTag tag;
+        if ((ret = file_->ReadTag(pos_, &tag)) != ERROR_SUCCESS) {
+            break;
+        }
+
+        if (start_timestamp_ < 0) {
+            start_timestamp_ = tag.timestamp;
+            start_ms_        = now;
+        }
+
+        if (!headers_sent_) {
+            if ((ret = send_headers(tag.timestamp)) != ERROR_SUCCESS) {
+                break;
+            }
+            headers_sent_ = true;
+        }
+
+        // a little ahead of the wall clock, as the client buffers
+        int64_t due = tag.timestamp - start_timestamp_ - (now - start_ms_) -
+                      buffer_ms_;
+        if (due > 0) {
+            *psleep_ms = (int)rs_min(due, (int64_t)RTMP_MR_SLEEP_MS);
+            break;
+        }
+
+        pos_ = tag.next;
+
+        if (tag.offset == file_->Metadata() ||
+            tag.offset == file_->VideoSequenceHeader() ||
+            tag.offset == file_->AudioSequenceHeader()) {
+            continue;
+        }
+
+        if (tag.type != (int8_t)flv::TagType::AUDIO &&
+            tag.type != (int8_t)flv::TagType::VIDEO &&
+            tag.type != (int8_t)flv::TagType::SCRIPT) {
+            continue;
+        }
+
+        if ((ret = file_->CreateMessage(&tag, &msgs[count])) !=
+            ERROR_SUCCESS) {
+            break;
+        }
+        count++;
+    }
+
+    if (count > 0) {
+        int r = send(msgs, count);
+        if (r != ERROR_SUCCESS) {
+            return r;
+        }
+    }
+
+    // page in what comes next before the tags are sent
+    if (pos_ + RTMP_VOD_READ_AHEAD / 2 > read_ahead_) {
+        file_->WillNeed(pos_, RTMP_VOD_READ_AHEAD);
+        read_ahead_ = pos_ + RTMP_VOD_READ_AHEAD;
+    }
+
+    return ret;
+}
+
+}  // namespace rtmp
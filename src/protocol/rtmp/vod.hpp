@@ -0,0 +1,106 @@
+#ifndef RS_RTMP_VOD_HPP
+#define RS_RTMP_VOD_HPP
+
+#include <common/core.hpp>
+
+#include <string>
+
+class MappedFile;
+
+namespace flv {
+class KeyframeIndex;
+}
+
+namespace rtmp {
+
+class Server;
+class Request;
+class SharedPtrMessage;
+
+struct VodTag
+{
+    int8_t  type;
+    int     size;
+    int64_t timestamp;
+    // the tag header, its data and the next tag in the file
+    int64_t offset;
+    char*   data;
+    int64_t next;
+};
+
+// a recorded flv shared by all its viewers of the worker. the file is
+// mapped once and its index loaded once, the messages sent to the clients
+// are views of the mapping.
+class VodFile {
+  public:
+    // the recording requested by a play, empty when it is not a vod
+    static std::string Path(Request* request);
+    static int         Fetch(const std::string& path, VodFile** pfile);
+    virtual void       Release();
+    // see MappedFile::Truncated
+    virtual bool       Truncated();
+
+  public:
+    // offset of the first tag, and of the keyframe at or before timestamp
+    virtual int64_t Begin();
+    virtual int64_t Seek(int64_t timestamp);
+    virtual int     ReadTag(int64_t offset, VodTag* tag);
+    virtual int     CreateMessage(VodTag* tag, SharedPtrMessage** pmsg);
+    virtual void    WillNeed(int64_t offset, int64_t size);
+    // metadata and sequence headers, resent after a seek, -1 when missing
+    virtual int64_t Metadata();
+    virtual int64_t VideoSequenceHeader();
+    virtual int64_t AudioSequenceHeader();
+
+  private:
+    VodFile(const std::string& path);
+    virtual ~VodFile();
+    int initialize();
+    int scan_headers();
+    int load_index();
+    int build_index();
+
+  private:
+    std::string         path_;
+    MappedFile*         file_;
+    flv::KeyframeIndex* index_;
+    int64_t             begin_;
+    int64_t             metadata_;
+    int64_t             sh_video_;
+    int64_t             sh_audio_;
+    int                 refs_;
+};
+
+// plays a VodFile to one client, paced by the tag timestamps and a little
+// ahead of them to keep the client buffer filled.
+class VodPlayer {
+  public:
+    VodPlayer(Server* rtmp, int stream_id);
+    virtual ~VodPlayer();
+
+  public:
+    virtual int Initialize(VodFile* file, int buffer_ms);
+    virtual int Seek(int64_t timestamp);
+    // send the due tags, ERROR_SYSTEM_FILE_EOF once all are sent
+    virtual int Cycle(int* psleep_ms);
+
+  private:
+    virtual int send_headers(int64_t timestamp);
+    virtual int send(SharedPtrMessage** msgs, int count);
+
+  private:
+    Server*  rtmp_;
+    int      stream_id_;
+    VodFile* file_;
+    int      buffer_ms_;
+    int64_t  pos_;
+    bool     headers_sent_;
+    // the timestamp played at start_ms_
+    int64_t  start_timestamp_;
+    int64_t  start_ms_;
+    int64_t  read_ahead_;
+};
+
+}  // namespace rtmp
+
+#endif